@@ -23,37 +23,136 @@
 #include "internal.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <errno.h>
 
 static int amber_exit_code = AMBER_EXIT_OK;
 
-static void amber_error_reporter(JSContext *cx, const char *message, JSErrorReport *report) {
-    fputs(message, stderr);
+void amber_error_reporter(JSContext *cx, const char *message, JSErrorReport *report) {
+    FILE *out = stderr;
+    JSObject *amber;
+    amber_run run;
+
+    /* captured batch runs get their errors alongside their output */
+    if((amber = JS_GetGlobalObject(cx)) != NULL &&
+       (run = JS_GetPrivate(cx, amber)) != NULL && run->out != NULL)
+        out = run->out;
+
+    fputs(message, out);
 
     if(report != NULL) {
         if(report->filename != NULL)
-            fprintf(stderr, " in %s", report->filename);
+            fprintf(out, " in %s", report->filename);
         if(report->lineno > 0)
-            fprintf(stderr, " at line %u", report->lineno);
+            fprintf(out, " at line %u", report->lineno);
     }
 
-    fputc('\n', stderr);
+    fputc('\n', out);
 }
 
+static struct option amber_options[] = {
+    { "serve",      required_argument,  NULL, 's' },
+    { "preload",    required_argument,  NULL, 'l' },
+    { "batch",      no_argument,        NULL, 'b' },
+    { "manifest",   required_argument,  NULL, 'm' },
+    { "jobs",       required_argument,  NULL, 'j' },
+    { "output",     required_argument,  NULL, 'o' },
+    { "eval",       required_argument,  NULL, 'e' },
+    { "lines",      no_argument,        NULL, 'n' },
+    { "print",      no_argument,        NULL, 'p' },
+    { "split",      required_argument,  NULL, 'F' },
+    { "max-cpu",    required_argument,  NULL, 'C' },
+    { "max-wall",   required_argument,  NULL, 'W' },
+    { "max-heap",   required_argument,  NULL, 'M' },
+    { "version",    no_argument,        NULL, 'v' },
+    { "help",       no_argument,        NULL, 'h' },
+    { NULL }
+};
+
 int main(int argc, char **argv) {
     int optchar;
-    char *filename, *pretty;
-    char *script;
-    int scriptlen, i;
-    JSRuntime *rt;
-    JSContext *cx;
-    JSObject *amber, *core, *obj;
+    char *filename, *pretty, *serve = NULL, *manifest = NULL, *outdir = NULL;
+    char *script = NULL, **preload, **scripts = NULL, *eval = NULL, *delim = NULL;
+    int scriptlen, npreload = 0, batch = 0, nscripts = 0, jobs = 1, lines = 0, autoprint = 0, i;
+    JSRuntime *rt = NULL;
+    JSContext *cx = NULL;
+    JSObject *amber;
+    amber_watchdog wd = NULL;
+    amber_memory mem = NULL;
+    char *end;
     jsval rval;
 
-    while((optchar = getopt(argc, argv, "+vh?")) >= 0) {
+    preload = (char **) malloc(sizeof(char *) * argc);
+
+    while((optchar = getopt_long(argc, argv, "+s:l:bm:j:o:e:npF:C:W:M:vh?", amber_options, NULL)) >= 0) {
         switch(optchar) {
+            case 's':
+                serve = optarg;
+                break;
+
+            case 'l':
+                preload[npreload++] = optarg;
+                break;
+
+            case 'b':
+                batch = 1;
+                break;
+
+            case 'm':
+                manifest = optarg;
+                batch = 1;
+                break;
+
+            case 'j':
+                jobs = atoi(optarg);
+                if(jobs < 1) {
+                    fprintf(stderr, "Invalid job count '%s'\n", optarg);
+                    return AMBER_EXIT_ARGS;
+                }
+                break;
+
+            case 'o':
+                outdir = optarg;
+                break;
+
+            case 'e':
+                eval = optarg;
+                break;
+
+            case 'p':
+                autoprint = 1;
+                /* fall through */
+
+            case 'n':
+                lines = 1;
+                break;
+
+            case 'F':
+                delim = optarg;
+                lines = 1;
+                break;
+
+            case 'C': case 'W':
+                if(optchar == 'C')
+                    amber_limit_cpu = strtod(optarg, &end);
+                else
+                    amber_limit_wall = strtod(optarg, &end);
+                if(*optarg == '\0' || *end != '\0' || (optchar == 'C' ? amber_limit_cpu : amber_limit_wall) <= 0) {
+                    fprintf(stderr, "Invalid time limit '%s'\n", optarg);
+                    return AMBER_EXIT_ARGS;
+                }
+                break;
+
+            case 'M':
+                if((amber_limit_heap = amber_memory_parse(optarg)) == 0) {
+                    fprintf(stderr, "Invalid heap size '%s'\n", optarg);
+                    return AMBER_EXIT_ARGS;
+                }
+                break;
+
             case 'v':
                 printf(" amber version: " VERSION "\n"
                        "engine version: %s\n", JS_GetImplementationVersion());
@@ -62,59 +161,151 @@ int main(int argc, char **argv) {
             case 'h': case '?': default:
                 fputs(
                     "amber - javascript script host\n"
-                    "Usage: amber [options] [scriptfile]\n", stdout);
+                    "Usage: amber [options] [scriptfile]\n"
+                    "       amber [options] --serve socket\n"
+                    "       amber [options] --batch scriptfile...\n"
+                    "       amber [options] -n|-p [-e code | scriptfile] [inputfile...]\n"
+                    "\n"
+                    "  -e, --eval code        run code instead of a scriptfile\n"
+                    "  -n, --lines            run the script once per input line, as _\n"
+                    "  -p, --print            like -n, printing _ after each line\n"
+                    "  -F, --split delim      like -n, also splitting each line into F\n"
+                    "  -C, --max-cpu secs     stop scripts that use more cpu time than this\n"
+                    "  -W, --max-wall secs    stop scripts that run for longer than this\n"
+                    "  -M, --max-heap size    stop scripts once the whole process uses more than this\n"
+                    "  -l, --preload module   load module before running anything\n"
+                    "  -b, --batch            run each scriptfile in its own global\n"
+                    "  -m, --manifest file    batch run the scripts listed in file\n"
+                    "  -j, --jobs n           run n batch scripts at once\n"
+                    "  -o, --output dir       capture batch script output in dir\n"
+                    "  -s, --serve socket     run scripts for amberc clients on socket\n"
+                    "  -v, --version          show version information\n"
+                    "  -h, --help             show this help\n", stdout);
                 return AMBER_EXIT_ARGS;
         }
     }
 
-    if(optind >= argc || strcmp(argv[optind], "-") == 0) {
-        pretty = "(stdin)";
-        filename = NULL;
+    /* a server would never get to the batch */
+    if(batch && serve != NULL) {
+        fputs("--serve can't be used with --batch or --manifest\n", stderr);
+        return AMBER_EXIT_ARGS;
     }
 
-    else
-        pretty = filename = argv[optind];
+    /* a batch takes every remaining argument as a script */
+    if(batch) {
+        if(manifest != NULL) {
+            if((scripts = amber_batch_manifest(manifest, &nscripts)) == NULL) {
+                fprintf(stderr, "Unable to read '%s': %s\n", manifest, strerror(errno));
+                return AMBER_EXIT_SCRIPT;
+            }
+        }
+
+        else {
+            scripts = &argv[optind];
+            nscripts = argc - optind;
+        }
+
+        if(nscripts == 0)
+            return AMBER_EXIT_OK;
+    }
 
-    if(amber_load_script(filename, &script, &scriptlen) < 0) {
-        fprintf(stderr, "Unable to read '%s': %s\n", pretty, strerror(errno));
-        return AMBER_EXIT_SCRIPT;
+    /* a server gets its scripts from clients */
+    else if(serve == NULL && eval != NULL) {
+        pretty = "(eval)";
+        script = strdup(eval);
+        scriptlen = strlen(script);
     }
 
-    if(scriptlen == 0)
-        return AMBER_EXIT_OK;
+    else if(serve == NULL) {
+        if(optind >= argc || strcmp(argv[optind], "-") == 0) {
+            pretty = "(stdin)";
+            filename = NULL;
+        }
+
+        else
+            pretty = filename = argv[optind];
+
+        if(amber_load_script(filename, &script, &scriptlen) < 0) {
+            fprintf(stderr, "Unable to read '%s': %s\n", pretty, strerror(errno));
+            return AMBER_EXIT_SCRIPT;
+        }
+
+        if(scriptlen == 0)
+            return AMBER_EXIT_OK;
 
-    optind++;
+        optind++;
+    }
 
-    if((rt = JS_NewRuntime(8L * 1024L * 1024L)) == NULL ||
+    if((rt = JS_NewRuntime(amber_memory_runtime_size(amber_limit_heap))) == NULL ||
        (cx = JS_NewContext(rt, 8192)) == NULL)
         { amber_exit_code = AMBER_EXIT_INIT; goto cleanup; }
 
+    amber_memory_init(rt);
+
     JS_SetErrorReporter(cx, amber_error_reporter);
 
+    /* batch scripts each get their own global */
+    if(batch) {
+        amber_exit_code = amber_batch(cx, scripts, nscripts, preload, npreload, jobs, outdir);
+        goto cleanup;
+    }
+
     amber = amber_global_init(cx);
     if(amber == NULL) {
         amber_exit_code = AMBER_EXIT_INIT;
         goto cleanup;
     }
 
-    /* arguments holds the command line arguments */
-    if((obj = JS_NewArrayObject(cx, 0, NULL)) == NULL ||
-
-       /* hook it up to the global objects */
-       JS_DefineProperty(cx, amber, "arguments", OBJECT_TO_JSVAL(obj), NULL, NULL, JSPROP_ENUMERATE) == JS_FALSE)
+    if(serve == NULL &&
+       amber_global_arguments(cx, amber, optind < argc ? argc - optind : 0, &argv[optind < argc ? optind : argc]) == JS_FALSE)
         { amber_exit_code = AMBER_EXIT_INIT; goto cleanup; }
-
-    /* loop over argv and add them to the array */
-    for(i = optind; i < argc; i++)
-        if(JS_DefineElement(cx, obj, i - optind, STRING_TO_JSVAL(JS_NewStringCopyZ(cx, argv[i])), NULL, NULL, JSPROP_ENUMERATE) == JS_FALSE)
-            { amber_exit_code = AMBER_EXIT_INIT; goto cleanup; }
     
     amber_exception_init(cx, amber);
 
-    if(JS_EvaluateScript(cx, amber, script, scriptlen, pretty, 1, &rval) == JS_FALSE)
+    /* a server's limits apply to each request, not to the server */
+    if(serve == NULL) {
+        wd = amber_watchdog_start(cx, amber_limit_cpu, amber_limit_wall);
+        mem = amber_memory_start(cx, amber_limit_heap);
+    }
+
+    for(i = 0; i < npreload; i++)
+        if(amber_global_preload(cx, amber, preload[i]) == JS_FALSE)
+            { amber_exit_code = AMBER_EXIT_INIT; goto cleanup; }
+
+    /* the warm global is copied into each request from here on */
+    if(serve != NULL)
+        amber_exit_code = amber_serve(cx, amber, serve);
+
+    /* the rest of the arguments are input */
+    else if(lines)
+        amber_exit_code = amber_lines(cx, amber, script, scriptlen, pretty,
+                                      &argv[optind < argc ? optind : argc], optind < argc ? argc - optind : 0,
+                                      autoprint, delim);
+
+    else if(JS_EvaluateScript(cx, amber, script, scriptlen, pretty, 1, &rval) == JS_FALSE)
         amber_exit_code = AMBER_EXIT_RUN;
 
 cleanup:
+    switch(amber_memory_stop(mem)) {
+        case AMBER_MEMORY_KILLED:
+            fputs("amber: script stopped after exceeding its memory limit\n", stderr);
+            /* fall through */
+
+        case AMBER_MEMORY_LIMIT:
+            amber_exit_code = AMBER_EXIT_MEMORY;
+            break;
+    }
+
+    switch(amber_watchdog_stop(wd)) {
+        case AMBER_WATCHDOG_KILLED:
+            fputs("amber: script stopped after exceeding its time limit\n", stderr);
+            /* fall through */
+
+        case AMBER_WATCHDOG_LIMIT:
+            amber_exit_code = AMBER_EXIT_LIMIT;
+            break;
+    }
+
     switch(amber_exit_code) {
         case AMBER_EXIT_INIT:
             fputs("amber initialisation failed\n", stderr);
@@ -124,6 +315,7 @@ cleanup:
     if(cx != NULL) JS_DestroyContext(cx);
     if(rt != NULL) JS_DestroyRuntime(rt);
     if(script != NULL) free(script);
+    free(preload);
 
     return amber_exit_code;
 }
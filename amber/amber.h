@@ -20,6 +20,9 @@
 #ifndef AMBER_H
 #define AMBER_H 1
 
+#include <stdio.h>
+#include <sys/types.h>
+
 #define JS_THREADSAFE 1
 #include <jsapi.h>
 
@@ -28,6 +31,20 @@ extern JSBool amber_run_script(JSContext *cx, JSObject *amber, char *filename, j
 extern JSBool amber_load_module(JSContext *cx, JSObject *amber, JSObject *search_path, char *thing, jsval *rval);
 
 extern JSBool amber_exception_throw(JSContext *cx, char *format, ...);
+extern JSBool amber_exception_throw_code(JSContext *cx, int err, const char *module, char *format, ...);
+
+/* text encodings for Files, see file.c */
+typedef enum amber_file_encoding {
+    AMBER_FILE_BINARY,
+    AMBER_FILE_LATIN1,
+    AMBER_FILE_UTF8
+} amber_file_encoding;
+
+extern FILE *amber_file_stream(JSContext *cx, jsval v);
+extern amber_file_encoding amber_file_get_encoding(JSContext *cx, jsval v);
+extern size_t amber_file_encode(const jschar *in, size_t len, JSBool more, unsigned char *out,
+                                amber_file_encoding enc, size_t *used);
+extern JSBool amber_file_write(JSContext *cx, FILE *f, const jschar *chars, size_t len, amber_file_encoding enc);
 
 #define ASSERT_THROW(expr, ...) \
     if(expr) \
@@ -36,10 +53,38 @@ extern JSBool amber_exception_throw(JSContext *cx, char *format, ...);
 #define THROW(...) \
     return amber_exception_throw(cx, __VA_ARGS__)
 
+#define ASSERT_THROW_CODE(expr, err, module, ...) \
+    if(expr) \
+        return amber_exception_throw_code(cx, err, module, __VA_ARGS__)
+
+#define THROW_CODE(err, module, ...) \
+    return amber_exception_throw_code(cx, err, module, __VA_ARGS__)
+
 #define AMBER_EXIT_OK       (0)
 #define AMBER_EXIT_ARGS     (-128)
 #define AMBER_EXIT_SCRIPT   (-129)
 #define AMBER_EXIT_INIT     (-130)
 #define AMBER_EXIT_RUN      (-131)
+#define AMBER_EXIT_LIMIT    (-132)
+#define AMBER_EXIT_MEMORY   (-133)
+
+/* cpu and wall clock limits on a run, see watchdog.c */
+typedef struct amber_watchdog_st *amber_watchdog;
+
+#define AMBER_WATCHDOG_LIMIT    (1)
+#define AMBER_WATCHDOG_KILLED   (2)
+
+extern amber_watchdog amber_watchdog_start(JSContext *cx, double max_cpu, double max_wall);
+extern int amber_watchdog_stop(amber_watchdog wd);
+
+/* heap budgets on a run, see memory.c */
+typedef struct amber_memory_st *amber_memory;
+
+#define AMBER_MEMORY_LIMIT      (1)
+#define AMBER_MEMORY_KILLED     (2)
+
+extern amber_memory amber_memory_start(JSContext *cx, size_t max_heap);
+extern int amber_memory_stop(amber_memory mem);
+extern void amber_memory_account(ssize_t bytes);
 
 #endif
@@ -0,0 +1,150 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "serve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char **environ;
+
+/* append a string, nul included, to the request block */
+static int amberc_add(char **data, int *len, int *pos, char *str) {
+    int n = strlen(str) + 1;
+
+    if(*pos + n > AMBER_SERVE_MAX)
+        return -1;
+
+    if(*len < *pos + n) {
+        while(*len < *pos + n)
+            *len += 4096;
+        *data = (char *) realloc(*data, sizeof(char) * *len);
+    }
+
+    memcpy(&((*data)[*pos]), str, n);
+    *pos += n;
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct sockaddr_un sun;
+    amber_serve_request req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(sizeof(int) * 3)];
+    char cwd[PATH_MAX], *data = NULL, **ev;
+    int sock, len = 0, pos = 0, i, fds[3] = { 0, 1, 2 };
+    int32_t code;
+
+    if(argc < 2 || strcmp(argv[1], "-h") == 0) {
+        fputs(
+            "amberc - client for a running amber --serve\n"
+            "Usage: amberc socket [scriptfile [arguments]]\n", stdout);
+        return AMBER_EXIT_ARGS;
+    }
+
+    if(strlen(argv[1]) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", argv[1]);
+        return AMBER_EXIT_ARGS;
+    }
+
+    if(getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "Unable to get working directory: %s\n", strerror(errno));
+        return AMBER_EXIT_ARGS;
+    }
+
+    /* cwd, then the script and its arguments, then the environment */
+    memset(&req, 0, sizeof(req));
+    req.magic = AMBER_SERVE_MAGIC;
+
+    if(amberc_add(&data, &len, &pos, cwd) < 0 ||
+       amberc_add(&data, &len, &pos, argc > 2 ? argv[2] : "-") < 0)
+        goto toobig;
+    req.argc = 1;
+
+    for(i = 3; i < argc; i++, req.argc++)
+        if(amberc_add(&data, &len, &pos, argv[i]) < 0)
+            goto toobig;
+
+    for(ev = environ; *ev != NULL; ev++, req.envc++)
+        if(amberc_add(&data, &len, &pos, *ev) < 0)
+            goto toobig;
+
+    req.len = pos;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, argv[1]);
+
+    if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+       connect(sock, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+        fprintf(stderr, "Unable to connect to '%s': %s\n", argv[1], strerror(errno));
+        return AMBER_EXIT_INIT;
+    }
+
+    /* our stdio rides along with the header */
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &req;
+    iov.iov_len = sizeof(req);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 3);
+
+    if(sendmsg(sock, &msg, 0) != sizeof(req) ||
+       write(sock, data, pos) != pos) {
+        fprintf(stderr, "Unable to send request to '%s': %s\n", argv[1], strerror(errno));
+        return AMBER_EXIT_INIT;
+    }
+
+    free(data);
+
+    /* the server has our stdio now, we just wait for the result */
+    if(read(sock, &code, sizeof(code)) != sizeof(code)) {
+        fputs("amber server dropped the connection\n", stderr);
+        return AMBER_EXIT_RUN;
+    }
+
+    close(sock);
+
+    return code;
+
+toobig:
+    fputs("Request too large\n", stderr);
+    return AMBER_EXIT_ARGS;
+}
@@ -0,0 +1,317 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "bundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <jsxdrapi.h>
+
+typedef struct amberpack_module_st {
+    char        *name;
+    char        *data;
+    uint32_t    data_len;
+    uint32_t    flags;
+} amberpack_module;
+
+static JSClass amberpack_class = {
+    "Amberpack", 0,
+    JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, JS_FinalizeStub
+};
+
+static void amberpack_error_reporter(JSContext *cx, const char *message, JSErrorReport *report) {
+    fputs(message, stderr);
+
+    if(report != NULL) {
+        if(report->filename != NULL)
+            fprintf(stderr, " in %s", report->filename);
+        if(report->lineno > 0)
+            fprintf(stderr, " at line %u", report->lineno);
+    }
+
+    fputc('\n', stderr);
+}
+
+/* slurp a module, dropping any #! line the same way the loader does */
+static char *amberpack_read(char *filename, uint32_t *len) {
+    FILE *f;
+    struct stat st;
+    char *data, *c;
+
+    if((f = fopen(filename, "r")) == NULL)
+        return NULL;
+
+    if(fstat(fileno(f), &st) < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    if((data = (char *) malloc(st.st_size + 1)) == NULL) {
+        fclose(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(fread(data, sizeof(char), st.st_size, f) != st.st_size) {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+
+    *len = st.st_size;
+    data[*len] = '\0';
+
+    if(*len >= 2 && data[0] == '#' && data[1] == '!') {
+        for(c = data; *c != '\0' && *c != '\n' && *c != '\r'; c++);
+        *len -= c - data;
+        memmove(data, c, *len + 1);
+    }
+
+    return data;
+}
+
+/* swap the source for engine bytecode */
+static int amberpack_compile(JSContext *cx, JSObject *global, amberpack_module *m, char *filename) {
+    JSScript *script;
+    JSXDRState *xdr;
+    void *bytes;
+    uint32 len;
+
+    if((script = JS_CompileScript(cx, global, m->data, m->data_len, filename, 1)) == NULL)
+        return -1;
+
+    xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+    if(JS_XDRScript(xdr, &script) == JS_FALSE) {
+        JS_XDRDestroy(xdr);
+        JS_DestroyScript(cx, script);
+        return -1;
+    }
+
+    bytes = JS_XDRMemGetData(xdr, &len);
+
+    free(m->data);
+    if((m->data = (char *) malloc(len)) == NULL) {
+        JS_XDRDestroy(xdr);
+        JS_DestroyScript(cx, script);
+        return -1;
+    }
+    memcpy(m->data, bytes, len);
+    m->data_len = len;
+    m->flags |= AMBER_BUNDLE_COMPILED;
+
+    JS_XDRDestroy(xdr);
+    JS_DestroyScript(cx, script);
+
+    return 0;
+}
+
+static int amberpack_write(char *filename, amberpack_module *modules, int nmodules, int compiled) {
+    FILE *f;
+    amber_bundle_header h;
+    amber_bundle_entry *e;
+    uint32_t *buckets, b;
+    uint64_t off;
+    char *tmp = NULL, pad[8] = { 0 };
+    int i, ret = -1;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AMBER_BUNDLE_MAGIC, 8);
+    h.version = AMBER_BUNDLE_VERSION;
+    h.nentries = nmodules;
+    if(compiled)
+        h.engine = amber_bundle_hash(JS_GetImplementationVersion(), strlen(JS_GetImplementationVersion()));
+
+    /* keep the table at most half full */
+    for(h.nbuckets = 16; h.nbuckets < nmodules * 2; h.nbuckets <<= 1);
+
+    buckets = (uint32_t *) calloc(h.nbuckets, sizeof(uint32_t));
+    e = (amber_bundle_entry *) calloc(nmodules, sizeof(amber_bundle_entry));
+    if(buckets == NULL || e == NULL) {
+        fputs("Out of memory\n", stderr);
+        goto done;
+    }
+
+    off = sizeof(h) + h.nbuckets * sizeof(uint32_t) + nmodules * sizeof(amber_bundle_entry);
+
+    for(i = 0; i < nmodules; i++) {
+        e[i].name_len = strlen(modules[i].name);
+        e[i].hash = amber_bundle_hash(modules[i].name, e[i].name_len);
+        e[i].name_off = off;
+        off += e[i].name_len;
+    }
+
+    for(i = 0; i < nmodules; i++) {
+        off = (off + 7) & ~7;
+        e[i].flags = modules[i].flags;
+        e[i].data_len = modules[i].data_len;
+        e[i].data_off = off;
+        off += e[i].data_len;
+    }
+
+    h.size = off;
+
+    for(i = 0; i < nmodules; i++) {
+        for(b = e[i].hash & (h.nbuckets - 1); buckets[b] != 0; b = (b + 1) & (h.nbuckets - 1)) {
+            if(e[buckets[b] - 1].hash == e[i].hash && strcmp(modules[buckets[b] - 1].name, modules[i].name) == 0) {
+                fprintf(stderr, "Module '%s' appears more than once\n", modules[i].name);
+                goto done;
+            }
+        }
+        buckets[b] = i + 1;
+    }
+
+    /* write it aside and rename, so running loaders never see half a bundle */
+    if((tmp = (char *) malloc(strlen(filename) + 5)) == NULL) {
+        fputs("Out of memory\n", stderr);
+        goto done;
+    }
+    sprintf(tmp, "%s.tmp", filename);
+
+    if((f = fopen(tmp, "w")) == NULL) {
+        fprintf(stderr, "Unable to open '%s': %s\n", tmp, strerror(errno));
+        goto done;
+    }
+
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(buckets, sizeof(uint32_t), h.nbuckets, f);
+    fwrite(e, sizeof(amber_bundle_entry), nmodules, f);
+
+    for(i = 0; i < nmodules; i++)
+        fwrite(modules[i].name, sizeof(char), e[i].name_len, f);
+
+    off = ftell(f);
+    for(i = 0; i < nmodules; i++) {
+        fwrite(pad, sizeof(char), e[i].data_off - off, f);
+        fwrite(modules[i].data, sizeof(char), e[i].data_len, f);
+        off = e[i].data_off + e[i].data_len;
+    }
+
+    if((ferror(f) | fclose(f)) != 0 || rename(tmp, filename) < 0) {
+        fprintf(stderr, "Unable to write '%s': %s\n", filename, strerror(errno));
+        unlink(tmp);
+        goto done;
+    }
+
+    ret = 0;
+
+done:
+    free(tmp);
+    free(buckets);
+    free(e);
+
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int optchar, compile = 0, nmodules, i;
+    amberpack_module *modules;
+    JSRuntime *rt = NULL;
+    JSContext *cx = NULL;
+    JSObject *global = NULL;
+    char *name, *c;
+
+    while((optchar = getopt(argc, argv, "+cvh?")) >= 0) {
+        switch(optchar) {
+            case 'c':
+                compile = 1;
+                break;
+
+            case 'v':
+                printf(" amber version: " VERSION "\n"
+                       "engine version: %s\n", JS_GetImplementationVersion());
+                return AMBER_EXIT_ARGS;
+
+            case 'h': case '?': default:
+                fputs(
+                    "amberpack - pack amber modules into a bundle\n"
+                    "Usage: amberpack [-c] bundle" AMBER_BUNDLE_SUFFIX " module.js...\n"
+                    "\n"
+                    "Modules are named by their path with any leading ./ and\n"
+                    "trailing .js removed. -c stores precompiled bytecode.\n", stdout);
+                return AMBER_EXIT_ARGS;
+        }
+    }
+
+    if(argc - optind < 2) {
+        fputs("amberpack: need a bundle and at least one module\n", stderr);
+        return AMBER_EXIT_ARGS;
+    }
+
+    if(compile) {
+        if((rt = JS_NewRuntime(8L * 1024L * 1024L)) == NULL ||
+           (cx = JS_NewContext(rt, 8192)) == NULL ||
+           (global = JS_NewObject(cx, &amberpack_class, NULL, NULL)) == NULL ||
+           JS_InitStandardClasses(cx, global) == JS_FALSE) {
+            fputs("amber initialisation failed\n", stderr);
+            return AMBER_EXIT_INIT;
+        }
+
+        JS_SetErrorReporter(cx, amberpack_error_reporter);
+    }
+
+    nmodules = argc - optind - 1;
+    if((modules = (amberpack_module *) calloc(nmodules, sizeof(amberpack_module))) == NULL) {
+        fputs("amberpack: out of memory\n", stderr);
+        return AMBER_EXIT_INIT;
+    }
+
+    for(i = 0; i < nmodules; i++) {
+        name = argv[optind + 1 + i];
+
+        if((modules[i].data = amberpack_read(name, &modules[i].data_len)) == NULL) {
+            fprintf(stderr, "Unable to read '%s': %s\n", name, strerror(errno));
+            return AMBER_EXIT_SCRIPT;
+        }
+
+        if(compile && amberpack_compile(cx, global, &modules[i], name) < 0) {
+            fprintf(stderr, "Unable to compile '%s'\n", name);
+            return AMBER_EXIT_SCRIPT;
+        }
+
+        while(strncmp(name, "./", 2) == 0)
+            name += 2;
+        if((modules[i].name = strdup(name)) == NULL) {
+            fputs("amberpack: out of memory\n", stderr);
+            return AMBER_EXIT_INIT;
+        }
+        if((c = strrchr(modules[i].name, '.')) != NULL && strcmp(c, ".js") == 0)
+            *c = '\0';
+    }
+
+    if(amberpack_write(argv[optind], modules, nmodules, compile) < 0)
+        return AMBER_EXIT_RUN;
+
+    if(cx != NULL) JS_DestroyContext(cx);
+    if(rt != NULL) JS_DestroyRuntime(rt);
+
+    return AMBER_EXIT_OK;
+}
@@ -0,0 +1,273 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct amber_batch_st {
+    pthread_mutex_t     mutex;
+    JSRuntime           *rt;
+    char                **scripts;
+    int                 nscripts;
+    char                **preload;
+    int                 npreload;
+    char                *outdir;
+    int                 next;
+    int                 failed;
+} *amber_batch_t;
+
+/* one script per line, blank lines and #comments skipped */
+char **amber_batch_manifest(char *filename, int *nscripts) {
+    FILE *f;
+    char buf[4096], *c, **scripts = NULL;
+    int len = 0;
+
+    *nscripts = 0;
+
+    if(strcmp(filename, "-") == 0)
+        f = stdin;
+
+    else if((f = fopen(filename, "r")) == NULL)
+        return NULL;
+
+    while(fgets(buf, sizeof(buf), f) != NULL) {
+        for(c = strchr(buf, '\0'); c > buf && (c[-1] == '\n' || c[-1] == '\r' || c[-1] == ' '); c--);
+        *c = '\0';
+
+        if(buf[0] == '\0' || buf[0] == '#')
+            continue;
+
+        if(*nscripts == len) {
+            len += 64;
+            scripts = (char **) realloc(scripts, sizeof(char *) * len);
+        }
+
+        scripts[(*nscripts)++] = strdup(buf);
+    }
+
+    if(f != stdin)
+        fclose(f);
+
+    /* an empty manifest is still a manifest */
+    if(scripts == NULL)
+        scripts = (char **) malloc(sizeof(char *));
+
+    return scripts;
+}
+
+static double amber_batch_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run a single script in a fresh global on this context */
+static int amber_batch_one(JSContext *cx, amber_batch_t b, int n) {
+    struct amber_run_st run;
+    JSObject *amber = NULL;
+    char *script = NULL, path[4096];
+    int scriptlen, i;
+    amber_watchdog wd;
+    amber_memory mem;
+    jsval rval;
+
+    run.exited = 0;
+    run.exit_code = AMBER_EXIT_OK;
+    run.out = NULL;
+
+    if(amber_load_script(b->scripts[n], &script, &scriptlen) < 0) {
+        fprintf(stderr, "Unable to read '%s': %s\n", b->scripts[n], strerror(errno));
+        return AMBER_EXIT_SCRIPT;
+    }
+
+    if(b->outdir != NULL) {
+        snprintf(path, sizeof(path), "%s/%d.out", b->outdir, n);
+        if((run.out = fopen(path, "w")) == NULL) {
+            fprintf(stderr, "Unable to open '%s': %s\n", path, strerror(errno));
+            free(script);
+            return AMBER_EXIT_INIT;
+        }
+    }
+
+    if((amber = amber_global_init(cx)) == NULL) {
+        run.exit_code = AMBER_EXIT_INIT;
+        goto done;
+    }
+
+    /* the previous script's global is garbage from here */
+    JS_SetGlobalObject(cx, amber);
+    JS_SetPrivate(cx, amber, &run);
+
+    if(amber_global_arguments(cx, amber, 0, NULL) == JS_FALSE) {
+        run.exit_code = AMBER_EXIT_INIT;
+        goto done;
+    }
+
+    amber_exception_init(cx, amber);
+
+    for(i = 0; i < b->npreload; i++)
+        if(amber_global_preload(cx, amber, b->preload[i]) == JS_FALSE) {
+            run.exit_code = AMBER_EXIT_INIT;
+            goto done;
+        }
+
+    wd = amber_watchdog_start(cx, amber_limit_cpu, amber_limit_wall);
+    mem = amber_memory_start(cx, amber_limit_heap);
+
+    if(scriptlen > 0 && JS_EvaluateScript(cx, amber, script, scriptlen, b->scripts[n], 1, &rval) == JS_FALSE && !run.exited)
+        run.exit_code = AMBER_EXIT_RUN;
+
+    if(amber_memory_stop(mem) != 0)
+        run.exit_code = AMBER_EXIT_MEMORY;
+    if(amber_watchdog_stop(wd) != 0)
+        run.exit_code = AMBER_EXIT_LIMIT;
+
+done:
+    if(amber != NULL)
+        JS_SetPrivate(cx, amber, NULL);
+
+    JS_ClearPendingException(cx);
+    JS_MaybeGC(cx);
+
+    if(run.out != NULL)
+        fclose(run.out);
+    if(script != NULL)
+        free(script);
+
+    return run.exit_code;
+}
+
+/* take scripts off the list until there are none left */
+static void amber_batch_work(JSContext *cx, amber_batch_t b) {
+    double start;
+    int n, code;
+
+    for(;;) {
+        pthread_mutex_lock(&b->mutex);
+        n = b->next++;
+        pthread_mutex_unlock(&b->mutex);
+
+        if(n >= b->nscripts)
+            return;
+
+        start = amber_batch_now();
+        code = amber_batch_one(cx, b, n);
+
+        pthread_mutex_lock(&b->mutex);
+        if(code != AMBER_EXIT_OK)
+            b->failed++;
+        fprintf(stderr, "%d\t%d\t%.3f\t%s\n", n, code, amber_batch_now() - start, b->scripts[n]);
+        pthread_mutex_unlock(&b->mutex);
+    }
+}
+
+static void *amber_batch_start(void *arg) {
+    amber_batch_t b = (amber_batch_t) arg;
+    JSContext *cx;
+
+    if((cx = JS_NewContext(b->rt, 8192)) == NULL)
+        return NULL;
+
+    JS_SetErrorReporter(cx, amber_error_reporter);
+
+    JS_BeginRequest(cx);
+    amber_batch_work(cx, b);
+    JS_EndRequest(cx);
+
+    JS_DestroyContext(cx);
+
+    return NULL;
+}
+
+int amber_batch(JSContext *cx, char **scripts, int nscripts, char **preload, int npreload, int jobs, char *outdir) {
+    struct amber_batch_st b;
+    JSObject *amber;
+    pthread_t *t;
+    int i, n, err;
+    jsval v;
+
+    pthread_mutex_init(&b.mutex, NULL);
+    b.rt = JS_GetRuntime(cx);
+    b.scripts = scripts;
+    b.nscripts = nscripts;
+    b.preload = preload;
+    b.npreload = npreload;
+    b.outdir = outdir;
+    b.next = 0;
+    b.failed = 0;
+
+    /* a single job just runs on the caller's context */
+    if(jobs == 1)
+        amber_batch_work(cx, &b);
+
+    else {
+        /* the workers share the AmberError class, so it gets set up here
+         * rather than by whichever of them gets there first */
+        if((amber = amber_global_init(cx)) == NULL) {
+            pthread_mutex_destroy(&b.mutex);
+            return AMBER_EXIT_INIT;
+        }
+
+        /* nothing else refers to it, and the workers' gcs mustn't take the
+         * class out from under them */
+        v = OBJECT_TO_JSVAL(amber);
+        if(JS_AddNamedRoot(cx, &v, "amber batch global") == JS_FALSE) {
+            pthread_mutex_destroy(&b.mutex);
+            return AMBER_EXIT_INIT;
+        }
+
+        amber_exception_init(cx, amber);
+
+        if((t = (pthread_t *) malloc(sizeof(pthread_t) * jobs)) == NULL)
+            jobs = 0;
+
+        for(n = 0; n < jobs; n++)
+            if((err = pthread_create(&t[n], NULL, amber_batch_start, &b)) != 0) {
+                fprintf(stderr, "Unable to start batch job %d, running %d: %s\n", n + 1, n, strerror(err));
+                break;
+            }
+
+        /* with no workers at all, the work still gets done here */
+        if(n == 0)
+            amber_batch_work(cx, &b);
+
+        for(i = 0; i < n; i++)
+            pthread_join(t[i], NULL);
+
+        free(t);
+
+        JS_RemoveRoot(cx, &v);
+    }
+
+    pthread_mutex_destroy(&b.mutex);
+
+    return b.failed > 0 ? AMBER_EXIT_RUN : AMBER_EXIT_OK;
+}
@@ -0,0 +1,212 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "bundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <jsprf.h>
+#include <jsxdrapi.h>
+
+/* every bundle we've looked at stays mapped (or known missing) for good */
+typedef struct amber_bundle_st {
+    struct amber_bundle_st  *next;
+    char                    *path;
+    char                    *map;
+    size_t                  size;
+} *amber_bundle;
+
+static amber_bundle amber_bundles = NULL;
+static pthread_mutex_t amber_bundle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int amber_bundle_is(char *path) {
+    size_t len = strlen(path), slen = strlen(AMBER_BUNDLE_SUFFIX);
+
+    return len > slen && strcmp(&path[len - slen], AMBER_BUNDLE_SUFFIX) == 0;
+}
+
+/* map the bundle and make sure the index won't walk us off the end */
+static void amber_bundle_map(amber_bundle b) {
+    amber_bundle_header *h;
+    amber_bundle_entry *e;
+    struct stat st;
+    uint32_t i;
+    int fd;
+
+    if((fd = open(b->path, O_RDONLY)) < 0)
+        return;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(amber_bundle_header) ||
+       (b->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        b->map = NULL;
+        close(fd);
+        return;
+    }
+
+    close(fd);
+
+    b->size = st.st_size;
+    h = (amber_bundle_header *) b->map;
+
+    if(memcmp(h->magic, AMBER_BUNDLE_MAGIC, 8) != 0 ||
+       h->version != AMBER_BUNDLE_VERSION ||
+       h->size != b->size ||
+       h->nbuckets == 0 || (h->nbuckets & (h->nbuckets - 1)) != 0 ||
+       h->nentries >= h->nbuckets ||
+       sizeof(amber_bundle_header) + h->nbuckets * sizeof(uint32_t) + (uint64_t) h->nentries * sizeof(amber_bundle_entry) > b->size)
+        goto bad;
+
+    e = (amber_bundle_entry *) (b->map + sizeof(amber_bundle_header) + h->nbuckets * sizeof(uint32_t));
+    /* compared this way round so a huge offset can't wrap past the check */
+    for(i = 0; i < h->nentries; i++)
+        if(e[i].name_off > b->size || e[i].name_len > b->size - e[i].name_off ||
+           e[i].data_off > b->size || e[i].data_len > b->size - e[i].data_off)
+            goto bad;
+
+    madvise(b->map, b->size, MADV_WILLNEED);
+
+    return;
+
+bad:
+    munmap(b->map, b->size);
+    b->map = NULL;
+}
+
+static amber_bundle amber_bundle_get(char *path) {
+    amber_bundle b;
+
+    pthread_mutex_lock(&amber_bundle_mutex);
+
+    for(b = amber_bundles; b != NULL; b = b->next)
+        if(strcmp(b->path, path) == 0)
+            break;
+
+    if(b == NULL) {
+        if((b = (amber_bundle) malloc(sizeof(struct amber_bundle_st))) == NULL ||
+           (b->path = strdup(path)) == NULL) {
+            free(b);
+            pthread_mutex_unlock(&amber_bundle_mutex);
+            return NULL;
+        }
+        b->map = NULL;
+        b->size = 0;
+
+        amber_bundle_map(b);
+
+        b->next = amber_bundles;
+        amber_bundles = b;
+    }
+
+    pthread_mutex_unlock(&amber_bundle_mutex);
+
+    return b;
+}
+
+int amber_bundle_lookup(char *path, char *name, amber_bundle_entry **entry, char **data) {
+    amber_bundle b;
+    amber_bundle_header *h;
+    amber_bundle_entry *e;
+    uint32_t *buckets, hash, i, n;
+    size_t len;
+
+    if((b = amber_bundle_get(path)) == NULL || b->map == NULL)
+        return -1;
+
+    h = (amber_bundle_header *) b->map;
+    buckets = (uint32_t *) (b->map + sizeof(amber_bundle_header));
+    e = (amber_bundle_entry *) &buckets[h->nbuckets];
+
+    len = strlen(name);
+    hash = amber_bundle_hash(name, len);
+
+    /* a good bundle always has an empty bucket to stop at. a corrupt one
+     * might not, so never go round more than once */
+    for(i = hash & (h->nbuckets - 1), n = 0; n < h->nbuckets && buckets[i] != 0; i = (i + 1) & (h->nbuckets - 1), n++) {
+        if(buckets[i] > h->nentries)
+            return -1;
+
+        *entry = &e[buckets[i] - 1];
+        if((*entry)->hash == hash && (*entry)->name_len == len &&
+           memcmp(b->map + (*entry)->name_off, name, len) == 0) {
+
+            /* bytecode is only good for the engine that produced it */
+            if(((*entry)->flags & AMBER_BUNDLE_COMPILED) &&
+               h->engine != amber_bundle_hash(JS_GetImplementationVersion(), strlen(JS_GetImplementationVersion())))
+                return -1;
+
+            *data = b->map + (*entry)->data_off;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+JSBool amber_bundle_run(JSContext *cx, JSObject *amber, char *path, char *name, amber_bundle_entry *entry, char *data, jsval *rval) {
+    JSXDRState *xdr;
+    JSScript *script;
+    char *filename;
+    uint32 opts;
+    JSBool ret;
+
+    if(!(entry->flags & AMBER_BUNDLE_COMPILED)) {
+        filename = JS_smprintf("%s:%s", path, name);
+
+        opts = JS_GetOptions(cx);
+        JS_SetOptions(cx, opts | JSOPTION_COMPILE_N_GO);
+
+        ret = JS_EvaluateScript(cx, amber, data, entry->data_len, filename, 1, rval);
+
+        JS_SetOptions(cx, opts);
+        JS_smprintf_free(filename);
+
+        return ret;
+    }
+
+    xdr = JS_XDRNewMem(cx, JSXDR_DECODE);
+    JS_XDRMemSetData(xdr, data, entry->data_len);
+    ret = JS_XDRScript(xdr, &script);
+
+    /* the data belongs to the map, don't let the xdr free it */
+    JS_XDRMemSetData(xdr, NULL, 0);
+    JS_XDRDestroy(xdr);
+
+    if(ret == JS_FALSE) {
+        if(!JS_IsExceptionPending(cx))
+            THROW("couldn't decode precompiled module '%s' from '%s'", name, path);
+        return JS_FALSE;
+    }
+
+    ret = JS_ExecuteScript(cx, amber, script, rval);
+    JS_DestroyScript(cx, script);
+
+    return ret;
+}
@@ -0,0 +1,76 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#ifndef AMBER_BUNDLE_H
+#define AMBER_BUNDLE_H 1
+
+#include <stdint.h>
+
+/*
+ * a bundle packs many modules into a single file that the loader maps
+ * once and then resolves names from without touching the filesystem.
+ *
+ * layout: header, nbuckets bucket slots, nentries entries, then the names
+ * and module data the entries point at. buckets hold an entry index plus
+ * one (zero is empty) and are probed linearly from hash & (nbuckets - 1).
+ */
+
+#define AMBER_BUNDLE_MAGIC      "AMBRBNDL"
+#define AMBER_BUNDLE_VERSION    (1)
+#define AMBER_BUNDLE_SUFFIX     ".amb"
+
+/* entry data is XDR-encoded bytecode rather than source */
+#define AMBER_BUNDLE_COMPILED   (0x1)
+
+typedef struct amber_bundle_header_st {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    engine;
+    uint32_t    nentries;
+    uint32_t    nbuckets;
+    uint64_t    size;
+} amber_bundle_header;
+
+typedef struct amber_bundle_entry_st {
+    uint32_t    hash;
+    uint32_t    flags;
+    uint32_t    name_len;
+    uint32_t    data_len;
+    uint64_t    name_off;
+    uint64_t    data_off;
+} amber_bundle_entry;
+
+/* fnv-1a, for names and the engine version */
+static inline uint32_t amber_bundle_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261U;
+
+    while(len-- > 0) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+extern int amber_bundle_is(char *path);
+extern int amber_bundle_lookup(char *path, char *name, amber_bundle_entry **entry, char **data);
+extern JSBool amber_bundle_run(JSContext *cx, JSObject *amber, char *path, char *name, amber_bundle_entry *entry, char *data, jsval *rval);
+
+#endif
@@ -19,59 +19,312 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 
 #include "amber.h"
+#include "internal.h"
 
-#include <jsprf.h>
+#include <jsdbgapi.h>
 
 static JSClass amber_exception_class;
 
+/* the errnos scripts are likely to want to tell apart. each is a constant
+ * on AmberError, and the name goes in an error's code */
+#define AMBER_ERRNO(e) { #e, e }
+
+static struct {
+    const char  *name;
+    int         err;
+} amber_exception_errnos[] = {
+    AMBER_ERRNO(EPERM),
+    AMBER_ERRNO(ENOENT),
+    AMBER_ERRNO(EINTR),
+    AMBER_ERRNO(EIO),
+    AMBER_ERRNO(EBADF),
+    AMBER_ERRNO(EAGAIN),
+    AMBER_ERRNO(ENOMEM),
+    AMBER_ERRNO(EACCES),
+    AMBER_ERRNO(EBUSY),
+    AMBER_ERRNO(EEXIST),
+    AMBER_ERRNO(EXDEV),
+    AMBER_ERRNO(ENOTDIR),
+    AMBER_ERRNO(EISDIR),
+    AMBER_ERRNO(EINVAL),
+    AMBER_ERRNO(EMFILE),
+    AMBER_ERRNO(EFBIG),
+    AMBER_ERRNO(ENOSPC),
+    AMBER_ERRNO(ESPIPE),
+    AMBER_ERRNO(EROFS),
+    AMBER_ERRNO(EPIPE),
+    AMBER_ERRNO(ERANGE),
+    AMBER_ERRNO(ENAMETOOLONG),
+    AMBER_ERRNO(ENOTEMPTY),
+    AMBER_ERRNO(ELOOP),
+    AMBER_ERRNO(ETIMEDOUT),
+    AMBER_ERRNO(ECONNREFUSED),
+    AMBER_ERRNO(ECONNRESET),
+    { NULL, 0 }
+};
+
+/* the scripted frames an error was thrown from, kept in a reserved slot
+ * until something asks for stack. the strings follow the array */
+typedef struct amber_exception_frame {
+    const char  *name;
+    const char  *filename;
+    int         fun;
+    int         line;
+} amber_exception_frame;
+
+typedef struct amber_exception_frames {
+    int                     n;
+    amber_exception_frame   f[1];
+} amber_exception_frames;
+
+static void amber_exception_finalize(JSContext *cx, JSObject *obj) {
+    jsval v;
+
+    if(JS_GetReservedSlot(cx, obj, 0, &v) && !JSVAL_IS_VOID(v))
+        free(JSVAL_TO_PRIVATE(v));
+}
+
+/* stack in the engine's own name()@file:line form, built the first time it's
+ * read and then kept on the error itself */
+static JSBool amber_exception_stack(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    amber_exception_frames *fr;
+    char *stack, *p;
+    size_t size = 0;
+    JSString *str;
+    int i;
+    jsval v;
+
+    if(JS_GetClass(cx, obj) != &amber_exception_class ||
+       !JS_GetReservedSlot(cx, obj, 0, &v) || JSVAL_IS_VOID(v))
+        return JS_TRUE;
+    fr = JSVAL_TO_PRIVATE(v);
+
+    for(i = 0; i < fr->n; i++)
+        size += strlen(fr->f[i].name) + strlen(fr->f[i].filename) + 16;
+
+    if((p = stack = malloc(size + 1)) == NULL)
+        THROW("out of memory");
+    *p = '\0';
+    for(i = 0; i < fr->n; i++)
+        p += sprintf(p, "%s%s@%s:%d\n", fr->f[i].name, fr->f[i].fun ? "()" : "", fr->f[i].filename, fr->f[i].line);
+
+    str = JS_NewStringCopyN(cx, stack, p - stack);
+    free(stack);
+    if(str == NULL)
+        return JS_FALSE;
+
+    *vp = STRING_TO_JSVAL(str);
+    if(!JS_DefineProperty(cx, obj, "stack", *vp, NULL, NULL, JSPROP_ENUMERATE))
+        return JS_FALSE;
+
+    JS_SetReservedSlot(cx, obj, 0, JSVAL_VOID);
+    free(fr);
+
+    return JS_TRUE;
+}
+
+static JSPropertySpec amber_exception_properties[] = {
+    { "stack",  0,  JSPROP_SHARED,  amber_exception_stack,  NULL },
+    { NULL }
+};
+
 static JSBool amber_exception_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     return amber_exception_class.construct(cx, obj, argc, argv, rval);
 }
 
 void amber_exception_init(JSContext *cx, JSObject *amber) {
-    JSObject *proto, *class;
+    JSObject *proto, *class, *ctor;
     jsval fval, pval;
+    int i;
 
     JS_GetProperty(cx, amber, "Error", &fval);
     JS_CallFunctionValue(cx, amber, fval, 0, NULL, &pval);
     proto = JSVAL_TO_OBJECT(pval);
 
-    memcpy(&amber_exception_class, JS_GetClass(cx, proto), sizeof(JSClass));
+    /* Error's class is the same for every global, so the copy is only made
+     * once. the first call has to happen before other threads can throw.
+     * ours gets a slot for the frames and frees them itself */
+    if(amber_exception_class.name == NULL) {
+        memcpy(&amber_exception_class, JS_GetClass(cx, proto), sizeof(JSClass));
+        amber_exception_class.name = "AmberError";
+        amber_exception_class.flags |= JSCLASS_HAS_RESERVED_SLOTS(1);
+        amber_exception_class.finalize = amber_exception_finalize;
+    }
 
-    amber_exception_class.name = "AmberError";
-
-    class = JS_InitClass(cx, amber, proto, &amber_exception_class, amber_exception_constructor, 3, NULL, NULL, NULL, NULL);
+    class = JS_InitClass(cx, amber, proto, &amber_exception_class, amber_exception_constructor, 3, amber_exception_properties, NULL, NULL, NULL);
     JS_SetPrivate(cx, class, NULL);
 
     JS_DefineProperty(cx, class, "name", STRING_TO_JSVAL(JS_NewStringCopyZ(cx, "AmberError")), NULL, NULL, JSPROP_ENUMERATE);
+
+    ctor = JS_GetConstructor(cx, class);
+
+    for(i = 0; amber_exception_errnos[i].name != NULL; i++)
+        JS_DefineProperty(cx, ctor, amber_exception_errnos[i].name, INT_TO_JSVAL(amber_exception_errnos[i].err),
+                          NULL, NULL, JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT);
+
+    /* kept on the global so throwing doesn't have to look them up, and so
+     * a script replacing AmberError can't change what we throw */
+    JS_SetReservedSlot(cx, amber, AMBER_SLOT_ERROR, OBJECT_TO_JSVAL(ctor));
+    JS_SetReservedSlot(cx, amber, AMBER_SLOT_ERROR_PROTO, OBJECT_TO_JSVAL(class));
+}
+
+/* fileName and lineNumber come from the innermost script. the frames are
+ * gone by the time anyone reads stack, so each one's name, file and line are
+ * copied out now, but nothing is formatted until then. arguments are left
+ * out, turning them into strings could run script */
+static void amber_exception_locate(JSContext *cx, JSObject *eobj) {
+    JSStackFrame *fp, *iter = NULL;
+    amber_exception_frames *fr;
+    amber_exception_frame *f;
+    JSScript *script;
+    JSFunction *fun;
+    const char *filename, *name;
+    size_t len = 0, n;
+    JSString *str;
+    char *p;
+    int nframes = 0;
+
+    /* count first so it all goes in one allocation */
+    while((fp = JS_FrameIterator(cx, &iter)) != NULL) {
+        if(JS_IsNativeFrame(cx, fp) || (script = JS_GetFrameScript(cx, fp)) == NULL)
+            continue;
+
+        filename = JS_GetScriptFilename(cx, script);
+        fun = JS_GetFrameFunction(cx, fp);
+        name = fun != NULL ? JS_GetFunctionName(fun) : NULL;
+        if(filename == NULL)
+            filename = "";
+
+        if(nframes++ == 0) {
+            if((str = JS_NewStringCopyZ(cx, filename)) != NULL)
+                JS_DefineProperty(cx, eobj, "fileName", STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE);
+            JS_DefineProperty(cx, eobj, "lineNumber", INT_TO_JSVAL(JS_PCToLineNumber(cx, script, JS_GetFramePC(cx, fp))),
+                              NULL, NULL, JSPROP_ENUMERATE);
+        }
+
+        len += (name != NULL ? strlen(name) : 0) + strlen(filename) + 2;
+    }
+
+    if(nframes == 0 ||
+       (fr = malloc(sizeof(amber_exception_frames) + sizeof(amber_exception_frame) * (nframes - 1) + len)) == NULL)
+        return;
+
+    p = (char *) &fr->f[nframes];
+    fr->n = 0;
+    iter = NULL;
+
+    while(fr->n < nframes && (fp = JS_FrameIterator(cx, &iter)) != NULL) {
+        if(JS_IsNativeFrame(cx, fp) || (script = JS_GetFrameScript(cx, fp)) == NULL)
+            continue;
+
+        f = &fr->f[fr->n++];
+
+        filename = JS_GetScriptFilename(cx, script);
+        fun = JS_GetFrameFunction(cx, fp);
+        name = fun != NULL ? JS_GetFunctionName(fun) : NULL;
+
+        f->fun = fun != NULL;
+        f->line = JS_PCToLineNumber(cx, script, JS_GetFramePC(cx, fp));
+
+        n = name != NULL ? strlen(name) + 1 : 1;
+        memcpy(p, name != NULL ? name : "", n);
+        f->name = p;
+        p += n;
+
+        n = filename != NULL ? strlen(filename) + 1 : 1;
+        memcpy(p, filename != NULL ? filename : "", n);
+        f->filename = p;
+        p += n;
+    }
+
+    JS_SetReservedSlot(cx, eobj, 0, PRIVATE_TO_JSVAL(fr));
+}
+
+static JSBool amber_exception_vthrow(JSContext *cx, int err, const char *module, const char *format, va_list ap) {
+    JSObject *amber, *eobj;
+    JSString *str;
+    char buf[256], *text = buf;
+    va_list aq;
+    jsval pval;
+    int len, i;
+
+    /* most messages are short enough not to need the heap */
+    va_copy(aq, ap);
+    len = vsnprintf(buf, sizeof(buf), format, aq);
+    va_end(aq);
+
+    if(len < 0)
+        len = 0;
+    else if((size_t) len >= sizeof(buf)) {
+        if((text = malloc(len + 1)) == NULL) {
+            text = buf;
+            len = sizeof(buf) - 1;
+        }
+        else
+            vsnprintf(text, len + 1, format, ap);
+    }
+
+    /* without our class there's nothing better to do than a plain error */
+    if((amber = JS_GetGlobalObject(cx)) == NULL ||
+       JS_GetReservedSlot(cx, amber, AMBER_SLOT_ERROR_PROTO, &pval) == JS_FALSE || !JSVAL_IS_OBJECT(pval) || JSVAL_IS_NULL(pval)) {
+        JS_ReportError(cx, "%s", text);
+        goto done;
+    }
+
+    if((eobj = JS_NewObject(cx, &amber_exception_class, JSVAL_TO_OBJECT(pval), amber)) == NULL)
+        goto done;
+    JS_SetPrivate(cx, eobj, NULL);
+
+    /* pending exceptions are rooted, so it's safe while it's filled in */
+    JS_SetPendingException(cx, OBJECT_TO_JSVAL(eobj));
+
+    if((str = JS_NewStringCopyN(cx, text, len)) != NULL)
+        JS_DefineProperty(cx, eobj, "message", STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE);
+
+    amber_exception_locate(cx, eobj);
+
+    if(err != 0) {
+        JS_DefineProperty(cx, eobj, "errno", INT_TO_JSVAL(err), NULL, NULL, JSPROP_ENUMERATE);
+
+        for(i = 0; amber_exception_errnos[i].name != NULL && amber_exception_errnos[i].err != err; i++);
+        if(amber_exception_errnos[i].name != NULL && (str = JS_NewStringCopyZ(cx, amber_exception_errnos[i].name)) != NULL)
+            JS_DefineProperty(cx, eobj, "code", STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE);
+    }
+
+    if(module != NULL && (str = JS_NewStringCopyZ(cx, module)) != NULL)
+        JS_DefineProperty(cx, eobj, "module", STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE);
+
+done:
+    if(text != buf)
+        free(text);
+
+    return JS_FALSE;
 }
 
 JSBool amber_exception_throw(JSContext *cx, char *format, ...) {
     va_list ap;
-    JSObject *amber;
-    char *text;
-    jsval argv[1], fval, eval;
 
     va_start(ap, format);
-    text = JS_vsmprintf(format, ap);
+    amber_exception_vthrow(cx, 0, NULL, format, ap);
     va_end(ap);
 
-    argv[0] = STRING_TO_JSVAL(JS_NewStringCopyZ(cx, text));
-
-    JS_free(cx, text);
-
-    amber = JS_GetGlobalObject(cx);
-
-    /* !!! need to add filename/linenumber here too */
+    return JS_FALSE;
+}
 
-    JS_GetProperty(cx, amber, "AmberError", &fval);
-    JS_CallFunctionValue(cx, amber, fval, 1, argv, &eval);
+/* as above, with an errno for code and errno, and the module it came from */
+JSBool amber_exception_throw_code(JSContext *cx, int err, const char *module, char *format, ...) {
+    va_list ap;
 
-    JS_SetPendingException(cx, OBJECT_TO_JSVAL(eval));
+    va_start(ap, format);
+    amber_exception_vthrow(cx, err, module, format, ap);
+    va_end(ap);
 
     return JS_FALSE;
 }
@@ -0,0 +1,163 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* jschars encoded per write chunk. utf-8 needs at most 3 bytes for each */
+#define AMBER_FILE_ENCODE_CHUNK (16 * 1024)
+
+#define AMBER_FILE_REPLACEMENT  0xfffd
+
+/* the stream behind a File object, for modules that want to work on one
+ * directly. NULL if it isn't a File or it's been closed */
+FILE *amber_file_stream(JSContext *cx, jsval v) {
+    JSObject *obj;
+    JSClass *clasp;
+
+    if(!JSVAL_IS_OBJECT(v) || JSVAL_IS_NULL(v))
+        return NULL;
+
+    obj = JSVAL_TO_OBJECT(v);
+    if((clasp = JS_GetClass(cx, obj)) == NULL || strcmp(clasp->name, "File") != 0)
+        return NULL;
+
+    return (FILE *) JS_GetPrivate(cx, obj);
+}
+
+/* how a File's text goes out. the encoding is in its reserved slot, and a
+ * slot that was never set means binary */
+amber_file_encoding amber_file_get_encoding(JSContext *cx, jsval v) {
+    jsval ev;
+
+    if(amber_file_stream(cx, v) == NULL ||
+       !JS_GetReservedSlot(cx, JSVAL_TO_OBJECT(v), 0, &ev) || !JSVAL_IS_INT(ev))
+        return AMBER_FILE_BINARY;
+
+    return (amber_file_encoding) JSVAL_TO_INT(ev);
+}
+
+/*
+ * encode up to len jschars into out, which has room for 3 * len bytes.
+ * *used says how many jschars went in, which is one short when a chunk
+ * ends on the first half of a surrogate pair and more is still to come
+ */
+size_t amber_file_encode(const jschar *in, size_t len, JSBool more, unsigned char *out,
+                         amber_file_encoding enc, size_t *used) {
+    size_t i = 0, o = 0, end;
+    unsigned int c, cp;
+#ifdef __SSE2__
+    __m128i a, b, zero = _mm_setzero_si128(), lowbyte = _mm_set1_epi16(0x00ff);
+    __m128i high = _mm_set1_epi16(enc == AMBER_FILE_UTF8 ? (short) 0xff80 : (short) 0xff00);
+#endif
+
+    while(i < len) {
+#ifdef __SSE2__
+        for(; i + 16 <= len; i += 16, o += 16) {
+            a = _mm_loadu_si128((const __m128i *) &in[i]);
+            b = _mm_loadu_si128((const __m128i *) &in[i + 8]);
+
+            if(enc == AMBER_FILE_BINARY) {
+                a = _mm_and_si128(a, lowbyte);
+                b = _mm_and_si128(b, lowbyte);
+            }
+            else if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), zero)) != 0xffff)
+                break;
+
+            _mm_storeu_si128((__m128i *) &out[o], _mm_packus_epi16(a, b));
+        }
+#endif
+
+        /* a block the slow way, then try wide again */
+        for(end = i + 16 < len ? i + 16 : len; i < end; i++) {
+            c = in[i];
+
+            if(enc == AMBER_FILE_BINARY) {
+                out[o++] = (unsigned char) c;
+                continue;
+            }
+            if(enc == AMBER_FILE_LATIN1) {
+                out[o++] = c > 0xff ? '?' : (unsigned char) c;
+                continue;
+            }
+
+            if(c < 0x80) {
+                out[o++] = (unsigned char) c;
+                continue;
+            }
+            if(c < 0x800) {
+                out[o++] = (unsigned char) (0xc0 | (c >> 6));
+                out[o++] = (unsigned char) (0x80 | (c & 0x3f));
+                continue;
+            }
+
+            if(c >= 0xd800 && c <= 0xdbff) {
+                if(i + 1 == len && more)
+                    goto done;
+                if(i + 1 < len && in[i + 1] >= 0xdc00 && in[i + 1] <= 0xdfff) {
+                    cp = 0x10000 + ((c - 0xd800) << 10) + (in[i + 1] - 0xdc00);
+                    out[o++] = (unsigned char) (0xf0 | (cp >> 18));
+                    out[o++] = (unsigned char) (0x80 | ((cp >> 12) & 0x3f));
+                    out[o++] = (unsigned char) (0x80 | ((cp >> 6) & 0x3f));
+                    out[o++] = (unsigned char) (0x80 | (cp & 0x3f));
+                    i++;
+                    continue;
+                }
+                c = AMBER_FILE_REPLACEMENT;
+            }
+            else if(c >= 0xdc00 && c <= 0xdfff)
+                c = AMBER_FILE_REPLACEMENT;
+
+            out[o++] = (unsigned char) (0xe0 | (c >> 12));
+            out[o++] = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+            out[o++] = (unsigned char) (0x80 | (c & 0x3f));
+        }
+    }
+
+done:
+    *used = i;
+    return o;
+}
+
+/* write len jschars in the given encoding, a chunk at a time */
+JSBool amber_file_write(JSContext *cx, FILE *f, const jschar *chars, size_t len, amber_file_encoding enc) {
+    unsigned char out[3 * AMBER_FILE_ENCODE_CHUNK];
+    size_t pos = 0, n, used, bytes;
+
+    while(pos < len) {
+        n = len - pos < AMBER_FILE_ENCODE_CHUNK ? len - pos : AMBER_FILE_ENCODE_CHUNK;
+        bytes = amber_file_encode(&chars[pos], n, pos + n < len, out, enc, &used);
+        pos += used;
+
+        if(fwrite(out, 1, bytes, f) != bytes)
+            THROW_CODE(errno, "File", "write error: %s", strerror(errno));
+    }
+
+    return JS_TRUE;
+}
@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include "amber.h"
+#include "internal.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,9 +37,15 @@ static JSBool amber_global_print(JSContext *cx, JSObject *obj, uintN argc, jsval
     uintN i;
     JSString *str;
     char *thing;
+    FILE *out = stdout;
+    amber_run run;
+
+    /* batch runs can have their output captured */
+    if((run = JS_GetPrivate(cx, JS_GetGlobalObject(cx))) != NULL && run->out != NULL)
+        out = run->out;
 
     if(argc == 0) {
-        fputs("\n", stdout);
+        fputs("\n", out);
         return JS_TRUE;
     }
 
@@ -48,10 +55,10 @@ static JSBool amber_global_print(JSContext *cx, JSObject *obj, uintN argc, jsval
             THROW("couldn't convert argument to char *");
         }
 
-        printf("%s%s", i > 0 ? " " : "", thing);
+        fprintf(out, "%s%s", i > 0 ? " " : "", thing);
     }
 
-    fputc('\n', stdout);
+    fputc('\n', out);
 
     return JS_TRUE;
 }
@@ -86,10 +93,19 @@ static JSBool amber_global_load(JSContext *cx, JSObject *obj, uintN argc, jsval
 static JSBool amber_global_exit(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     int code = AMBER_EXIT_OK;
     JSRuntime *rt;
+    amber_run run;
 
     if(argc > 0)
         code = JSVAL_TO_INT(argv[0]);
 
+    /* if someone else owns the process, just record the code and unwind.
+     * returning false without an exception pending can't be caught */
+    if((run = JS_GetPrivate(cx, JS_GetGlobalObject(cx))) != NULL) {
+        run->exited = 1;
+        run->exit_code = code;
+        return JS_FALSE;
+    }
+
     rt = JS_GetRuntime(cx);
 
     JS_DestroyContext(cx);
@@ -100,10 +116,55 @@ static JSBool amber_global_exit(JSContext *cx, JSObject *obj, uintN argc, jsval
     return JS_FALSE;
 }
 
+/*
+ * memory() says where the heap is at: gcHeap (gc things), native (what
+ * modules hold), total (everything malloc has handed out, both of those
+ * included), peak, peakRss, and limit (the budget, or 0)
+ */
+static JSBool amber_global_memory(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    amber_memory_stats_t st;
+    JSObject *res;
+    jsval v;
+    int i;
+    struct {
+        const char  *name;
+        size_t      *value;
+    } fields[] = {
+        { "gcHeap",     &st.gc_heap },
+        { "native",     &st.native },
+        { "total",      &st.total },
+        { "peak",       &st.peak },
+        { "peakRss",    &st.peak_rss },
+        { "limit",      &st.limit },
+        { NULL }
+    };
+
+    amber_memory_stats(cx, &st);
+
+    if((res = JS_NewObject(cx, NULL, NULL, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(res);
+
+    for(i = 0; fields[i].name != NULL; i++)
+        if(!JS_NewNumberValue(cx, (jsdouble) *fields[i].value, &v) ||
+           !JS_DefineProperty(cx, res, fields[i].name, v, NULL, NULL, JSPROP_ENUMERATE))
+            return JS_FALSE;
+
+    return JS_TRUE;
+}
+
+static JSBool amber_global_gc(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JS_GC(cx);
+
+    return JS_TRUE;
+}
+
 static JSFunctionSpec amber_functions[] = {
     { "print",  amber_global_print, 0, 0 },
     { "load",   amber_global_load,  1, 0 },
     { "exit",   amber_global_exit,  0, 0 },
+    { "memory", amber_global_memory, 0, 0 },
+    { "gc",     amber_global_gc,    0, 0 },
     { NULL }
 };
 
@@ -111,11 +172,13 @@ static JSFunctionSpec amber_core_functions[] = {
     { "print",  amber_global_print, 0, JSPROP_READONLY | JSPROP_PERMANENT },
     { "load",   amber_global_load,  1, JSPROP_READONLY | JSPROP_PERMANENT },
     { "exit",   amber_global_exit,  0, JSPROP_READONLY | JSPROP_PERMANENT },
+    { "memory", amber_global_memory, 0, JSPROP_READONLY | JSPROP_PERMANENT },
+    { "gc",     amber_global_gc,    0, JSPROP_READONLY | JSPROP_PERMANENT },
     { NULL }
 };
 
 static JSClass amber_class = {
-    "Amber", 0,
+    "Amber", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(AMBER_GLOBAL_SLOTS),
     JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
     JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, JS_FinalizeStub
 };
@@ -129,6 +192,7 @@ JSObject *amber_global_init(JSContext *cx) {
     if((amber = JS_NewObject(cx, &amber_class, NULL, NULL)) == NULL ||
 
        /* load all the builtin stuff into it */
+       JS_SetPrivate(cx, amber, NULL) == JS_FALSE ||
        JS_InitStandardClasses(cx, amber) == JS_FALSE ||
 
        /* get our core functions online */
@@ -172,3 +236,31 @@ JSObject *amber_global_init(JSContext *cx) {
 
     return amber;
 }
+
+JSBool amber_global_arguments(JSContext *cx, JSObject *amber, int argc, char **argv) {
+    JSObject *obj;
+    int i;
+
+    /* arguments holds the command line arguments */
+    if((obj = JS_NewArrayObject(cx, 0, NULL)) == NULL ||
+
+       /* hook it up to the global objects */
+       JS_DefineProperty(cx, amber, "arguments", OBJECT_TO_JSVAL(obj), NULL, NULL, JSPROP_ENUMERATE) == JS_FALSE)
+        return JS_FALSE;
+
+    /* loop over argv and add them to the array */
+    for(i = 0; i < argc; i++)
+        if(JS_DefineElement(cx, obj, i, STRING_TO_JSVAL(JS_NewStringCopyZ(cx, argv[i])), NULL, NULL, JSPROP_ENUMERATE) == JS_FALSE)
+            return JS_FALSE;
+
+    return JS_TRUE;
+}
+
+/* load a module up front, as if the script had called load() */
+JSBool amber_global_preload(JSContext *cx, JSObject *amber, char *module) {
+    jsval argv[1], rval;
+
+    argv[0] = STRING_TO_JSVAL(JS_NewStringCopyZ(cx, module));
+
+    return JS_CallFunctionName(cx, amber, "load", 1, argv, &rval);
+}
@@ -20,7 +20,50 @@
 #ifndef AMBER_INTERNAL_H
 #define AMBER_INTERNAL_H 1
 
+#include <stdio.h>
+
+/* per-run state, hung off the global object when the script isn't the only
+ * thing this process will ever run. exit() unwinds instead of exiting */
+typedef struct amber_run_st {
+    int         exited;
+    int         exit_code;
+    FILE        *out;
+} *amber_run;
+
+/* reserved slots on the global object */
+#define AMBER_SLOT_ERROR        (0)
+#define AMBER_SLOT_ERROR_PROTO  (1)
+#define AMBER_GLOBAL_SLOTS      (2)
+
+extern double amber_limit_cpu, amber_limit_wall;
+extern size_t amber_limit_heap;
+
+typedef struct amber_memory_stats_st {
+    size_t      gc_heap;
+    size_t      native;
+    size_t      total;
+    size_t      peak;
+    size_t      peak_rss;
+    size_t      limit;
+} amber_memory_stats_t;
+
+extern void amber_memory_init(JSRuntime *rt);
+extern uint32 amber_memory_runtime_size(size_t max_heap);
+extern size_t amber_memory_parse(const char *str);
+extern void amber_memory_stats(JSContext *cx, amber_memory_stats_t *st);
+
+extern void amber_error_reporter(JSContext *cx, const char *message, JSErrorReport *report);
+
 extern JSObject *amber_global_init(JSContext *cx);
+extern JSBool amber_global_arguments(JSContext *cx, JSObject *amber, int argc, char **argv);
+extern JSBool amber_global_preload(JSContext *cx, JSObject *amber, char *module);
 extern void amber_exception_init(JSContext *cx, JSObject *amber);
 
+extern int amber_lines(JSContext *cx, JSObject *amber, char *script, int scriptlen, char *pretty, char **files, int nfiles, int autoprint, char *delim);
+
+extern int amber_serve(JSContext *cx, JSObject *amber, char *path);
+
+extern char **amber_batch_manifest(char *filename, int *nscripts);
+extern int amber_batch(JSContext *cx, char **scripts, int nscripts, char **preload, int npreload, int jobs, char *outdir);
+
 #endif
@@ -0,0 +1,236 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#define AMBER_LINES_BUFSIZE (256 * 1024)
+
+typedef struct amber_lines_st {
+    JSContext   *cx;
+    JSObject    *amber;
+    JSScript    *script;
+    int         autoprint;
+    char        *delim;
+    int         delimlen;
+} *amber_lines_t;
+
+/* break the line up into F */
+static JSBool amber_lines_split(amber_lines_t l, char *line, int len) {
+    JSContext *cx = l->cx;
+    JSObject *fields;
+    char *c, *end = line + len;
+    jsval v;
+    jsint n = 0;
+
+    if((fields = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+
+    v = OBJECT_TO_JSVAL(fields);
+    if(JS_SetProperty(cx, l->amber, "F", &v) == JS_FALSE)
+        return JS_FALSE;
+
+    for(;;) {
+        if(l->delimlen == 1)
+            c = memchr(line, l->delim[0], end - line);
+        else
+            c = memmem(line, end - line, l->delim, l->delimlen);
+        if(c == NULL)
+            c = end;
+
+        v = STRING_TO_JSVAL(JS_NewStringCopyN(cx, line, c - line));
+        if(JS_SetElement(cx, fields, n++, &v) == JS_FALSE)
+            return JS_FALSE;
+
+        if(c == end)
+            break;
+        line = c + l->delimlen;
+    }
+
+    return JS_TRUE;
+}
+
+/* bind the line and run the script over it */
+static JSBool amber_lines_one(amber_lines_t l, char *line, int len) {
+    JSContext *cx = l->cx;
+    JSString *str;
+    jsval v, rval;
+
+    if(len > 0 && line[len - 1] == '\r')
+        len--;
+
+    if((str = JS_NewStringCopyN(cx, line, len)) == NULL)
+        return JS_FALSE;
+
+    v = STRING_TO_JSVAL(str);
+    if(JS_SetProperty(cx, l->amber, "_", &v) == JS_FALSE)
+        return JS_FALSE;
+
+    if(l->delim != NULL && amber_lines_split(l, line, len) == JS_FALSE)
+        return JS_FALSE;
+
+    if(JS_ExecuteScript(cx, l->amber, l->script, &rval) == JS_FALSE)
+        return JS_FALSE;
+
+    if(l->autoprint) {
+        if(JS_GetProperty(cx, l->amber, "_", &v) == JS_FALSE ||
+           (str = JS_ValueToString(cx, v)) == NULL)
+            return JS_FALSE;
+
+        fwrite(JS_GetStringBytes(str), sizeof(char), JS_GetStringLength(str), stdout);
+        fputc('\n', stdout);
+    }
+
+    return JS_TRUE;
+}
+
+/* split the input into lines ourselves, big reads and memchr. -1 is a
+ * read error (or running out of memory, with errno set to say so), -2
+ * means the script failed */
+static int amber_lines_fd(amber_lines_t l, int fd) {
+    char *buf, *line, *nl, *grown;
+    int len = AMBER_LINES_BUFSIZE, pos = 0, n;
+
+    if((buf = (char *) malloc(len)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(;;) {
+        /* a line longer than the buffer */
+        if(pos == len) {
+            if(len > INT_MAX / 2 || (grown = (char *) realloc(buf, len * 2)) == NULL) {
+                free(buf);
+                errno = ENOMEM;
+                return -1;
+            }
+            buf = grown;
+            len *= 2;
+        }
+
+        if((n = read(fd, &buf[pos], len - pos)) < 0) {
+            if(errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+
+        /* whatever's left at the end is the last line */
+        if(n == 0) {
+            if(pos > 0 && amber_lines_one(l, buf, pos) == JS_FALSE)
+                goto fail;
+            break;
+        }
+
+        line = buf;
+        n += pos;
+
+        while((nl = memchr(line, '\n', &buf[n] - line)) != NULL) {
+            if(amber_lines_one(l, line, nl - line) == JS_FALSE)
+                goto fail;
+            line = nl + 1;
+        }
+
+        pos = &buf[n] - line;
+        memmove(buf, line, pos);
+    }
+
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    return -2;
+}
+
+int amber_lines(JSContext *cx, JSObject *amber, char *script, int scriptlen, char *pretty, char **files, int nfiles, int autoprint, char *delim) {
+    struct amber_lines_st l;
+    JSObject *sobj;
+    jsval v;
+    int i, fd, err, ret = AMBER_EXIT_OK;
+
+    l.cx = cx;
+    l.amber = amber;
+    l.autoprint = autoprint;
+
+    /* an empty delimiter splits on spaces */
+    l.delim = delim;
+    if(delim != NULL && *delim == '\0')
+        l.delim = " ";
+    l.delimlen = l.delim != NULL ? strlen(l.delim) : 0;
+
+    /* compile once, run per line. the script object keeps it alive */
+    if((l.script = JS_CompileScript(cx, amber, script, scriptlen, pretty, 1)) == NULL)
+        return AMBER_EXIT_RUN;
+
+    if((sobj = JS_NewScriptObject(cx, l.script)) == NULL) {
+        JS_DestroyScript(cx, l.script);
+        return AMBER_EXIT_INIT;
+    }
+
+    v = OBJECT_TO_JSVAL(sobj);
+    if(JS_DefineProperty(cx, amber, "_", JSVAL_VOID, NULL, NULL, JSPROP_ENUMERATE) == JS_FALSE ||
+       JS_AddNamedRoot(cx, &v, "amber line script") == JS_FALSE)
+        return AMBER_EXIT_INIT;
+
+    if(nfiles == 0 && (err = amber_lines_fd(&l, 0)) < 0) {
+        if(err == -1)
+            fprintf(stderr, "Unable to read '(stdin)': %s\n", strerror(errno));
+        ret = err == -1 ? AMBER_EXIT_SCRIPT : AMBER_EXIT_RUN;
+    }
+
+    for(i = 0; i < nfiles && ret == AMBER_EXIT_OK; i++) {
+        if(strcmp(files[i], "-") == 0)
+            fd = 0;
+
+        else if((fd = open(files[i], O_RDONLY)) < 0) {
+            fprintf(stderr, "Unable to read '%s': %s\n", files[i], strerror(errno));
+            ret = AMBER_EXIT_SCRIPT;
+            break;
+        }
+
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        if((err = amber_lines_fd(&l, fd)) < 0) {
+            if(err == -1)
+                fprintf(stderr, "Unable to read '%s': %s\n", files[i], strerror(errno));
+            ret = err == -1 ? AMBER_EXIT_SCRIPT : AMBER_EXIT_RUN;
+        }
+
+        if(fd != 0)
+            close(fd);
+    }
+
+    fflush(stdout);
+
+    JS_RemoveRoot(cx, &v);
+
+    return ret;
+}
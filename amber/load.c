@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include "amber.h"
+#include "bundle.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -93,7 +94,7 @@ JSBool amber_run_script(JSContext *cx, JSObject *amber, char *filename, jsval *r
     JSBool ret;
 
     if(amber_load_script(filename, &script, &scriptlen) < 0) {
-        THROW("unable to load '%s': %s", filename, strerror(errno));
+        THROW_CODE(errno, NULL, "unable to load '%s': %s", filename, strerror(errno));
         return JS_FALSE;
     }
     if(scriptlen == 0) {
@@ -116,6 +117,8 @@ JSBool amber_load_module(JSContext *cx, JSObject *amber, JSObject *search_path,
     jsval result;
     struct stat st;
     JSString *str, *full;
+    amber_bundle_entry *entry;
+    char *dir, *data;
 #ifdef HAVE_DLFCN_H
     void *dl;
     JSBool (*init)(JSContext *cx, JSObject *amber);
@@ -127,6 +130,15 @@ JSBool amber_load_module(JSContext *cx, JSObject *amber, JSObject *search_path,
 
     for(i = 0; i < len; i++) {
         JS_GetElement(cx, search_path, i, &result);
+
+        /* bundles resolve straight out of the map, no filesystem involved */
+        dir = JS_GetStringBytes(JSVAL_TO_STRING(result));
+        if(amber_bundle_is(dir)) {
+            if(amber_bundle_lookup(dir, JS_GetStringBytes(str), &entry, &data) == 0)
+                return amber_bundle_run(cx, amber, dir, JS_GetStringBytes(str), entry, data, rval);
+            continue;
+        }
+
         full = JS_ConcatStrings(cx, JS_ConcatStrings(cx, JSVAL_TO_STRING(result), JS_NewStringCopyZ(cx, "/")), str);
 
         thing = JS_GetStringBytes(JS_ConcatStrings(cx, full, JS_NewStringCopyZ(cx, ".js")));
@@ -0,0 +1,319 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_JSCNTXT_H
+# include <jscntxt.h>
+#endif
+
+/*
+ * memory budgets. the engine doesn't let us see its allocations one by one,
+ * so the accounting is done in two halves. after every gc the whole malloc
+ * heap is measured, which takes in the gc arenas, string and slot storage
+ * and anything modules hold. between collections, modules report what they
+ * take and give back through amber_memory_account so big native buffers
+ * don't have to wait for the next gc to be seen. the engine is told to
+ * collect every AMBER_MEMORY_GC_TRIGGER bytes of js mallocs, which keeps
+ * the measurement from getting stale however big the budget is.
+ *
+ * going over works like the watchdog. the first time gets an AmberError
+ * the script can catch and tidy up after, and a script that then carries
+ * on past the grace margin is stopped where it stands.
+ *
+ * all of this is measured for the whole process, not per script. the
+ * engine has one heap per runtime and malloc has one per process, so
+ * threads and concurrent batch jobs are all held to the same figure
+ */
+
+#define AMBER_MEMORY_GC_TRIGGER (8L * 1024L * 1024L)
+
+/* how far past the budget a warned script can get before it's stopped */
+#define AMBER_MEMORY_GRACE(max) ((max) / 8)
+
+typedef enum amber_memory_state {
+    AMBER_MEMORY_OK,
+    AMBER_MEMORY_WARN,
+    AMBER_MEMORY_KILL
+} amber_memory_state;
+
+struct amber_memory_st {
+    JSContext               *cx;
+    JSBranchCallback        old_branch;
+    amber_memory            prev;
+
+    size_t                  max;
+    amber_memory_state      state;
+
+    /* what was in use after the last collection we forced, 0 for none */
+    size_t                  collected;
+};
+
+/* process default, from --max-heap */
+size_t amber_limit_heap = 0;
+
+/* the last measurement plus whatever's been accounted since, the most it's
+ * ever been, and what modules say they're holding */
+static size_t amber_memory_used = 0, amber_memory_peak = 0, amber_memory_native = 0;
+
+static JSGCCallback amber_memory_old_gc = NULL;
+
+static __thread amber_memory amber_memory_current = NULL;
+
+static void amber_memory_note_peak(size_t used) {
+    size_t peak = __atomic_load_n(&amber_memory_peak, __ATOMIC_RELAXED);
+
+    while(used > peak &&
+          !__atomic_compare_exchange_n(&amber_memory_peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* bytes of heap in use right now. without mallinfo2 the resident set is
+ * the next best thing */
+static size_t amber_memory_measure(void) {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.uordblks + mi.hblkhd;
+#else
+    unsigned long size, resident;
+    FILE *f;
+
+    if((f = fopen("/proc/self/statm", "r")) == NULL)
+        return __atomic_load_n(&amber_memory_used, __ATOMIC_RELAXED);
+    if(fscanf(f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+
+    return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/* add to a counter, stopping at zero. a measurement can come in between
+ * an allocation being counted and its free, so frees can outnumber what's
+ * left */
+static size_t amber_memory_add(size_t *counter, ssize_t bytes) {
+    size_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED), next;
+
+    do {
+        next = bytes < 0 && cur < (size_t) -bytes ? 0 : cur + bytes;
+    } while(!__atomic_compare_exchange_n(counter, &cur, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return next;
+}
+
+/* modules call this with what they allocate (positive) and free (negative) */
+void amber_memory_account(ssize_t bytes) {
+    size_t used;
+
+    amber_memory_add(&amber_memory_native, bytes);
+    used = amber_memory_add(&amber_memory_used, bytes);
+
+    if(bytes > 0)
+        amber_memory_note_peak(used);
+}
+
+static JSBool amber_memory_gc(JSContext *cx, JSGCStatus status) {
+    size_t used;
+
+    if(status == JSGC_END) {
+        used = amber_memory_measure();
+        __atomic_store_n(&amber_memory_used, used, __ATOMIC_RELAXED);
+        amber_memory_note_peak(used);
+    }
+
+    return amber_memory_old_gc != NULL ? amber_memory_old_gc(cx, status) : JS_TRUE;
+}
+
+/* hook the runtime up. with a budget the runtime is created as big as the
+ * budget, since in this engine that's a hard cap on gc things rather than
+ * a trigger, but collections still have to come round regularly */
+void amber_memory_init(JSRuntime *rt) {
+#ifdef HAVE_JSCNTXT_H
+    rt->gcMaxMallocBytes = AMBER_MEMORY_GC_TRIGGER;
+#endif
+
+    amber_memory_old_gc = JS_SetGCCallbackRT(rt, amber_memory_gc);
+    __atomic_store_n(&amber_memory_used, amber_memory_measure(), __ATOMIC_RELAXED);
+}
+
+/* the runtime size to ask for, given a budget. without jscntxt.h the
+ * trigger can't be lowered and nothing sees the gc heap, so a bigger
+ * runtime would only let it grow unchecked */
+uint32 amber_memory_runtime_size(size_t max_heap) {
+#ifdef HAVE_JSCNTXT_H
+    if(max_heap <= AMBER_MEMORY_GC_TRIGGER)
+        return AMBER_MEMORY_GC_TRIGGER;
+    if(max_heap >= 0xffffffffUL)
+        return 0xffffffffUL;
+    return (uint32) max_heap;
+#else
+    return AMBER_MEMORY_GC_TRIGGER;
+#endif
+}
+
+void amber_memory_stats(JSContext *cx, amber_memory_stats_t *st) {
+    struct rusage ru;
+
+    memset(st, 0, sizeof(*st));
+
+#ifdef HAVE_JSCNTXT_H
+    st->gc_heap = JS_GetRuntime(cx)->gcBytes;
+#endif
+    st->total = amber_memory_measure();
+    st->native = __atomic_load_n(&amber_memory_native, __ATOMIC_RELAXED);
+    amber_memory_note_peak(st->total);
+    st->peak = __atomic_load_n(&amber_memory_peak, __ATOMIC_RELAXED);
+    st->limit = amber_memory_current != NULL && amber_memory_current->cx == cx ? amber_memory_current->max : 0;
+
+    if(getrusage(RUSAGE_SELF, &ru) == 0)
+        st->peak_rss = (size_t) ru.ru_maxrss * 1024;
+}
+
+static char *amber_memory_size(size_t bytes, char *buf, size_t len) {
+    if(bytes >= 1024L * 1024L * 1024L)
+        snprintf(buf, len, "%.1fGB", bytes / (1024.0 * 1024.0 * 1024.0));
+    else
+        snprintf(buf, len, "%.1fMB", bytes / (1024.0 * 1024.0));
+
+    return buf;
+}
+
+/* sizes on the command line: bytes, or with a k, m or g after them */
+size_t amber_memory_parse(const char *str) {
+    char *end;
+    double n;
+
+    n = strtod(str, &end);
+    if(end == str || n <= 0)
+        return 0;
+
+    switch(*end) {
+        case 'k': case 'K': n *= 1024; end++; break;
+        case 'm': case 'M': n *= 1024 * 1024; end++; break;
+        case 'g': case 'G': n *= 1024 * 1024 * 1024; end++; break;
+    }
+
+    if(*end != '\0' || n < 1)
+        return 0;
+
+    return (size_t) n;
+}
+
+/* it might all be garbage. a collection is only forced again once the heap
+ * has grown by the grace margin since the last one, otherwise a script
+ * sitting just over the line would collect on every branch */
+static size_t amber_memory_collect(JSContext *cx, amber_memory mem, size_t used) {
+    if(mem->collected != 0 && used < mem->collected + AMBER_MEMORY_GRACE(mem->max))
+        return used;
+
+    JS_GC(cx);
+
+    used = __atomic_load_n(&amber_memory_used, __ATOMIC_RELAXED);
+    mem->collected = used > 0 ? used : 1;
+
+    return used;
+}
+
+static JSBool amber_memory_branch(JSContext *cx, JSScript *script) {
+    amber_memory mem = amber_memory_current;
+    char buf[32];
+    size_t used;
+
+    if(mem == NULL || mem->cx != cx)
+        return mem != NULL && mem->old_branch != NULL ? mem->old_branch(cx, script) : JS_TRUE;
+
+    used = __atomic_load_n(&amber_memory_used, __ATOMIC_RELAXED);
+
+    if(mem->state == AMBER_MEMORY_OK && used > mem->max) {
+        if(amber_memory_collect(cx, mem, used) > mem->max) {
+            mem->state = AMBER_MEMORY_WARN;
+            return amber_exception_throw(cx, "out of memory: heap limit of %s exceeded",
+                                         amber_memory_size(mem->max, buf, sizeof(buf)));
+        }
+    }
+
+    else if(mem->state == AMBER_MEMORY_WARN && used > mem->max + AMBER_MEMORY_GRACE(mem->max)) {
+        if(amber_memory_collect(cx, mem, used) > mem->max + AMBER_MEMORY_GRACE(mem->max))
+            mem->state = AMBER_MEMORY_KILL;
+    }
+
+    if(mem->state == AMBER_MEMORY_KILL) {
+        JS_ClearPendingException(cx);
+        return JS_FALSE;
+    }
+
+    return mem->old_branch != NULL ? mem->old_branch(cx, script) : JS_TRUE;
+}
+
+/* hold the calling thread's run on cx to max_heap bytes, zero for no
+ * limit. returns NULL if there's nothing to enforce */
+amber_memory amber_memory_start(JSContext *cx, size_t max_heap) {
+    amber_memory mem;
+
+    if(max_heap == 0)
+        return NULL;
+
+    if((mem = (amber_memory) calloc(1, sizeof(struct amber_memory_st))) == NULL)
+        return NULL;
+
+    mem->cx = cx;
+    mem->max = max_heap;
+    mem->state = AMBER_MEMORY_OK;
+
+    mem->prev = amber_memory_current;
+    amber_memory_current = mem;
+
+    mem->old_branch = JS_SetBranchCallback(cx, amber_memory_branch);
+
+    return mem;
+}
+
+/* stop enforcing. says whether the budget was blown: AMBER_MEMORY_LIMIT if
+ * the script was warned, AMBER_MEMORY_KILLED if it had to be stopped. this
+ * and the watchdog both chain the branch callback, so stop them in the
+ * reverse of the order they were started */
+int amber_memory_stop(amber_memory mem) {
+    int ret;
+
+    if(mem == NULL)
+        return 0;
+
+    JS_SetBranchCallback(mem->cx, mem->old_branch);
+    amber_memory_current = mem->prev;
+
+    ret = mem->state == AMBER_MEMORY_KILL ? AMBER_MEMORY_KILLED :
+          mem->state == AMBER_MEMORY_WARN ? AMBER_MEMORY_LIMIT : 0;
+
+    free(mem);
+
+    return ret;
+}
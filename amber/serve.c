@@ -0,0 +1,280 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "internal.h"
+#include "serve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+extern char **environ;
+
+/* pull a request off the connection, with the client's stdio attached */
+static char *amber_serve_recv(int conn, amber_serve_request *req, int *fds) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(sizeof(int) * 3)];
+    char *data;
+    int len, pos;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = req;
+    iov.iov_len = sizeof(amber_serve_request);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    if(recvmsg(conn, &msg, MSG_WAITALL) != sizeof(amber_serve_request))
+        return NULL;
+
+    if((cmsg = CMSG_FIRSTHDR(&msg)) == NULL ||
+       cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3))
+        return NULL;
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+
+    if(req->magic != AMBER_SERVE_MAGIC || req->len == 0 || req->len > AMBER_SERVE_MAX)
+        return NULL;
+
+    if((data = (char *) malloc(req->len)) == NULL)
+        return NULL;
+    for(pos = 0; pos < req->len; pos += len)
+        if((len = read(conn, &data[pos], req->len - pos)) <= 0) {
+            free(data);
+            return NULL;
+        }
+
+    return data;
+}
+
+/* split the string block into cwd, argv and a fresh environment */
+static char **amber_serve_strings(amber_serve_request *req, char *data) {
+    char **strings, *c;
+    int i, n;
+
+    if(data[req->len - 1] != '\0')
+        return NULL;
+
+    /* every string takes at least its nul, so there can't be more of them
+     * than there are bytes */
+    if((uint64_t) 1 + req->argc + req->envc > req->len)
+        return NULL;
+
+    n = 1 + req->argc + req->envc;
+    if((strings = (char **) malloc(sizeof(char *) * (n + 1))) == NULL)
+        return NULL;
+
+    for(i = 0, c = data; i < n; i++) {
+        if(c >= data + req->len) {
+            free(strings);
+            return NULL;
+        }
+        strings[i] = c;
+        c = strchr(c, '\0') + 1;
+    }
+    strings[n] = NULL;
+
+    return strings;
+}
+
+/* runs in the forked child, against a copy of the warm global */
+static int amber_serve_run(JSContext *cx, JSObject *amber, int conn) {
+    amber_serve_request req;
+    struct amber_run_st run;
+    char *data, **strings, *filename, *pretty, *script = NULL;
+    int fds[3], scriptlen, i;
+    amber_watchdog wd;
+    amber_memory mem;
+    int32_t code;
+    jsval rval;
+
+    if((data = amber_serve_recv(conn, &req, fds)) == NULL ||
+       req.argc == 0 ||
+       (strings = amber_serve_strings(&req, data)) == NULL)
+        return AMBER_EXIT_ARGS;
+
+    /* take over the client's stdio */
+    for(i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        if(fds[i] > 2)
+            close(fds[i]);
+    }
+
+    if(chdir(strings[0]) < 0) {
+        fprintf(stderr, "Unable to change to '%s': %s\n", strings[0], strerror(errno));
+        code = AMBER_EXIT_ARGS;
+        goto done;
+    }
+
+    environ = &strings[1 + req.argc];
+
+    if(strcmp(strings[1], "-") == 0) {
+        pretty = "(stdin)";
+        filename = NULL;
+    }
+
+    else
+        pretty = filename = strings[1];
+
+    if(amber_load_script(filename, &script, &scriptlen) < 0) {
+        fprintf(stderr, "Unable to read '%s': %s\n", pretty, strerror(errno));
+        code = AMBER_EXIT_SCRIPT;
+        goto done;
+    }
+
+    run.exited = 0;
+    run.exit_code = AMBER_EXIT_OK;
+    run.out = NULL;
+    JS_SetPrivate(cx, amber, &run);
+
+    if(amber_global_arguments(cx, amber, req.argc - 1, &strings[2]) == JS_FALSE) {
+        code = AMBER_EXIT_INIT;
+        goto done;
+    }
+
+    wd = amber_watchdog_start(cx, amber_limit_cpu, amber_limit_wall);
+    mem = amber_memory_start(cx, amber_limit_heap);
+
+    code = AMBER_EXIT_OK;
+    if(scriptlen > 0 && JS_EvaluateScript(cx, amber, script, scriptlen, pretty, 1, &rval) == JS_FALSE)
+        code = AMBER_EXIT_RUN;
+
+    if(run.exited)
+        code = run.exit_code;
+
+    if(amber_memory_stop(mem) != 0)
+        code = AMBER_EXIT_MEMORY;
+    if(amber_watchdog_stop(wd) != 0)
+        code = AMBER_EXIT_LIMIT;
+
+done:
+    fflush(stdout);
+    fflush(stderr);
+
+    write(conn, &code, sizeof(code));
+
+    return code;
+}
+
+int amber_serve(JSContext *cx, JSObject *amber, char *path) {
+    struct sockaddr_un sun;
+    struct ucred cred;
+    struct stat st;
+    socklen_t credlen;
+    int listener, conn, ret;
+    mode_t mask;
+    pid_t pid;
+
+    if(strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", path);
+        return AMBER_EXIT_ARGS;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    /* only a socket left over from an earlier server gets cleared away */
+    if(lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Unable to listen on '%s': it exists and isn't a socket\n", path);
+            return AMBER_EXIT_ARGS;
+        }
+        unlink(path);
+    }
+    else if(errno != ENOENT) {
+        fprintf(stderr, "Unable to listen on '%s': %s\n", path, strerror(errno));
+        return AMBER_EXIT_INIT;
+    }
+
+    /* anyone who can connect can run code as us, so the socket is ours
+     * alone, and connections from anyone else are turned away below */
+    mask = umask(077);
+
+    if((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+       bind(listener, (struct sockaddr *) &sun, sizeof(sun)) < 0 ||
+       listen(listener, 64) < 0) {
+        fprintf(stderr, "Unable to listen on '%s': %s\n", path, strerror(errno));
+        umask(mask);
+        return AMBER_EXIT_INIT;
+    }
+
+    umask(mask);
+
+    /* children report to their client directly, nobody needs to reap them */
+    signal(SIGCHLD, SIG_IGN);
+
+    for(;;) {
+        if((conn = accept(listener, NULL, NULL)) < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "Unable to accept on '%s': %s\n", path, strerror(errno));
+            return AMBER_EXIT_RUN;
+        }
+
+        credlen = sizeof(cred);
+        if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0) {
+            fprintf(stderr, "Unable to check client on '%s': %s\n", path, strerror(errno));
+            close(conn);
+            continue;
+        }
+        if(cred.uid != geteuid()) {
+            fprintf(stderr, "Refusing client on '%s' with uid %d\n", path, (int) cred.uid);
+            close(conn);
+            continue;
+        }
+
+        /* anything buffered now would come out once per child */
+        fflush(NULL);
+
+        pid = fork();
+        if(pid == 0) {
+            /* scripts run here can start and wait for their own children */
+            signal(SIGCHLD, SIG_DFL);
+            close(listener);
+
+            ret = amber_serve_run(cx, amber, conn);
+
+            /* _exit won't flush stdio for us, and whatever the script
+             * printed is still sitting in there */
+            fflush(NULL);
+            _exit(ret);
+        }
+
+        if(pid < 0)
+            fprintf(stderr, "Unable to fork for request: %s\n", strerror(errno));
+
+        close(conn);
+    }
+}
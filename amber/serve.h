@@ -0,0 +1,46 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#ifndef AMBER_SERVE_H
+#define AMBER_SERVE_H 1
+
+#include <stdint.h>
+
+/*
+ * wire protocol between amberc and a server started with amber --serve.
+ *
+ * the client sends a request header with its stdin, stdout and stderr
+ * attached as SCM_RIGHTS, followed by len bytes of nul-terminated strings:
+ * the working directory, argc arguments (script first, "-" for stdin) and
+ * envc environment entries. the server answers with the exit code as a
+ * single int32_t, or just closes the connection if the run died.
+ */
+
+#define AMBER_SERVE_MAGIC   (0x616d6272)
+#define AMBER_SERVE_MAX     (1024 * 1024)
+
+typedef struct amber_serve_request_st {
+    uint32_t    magic;
+    uint32_t    argc;
+    uint32_t    envc;
+    uint32_t    len;
+} amber_serve_request;
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * amber - a Javascript hosting environment for the command line
+ * Copyright (c) 2005 Robert Norris
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA02111-1307USA
+ */
+
+
+#include "config.h"
+
+#include "amber.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+/* how long a script gets to clean up after being told it's over the limit */
+#define AMBER_WATCHDOG_GRACE    (1.0)
+
+/* longest we sleep at once, however far off the limits are */
+#define AMBER_WATCHDOG_MAXWAIT  (3600.0)
+
+typedef enum amber_watchdog_state {
+    AMBER_WATCHDOG_OK,
+    AMBER_WATCHDOG_WARN,
+    AMBER_WATCHDOG_KILL
+} amber_watchdog_state;
+
+struct amber_watchdog_st {
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+    pthread_t               t;
+    int                     stop;
+
+    JSContext               *cx;
+    JSBranchCallback        old_branch;
+    amber_watchdog          prev;
+
+    clockid_t               cpu;
+    double                  max_cpu, max_wall;
+    double                  start_wall, start_cpu, warn_wall;
+
+    volatile amber_watchdog_state state;
+    const char              *why;
+    int                     thrown;
+};
+
+/* process defaults, from --max-cpu and --max-wall */
+double amber_limit_cpu = 0, amber_limit_wall = 0;
+
+/* the watchdog for whatever this thread is running. the branch callback
+ * looks here so it doesn't have to take any locks */
+static __thread amber_watchdog amber_watchdog_current = NULL;
+
+static double amber_watchdog_clock(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * called by the engine on every backward branch. first time over the limit
+ * gets an AmberError the script can catch to tidy up. if it's still going
+ * after the grace period it gets stopped with no exception, which nothing
+ * can catch
+ */
+static JSBool amber_watchdog_branch(JSContext *cx, JSScript *script) {
+    amber_watchdog wd = amber_watchdog_current;
+
+    if(wd == NULL || wd->cx != cx || wd->state == AMBER_WATCHDOG_OK)
+        return wd != NULL && wd->old_branch != NULL ? wd->old_branch(cx, script) : JS_TRUE;
+
+    if(wd->state == AMBER_WATCHDOG_KILL) {
+        JS_ClearPendingException(cx);
+        return JS_FALSE;
+    }
+
+    if(!wd->thrown) {
+        wd->thrown = 1;
+        return amber_exception_throw(cx, "%s time limit of %gs exceeded", wd->why,
+                                     wd->why[0] == 'c' ? wd->max_cpu : wd->max_wall);
+    }
+
+    /* the script gets its grace period, and so does whoever hooked in before us */
+    return wd->old_branch != NULL ? wd->old_branch(cx, script) : JS_TRUE;
+}
+
+static void *amber_watchdog_run(void *arg) {
+    amber_watchdog wd = (amber_watchdog) arg;
+    double wall, cpu, wait, left;
+    struct timespec ts;
+
+    pthread_mutex_lock(&wd->mutex);
+
+    while(!wd->stop && wd->state != AMBER_WATCHDOG_KILL) {
+        wall = amber_watchdog_clock(CLOCK_MONOTONIC) - wd->start_wall;
+        cpu = amber_watchdog_clock(wd->cpu) - wd->start_cpu;
+
+        if(wd->state == AMBER_WATCHDOG_OK) {
+            if(wd->max_cpu > 0 && cpu >= wd->max_cpu)
+                wd->why = "cpu";
+            else if(wd->max_wall > 0 && wall >= wd->max_wall)
+                wd->why = "wall";
+
+            if(wd->why != NULL) {
+                wd->warn_wall = wall;
+                wd->state = AMBER_WATCHDOG_WARN;
+            }
+        }
+
+        else if(wall - wd->warn_wall >= AMBER_WATCHDOG_GRACE) {
+            wd->state = AMBER_WATCHDOG_KILL;
+            break;
+        }
+
+        /* sleep until the soonest anything could have run out. cpu time
+         * can't go faster than the clock on the wall */
+        if(wd->state == AMBER_WATCHDOG_WARN)
+            wait = AMBER_WATCHDOG_GRACE - (wall - wd->warn_wall);
+        else {
+            wait = -1;
+            if(wd->max_cpu > 0)
+                wait = wd->max_cpu - cpu;
+            if(wd->max_wall > 0 && ((left = wd->max_wall - wall) < wait || wait < 0))
+                wait = left;
+        }
+        if(wait < 0.01)
+            wait = 0.01;
+        /* a huge limit mustn't overflow the deadline. waking up early just
+         * means going round again */
+        if(wait > AMBER_WATCHDOG_MAXWAIT)
+            wait = AMBER_WATCHDOG_MAXWAIT;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += (time_t) wait;
+        ts.tv_nsec += (long) ((wait - (time_t) wait) * 1e9);
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&wd->cond, &wd->mutex, &ts);
+    }
+
+    pthread_mutex_unlock(&wd->mutex);
+
+    return NULL;
+}
+
+/* start watching the calling thread's run on cx. limits are in seconds, zero
+ * for none. returns NULL if there's nothing to watch or it couldn't start */
+amber_watchdog amber_watchdog_start(JSContext *cx, double max_cpu, double max_wall) {
+    amber_watchdog wd;
+    pthread_condattr_t attr;
+
+    if(max_cpu <= 0 && max_wall <= 0)
+        return NULL;
+
+    if((wd = (amber_watchdog) calloc(1, sizeof(struct amber_watchdog_st))) == NULL)
+        return NULL;
+
+    if(pthread_getcpuclockid(pthread_self(), &wd->cpu) != 0) {
+        free(wd);
+        return NULL;
+    }
+
+    wd->cx = cx;
+    wd->max_cpu = max_cpu;
+    wd->max_wall = max_wall;
+    /* the thread may have been busy before this run, so both limits count
+     * from now */
+    wd->start_wall = amber_watchdog_clock(CLOCK_MONOTONIC);
+    wd->start_cpu = amber_watchdog_clock(wd->cpu);
+    wd->state = AMBER_WATCHDOG_OK;
+
+    pthread_mutex_init(&wd->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wd->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&wd->t, NULL, amber_watchdog_run, wd) != 0) {
+        pthread_cond_destroy(&wd->cond);
+        pthread_mutex_destroy(&wd->mutex);
+        free(wd);
+        return NULL;
+    }
+
+    wd->prev = amber_watchdog_current;
+    amber_watchdog_current = wd;
+
+    wd->old_branch = JS_SetBranchCallback(cx, amber_watchdog_branch);
+
+    return wd;
+}
+
+/* stop watching. says whether the limit was hit: AMBER_WATCHDOG_LIMIT if
+ * the script was warned, AMBER_WATCHDOG_KILLED if it had to be stopped */
+int amber_watchdog_stop(amber_watchdog wd) {
+    int ret;
+
+    if(wd == NULL)
+        return 0;
+
+    pthread_mutex_lock(&wd->mutex);
+    wd->stop = 1;
+    pthread_cond_signal(&wd->cond);
+    pthread_mutex_unlock(&wd->mutex);
+
+    pthread_join(wd->t, NULL);
+
+    JS_SetBranchCallback(wd->cx, wd->old_branch);
+    amber_watchdog_current = wd->prev;
+
+    ret = wd->state == AMBER_WATCHDOG_KILL ? AMBER_WATCHDOG_KILLED :
+          wd->state == AMBER_WATCHDOG_WARN ? AMBER_WATCHDOG_LIMIT : 0;
+
+    pthread_cond_destroy(&wd->cond);
+    pthread_mutex_destroy(&wd->mutex);
+    free(wd);
+
+    return ret;
+}
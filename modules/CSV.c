@@ -0,0 +1,745 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <jsapi.h>
+
+#define CSV_BUFSIZE     (256 * 1024)
+#define CSV_BATCH       (1024)
+
+/* the File we're working on lives here so it can't be collected under us */
+#define CSV_SLOT_FILE   (0)
+
+typedef struct csv_reader_st {
+    FILE        *f;
+    int         own;
+    char        delim;
+    char        quote;
+    char        *buf;
+    size_t      size;
+    size_t      len;
+    size_t      pos;
+    int         eof;
+    int         *map;
+    int         nmap;
+    char        *field;
+    size_t      fieldsize;
+} *csv_reader;
+
+typedef struct csv_writer_st {
+    FILE        *f;
+    int         own;
+    char        delim;
+    char        quote;
+    char        *buf;
+    size_t      len;
+} *csv_writer;
+
+/* find the next delimiter or line end. this is where the time goes */
+static const char *csv_scan(const char *p, const char *end, char delim) {
+#if defined(__AVX2__)
+    __m256i wd = _mm256_set1_epi8(delim), wn = _mm256_set1_epi8('\n'), wr = _mm256_set1_epi8('\r');
+    __m256i wx;
+    unsigned int wm;
+
+    while(end - p >= 32) {
+        wx = _mm256_loadu_si256((const __m256i *) p);
+        wm = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(wx, wd), _mm256_cmpeq_epi8(wx, wn)), _mm256_cmpeq_epi8(wx, wr)));
+        if(wm != 0)
+            return p + __builtin_ctz(wm);
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i vd = _mm_set1_epi8(delim), vn = _mm_set1_epi8('\n'), vr = _mm_set1_epi8('\r');
+    __m128i vx;
+    unsigned int vm;
+
+    while(end - p >= 16) {
+        vx = _mm_loadu_si128((const __m128i *) p);
+        vm = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(vx, vd), _mm_cmpeq_epi8(vx, vn)), _mm_cmpeq_epi8(vx, vr)));
+        if(vm != 0)
+            return p + __builtin_ctz(vm);
+        p += 16;
+    }
+#endif
+
+    for(; p < end; p++)
+        if(*p == delim || *p == '\n' || *p == '\r')
+            return p;
+
+    return end;
+}
+
+/* pick up the File or filename we were handed */
+static FILE *csv_stream(JSContext *cx, JSObject *obj, jsval v, char *mode, int *own) {
+    JSString *str;
+    char *name;
+    FILE *f;
+
+    if((f = amber_file_stream(cx, v)) != NULL) {
+        JS_SetReservedSlot(cx, obj, CSV_SLOT_FILE, v);
+        *own = 0;
+        return f;
+    }
+
+    if(!JSVAL_IS_STRING(v))
+        return NULL;
+
+    str = JSVAL_TO_STRING(v);
+    name = JS_GetStringBytes(str);
+
+    if((f = fopen(name, mode)) == NULL)
+        return NULL;
+
+    *own = 1;
+    return f;
+}
+
+/* delimiter and quote from the options object */
+static JSBool csv_options(JSContext *cx, JSObject *opts, char *delim, char *quote) {
+    JSString *str;
+    jsval v;
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    if(JS_GetProperty(cx, opts, "delimiter", &v) == JS_FALSE)
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        ASSERT_THROW((str = JS_ValueToString(cx, v)) == NULL || JS_GetStringLength(str) != 1,
+                     "delimiter must be a single character");
+        *delim = JS_GetStringBytes(str)[0];
+    }
+
+    if(JS_GetProperty(cx, opts, "quote", &v) == JS_FALSE)
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        ASSERT_THROW((str = JS_ValueToString(cx, v)) == NULL || JS_GetStringLength(str) != 1,
+                     "quote must be a single character");
+        *quote = JS_GetStringBytes(str)[0];
+    }
+
+    ASSERT_THROW(*delim == *quote || *delim == '\n' || *delim == '\r',
+                 "delimiter can't be a quote or line end");
+
+    return JS_TRUE;
+}
+
+/* move what's left to the front and top the buffer up */
+static void csv_fill(csv_reader r) {
+    size_t n;
+
+    if(r->eof)
+        return;
+
+    if(r->pos > 0) {
+        memmove(r->buf, &r->buf[r->pos], r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+
+    /* a row bigger than the buffer gets a bigger buffer */
+    if(r->len == r->size) {
+        r->size *= 2;
+        r->buf = (char *) realloc(r->buf, r->size);
+    }
+
+    n = fread(&r->buf[r->len], sizeof(char), r->size - r->len, r->f);
+    r->len += n;
+
+    if(n == 0)
+        r->eof = 1;
+}
+
+static char *csv_field_grow(csv_reader r, size_t want) {
+    if(r->fieldsize < want) {
+        while(r->fieldsize < want)
+            r->fieldsize *= 2;
+        r->field = (char *) realloc(r->field, r->fieldsize);
+    }
+
+    return r->field;
+}
+
+/*
+ * parse one row from the buffer into row. returns 1 for a row, 0 at the
+ * end of the input and -1 if the row runs off the end of the buffer and
+ * needs a refill first. -2 is a js failure, -3 a quote left open at eof.
+ */
+static int csv_row(JSContext *cx, csv_reader r, JSObject *row) {
+    const char *p = &r->buf[r->pos], *end = &r->buf[r->len], *c, *q;
+    char *out;
+    size_t flen;
+    int col = 0, want;
+    jsval v;
+
+    if(p == end)
+        return r->eof ? 0 : -1;
+
+    for(;;) {
+        want = col < r->nmap ? r->map[col] : (r->map == NULL ? col : -1);
+
+        /* quoted field, quotes inside are doubled */
+        if(p < end && *p == r->quote) {
+            p++;
+            flen = 0;
+            for(;;) {
+                if((q = memchr(p, r->quote, end - p)) == NULL)
+                    return r->eof ? -3 : -1;
+
+                if(want >= 0) {
+                    out = csv_field_grow(r, flen + (q - p) + 1);
+                    memcpy(&out[flen], p, q - p);
+                }
+                flen += q - p;
+
+                if(q + 1 == end && !r->eof)
+                    return -1;
+
+                if(q + 1 < end && q[1] == r->quote) {
+                    if(want >= 0)
+                        r->field[flen] = r->quote;
+                    flen++;
+                    p = q + 2;
+                    continue;
+                }
+
+                p = q + 1;
+                break;
+            }
+
+            /* anything between the closing quote and the delimiter tags along */
+            c = csv_scan(p, end, r->delim);
+            if(c == end && !r->eof)
+                return -1;
+            if(want >= 0 && c > p) {
+                out = csv_field_grow(r, flen + (c - p) + 1);
+                memcpy(&out[flen], p, c - p);
+            }
+            flen += c - p;
+
+            if(want >= 0) {
+                v = STRING_TO_JSVAL(JS_NewStringCopyN(cx, r->field, flen));
+                if(JS_SetElement(cx, row, want, &v) == JS_FALSE)
+                    return -2;
+            }
+        }
+
+        else {
+            c = csv_scan(p, end, r->delim);
+            if(c == end && !r->eof)
+                return -1;
+
+            if(want >= 0) {
+                v = STRING_TO_JSVAL(JS_NewStringCopyN(cx, p, c - p));
+                if(JS_SetElement(cx, row, want, &v) == JS_FALSE)
+                    return -2;
+            }
+        }
+
+        col++;
+
+        if(c == end) {
+            r->pos = r->len;
+            return 1;
+        }
+
+        if(*c == r->delim) {
+            p = c + 1;
+            continue;
+        }
+
+        /* line end, \r\n counts as one */
+        if(*c == '\r') {
+            if(c + 1 == end && !r->eof)
+                return -1;
+            if(c + 1 < end && c[1] == '\n')
+                c++;
+        }
+
+        r->pos = c + 1 - r->buf;
+        return 1;
+    }
+}
+
+static JSBool csv_reader_rows(JSContext *cx, JSObject *obj, csv_reader r, jsint want, jsval *rval) {
+    JSObject *rows, *row;
+    jsval v;
+    jsint n = 0;
+    int ret;
+
+    if((rows = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(rows);
+
+    while(n < want) {
+        if((row = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+            return JS_FALSE;
+
+        v = OBJECT_TO_JSVAL(row);
+        if(JS_SetElement(cx, rows, n, &v) == JS_FALSE)
+            return JS_FALSE;
+
+        ret = csv_row(cx, r, row);
+
+        /* the buffer either grows or hits eof, so this always gets somewhere */
+        if(ret == -1) {
+            csv_fill(r);
+            continue;
+        }
+
+        if(ret == -2)
+            return JS_FALSE;
+        ASSERT_THROW(ret == -3, "unterminated quoted field at end of input");
+
+        if(ret == 0) {
+            JS_SetArrayLength(cx, rows, n);
+            break;
+        }
+
+        n++;
+    }
+
+    ASSERT_THROW(ferror(r->f), "read error");
+
+    if(n == 0)
+        *rval = JSVAL_NULL;
+
+    return JS_TRUE;
+}
+
+static JSBool csv_reader_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_reader r;
+    int32 want = CSV_BATCH;
+
+    if((r = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    if(argc > 0)
+        ASSERT_THROW(JS_ValueToInt32(cx, argv[0], &want) == JS_FALSE || want <= 0,
+                     "batch size must be a positive integer");
+
+    return csv_reader_rows(cx, obj, r, want, rval);
+}
+
+static JSBool csv_reader_readrow(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_reader r;
+
+    if((r = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    if(csv_reader_rows(cx, obj, r, 1, rval) == JS_FALSE)
+        return JS_FALSE;
+
+    if(!JSVAL_IS_NULL(*rval))
+        return JS_GetElement(cx, JSVAL_TO_OBJECT(*rval), 0, rval);
+
+    return JS_TRUE;
+}
+
+static void csv_reader_free(JSContext *cx, csv_reader r) {
+    if(r->own && r->f != NULL)
+        fclose(r->f);
+    free(r->buf);
+    free(r->field);
+    if(r->map != NULL)
+        free(r->map);
+    JS_free(cx, r);
+}
+
+static JSBool csv_reader_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_reader r;
+
+    if((r = JS_GetPrivate(cx, obj)) != NULL) {
+        csv_reader_free(cx, r);
+        JS_SetPrivate(cx, obj, NULL);
+    }
+
+    JS_SetReservedSlot(cx, obj, CSV_SLOT_FILE, JSVAL_VOID);
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec csv_reader_methods[] = {
+    { "read",       csv_reader_read,    1, 0 },
+    { "readRow",    csv_reader_readrow, 0, 0 },
+    { "close",      csv_reader_close,   0, 0 },
+    { NULL }
+};
+
+enum csv_reader_tinyid {
+    CSV_READER_EOF
+};
+
+static JSPropertySpec csv_reader_properties[] = {
+    { "eof",    CSV_READER_EOF, JSPROP_ENUMERATE | JSPROP_READONLY },
+    { NULL }
+};
+
+/* column projection, so we never build the fields nobody asked for */
+static JSBool csv_reader_columns(JSContext *cx, csv_reader r, JSObject *opts) {
+    JSObject *cols;
+    jsuint i, len;
+    int32 col;
+    int *map;
+    jsval v;
+
+    if(JS_GetProperty(cx, opts, "columns", &v) == JS_FALSE)
+        return JS_FALSE;
+    if(JSVAL_IS_VOID(v) || JSVAL_IS_NULL(v))
+        return JS_TRUE;
+
+    ASSERT_THROW(!JSVAL_IS_OBJECT(v) || !JS_IsArrayObject(cx, cols = JSVAL_TO_OBJECT(v)),
+                 "columns must be an array of column numbers");
+
+    JS_GetArrayLength(cx, cols, &len);
+
+    for(i = 0; i < len; i++) {
+        if(JS_GetElement(cx, cols, i, &v) == JS_FALSE)
+            return JS_FALSE;
+        ASSERT_THROW(JS_ValueToInt32(cx, v, &col) == JS_FALSE || col < 0 || col > 65535,
+                     "column numbers must be integers from 0");
+
+        if(col >= r->nmap) {
+            ASSERT_THROW((map = (int *) realloc(r->map, sizeof(int) * (col + 1))) == NULL, "out of memory");
+            r->map = map;
+            for(; r->nmap <= col; r->nmap++)
+                r->map[r->nmap] = -1;
+        }
+
+        r->map[col] = i;
+    }
+
+    /* nothing selected still means nothing, not everything */
+    if(r->map == NULL) {
+        ASSERT_THROW((r->map = (int *) malloc(sizeof(int))) == NULL, "out of memory");
+        r->map[0] = -1;
+        r->nmap = 0;
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool csv_reader_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_reader r;
+    JSObject *opts = NULL;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc == 0, "no file specified");
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if((r = JS_malloc(cx, sizeof(struct csv_reader_st))) == NULL)
+        return JS_FALSE;
+    memset(r, 0, sizeof(struct csv_reader_st));
+
+    r->delim = ',';
+    r->quote = '"';
+
+    if(csv_options(cx, opts, &r->delim, &r->quote) == JS_FALSE ||
+       (opts != NULL && csv_reader_columns(cx, r, opts) == JS_FALSE)) {
+        csv_reader_free(cx, r);
+        return JS_FALSE;
+    }
+
+    if((r->f = csv_stream(cx, obj, argv[0], "r", &r->own)) == NULL) {
+        csv_reader_free(cx, r);
+        THROW("couldn't open file for reading: %s", JSVAL_IS_STRING(argv[0]) ? strerror(errno) : "not a File or filename");
+    }
+
+    r->size = CSV_BUFSIZE;
+    r->buf = (char *) malloc(r->size);
+    r->fieldsize = 1024;
+    r->field = (char *) malloc(r->fieldsize);
+    if(r->buf == NULL || r->field == NULL) {
+        csv_reader_free(cx, r);
+        THROW("out of memory");
+    }
+
+    JS_SetPrivate(cx, obj, r);
+
+    return JS_TRUE;
+}
+
+static JSBool csv_reader_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    csv_reader r;
+
+    if((r = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case CSV_READER_EOF:
+            *vp = BOOLEAN_TO_JSVAL(r->eof && r->pos == r->len);
+            break;
+    }
+
+    return JS_TRUE;
+}
+
+static void csv_reader_finalize(JSContext *cx, JSObject *obj) {
+    csv_reader r;
+
+    if((r = JS_GetPrivate(cx, obj)) != NULL) {
+        csv_reader_free(cx, r);
+        JS_SetPrivate(cx, obj, NULL);
+    }
+}
+
+static JSClass csv_reader_class = {
+    "CSVReader", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, csv_reader_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, csv_reader_finalize
+};
+
+static int csv_writer_flush_buf(csv_writer w) {
+    if(w->len > 0) {
+        fwrite(w->buf, sizeof(char), w->len, w->f);
+        w->len = 0;
+    }
+
+    return ferror(w->f) ? -1 : 0;
+}
+
+static void csv_writer_put(csv_writer w, const char *data, size_t len) {
+    if(w->len + len > CSV_BUFSIZE) {
+        csv_writer_flush_buf(w);
+
+        /* too big to be worth buffering */
+        if(len > CSV_BUFSIZE) {
+            fwrite(data, sizeof(char), len, w->f);
+            return;
+        }
+    }
+
+    memcpy(&w->buf[w->len], data, len);
+    w->len += len;
+}
+
+static void csv_writer_field(csv_writer w, const char *data, size_t len) {
+    const char *end = data + len, *q;
+
+    /* only quote if we have to */
+    if(csv_scan(data, end, w->delim) == end && memchr(data, w->quote, len) == NULL) {
+        csv_writer_put(w, data, len);
+        return;
+    }
+
+    csv_writer_put(w, &w->quote, 1);
+    while((q = memchr(data, w->quote, end - data)) != NULL) {
+        csv_writer_put(w, data, q - data + 1);
+        csv_writer_put(w, &w->quote, 1);
+        data = q + 1;
+    }
+    csv_writer_put(w, data, end - data);
+    csv_writer_put(w, &w->quote, 1);
+}
+
+static JSBool csv_writer_row(JSContext *cx, csv_writer w, jsval rowval) {
+    JSObject *row;
+    JSString *str;
+    jsuint i, len;
+    jsval v;
+
+    ASSERT_THROW(!JSVAL_IS_OBJECT(rowval) || JSVAL_IS_NULL(rowval) || !JS_IsArrayObject(cx, row = JSVAL_TO_OBJECT(rowval)),
+                 "row must be an array");
+
+    JS_GetArrayLength(cx, row, &len);
+
+    for(i = 0; i < len; i++) {
+        if(i > 0)
+            csv_writer_put(w, &w->delim, 1);
+
+        if(JS_GetElement(cx, row, i, &v) == JS_FALSE)
+            return JS_FALSE;
+        if(JSVAL_IS_VOID(v) || JSVAL_IS_NULL(v))
+            continue;
+
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            THROW("couldn't convert field to string");
+
+        csv_writer_field(w, JS_GetStringBytes(str), JS_GetStringLength(str));
+    }
+
+    csv_writer_put(w, "\n", 1);
+
+    return JS_TRUE;
+}
+
+/* a File we were handed may be finalized before we are, so we can't flush
+ * into it from our finalizer. hand each call's rows over to its stream
+ * instead, and the File writes them out however it ends up closed */
+static JSBool csv_writer_done(JSContext *cx, csv_writer w, JSBool ok) {
+    if(!w->own && csv_writer_flush_buf(w) < 0 && ok)
+        THROW("write error");
+
+    return ok;
+}
+
+static JSBool csv_writer_write(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_writer w;
+    uintN i;
+
+    ASSERT_THROW((w = JS_GetPrivate(cx, obj)) == NULL, "writer is closed");
+
+    for(i = 0; i < argc; i++)
+        if(csv_writer_row(cx, w, argv[i]) == JS_FALSE)
+            return csv_writer_done(cx, w, JS_FALSE);
+
+    return csv_writer_done(cx, w, JS_TRUE);
+}
+
+static JSBool csv_writer_writerows(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_writer w;
+    JSObject *rows;
+    jsuint i, len;
+    jsval v;
+
+    ASSERT_THROW((w = JS_GetPrivate(cx, obj)) == NULL, "writer is closed");
+
+    if(argc == 0)
+        return JS_TRUE;
+
+    ASSERT_THROW(!JSVAL_IS_OBJECT(argv[0]) || JSVAL_IS_NULL(argv[0]) || !JS_IsArrayObject(cx, rows = JSVAL_TO_OBJECT(argv[0])),
+                 "rows must be an array of arrays");
+
+    JS_GetArrayLength(cx, rows, &len);
+
+    for(i = 0; i < len; i++)
+        if(JS_GetElement(cx, rows, i, &v) == JS_FALSE ||
+           csv_writer_row(cx, w, v) == JS_FALSE)
+            return csv_writer_done(cx, w, JS_FALSE);
+
+    return csv_writer_done(cx, w, JS_TRUE);
+}
+
+static JSBool csv_writer_flush(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_writer w;
+
+    if((w = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(csv_writer_flush_buf(w) < 0 || fflush(w->f) != 0, "write error");
+
+    return JS_TRUE;
+}
+
+static JSBool csv_writer_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_writer w;
+    int err;
+
+    if((w = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    err = csv_writer_flush_buf(w) < 0 || fflush(w->f) != 0;
+
+    if(w->own)
+        fclose(w->f);
+    free(w->buf);
+    JS_free(cx, w);
+
+    JS_SetPrivate(cx, obj, NULL);
+    JS_SetReservedSlot(cx, obj, CSV_SLOT_FILE, JSVAL_VOID);
+
+    ASSERT_THROW(err, "write error");
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec csv_writer_methods[] = {
+    { "write",      csv_writer_write,       1, 0 },
+    { "writeRows",  csv_writer_writerows,   1, 0 },
+    { "flush",      csv_writer_flush,       0, 0 },
+    { "close",      csv_writer_close,       0, 0 },
+    { NULL }
+};
+
+static JSBool csv_writer_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    csv_writer w;
+    JSObject *opts = NULL;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc == 0, "no file specified");
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if((w = JS_malloc(cx, sizeof(struct csv_writer_st))) == NULL)
+        return JS_FALSE;
+    memset(w, 0, sizeof(struct csv_writer_st));
+
+    w->delim = ',';
+    w->quote = '"';
+
+    if(csv_options(cx, opts, &w->delim, &w->quote) == JS_FALSE) {
+        JS_free(cx, w);
+        return JS_FALSE;
+    }
+
+    if((w->f = csv_stream(cx, obj, argv[0], "w", &w->own)) == NULL) {
+        JS_free(cx, w);
+        THROW("couldn't open file for writing: %s", JSVAL_IS_STRING(argv[0]) ? strerror(errno) : "not a File or filename");
+    }
+
+    if((w->buf = (char *) malloc(CSV_BUFSIZE)) == NULL) {
+        if(w->own)
+            fclose(w->f);
+        JS_free(cx, w);
+        THROW("out of memory");
+    }
+
+    JS_SetPrivate(cx, obj, w);
+
+    return JS_TRUE;
+}
+
+/* rows for a File we were handed are already in its stream, so only our
+ * own streams need flushing here */
+static void csv_writer_finalize(JSContext *cx, JSObject *obj) {
+    csv_writer w;
+
+    if((w = JS_GetPrivate(cx, obj)) != NULL) {
+        if(w->own) {
+            csv_writer_flush_buf(w);
+            fclose(w->f);
+        }
+        free(w->buf);
+        JS_free(cx, w);
+        JS_SetPrivate(cx, obj, NULL);
+    }
+}
+
+static JSClass csv_writer_class = {
+    "CSVWriter", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, csv_writer_finalize
+};
+
+JSBool CSV(JSContext *cx, JSObject *amber) {
+    JSObject *reader, *writer;
+
+    reader = JS_InitClass(cx, amber, NULL, &csv_reader_class,
+                          csv_reader_constructor, 2,
+                          csv_reader_properties, csv_reader_methods,
+                          NULL, NULL);
+
+    writer = JS_InitClass(cx, amber, NULL, &csv_writer_class,
+                          csv_writer_constructor, 2,
+                          NULL, csv_writer_methods,
+                          NULL, NULL);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,923 @@
+#include "amber/amber.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <jsapi.h>
+
+/*
+ * HashMap, HashSet and Counter share one table. entries live in a dense
+ * array in insertion order and a separate open addressed index of entry
+ * numbers points into it, so probing touches 4 bytes a slot and iterating
+ * never has to skip empty buckets. keys are strings or numbers; anything
+ * else is turned into a string first. 1 and "1" are different keys
+ */
+
+#define COLL_EMPTY      (-1)
+#define COLL_DELETED    (-2)
+#define COLL_MIN        (8)
+
+typedef enum coll_kind {
+    COLL_MAP,
+    COLL_SET,
+    COLL_COUNTER
+} coll_kind;
+
+typedef enum coll_order {
+    COLL_INSERTION,
+    COLL_KEY,
+    COLL_VALUE
+} coll_order;
+
+typedef struct coll_entry {
+    jsval       key;
+    union {
+        jsval       v;
+        jsdouble    n;
+    } u;
+    uint32_t    hash;
+    uint32_t    live;
+} coll_entry;
+
+typedef struct coll_stuff {
+    coll_kind   kind;
+    coll_entry  *entries;
+    uint32_t    used, count, cap;
+    int32_t     *index;
+    uint32_t    mask;
+} *coll_stuff;
+
+static uint32_t coll_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+/* four characters at a time */
+static uint32_t coll_hash_chars(const jschar *s, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n, w;
+
+    for(; n >= 4; s += 4, n -= 4) {
+        memcpy(&w, s, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    for(; n > 0; s++, n--)
+        h = (h ^ *s) * 0xc4ceb9fe1a85ec53ULL;
+
+    return coll_mix(h);
+}
+
+static jsdouble coll_number(jsval v) {
+    return JSVAL_IS_INT(v) ? (jsdouble) JSVAL_TO_INT(v) : *JSVAL_TO_DOUBLE(v);
+}
+
+/* numbers that are whole and small enough become ints, so 1 and 1.0 are
+ * the same key and most number keys don't hold on to a double */
+static JSBool coll_key(JSContext *cx, jsval v, jsval *key, uint32_t *hash) {
+    JSString *str;
+    jsdouble d;
+    uint64_t bits;
+
+    if(JSVAL_IS_INT(v) || JSVAL_IS_DOUBLE(v)) {
+        d = coll_number(v);
+        if(d == 0)
+            d = 0;
+        else if(d != d)
+            d = NAN;
+
+        if(JSVAL_IS_DOUBLE(v) && d >= JSVAL_INT_MIN && d <= JSVAL_INT_MAX && d == (jsdouble) (jsint) d)
+            v = INT_TO_JSVAL((jsint) d);
+
+        memcpy(&bits, &d, sizeof(bits));
+        *key = v;
+        *hash = coll_mix(bits ^ 0x5bd1e995ULL);
+        return JS_TRUE;
+    }
+
+    if(JSVAL_IS_STRING(v))
+        str = JSVAL_TO_STRING(v);
+    else if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+
+    *key = STRING_TO_JSVAL(str);
+    *hash = coll_hash_chars(JS_GetStringChars(str), JS_GetStringLength(str));
+    return JS_TRUE;
+}
+
+static int coll_key_equal(jsval a, jsval b) {
+    JSString *sa, *sb;
+    size_t len;
+    jsdouble da, db;
+
+    if(a == b)
+        return 1;
+
+    if(JSVAL_IS_STRING(a) != JSVAL_IS_STRING(b))
+        return 0;
+
+    if(JSVAL_IS_STRING(a)) {
+        sa = JSVAL_TO_STRING(a);
+        sb = JSVAL_TO_STRING(b);
+        if((len = JS_GetStringLength(sa)) != JS_GetStringLength(sb))
+            return 0;
+        return memcmp(JS_GetStringChars(sa), JS_GetStringChars(sb), len * sizeof(jschar)) == 0;
+    }
+
+    da = coll_number(a);
+    db = coll_number(b);
+    return da == db || (da != da && db != db);
+}
+
+/* entry number for a key, or -1. *slot is where it is or would go */
+static int32_t coll_find(coll_stuff c, jsval key, uint32_t hash, uint32_t *slot) {
+    uint32_t i, hole = (uint32_t) -1;
+    int32_t e;
+
+    for(i = hash & c->mask; ; i = (i + 1) & c->mask) {
+        if((e = c->index[i]) == COLL_EMPTY)
+            break;
+        if(e == COLL_DELETED) {
+            if(hole == (uint32_t) -1)
+                hole = i;
+            continue;
+        }
+        if(c->entries[e].hash == hash && coll_key_equal(c->entries[e].key, key)) {
+            *slot = i;
+            return e;
+        }
+    }
+
+    *slot = hole != (uint32_t) -1 ? hole : i;
+    return -1;
+}
+
+/* squeeze out deleted entries and lay the index out again at a size that
+ * keeps it at most half full */
+static JSBool coll_rebuild(JSContext *cx, coll_stuff c, uint32_t cap) {
+    coll_entry *entries;
+    int32_t *index;
+    uint32_t size, i, j, slot;
+
+    for(size = COLL_MIN * 2; size < cap * 2; size *= 2)
+        ;
+
+    if(cap != c->cap) {
+        entries = realloc(c->entries, cap * sizeof(coll_entry));
+        ASSERT_THROW(entries == NULL, "out of memory");
+        c->entries = entries;
+        c->cap = cap;
+    }
+
+    if(size != c->mask + 1) {
+        index = malloc(size * sizeof(int32_t));
+        ASSERT_THROW(index == NULL, "out of memory");
+        free(c->index);
+        c->index = index;
+        c->mask = size - 1;
+    }
+    memset(c->index, 0xff, size * sizeof(int32_t));
+
+    for(i = j = 0; i < c->used; i++) {
+        if(!c->entries[i].live)
+            continue;
+        if(i != j)
+            c->entries[j] = c->entries[i];
+
+        for(slot = c->entries[j].hash & c->mask; c->index[slot] != COLL_EMPTY; slot = (slot + 1) & c->mask)
+            ;
+        c->index[slot] = j;
+        j++;
+    }
+    c->used = j;
+
+    return JS_TRUE;
+}
+
+static JSBool coll_reserve_for(JSContext *cx, coll_stuff c, uint32_t want) {
+    uint32_t cap;
+
+    if(want <= c->cap)
+        return JS_TRUE;
+
+    for(cap = c->cap > COLL_MIN ? c->cap : COLL_MIN; cap < want; cap *= 2)
+        ;
+
+    return coll_rebuild(cx, c, cap);
+}
+
+/* entry for a key, adding it if it's not there */
+static JSBool coll_insert(JSContext *cx, coll_stuff c, jsval v, coll_entry **entry, JSBool *created) {
+    uint32_t hash, slot;
+    coll_entry *e;
+    jsval key;
+    int32_t n;
+
+    if(!coll_key(cx, v, &key, &hash))
+        return JS_FALSE;
+
+    if((n = coll_find(c, key, hash, &slot)) >= 0) {
+        *entry = &c->entries[n];
+        *created = JS_FALSE;
+        return JS_TRUE;
+    }
+
+    /* out of room at the end. reuse what deletes left behind if that's at
+     * least half of it, otherwise double */
+    if(c->used == c->cap) {
+        if(!coll_rebuild(cx, c, c->count <= c->cap / 2 ? c->cap : c->cap * 2))
+            return JS_FALSE;
+        coll_find(c, key, hash, &slot);
+    }
+
+    e = &c->entries[c->used];
+    e->key = key;
+    e->hash = hash;
+    e->live = 1;
+    if(c->kind == COLL_COUNTER)
+        e->u.n = 0;
+    else
+        e->u.v = JSVAL_VOID;
+
+    c->index[slot] = c->used++;
+    c->count++;
+
+    *entry = e;
+    *created = JS_TRUE;
+    return JS_TRUE;
+}
+
+static JSBool coll_lookup(JSContext *cx, coll_stuff c, jsval v, coll_entry **entry, uint32_t *slot) {
+    uint32_t hash, s;
+    jsval key;
+    int32_t n;
+
+    *entry = NULL;
+    if(c->count == 0)
+        return JS_TRUE;
+
+    if(!coll_key(cx, v, &key, &hash))
+        return JS_FALSE;
+
+    if((n = coll_find(c, key, hash, &s)) >= 0) {
+        *entry = &c->entries[n];
+        if(slot != NULL)
+            *slot = s;
+    }
+
+    return JS_TRUE;
+}
+
+static void coll_clear(coll_stuff c) {
+    c->used = c->count = 0;
+    if(c->index != NULL)
+        memset(c->index, 0xff, (c->mask + 1) * sizeof(int32_t));
+}
+
+static int coll_compare_keys(const void *a, const void *b) {
+    const coll_entry *ea = *(const coll_entry **) a, *eb = *(const coll_entry **) b;
+    JSString *sa, *sb;
+    const jschar *ca, *cb;
+    size_t la, lb, i;
+    jsdouble da, db;
+
+    /* numbers first, in order, then strings by character */
+    if(!JSVAL_IS_STRING(ea->key) && !JSVAL_IS_STRING(eb->key)) {
+        da = coll_number(ea->key);
+        db = coll_number(eb->key);
+        if(da < db || (da == da && db != db))
+            return -1;
+        if(da > db || (da != da && db == db))
+            return 1;
+        return ea < eb ? -1 : ea > eb;
+    }
+    if(!JSVAL_IS_STRING(ea->key))
+        return -1;
+    if(!JSVAL_IS_STRING(eb->key))
+        return 1;
+
+    sa = JSVAL_TO_STRING(ea->key);
+    sb = JSVAL_TO_STRING(eb->key);
+    ca = JS_GetStringChars(sa);
+    cb = JS_GetStringChars(sb);
+    la = JS_GetStringLength(sa);
+    lb = JS_GetStringLength(sb);
+
+    for(i = 0; i < la && i < lb; i++)
+        if(ca[i] != cb[i])
+            return ca[i] < cb[i] ? -1 : 1;
+
+    return la < lb ? -1 : la > lb;
+}
+
+/* biggest counts first, ties in insertion order */
+static int coll_compare_counts(const void *a, const void *b) {
+    const coll_entry *ea = *(const coll_entry **) a, *eb = *(const coll_entry **) b;
+
+    if(ea->u.n != eb->u.n)
+        return ea->u.n > eb->u.n ? -1 : 1;
+    return ea < eb ? -1 : ea > eb;
+}
+
+static JSBool coll_get_order(JSContext *cx, coll_stuff c, uintN argc, jsval *argv, uintN n, coll_order *order) {
+    JSString *str;
+    char *name;
+
+    *order = COLL_INSERTION;
+    if(argc <= n || JSVAL_IS_VOID(argv[n]))
+        return JS_TRUE;
+
+    if((str = JS_ValueToString(cx, argv[n])) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    if(strcmp(name, "key") == 0)
+        *order = COLL_KEY;
+    else if(strcmp(name, "value") == 0 && c->kind == COLL_COUNTER)
+        *order = COLL_VALUE;
+    else if(strcmp(name, "insertion") != 0)
+        THROW("unknown order '%s'", name);
+
+    return JS_TRUE;
+}
+
+/* live entries in the order asked for */
+static coll_entry **coll_ordered(JSContext *cx, coll_stuff c, coll_order order) {
+    coll_entry **list;
+    uint32_t i, n;
+
+    if((list = malloc((c->count ? c->count : 1) * sizeof(coll_entry *))) == NULL) {
+        amber_exception_throw(cx, "out of memory");
+        return NULL;
+    }
+
+    for(i = n = 0; i < c->used; i++)
+        if(c->entries[i].live)
+            list[n++] = &c->entries[i];
+
+    if(order == COLL_KEY)
+        qsort(list, n, sizeof(coll_entry *), coll_compare_keys);
+    else if(order == COLL_VALUE)
+        qsort(list, n, sizeof(coll_entry *), coll_compare_counts);
+
+    return list;
+}
+
+static JSBool coll_value(JSContext *cx, coll_stuff c, coll_entry *e, jsval *vp) {
+    if(c->kind == COLL_COUNTER)
+        return JS_NewNumberValue(cx, e->u.n, vp);
+
+    *vp = c->kind == COLL_MAP ? e->u.v : e->key;
+    return JS_TRUE;
+}
+
+typedef enum coll_what {
+    COLL_KEYS,
+    COLL_VALUES,
+    COLL_ENTRIES
+} coll_what;
+
+/* keys, values or [key, value] pairs as an array, at most limit of them */
+static JSBool coll_list(JSContext *cx, coll_stuff c, coll_what what, coll_order order, uint32_t limit, jsval *rval) {
+    JSObject *arr, *pair;
+    coll_entry **list;
+    jsval v[2];
+    uint32_t i, n;
+
+    n = c->count < limit ? c->count : limit;
+
+    if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    if((list = coll_ordered(cx, c, order)) == NULL)
+        return JS_FALSE;
+
+    for(i = 0; i < n; i++) {
+        v[0] = list[i]->key;
+        if(what != COLL_KEYS && !coll_value(cx, c, list[i], &v[1]))
+            goto fail;
+
+        if(what == COLL_ENTRIES) {
+            if((pair = JS_NewArrayObject(cx, 2, v)) == NULL)
+                goto fail;
+            v[0] = OBJECT_TO_JSVAL(pair);
+        } else if(what == COLL_VALUES)
+            v[0] = v[1];
+
+        if(!JS_SetElement(cx, arr, i, &v[0]))
+            goto fail;
+    }
+
+    free(list);
+    return JS_TRUE;
+
+fail:
+    free(list);
+    return JS_FALSE;
+}
+
+static JSBool coll_keys(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_order order;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    if(!coll_get_order(cx, c, argc, argv, 0, &order))
+        return JS_FALSE;
+
+    return coll_list(cx, c, COLL_KEYS, order, (uint32_t) -1, rval);
+}
+
+static JSBool coll_values(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_order order;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    if(!coll_get_order(cx, c, argc, argv, 0, &order))
+        return JS_FALSE;
+
+    return coll_list(cx, c, COLL_VALUES, order, (uint32_t) -1, rval);
+}
+
+static JSBool coll_entries(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_order order;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    if(!coll_get_order(cx, c, argc, argv, 0, &order))
+        return JS_FALSE;
+
+    return coll_list(cx, c, COLL_ENTRIES, order, (uint32_t) -1, rval);
+}
+
+/* fun(value, key, collection) for each entry. works from a copy so fun can
+ * change the collection as it goes */
+static JSBool coll_for_each(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    JSObject *arr, *pair;
+    coll_order order;
+    jsval args[3], v, ret;
+    jsuint len, i;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1 || JS_ValueToFunction(cx, argv[0]) == NULL, "forEach needs a function");
+    if(!coll_get_order(cx, c, argc, argv, 1, &order))
+        return JS_FALSE;
+
+    if(!coll_list(cx, c, COLL_ENTRIES, order, (uint32_t) -1, rval))
+        return JS_FALSE;
+    arr = JSVAL_TO_OBJECT(*rval);
+
+    JS_GetArrayLength(cx, arr, &len);
+    args[2] = OBJECT_TO_JSVAL(obj);
+
+    for(i = 0; i < len; i++) {
+        if(!JS_GetElement(cx, arr, i, &v))
+            return JS_FALSE;
+        pair = JSVAL_TO_OBJECT(v);
+        if(!JS_GetElement(cx, pair, 1, &args[0]) || !JS_GetElement(cx, pair, 0, &args[1]))
+            return JS_FALSE;
+        if(!JS_CallFunctionValue(cx, obj, argv[0], 3, args, &ret))
+            return JS_FALSE;
+    }
+
+    *rval = JSVAL_VOID;
+    return JS_TRUE;
+}
+
+static JSBool coll_has(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "has needs a key");
+
+    if(!coll_lookup(cx, c, argv[0], &e, NULL))
+        return JS_FALSE;
+
+    *rval = BOOLEAN_TO_JSVAL(e != NULL);
+    return JS_TRUE;
+}
+
+static JSBool coll_delete(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+    uint32_t slot;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "delete needs a key");
+
+    if(!coll_lookup(cx, c, argv[0], &e, &slot))
+        return JS_FALSE;
+
+    if(e != NULL) {
+        c->index[slot] = COLL_DELETED;
+        e->live = 0;
+        e->key = JSVAL_VOID;
+        e->u.v = JSVAL_VOID;
+        c->count--;
+    }
+
+    *rval = BOOLEAN_TO_JSVAL(e != NULL);
+    return JS_TRUE;
+}
+
+static JSBool coll_clear_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    coll_clear(c);
+
+    return JS_TRUE;
+}
+
+/* make room for this many entries without growing again */
+static JSBool coll_reserve(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    jsdouble d;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1 || !JS_ValueToNumber(cx, argv[0], &d) || d < 0 || d > (1U << 30),
+                 "reserve needs a number of entries");
+
+    return coll_reserve_for(cx, c, c->count + (uint32_t) d);
+}
+
+static JSBool coll_map_get(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "get needs a key");
+
+    if(!coll_lookup(cx, c, argv[0], &e, NULL))
+        return JS_FALSE;
+
+    if(e != NULL)
+        *rval = e->u.v;
+    else
+        *rval = argc > 1 ? argv[1] : JSVAL_VOID;
+
+    return JS_TRUE;
+}
+
+static JSBool coll_map_set(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+    JSBool created;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "set needs a key");
+
+    if(!coll_insert(cx, c, argv[0], &e, &created))
+        return JS_FALSE;
+    e->u.v = argc > 1 ? argv[1] : JSVAL_VOID;
+
+    *rval = OBJECT_TO_JSVAL(obj);
+    return JS_TRUE;
+}
+
+static JSBool coll_array(JSContext *cx, jsval v, JSObject **arr, jsuint *len) {
+    ASSERT_THROW(!JSVAL_IS_OBJECT(v) || JSVAL_IS_NULL(v) || !JS_IsArrayObject(cx, JSVAL_TO_OBJECT(v)),
+                 "expected an array");
+
+    *arr = JSVAL_TO_OBJECT(v);
+    return JS_GetArrayLength(cx, *arr, len);
+}
+
+/* setAll(keys, values) or setAll([[key, value], ...]) */
+static JSBool coll_map_set_all(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    JSObject *keys, *values = NULL, *pair;
+    jsuint len, vlen, i;
+    coll_entry *e;
+    JSBool created;
+    jsval k, v;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "setAll needs an array");
+
+    if(!coll_array(cx, argv[0], &keys, &len))
+        return JS_FALSE;
+    if(argc > 1) {
+        if(!coll_array(cx, argv[1], &values, &vlen))
+            return JS_FALSE;
+        ASSERT_THROW(vlen != len, "keys and values are different lengths");
+    }
+
+    if(!coll_reserve_for(cx, c, c->count + len))
+        return JS_FALSE;
+
+    for(i = 0; i < len; i++) {
+        if(!JS_GetElement(cx, keys, i, &k))
+            return JS_FALSE;
+
+        if(values != NULL) {
+            if(!JS_GetElement(cx, values, i, &v))
+                return JS_FALSE;
+        } else {
+            ASSERT_THROW(!JSVAL_IS_OBJECT(k) || JSVAL_IS_NULL(k), "expected [key, value] pairs");
+            pair = JSVAL_TO_OBJECT(k);
+            if(!JS_GetElement(cx, pair, 0, &k) || !JS_GetElement(cx, pair, 1, &v))
+                return JS_FALSE;
+        }
+
+        /* v came off an array that's still live, so it stays rooted */
+        if(!coll_insert(cx, c, k, &e, &created))
+            return JS_FALSE;
+        e->u.v = v;
+    }
+
+    *rval = OBJECT_TO_JSVAL(obj);
+    return JS_TRUE;
+}
+
+static JSBool coll_set_add(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+    JSBool created;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "add needs a key");
+
+    if(!coll_insert(cx, c, argv[0], &e, &created))
+        return JS_FALSE;
+
+    *rval = BOOLEAN_TO_JSVAL(created);
+    return JS_TRUE;
+}
+
+/* counter.add(key, [n]) returns the new count */
+static JSBool coll_counter_add(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+    JSBool created;
+    jsdouble n = 1;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "add needs a key");
+
+    if(argc > 1 && !JS_ValueToNumber(cx, argv[1], &n))
+        return JS_FALSE;
+
+    if(!coll_insert(cx, c, argv[0], &e, &created))
+        return JS_FALSE;
+    e->u.n += n;
+
+    return JS_NewNumberValue(cx, e->u.n, rval);
+}
+
+static JSBool coll_counter_get(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    coll_entry *e;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "get needs a key");
+
+    if(!coll_lookup(cx, c, argv[0], &e, NULL))
+        return JS_FALSE;
+
+    return JS_NewNumberValue(cx, e != NULL ? e->u.n : 0, rval);
+}
+
+/* addAll(keys) for sets and counters, addAll(keys, counts) for counters */
+static JSBool coll_add_all(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    JSObject *keys, *counts = NULL;
+    jsuint len, clen, i;
+    coll_entry *e;
+    JSBool created;
+    jsdouble n = 1;
+    jsval k, v;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    ASSERT_THROW(argc < 1, "addAll needs an array");
+
+    if(!coll_array(cx, argv[0], &keys, &len))
+        return JS_FALSE;
+    if(argc > 1 && c->kind == COLL_COUNTER) {
+        if(!coll_array(cx, argv[1], &counts, &clen))
+            return JS_FALSE;
+        ASSERT_THROW(clen != len, "keys and counts are different lengths");
+    }
+
+    if(!coll_reserve_for(cx, c, c->count + len))
+        return JS_FALSE;
+
+    for(i = 0; i < len; i++) {
+        if(!JS_GetElement(cx, keys, i, &k))
+            return JS_FALSE;
+        if(counts != NULL && (!JS_GetElement(cx, counts, i, &v) || !JS_ValueToNumber(cx, v, &n)))
+            return JS_FALSE;
+
+        if(!coll_insert(cx, c, k, &e, &created))
+            return JS_FALSE;
+        if(c->kind == COLL_COUNTER)
+            e->u.n += n;
+    }
+
+    *rval = OBJECT_TO_JSVAL(obj);
+    return JS_TRUE;
+}
+
+/* the n biggest counts as [key, count] pairs */
+static JSBool coll_counter_top(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    coll_stuff c = JS_GetPrivate(cx, obj);
+    int32 n = 10;
+
+    ASSERT_THROW(c == NULL, "not a collection");
+    if(argc > 0 && !JS_ValueToInt32(cx, argv[0], &n))
+        return JS_FALSE;
+    ASSERT_THROW(n < 0, "top needs a positive number");
+
+    return coll_list(cx, c, COLL_ENTRIES, COLL_VALUE, (uint32_t) n, rval);
+}
+
+static JSFunctionSpec coll_map_methods[] = {
+    { "get",        coll_map_get,       1, 0 },
+    { "set",        coll_map_set,       2, 0 },
+    { "setAll",     coll_map_set_all,   2, 0 },
+    { "has",        coll_has,           1, 0 },
+    { "delete",     coll_delete,        1, 0 },
+    { "clear",      coll_clear_method,  0, 0 },
+    { "reserve",    coll_reserve,       1, 0 },
+    { "keys",       coll_keys,          1, 0 },
+    { "values",     coll_values,        1, 0 },
+    { "entries",    coll_entries,       1, 0 },
+    { "forEach",    coll_for_each,      2, 0 },
+    { NULL }
+};
+
+static JSFunctionSpec coll_set_methods[] = {
+    { "add",        coll_set_add,       1, 0 },
+    { "addAll",     coll_add_all,       1, 0 },
+    { "has",        coll_has,           1, 0 },
+    { "delete",     coll_delete,        1, 0 },
+    { "clear",      coll_clear_method,  0, 0 },
+    { "reserve",    coll_reserve,       1, 0 },
+    { "values",     coll_keys,          1, 0 },
+    { "forEach",    coll_for_each,      2, 0 },
+    { NULL }
+};
+
+static JSFunctionSpec coll_counter_methods[] = {
+    { "add",        coll_counter_add,   2, 0 },
+    { "addAll",     coll_add_all,       2, 0 },
+    { "get",        coll_counter_get,   1, 0 },
+    { "has",        coll_has,           1, 0 },
+    { "delete",     coll_delete,        1, 0 },
+    { "clear",      coll_clear_method,  0, 0 },
+    { "reserve",    coll_reserve,       1, 0 },
+    { "keys",       coll_keys,          1, 0 },
+    { "values",     coll_values,        1, 0 },
+    { "entries",    coll_entries,       1, 0 },
+    { "top",        coll_counter_top,   1, 0 },
+    { "forEach",    coll_for_each,      2, 0 },
+    { NULL }
+};
+
+enum coll_tinyid {
+    COLL_SIZE,
+    COLL_CAPACITY
+};
+
+static JSPropertySpec coll_properties[] = {
+    { "size",       COLL_SIZE,      JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "capacity",   COLL_CAPACITY,  JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { NULL }
+};
+
+static JSBool coll_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    coll_stuff c;
+
+    if((c = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case COLL_SIZE:
+            return JS_NewNumberValue(cx, (jsdouble) c->count, vp);
+
+        case COLL_CAPACITY:
+            return JS_NewNumberValue(cx, (jsdouble) c->cap, vp);
+    }
+
+    return JS_TRUE;
+}
+
+/* keys and map values are only reachable through us */
+static uint32 coll_mark(JSContext *cx, JSObject *obj, void *arg) {
+    coll_stuff c;
+    uint32_t i;
+
+    if((c = JS_GetPrivate(cx, obj)) == NULL)
+        return 0;
+
+    for(i = 0; i < c->used; i++) {
+        if(!c->entries[i].live)
+            continue;
+        if(JSVAL_IS_GCTHING(c->entries[i].key))
+            JS_MarkGCThing(cx, JSVAL_TO_GCTHING(c->entries[i].key), "collection key", arg);
+        if(c->kind == COLL_MAP && JSVAL_IS_GCTHING(c->entries[i].u.v))
+            JS_MarkGCThing(cx, JSVAL_TO_GCTHING(c->entries[i].u.v), "collection value", arg);
+    }
+
+    return 0;
+}
+
+static void coll_finalize(JSContext *cx, JSObject *obj) {
+    coll_stuff c;
+
+    if((c = JS_GetPrivate(cx, obj)) == NULL)
+        return;
+
+    free(c->entries);
+    free(c->index);
+    free(c);
+}
+
+/*
+ * new HashMap([capacity | [[key, value], ...]])
+ * new HashSet([capacity | [key, ...]])
+ * new Counter([capacity | [key, ...]])
+ */
+static JSBool coll_construct(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval, coll_kind kind) {
+    coll_stuff c;
+    jsdouble d;
+
+    c = calloc(1, sizeof(struct coll_stuff));
+    ASSERT_THROW(c == NULL, "out of memory");
+    c->kind = kind;
+
+    JS_SetPrivate(cx, obj, c);
+
+    if(argc == 0 || JSVAL_IS_VOID(argv[0]))
+        return coll_reserve_for(cx, c, COLL_MIN);
+
+    if(JSVAL_IS_OBJECT(argv[0]) && !JSVAL_IS_NULL(argv[0]) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(argv[0])))
+        return kind == COLL_MAP ? coll_map_set_all(cx, obj, 1, argv, rval) : coll_add_all(cx, obj, 1, argv, rval);
+
+    if(!JS_ValueToNumber(cx, argv[0], &d))
+        return JS_FALSE;
+    ASSERT_THROW(d < 0 || d > (1U << 30), "bad capacity");
+
+    return coll_reserve_for(cx, c, (uint32_t) d > COLL_MIN ? (uint32_t) d : COLL_MIN);
+}
+
+static JSBool coll_map_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return coll_construct(cx, obj, argc, argv, rval, COLL_MAP);
+}
+
+static JSBool coll_set_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return coll_construct(cx, obj, argc, argv, rval, COLL_SET);
+}
+
+static JSBool coll_counter_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return coll_construct(cx, obj, argc, argv, rval, COLL_COUNTER);
+}
+
+static JSClass coll_map_class = {
+    "HashMap", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, coll_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, coll_finalize,
+    NULL, NULL, NULL, NULL, NULL, NULL, coll_mark, 0
+};
+
+static JSClass coll_set_class = {
+    "HashSet", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, coll_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, coll_finalize,
+    NULL, NULL, NULL, NULL, NULL, NULL, coll_mark, 0
+};
+
+static JSClass coll_counter_class = {
+    "Counter", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, coll_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, coll_finalize,
+    NULL, NULL, NULL, NULL, NULL, NULL, coll_mark, 0
+};
+
+JSBool Collections(JSContext *cx, JSObject *amber) {
+    JSObject *map, *set, *counter;
+
+    map = JS_InitClass(cx, amber, NULL, &coll_map_class,
+                       coll_map_constructor, 1,
+                       coll_properties, coll_map_methods,
+                       NULL, NULL);
+
+    set = JS_InitClass(cx, amber, NULL, &coll_set_class,
+                       coll_set_constructor, 1,
+                       coll_properties, coll_set_methods,
+                       NULL, NULL);
+
+    counter = JS_InitClass(cx, amber, NULL, &coll_counter_class,
+                           coll_counter_constructor, 1,
+                           coll_properties, coll_counter_methods,
+                           NULL, NULL);
+
+    return JS_TRUE;
+}
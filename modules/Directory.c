@@ -0,0 +1,634 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <jsapi.h>
+
+#define DIR_BUFSIZE     (256 * 1024)
+#define DIR_MAX_THREADS (64)
+
+/* what the kernel hands back from getdents64 */
+struct dir_dirent64 {
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+
+typedef struct dir_entry_st {
+    char            *name;
+    unsigned char   type;
+    int             has_stat;
+    struct stat     st;
+} dir_entry;
+
+typedef struct dir_list_st {
+    dir_entry       *e;
+    int             n, size;
+} dir_list;
+
+typedef struct dir_filter_st {
+    char            *match;
+    char            **exts;
+    int             nexts;
+    int             want_stat;
+    int             want_dirs;
+} dir_filter;
+
+typedef struct dir_walk_st {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    char            **queue;
+    int             nqueue, queuesize;
+
+    /* workers in the middle of a directory. when this is zero and the
+     * queue is empty, we're done */
+    int             busy;
+
+    /* the first thing that went wrong, and where. everyone stops on it */
+    int             err;
+    char            *errpath;
+
+    dir_filter      *filter;
+} *dir_walk;
+
+typedef struct dir_worker_st {
+    dir_walk        w;
+    pthread_t       t;
+    dir_list        list;
+} dir_worker;
+
+static const char *dir_type_name(unsigned char type) {
+    switch(type) {
+        case DT_REG:  return "file";
+        case DT_DIR:  return "dir";
+        case DT_LNK:  return "link";
+        case DT_FIFO: return "fifo";
+        case DT_SOCK: return "socket";
+        case DT_CHR:  return "char";
+        case DT_BLK:  return "block";
+    }
+    return "unknown";
+}
+
+static unsigned char dir_type_from_mode(mode_t mode) {
+    if(S_ISREG(mode))  return DT_REG;
+    if(S_ISDIR(mode))  return DT_DIR;
+    if(S_ISLNK(mode))  return DT_LNK;
+    if(S_ISFIFO(mode)) return DT_FIFO;
+    if(S_ISSOCK(mode)) return DT_SOCK;
+    if(S_ISCHR(mode))  return DT_CHR;
+    if(S_ISBLK(mode))  return DT_BLK;
+    return DT_UNKNOWN;
+}
+
+static int dir_list_add(dir_list *l, char *name, unsigned char type, struct stat *st) {
+    dir_entry *e;
+    int size;
+
+    if(l->n == l->size) {
+        size = l->size == 0 ? 256 : l->size * 2;
+        if((e = realloc(l->e, sizeof(dir_entry) * size)) == NULL)
+            return -1;
+        l->e = e;
+        l->size = size;
+    }
+
+    e = &l->e[l->n++];
+    e->name = name;
+    e->type = type;
+    if((e->has_stat = (st != NULL)))
+        e->st = *st;
+
+    return 0;
+}
+
+static void dir_list_free(dir_list *l) {
+    int i;
+
+    for(i = 0; i < l->n; i++)
+        free(l->e[i].name);
+    free(l->e);
+
+    l->e = NULL;
+    l->n = l->size = 0;
+}
+
+static int dir_filter_match(dir_filter *f, const char *name, unsigned char type) {
+    size_t len, elen;
+    int i;
+
+    if(type == DT_DIR && !f->want_dirs)
+        return 0;
+
+    if(f->match != NULL && fnmatch(f->match, name, 0) != 0)
+        return 0;
+
+    if(f->nexts > 0) {
+        len = strlen(name);
+        for(i = 0; i < f->nexts; i++) {
+            elen = strlen(f->exts[i]);
+            if(len > elen && name[len - elen - 1] == '.' && strcmp(&name[len - elen], f->exts[i]) == 0)
+                break;
+        }
+        if(i == f->nexts)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * read one directory. matching entries go on the list, named relative to
+ * prefix (or bare if prefix is NULL). subdirectories go on subdirs if it's
+ * given. buf is DIR_BUFSIZE bytes of scratch
+ */
+static int dir_scan(const char *path, const char *prefix, dir_filter *f, char *buf, dir_list *list, dir_list *subdirs) {
+    struct dir_dirent64 *d;
+    struct stat st, *stp;
+    unsigned char type;
+    size_t plen = prefix != NULL ? strlen(prefix) : 0, nlen;
+    long n, pos;
+    char *name, *copy;
+    int fd, err, match, recurse;
+
+    if((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return -1;
+
+    while((n = syscall(SYS_getdents64, fd, buf, DIR_BUFSIZE)) > 0) {
+        for(pos = 0; pos < n; pos += d->d_reclen) {
+            d = (struct dir_dirent64 *) &buf[pos];
+
+            if(d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+
+            type = d->d_type;
+            stp = NULL;
+
+            /* some filesystems don't fill in the type, so we have to ask */
+            if(type == DT_UNKNOWN || f->want_stat) {
+                if(fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = dir_type_from_mode(st.st_mode);
+                    if(f->want_stat)
+                        stp = &st;
+                }
+            }
+
+            match = dir_filter_match(f, d->d_name, type);
+            recurse = subdirs != NULL && type == DT_DIR;
+            if(!match && !recurse)
+                continue;
+
+            nlen = strlen(d->d_name);
+            if((name = malloc(plen + nlen + 2)) == NULL)
+                goto nomem;
+            if(prefix != NULL) {
+                memcpy(name, prefix, plen);
+                name[plen] = '/';
+                memcpy(&name[plen + 1], d->d_name, nlen + 1);
+            }
+            else
+                memcpy(name, d->d_name, nlen + 1);
+
+            /* a matching directory ends up on both lists */
+            if(match) {
+                copy = recurse ? strdup(name) : name;
+                if(copy == NULL || dir_list_add(list, copy, type, stp) < 0) {
+                    if(copy != name)
+                        free(copy);
+                    free(name);
+                    goto nomem;
+                }
+            }
+
+            if(recurse && dir_list_add(subdirs, name, type, NULL) < 0) {
+                free(name);
+                goto nomem;
+            }
+        }
+    }
+
+    err = errno;
+    close(fd);
+
+    if(n < 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+
+nomem:
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+}
+
+/* remember the first failure and wake everyone so they give up. takes
+ * ownership of path. call with the lock held */
+static void dir_walk_fail(dir_walk w, int err, char *path) {
+    if(w->err == 0) {
+        w->err = err;
+        w->errpath = path;
+    }
+    else
+        free(path);
+
+    pthread_cond_broadcast(&w->cond);
+}
+
+static void *dir_walk_worker(void *arg) {
+    dir_worker *wk = (dir_worker *) arg;
+    dir_walk w = wk->w;
+    dir_list subdirs = { NULL, 0, 0 };
+    char *buf, *path, **q;
+    int i, err;
+
+    buf = malloc(DIR_BUFSIZE);
+
+    pthread_mutex_lock(&w->mutex);
+
+    if(buf == NULL)
+        dir_walk_fail(w, ENOMEM, NULL);
+
+    while(1) {
+        while(w->nqueue == 0 && w->busy > 0 && w->err == 0)
+            pthread_cond_wait(&w->cond, &w->mutex);
+
+        if(w->nqueue == 0 || w->err != 0)
+            break;
+
+        path = w->queue[--w->nqueue];
+        w->busy++;
+
+        pthread_mutex_unlock(&w->mutex);
+
+        err = dir_scan(path, path, w->filter, buf, &wk->list, &subdirs) < 0 ? errno : 0;
+
+        pthread_mutex_lock(&w->mutex);
+
+        /* directories we can't get into, or that went away under us, are
+         * skipped the same as find carrying on. anything else stops the walk */
+        if(err != 0 && err != EACCES && err != ENOENT && err != ENOTDIR) {
+            dir_walk_fail(w, err, path);
+            path = NULL;
+        }
+        free(path);
+
+        if(subdirs.n > 0 && w->err == 0 && w->nqueue + subdirs.n > w->queuesize) {
+            i = w->queuesize;
+            while(w->nqueue + subdirs.n > i)
+                i *= 2;
+            if((q = realloc(w->queue, sizeof(char *) * i)) != NULL) {
+                w->queue = q;
+                w->queuesize = i;
+            }
+            else
+                dir_walk_fail(w, ENOMEM, NULL);
+        }
+
+        for(i = 0; i < subdirs.n; i++) {
+            if(w->err == 0)
+                w->queue[w->nqueue++] = subdirs.e[i].name;
+            else
+                free(subdirs.e[i].name);
+        }
+        if(subdirs.n > 0 && w->err == 0)
+            pthread_cond_broadcast(&w->cond);
+        subdirs.n = 0;
+
+        w->busy--;
+    }
+
+    /* last one out wakes everyone else up */
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+
+    free(subdirs.e);
+    free(buf);
+
+    return NULL;
+}
+
+static JSBool dir_get_option(JSContext *cx, JSObject *opts, const char *name, jsval *vp) {
+    *vp = JSVAL_VOID;
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    return JS_GetProperty(cx, opts, name, vp);
+}
+
+static JSBool dir_filter_init(JSContext *cx, JSObject *opts, dir_filter *f) {
+    JSObject *arr;
+    JSString *str;
+    JSBool b;
+    jsuint len, i;
+    char *ext;
+    jsval v;
+
+    memset(f, 0, sizeof(dir_filter));
+
+    if(!dir_get_option(cx, opts, "stat", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v) && JS_ValueToBoolean(cx, v, &b))
+        f->want_stat = b;
+
+    if(!dir_get_option(cx, opts, "match", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v) && !JSVAL_IS_NULL(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            THROW("couldn't convert match to string");
+        if((f->match = strdup(JS_GetStringBytes(str))) == NULL)
+            THROW("out of memory");
+    }
+
+    /* a single extension or an array of them, with or without the dot */
+    if(!dir_get_option(cx, opts, "ext", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v) && !JSVAL_IS_NULL(v)) {
+        if(JSVAL_IS_OBJECT(v) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(v))) {
+            arr = JSVAL_TO_OBJECT(v);
+            JS_GetArrayLength(cx, arr, &len);
+        }
+        else {
+            arr = NULL;
+            len = 1;
+        }
+
+        if((f->exts = calloc(len, sizeof(char *))) == NULL)
+            THROW("out of memory");
+        for(i = 0; i < len; i++) {
+            if(arr != NULL && !JS_GetElement(cx, arr, i, &v))
+                return JS_FALSE;
+            if((str = JS_ValueToString(cx, v)) == NULL)
+                THROW("couldn't convert extension to string");
+            ext = JS_GetStringBytes(str);
+            if((f->exts[f->nexts] = strdup(ext[0] == '.' ? &ext[1] : ext)) == NULL)
+                THROW("out of memory");
+            f->nexts++;
+        }
+    }
+
+    /* directories are listed unless there's a filter on names */
+    if(!dir_get_option(cx, opts, "dirs", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v) && JS_ValueToBoolean(cx, v, &b))
+        f->want_dirs = b;
+    else
+        f->want_dirs = f->match == NULL && f->nexts == 0;
+
+    return JS_TRUE;
+}
+
+static void dir_filter_free(dir_filter *f) {
+    int i;
+
+    free(f->match);
+    for(i = 0; i < f->nexts; i++)
+        free(f->exts[i]);
+    free(f->exts);
+}
+
+static JSBool dir_define_number(JSContext *cx, JSObject *obj, const char *name, jsdouble d) {
+    jsval v;
+
+    if(!JS_NewNumberValue(cx, d, &v))
+        return JS_FALSE;
+
+    return JS_DefineProperty(cx, obj, name, v, NULL, NULL, JSPROP_ENUMERATE);
+}
+
+/* turn the native list into an array of entry objects. each object goes into
+ * the array before anything else is allocated so it's never unrooted */
+static JSBool dir_list_to_array(JSContext *cx, dir_list *l, const char *key, jsval *rval) {
+    JSObject *arr, *obj;
+    JSString *str;
+    dir_entry *e;
+    jsval v;
+    int i;
+
+    if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    for(i = 0; i < l->n; i++) {
+        e = &l->e[i];
+
+        if((obj = JS_NewObject(cx, NULL, NULL, NULL)) == NULL)
+            return JS_FALSE;
+        v = OBJECT_TO_JSVAL(obj);
+        if(!JS_SetElement(cx, arr, i, &v))
+            return JS_FALSE;
+
+        if((str = JS_NewStringCopyZ(cx, e->name)) == NULL ||
+           !JS_DefineProperty(cx, obj, key, STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE))
+            return JS_FALSE;
+
+        if((str = JS_NewStringCopyZ(cx, dir_type_name(e->type))) == NULL ||
+           !JS_DefineProperty(cx, obj, "type", STRING_TO_JSVAL(str), NULL, NULL, JSPROP_ENUMERATE))
+            return JS_FALSE;
+
+        if(e->has_stat) {
+            if(!dir_define_number(cx, obj, "size", (jsdouble) e->st.st_size) ||
+               !dir_define_number(cx, obj, "mtime", (jsdouble) e->st.st_mtim.tv_sec + e->st.st_mtim.tv_nsec / 1e9) ||
+               !dir_define_number(cx, obj, "mode", (jsdouble) (e->st.st_mode & 07777)) ||
+               !dir_define_number(cx, obj, "ino", (jsdouble) e->st.st_ino))
+                return JS_FALSE;
+        }
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool dir_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JSString *str;
+    JSObject *opts = NULL;
+    dir_filter f;
+    dir_list list = { NULL, 0, 0 };
+    char *path, *buf;
+    JSBool ret;
+    int err;
+
+    ASSERT_THROW(argc == 0, "no directory specified");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert argument to string");
+    path = JS_GetStringBytes(str);
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if(dir_filter_init(cx, opts, &f) == JS_FALSE) {
+        dir_filter_free(&f);
+        return JS_FALSE;
+    }
+
+    if((buf = malloc(DIR_BUFSIZE)) == NULL) {
+        dir_filter_free(&f);
+        THROW("out of memory");
+    }
+
+    err = dir_scan(path, NULL, &f, buf, &list, NULL) < 0 ? errno : 0;
+
+    free(buf);
+    dir_filter_free(&f);
+
+    if(err != 0) {
+        dir_list_free(&list);
+        THROW("couldn't read directory '%s': %s", path, strerror(err));
+    }
+
+    ret = dir_list_to_array(cx, &list, "name", rval);
+    dir_list_free(&list);
+
+    return ret;
+}
+
+static JSBool dir_walk_fn(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    struct dir_walk_st w;
+    dir_worker *workers;
+    JSString *str;
+    JSObject *opts = NULL;
+    dir_filter f;
+    dir_list all = { NULL, 0, 0 };
+    jsrefcount saved;
+    char *path;
+    int32 nthreads = 4;
+    int i, j, fd, started, nomem;
+    JSBool ret;
+    jsval v;
+
+    ASSERT_THROW(argc == 0, "no directory specified");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert argument to string");
+    path = JS_GetStringBytes(str);
+
+    /* the workers skip directories they can't open, so check the root here */
+    if((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        THROW_CODE(errno, "Directory", "couldn't walk '%s': %s", path, strerror(errno));
+    close(fd);
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if(!dir_get_option(cx, opts, "threads", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v))
+        ASSERT_THROW(JS_ValueToInt32(cx, v, &nthreads) == JS_FALSE, "couldn't convert threads to an integer");
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > DIR_MAX_THREADS)
+        nthreads = DIR_MAX_THREADS;
+
+    if(dir_filter_init(cx, opts, &f) == JS_FALSE) {
+        dir_filter_free(&f);
+        return JS_FALSE;
+    }
+
+    memset(&w, 0, sizeof(struct dir_walk_st));
+    w.filter = &f;
+    w.queuesize = 256;
+    w.queue = malloc(sizeof(char *) * w.queuesize);
+    workers = calloc(nthreads, sizeof(dir_worker));
+    if(w.queue == NULL || workers == NULL || (w.queue[w.nqueue] = strdup(path)) == NULL) {
+        free(w.queue);
+        free(workers);
+        dir_filter_free(&f);
+        THROW("out of memory");
+    }
+    for(i = strlen(path); i > 1 && w.queue[w.nqueue][i - 1] == '/'; i--)
+        w.queue[w.nqueue][i - 1] = '\0';
+    w.nqueue++;
+
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+
+    /* the walk is all native, so let the gc and other threads get on */
+    saved = JS_SuspendRequest(cx);
+
+    for(i = started = 0; i < nthreads; i++) {
+        workers[i].w = &w;
+        if(pthread_create(&workers[i].t, NULL, dir_walk_worker, &workers[i]) == 0)
+            started++;
+        else
+            break;
+    }
+
+    /* couldn't get any threads, do it ourselves */
+    if(started == 0)
+        dir_walk_worker(&workers[0]);
+
+    for(i = 0; i < started; i++)
+        pthread_join(workers[i].t, NULL);
+
+    /* gather up into one list. the names move, so don't free them twice */
+    for(i = nomem = 0; i < nthreads; i++) {
+        for(j = 0; j < workers[i].list.n; j++) {
+            if(nomem || dir_list_add(&all, workers[i].list.e[j].name, workers[i].list.e[j].type,
+                                     workers[i].list.e[j].has_stat ? &workers[i].list.e[j].st : NULL) < 0) {
+                free(workers[i].list.e[j].name);
+                nomem = 1;
+            }
+        }
+        free(workers[i].list.e);
+    }
+
+    JS_ResumeRequest(cx, saved);
+
+    /* a walk that stopped early leaves some of the queue behind */
+    for(i = 0; i < w.nqueue; i++)
+        free(w.queue[i]);
+
+    free(workers);
+    free(w.queue);
+    pthread_mutex_destroy(&w.mutex);
+    pthread_cond_destroy(&w.cond);
+    dir_filter_free(&f);
+
+    if(w.err != 0 || nomem) {
+        dir_list_free(&all);
+        if(w.err == 0 || w.err == ENOMEM) {
+            free(w.errpath);
+            THROW("out of memory");
+        }
+        amber_exception_throw_code(cx, w.err, "Directory", "couldn't walk '%s': %s", w.errpath, strerror(w.err));
+        free(w.errpath);
+        return JS_FALSE;
+    }
+
+    ret = dir_list_to_array(cx, &all, "path", rval);
+    dir_list_free(&all);
+
+    return ret;
+}
+
+static JSFunctionSpec directory_functions[] = {
+    { "read",   dir_read,       2, JSPROP_ENUMERATE },
+    { "walk",   dir_walk_fn,    2, JSPROP_ENUMERATE },
+    { NULL }
+};
+
+JSBool Directory(JSContext *cx, JSObject *amber) {
+    JSObject *directory;
+
+    directory = JS_NewObject(cx, NULL, NULL, NULL);
+    JS_DefineProperty(cx, amber, "Directory", OBJECT_TO_JSVAL(directory), NULL, NULL, JSPROP_ENUMERATE);
+    JS_DefineFunctions(cx, directory, directory_functions);
+
+    return JS_TRUE;
+}
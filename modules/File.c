@@ -1,15 +1,551 @@
+#include "config.h"
+
 #include "amber/amber.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include <jsapi.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+# define FILE_GZIP 1
+# include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+# define FILE_ZSTD 1
+# include <zstd.h>
+#endif
+
+#define FILE_CODEC_BUFSIZE  (256 * 1024)
+
+/* zlib keeps an input and a double-sized output buffer per stream */
+#define FILE_GZIP_HELD      (3 * FILE_CODEC_BUFSIZE)
+
+#define FILE_COPY_BUFSIZE   (256 * 1024)
+#define FILE_COPY_CHUNK     (1024 * 1024 * 1024)
+#define FILE_SPLICE_CHUNK   (1024 * 1024)
+
+typedef enum file_codec {
+    FILE_CODEC_NONE,
+    FILE_CODEC_GZIP,
+    FILE_CODEC_ZLIB,
+    FILE_CODEC_ZSTD
+} file_codec;
+
+static const char *file_codec_names[] = { "none", "gzip", "zlib", "zstd", NULL };
+
+/* pick a codec from the filename. zlib streams don't have an extension */
+static file_codec file_codec_from_name(const char *name) {
+    size_t len = strlen(name);
+
+    if(len > 3 && strcmp(&name[len - 3], ".gz") == 0)
+        return FILE_CODEC_GZIP;
+    if(len > 4 && strcmp(&name[len - 4], ".zst") == 0)
+        return FILE_CODEC_ZSTD;
+
+    return FILE_CODEC_NONE;
+}
+
+static JSBool file_codec_from_value(JSContext *cx, jsval v, file_codec *codec) {
+    JSString *str;
+    char *name;
+    int i;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; file_codec_names[i] != NULL; i++)
+        if(strcmp(name, file_codec_names[i]) == 0) {
+            *codec = (file_codec) i;
+            break;
+        }
+
+    ASSERT_THROW(file_codec_names[i] == NULL, "unknown compression format '%s'", name);
+
+#ifndef FILE_GZIP
+    ASSERT_THROW(*codec == FILE_CODEC_GZIP || *codec == FILE_CODEC_ZLIB, "%s support not compiled in", name);
+#endif
+#ifndef FILE_ZSTD
+    ASSERT_THROW(*codec == FILE_CODEC_ZSTD, "%s support not compiled in", name);
+#endif
+
+    return JS_TRUE;
+}
+
+/*
+ * text encodings. strings are jschar inside js and bytes outside, so every
+ * read widens and every write narrows. binary just moves the low byte,
+ * latin-1 is the same on the way in but writes '?' for anything it can't
+ * hold, and utf-8 is validated and decoded properly. all three take a sse2
+ * path over runs of ascii, which is most text
+ */
+
+/* the encodings themselves are in amber.h, so other modules can write
+ * to a File the way it would */
+typedef amber_file_encoding file_encoding;
+
+#define FILE_ENC_BINARY     AMBER_FILE_BINARY
+#define FILE_ENC_LATIN1     AMBER_FILE_LATIN1
+#define FILE_ENC_UTF8       AMBER_FILE_UTF8
+
+static const struct {
+    const char      *name;
+    file_encoding   enc;
+} file_encoding_names[] = {
+    { "binary",     FILE_ENC_BINARY },
+    { "latin-1",    FILE_ENC_LATIN1 },
+    { "latin1",     FILE_ENC_LATIN1 },
+    { "iso-8859-1", FILE_ENC_LATIN1 },
+    { "utf-8",      FILE_ENC_UTF8 },
+    { "utf8",       FILE_ENC_UTF8 },
+    { NULL }
+};
+
+#define FILE_REPLACEMENT    0xfffd
+
+static JSBool file_encoding_from_value(JSContext *cx, jsval v, file_encoding *enc) {
+    JSString *str;
+    char *name;
+    int i;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; file_encoding_names[i].name != NULL; i++)
+        if(strcasecmp(name, file_encoding_names[i].name) == 0) {
+            *enc = file_encoding_names[i].enc;
+            return JS_TRUE;
+        }
+
+    THROW("unknown encoding '%s'", name);
+}
+
+/* the encoding lives in a reserved slot so the private can stay a bare FILE
+ * for amber_file_stream. a slot that was never set means binary */
+static file_encoding file_get_encoding(JSContext *cx, JSObject *obj) {
+    jsval v;
+
+    if(!JS_GetReservedSlot(cx, obj, 0, &v) || !JSVAL_IS_INT(v))
+        return FILE_ENC_BINARY;
+
+    return (file_encoding) JSVAL_TO_INT(v);
+}
+
+/* bytes to jschars one for one */
+static void file_widen(const unsigned char *in, size_t len, jschar *out) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), x;
+
+    for(; i + 16 <= len; i += 16) {
+        x = _mm_loadu_si128((const __m128i *) &in[i]);
+        _mm_storeu_si128((__m128i *) &out[i], _mm_unpacklo_epi8(x, zero));
+        _mm_storeu_si128((__m128i *) &out[i + 8], _mm_unpackhi_epi8(x, zero));
+    }
+#endif
+
+    for(; i < len; i++)
+        out[i] = in[i];
+}
+
+/*
+ * utf-8 to utf-16. out needs room for len jschars, which is always enough:
+ * no sequence makes more units than it has bytes. a malformed sequence
+ * becomes a single U+FFFD covering the lead byte and whatever continuation
+ * bytes were valid before it went wrong. returns the number of jschars
+ */
+static size_t file_utf8_decode(const unsigned char *in, size_t len, jschar *out) {
+    size_t i = 0, o = 0, need, k;
+    unsigned int c, cp, min;
+
+    while(i < len) {
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128(), x;
+
+        for(; i + 16 <= len; i += 16, o += 16) {
+            x = _mm_loadu_si128((const __m128i *) &in[i]);
+            if(_mm_movemask_epi8(x) != 0)
+                break;
+            _mm_storeu_si128((__m128i *) &out[o], _mm_unpacklo_epi8(x, zero));
+            _mm_storeu_si128((__m128i *) &out[o + 8], _mm_unpackhi_epi8(x, zero));
+        }
+#endif
+
+        /* scalar from here. ascii sends it back to the wide loop, but only
+         * every 16 bytes so mixed text doesn't bounce on every character */
+        for(; i < len; ) {
+            c = in[i];
+            if(c < 0x80) {
+                out[o++] = (jschar) c;
+                i++;
+                if((i & 15) == 0)
+                    break;
+                continue;
+            }
+
+            if(c >= 0xc2 && c <= 0xdf) {
+                need = 1; cp = c & 0x1f; min = 0x80;
+            }
+            else if(c >= 0xe0 && c <= 0xef) {
+                need = 2; cp = c & 0x0f; min = 0x800;
+            }
+            else if(c >= 0xf0 && c <= 0xf4) {
+                need = 3; cp = c & 0x07; min = 0x10000;
+            }
+            else {
+                out[o++] = FILE_REPLACEMENT;
+                i++;
+                continue;
+            }
+
+            for(k = 1; k <= need && i + k < len && (in[i + k] & 0xc0) == 0x80; k++)
+                cp = (cp << 6) | (in[i + k] & 0x3f);
+
+            if(k <= need || cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+                out[o++] = FILE_REPLACEMENT;
+                i += k;
+                continue;
+            }
+
+            if(cp >= 0x10000) {
+                cp -= 0x10000;
+                out[o++] = (jschar) (0xd800 + (cp >> 10));
+                out[o++] = (jschar) (0xdc00 + (cp & 0x3ff));
+            }
+            else
+                out[o++] = (jschar) cp;
+
+            i += need + 1;
+        }
+    }
+
+    return o;
+}
+
+/* how many more bytes the sequence at the end of the buffer is waiting for,
+ * so a read doesn't stop halfway through a character */
+static size_t file_utf8_pending(const unsigned char *in, size_t len) {
+    size_t back, need;
+    unsigned int c;
+
+    for(back = 1; back <= 3 && back <= len; back++) {
+        c = in[len - back];
+        if((c & 0xc0) == 0x80)
+            continue;
+
+        if(c >= 0xc2 && c <= 0xdf)
+            need = 2;
+        else if(c >= 0xe0 && c <= 0xef)
+            need = 3;
+        else if(c >= 0xf0 && c <= 0xf4)
+            need = 4;
+        else
+            return 0;
+
+        return need > back ? need - back : 0;
+    }
+
+    return 0;
+}
+
+/* bytes into a new string in the given encoding. the bytes are left alone */
+static JSString *file_decode(JSContext *cx, const char *buf, size_t len, file_encoding enc) {
+    jschar *chars;
+    JSString *str;
+    size_t n;
+
+    if((chars = JS_malloc(cx, (len + 1) * sizeof(jschar))) == NULL)
+        return NULL;
+
+    if(enc == FILE_ENC_UTF8)
+        n = file_utf8_decode((const unsigned char *) buf, len, chars);
+    else {
+        file_widen((const unsigned char *) buf, len, chars);
+        n = len;
+    }
+    chars[n] = 0;
+
+    if((str = JS_NewUCString(cx, chars, n)) == NULL)
+        JS_free(cx, chars);
+
+    return str;
+}
+
+/* write a whole string in the given encoding */
+static JSBool file_put_string(JSContext *cx, FILE *f, JSString *str, file_encoding enc) {
+    return amber_file_write(cx, f, JS_GetStringChars(str), JS_GetStringLength(str), enc);
+}
+
+/*
+ * compressed streams. these sit behind a cookie FILE so that everything
+ * else (including other modules via amber_file_stream) just sees a FILE
+ */
+
+#if defined(FILE_GZIP) && defined(HAVE_FOPENCOOKIE)
+
+static ssize_t file_gzip_read(void *cookie, char *buf, size_t size) {
+    int n;
+
+    if((n = gzread((gzFile) cookie, buf, size)) < 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    return n;
+}
+
+static ssize_t file_gzip_write(void *cookie, const char *buf, size_t size) {
+    if(size > 0 && gzwrite((gzFile) cookie, buf, size) == 0) {
+        errno = EIO;
+        return 0;
+    }
+
+    return size;
+}
+
+static int file_gzip_close(void *cookie) {
+    amber_memory_account(-FILE_GZIP_HELD);
+
+    return gzclose((gzFile) cookie) == Z_OK ? 0 : EOF;
+}
+
+static cookie_io_functions_t file_gzip_io = {
+    file_gzip_read, file_gzip_write, NULL, file_gzip_close
+};
+
+static FILE *file_gzip_open(const char *name, const char *mode) {
+    gzFile gz;
+    FILE *f;
+
+    if((gz = gzopen(name, mode)) == NULL) {
+        if(errno == 0)
+            errno = ENOMEM;
+        return NULL;
+    }
+
+    gzbuffer(gz, FILE_CODEC_BUFSIZE);
+
+    if((f = fopencookie(gz, mode, file_gzip_io)) == NULL)
+        gzclose(gz);
+    else
+        amber_memory_account(FILE_GZIP_HELD);
+
+    return f;
+}
+
+#endif
+
+#if defined(FILE_ZSTD) && defined(HAVE_FOPENCOOKIE)
+
+typedef struct file_zstd_st {
+    FILE            *f;
+    ZSTD_CCtx       *cctx;
+    ZSTD_DCtx       *dctx;
+    ZSTD_inBuffer   in;
+    char            *buf;
+    size_t          bufsize;
+    int             eof;
+} *file_zstd;
+
+static ssize_t file_zstd_read(void *cookie, char *buf, size_t size) {
+    file_zstd z = (file_zstd) cookie;
+    ZSTD_outBuffer out = { buf, size, 0 };
+    size_t n, ret = 0, prev;
+
+    while(out.pos < out.size) {
+        if(z->in.pos == z->in.size && !z->eof) {
+            if((n = fread(z->buf, sizeof(char), z->bufsize, z->f)) == 0) {
+                if(ferror(z->f))
+                    return -1;
+                z->eof = 1;
+            }
+            z->in.src = z->buf;
+            z->in.size = n;
+            z->in.pos = 0;
+        }
+
+        prev = out.pos;
+        ret = ZSTD_decompressStream(z->dctx, &out, &z->in);
+        if(ZSTD_isError(ret)) {
+            errno = EIO;
+            return -1;
+        }
+
+        /* hand back what we have rather than block on more input */
+        if(out.pos > 0 && z->in.pos == z->in.size)
+            break;
+
+        if(z->eof && out.pos == prev)
+            break;
+    }
+
+    /* input ran out partway through a frame */
+    if(out.pos == 0 && z->eof && ret != 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    return out.pos;
+}
+
+static ssize_t file_zstd_flush(file_zstd z, ZSTD_inBuffer *in, ZSTD_EndDirective end) {
+    ZSTD_outBuffer out;
+    size_t ret;
+
+    do {
+        out.dst = z->buf;
+        out.size = z->bufsize;
+        out.pos = 0;
+
+        ret = ZSTD_compressStream2(z->cctx, &out, in, end);
+        if(ZSTD_isError(ret)) {
+            errno = EIO;
+            return -1;
+        }
+
+        if(out.pos > 0 && fwrite(z->buf, sizeof(char), out.pos, z->f) != out.pos)
+            return -1;
+    } while(in->pos < in->size || (end == ZSTD_e_end && ret != 0));
+
+    return 0;
+}
+
+static ssize_t file_zstd_write(void *cookie, const char *buf, size_t size) {
+    ZSTD_inBuffer in = { buf, size, 0 };
+
+    if(file_zstd_flush((file_zstd) cookie, &in, ZSTD_e_continue) < 0)
+        return 0;
+
+    return size;
+}
+
+static int file_zstd_close(void *cookie) {
+    file_zstd z = (file_zstd) cookie;
+    ZSTD_inBuffer in = { NULL, 0, 0 };
+    int ret = 0;
+
+    if(z->cctx != NULL) {
+        if(file_zstd_flush(z, &in, ZSTD_e_end) < 0)
+            ret = EOF;
+        ZSTD_freeCCtx(z->cctx);
+    }
+    if(z->dctx != NULL)
+        ZSTD_freeDCtx(z->dctx);
+
+    if(fclose(z->f) != 0)
+        ret = EOF;
+
+    if(z->buf != NULL)
+        amber_memory_account(-(ssize_t) z->bufsize);
+    free(z->buf);
+    free(z);
+
+    return ret;
+}
+
+static cookie_io_functions_t file_zstd_io = {
+    file_zstd_read, file_zstd_write, NULL, file_zstd_close
+};
+
+static FILE *file_zstd_open(const char *name, const char *mode) {
+    file_zstd z;
+    FILE *f;
+
+    if((z = calloc(1, sizeof(struct file_zstd_st))) == NULL)
+        return NULL;
+
+    if((z->f = fopen(name, mode)) == NULL) {
+        free(z);
+        return NULL;
+    }
+
+    if(mode[0] == 'r') {
+        z->dctx = ZSTD_createDCtx();
+        z->bufsize = FILE_CODEC_BUFSIZE;
+    }
+    else {
+        z->cctx = ZSTD_createCCtx();
+        z->bufsize = ZSTD_CStreamOutSize() > FILE_CODEC_BUFSIZE ? ZSTD_CStreamOutSize() : FILE_CODEC_BUFSIZE;
+    }
+
+    if((z->dctx != NULL || z->cctx != NULL) && (z->buf = malloc(z->bufsize)) != NULL)
+        amber_memory_account(z->bufsize);
+
+    if(z->buf == NULL || (f = fopencookie(z, mode, file_zstd_io)) == NULL) {
+        file_zstd_close(z);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return f;
+}
+
+#endif
+
+static FILE *file_codec_open(const char *name, const char *mode, file_codec codec) {
+    if(codec == FILE_CODEC_NONE)
+        return fopen(name, mode);
+
+    /* compressed streams only go one way */
+    if(strchr(mode, '+') != NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+#ifdef HAVE_FOPENCOOKIE
+    switch(codec) {
+# ifdef FILE_GZIP
+        case FILE_CODEC_GZIP:
+            return file_gzip_open(name, mode);
+# endif
+
+# ifdef FILE_ZSTD
+        case FILE_CODEC_ZSTD:
+            return file_zstd_open(name, mode);
+# endif
+
+        default:
+            break;
+    }
+#endif
+
+    errno = ENOTSUP;
+    return NULL;
+}
+
+/* the standard streams are shared with everything else, so letting go of
+ * one only flushes it */
+static void file_release(FILE *f) {
+    if(f == stdin)
+        return;
+
+    if(f == stdout || f == stderr)
+        fflush(f);
+    else
+        fclose(f);
+}
+
 static JSBool file_open(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     JSString *str;
     char *name, *mode;
+    file_codec codec;
+    file_encoding enc;
     FILE *f;
 
     if(argc == 0)
@@ -25,13 +561,28 @@ static JSBool file_open(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, j
     else
         mode = "r";
 
+    if(argc > 2 && !JSVAL_IS_VOID(argv[2]) && !JSVAL_IS_NULL(argv[2])) {
+        if(file_codec_from_value(cx, argv[2], &codec) == JS_FALSE)
+            return JS_FALSE;
+    }
+    else
+        codec = file_codec_from_name(name);
+
+    /* an encoding given here sticks until it's changed. leaving it out
+     * keeps whatever the File had */
+    if(argc > 3) {
+        if(file_encoding_from_value(cx, argv[3], &enc) == JS_FALSE ||
+           !JS_SetReservedSlot(cx, obj, 0, INT_TO_JSVAL(enc)))
+            return JS_FALSE;
+    }
+
     if((f = JS_GetPrivate(cx, obj)) != NULL) {
-        fclose(f);
+        file_release(f);
         JS_SetPrivate(cx, obj, NULL);
     }
 
-    f = fopen(name, mode);
-    ASSERT_THROW(f == NULL, "couldn't open '%s' with mode '%s': %s", name, mode, strerror(errno));
+    f = file_codec_open(name, mode, codec);
+    ASSERT_THROW_CODE(f == NULL, errno, "File", "couldn't open '%s' with mode '%s': %s", name, mode, strerror(errno));
     
     JS_SetPrivate(cx, obj, f);
     
@@ -42,7 +593,7 @@ static JSBool file_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
     FILE *f;
 
     if((f = JS_GetPrivate(cx, obj)) != NULL) {
-        fclose(f);
+        file_release(f);
         JS_SetPrivate(cx, obj, NULL);
     }
 
@@ -51,8 +602,10 @@ static JSBool file_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
 
 static JSBool file_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     FILE *f;
-    char *buf;
-    int want, len, pos;
+    char *buf, *nbuf;
+    int32 want;
+    size_t len, pos, chunk, pending;
+    file_encoding enc;
     JSString *str;
 
     if((f = JS_GetPrivate(cx, obj)) == NULL)
@@ -67,21 +620,35 @@ static JSBool file_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, j
     if(want == 0)
         return JS_TRUE;
 
+    enc = file_get_encoding(cx, obj);
+
+    /* a counted read gets its buffer up front, with room for the rest of a
+     * utf-8 character. otherwise grow by doubling */
     buf = NULL; len = pos = 0;
-    while(!feof(f) && (want < 0 || pos < want)) {
-        if(len < pos + 1024) {
-            buf = (char *) JS_realloc(cx, buf, sizeof(char) * (len + 1024));
-            len += 1024;
+    while(!feof(f) && (want < 0 || pos < (size_t) want)) {
+        if(len == pos) {
+            len = want > 0 ? (size_t) want + 4 : len == 0 ? 64 * 1024 : len * 2;
+            if((nbuf = JS_realloc(cx, buf, len)) == NULL) {
+                JS_free(cx, buf);
+                return JS_FALSE;
+            }
+            buf = nbuf;
         }
 
-        if(want > 0 && want - pos < 1024)
-            pos += fread(&(buf[pos]), sizeof(char), want - pos, f);
-        else
-            pos += fread(&(buf[pos]), sizeof(char), 1024, f);
+        chunk = want > 0 ? (size_t) want - pos : len - pos;
+        pos += fread(&buf[pos], 1, chunk, f);
+
+        if(ferror(f)) {
+            JS_free(cx, buf);
+            THROW_CODE(errno, "File", "read error: %s", strerror(errno));
+        }
+    }
 
+    if(enc == FILE_ENC_UTF8 && want > 0 && (pending = file_utf8_pending((unsigned char *) buf, pos)) > 0) {
+        pos += fread(&buf[pos], 1, pending, f);
         if(ferror(f)) {
             JS_free(cx, buf);
-            THROW("read error");
+            THROW_CODE(errno, "File", "read error: %s", strerror(errno));
         }
     }
 
@@ -91,12 +658,11 @@ static JSBool file_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, j
         return JS_TRUE;
     }
 
-    if(pos == len)
-        buf = (char *) JS_realloc(cx, buf, sizeof(char) * (len + 1));
+    str = file_decode(cx, buf, pos, enc);
+    JS_free(cx, buf);
+    if(str == NULL)
+        return JS_FALSE;
 
-    buf[pos] = '\0';
-
-    str = JS_NewString(cx, buf, pos);
     *rval = STRING_TO_JSVAL(str);
 
     return JS_TRUE;
@@ -104,8 +670,7 @@ static JSBool file_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, j
 
 static JSBool file_write(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     FILE *f;
-    char *buf;
-    int len;
+    JSString *str;
 
     if((f = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
@@ -113,38 +678,32 @@ static JSBool file_write(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
     if(argc == 0)
         return JS_TRUE;
 
-    buf = JS_GetStringBytes(JSVAL_TO_STRING(argv[0]));
-    len = JS_GetStringLength(JSVAL_TO_STRING(argv[0]));
-
-    fwrite(buf, sizeof(char), len, f);
-    ASSERT_THROW(ferror(f), "write error");
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
 
-    return JS_TRUE;
+    return file_put_string(cx, f, str, file_get_encoding(cx, obj));
 }
 
 static JSBool file_print(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     FILE *f;
     uintN i;
     JSString *str;
-    char *thing;
+    file_encoding enc;
 
     if((f = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
 
-    if(argc == 0) {
-        fputs("\n", f);
-        ASSERT_THROW(ferror(f), "write error");
-        return JS_TRUE;
-    }
+    enc = file_get_encoding(cx, obj);
 
     for(i = 0; i < argc; i++) {
-        if((str = JS_ValueToString(cx, argv[i])) == NULL ||
-           (thing = JS_GetStringBytes(str)) == NULL) {
-            THROW("couldn't convert argument to char *");
-        }
+        if((str = JS_ValueToString(cx, argv[i])) == NULL)
+            return JS_FALSE;
+        argv[i] = STRING_TO_JSVAL(str);
 
-        fprintf(f, "%s%s", i > 0 ? " " : "", thing);
-        ASSERT_THROW(ferror(f), "write error");
+        if(i > 0)
+            fputc(' ', f);
+        if(!file_put_string(cx, f, str, enc))
+            return JS_FALSE;
     }
 
     fputc('\n', f);
@@ -153,111 +712,1209 @@ static JSBool file_print(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
     return JS_TRUE;
 }
 
+/* one line without its terminator, or undefined at the end of the file */
 static JSBool file_readline(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     FILE *f;
-    char buf[256], *c;
-    JSString *str = NULL;
-    int done;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    JSString *str;
 
     if((f = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
 
-    done = 0;
-    buf[254] = '\0';
-    do {
-        fgets(buf, 256, f);
-        ASSERT_THROW(ferror(f), "read error");
+    if((len = getline(&line, &size, f)) < 0) {
+        free(line);
+        ASSERT_THROW_CODE(ferror(f), errno, "File", "read error: %s", strerror(errno));
+        *rval = JSVAL_VOID;
+        return JS_TRUE;
+    }
 
-        c = strchr(buf, '\0'); c--;
-        if(*c == '\n' || *c == '\r') {
-            done = 1;
-            *c = '\0';
-        }
-        else if(feof(f))
-            done = 1;
+    if(len > 0 && line[len - 1] == '\n')
+        len--;
+    if(len > 0 && line[len - 1] == '\r')
+        len--;
 
-        if(str == NULL)
-            str = JS_NewStringCopyZ(cx, buf);
-        else
-            str = JS_ConcatStrings(cx, str, JS_NewStringCopyZ(cx, buf));
-    } while(!done);
+    str = file_decode(cx, line, len, file_get_encoding(cx, obj));
+    free(line);
+    if(str == NULL)
+        return JS_FALSE;
+
+    *rval = STRING_TO_JSVAL(str);
 
-    if(str != NULL)
-        *rval = STRING_TO_JSVAL(str);
-    else
-        *rval = JSVAL_VOID;
-    
     return JS_TRUE;
 }
 
-static JSFunctionSpec file_methods[] = {
-    { "open",       file_open,      2, 0 },
-    { "close",      file_close,     0, 0 },
-    { "read",       file_read,      1, 0 },
-    { "write",      file_write,     1, 0 },
-    { "print",      file_print,     0, 0 },
-    { "readline",   file_readline,  0, 0 },
-    { NULL }
-};
-
-enum file_tinyid {
-    FILE_EOF
-};
+/*
+ * search() picks lines out of a file without making strings of the ones
+ * that don't match. the file is read a block of whole lines at a time and
+ * scanned where it lies: one pattern by its first and last bytes sixteen
+ * at a time, several with an aho-corasick automaton over just the bytes
+ * the patterns use. patterns are literal and can't span lines
+ */
 
-static JSPropertySpec file_properties[] = {
-    { "eof",    FILE_EOF,   JSPROP_ENUMERATE | JSPROP_READONLY },
-    { NULL }
-};
+#define FILE_SEARCH_BUFSIZE (1024 * 1024)
 
-static JSBool file_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
-    if(argc == 0) {
-        JS_SetPrivate(cx, obj, NULL);
-        return JS_TRUE;
-    }
+typedef enum file_search_mode {
+    FILE_SEARCH_LINES,
+    FILE_SEARCH_OFFSETS,
+    FILE_SEARCH_COUNT
+} file_search_mode;
 
-    return file_open(cx, obj, argc, argv, rval);
-}
+static const char *file_search_modes[] = { "lines", "offsets", "count", NULL };
 
-static JSBool file_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
-    FILE *f;
+typedef struct file_search_st {
+    /* the patterns, encoded as the file is, end to end */
+    unsigned char   *pats;
+    size_t          *lens;
+    int             npats;
 
-    if((f = JS_GetPrivate(cx, obj)) == NULL)
-        return JS_TRUE;
+    /* the automaton, when there's more than one. delta is a row of
+     * nclasses next states for each state, match the pattern spelled by a
+     * state or -1, dict the nearest suffix state with a match or -1, and
+     * same the next pattern that's the same as each one or -1 */
+    unsigned char   classes[256];
+    int             nclasses;
+    int32_t         *delta;
+    int32_t         *match;
+    int32_t         *dict;
+    int32_t         *same;
 
-    switch(JSVAL_TO_INT(id)) {
-        case FILE_EOF:
-            if(feof(f))
-                *vp = BOOLEAN_TO_JSVAL(JS_TRUE);
-            else
-                *vp = BOOLEAN_TO_JSVAL(JS_FALSE);
-            break;
-    }
+    FILE            *f;
+    file_search_mode mode;
+    file_encoding   enc;
+    jsval           callback;
+    JSObject        *results;
+    jsuint          found;
+    jsuint          limit;
+} *file_searcher;
 
-    return JS_TRUE;
+static void file_search_free(file_searcher s) {
+    free(s->pats);
+    free(s->lens);
+    free(s->delta);
+    free(s->match);
+    free(s->dict);
+    free(s->same);
 }
 
-static void file_finalize(JSContext *cx, JSObject *obj) {
-    FILE *f;
+static JSBool file_search_automaton(JSContext *cx, file_searcher s) {
+    int32_t *fail, *queue, states, next, st, t, c;
+    size_t total, i, off;
+    int p, head, tail;
 
-    if((f = JS_GetPrivate(cx, obj)) != NULL) {
-        fclose(f);
-        JS_SetPrivate(cx, obj, NULL);
-    }
-}
+    memset(s->classes, 0, sizeof(s->classes));
 
-static JSClass file_class = {
-    "File", JSCLASS_HAS_PRIVATE,
-    JS_PropertyStub, JS_PropertyStub, file_get_property, JS_PropertyStub,
-    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, file_finalize
-};
+    /* class 0 is every byte no pattern has */
+    for(total = 0, p = 0; p < s->npats; p++)
+        total += s->lens[p];
+    for(i = 0, s->nclasses = 1; i < total; i++)
+        if(s->classes[s->pats[i]] == 0)
+            s->classes[s->pats[i]] = s->nclasses++;
+
+    states = total + 1;
+    s->delta = (int32_t *) malloc(sizeof(int32_t) * states * s->nclasses);
+    s->match = (int32_t *) malloc(sizeof(int32_t) * states);
+    s->dict = (int32_t *) malloc(sizeof(int32_t) * states);
+    s->same = (int32_t *) malloc(sizeof(int32_t) * s->npats);
+    fail = (int32_t *) malloc(sizeof(int32_t) * states);
+    queue = (int32_t *) malloc(sizeof(int32_t) * states);
+
+    if(s->delta == NULL || s->match == NULL || s->dict == NULL || s->same == NULL || fail == NULL || queue == NULL) {
+        free(fail);
+        free(queue);
+        THROW("out of memory");
+    }
+
+    /* the trie first, -1 where there's no edge */
+    for(i = 0; i < (size_t) states * s->nclasses; i++)
+        s->delta[i] = -1;
+    for(i = 0; i < (size_t) states; i++)
+        s->match[i] = s->dict[i] = -1;
+
+    for(p = 0, off = 0, next = 1; p < s->npats; off += s->lens[p], p++) {
+        for(st = 0, i = 0; i < s->lens[p]; i++) {
+            c = s->classes[s->pats[off + i]];
+            if(s->delta[st * s->nclasses + c] < 0)
+                s->delta[st * s->nclasses + c] = next++;
+            st = s->delta[st * s->nclasses + c];
+        }
+        /* a repeated pattern goes on the end of the first one's list */
+        s->same[p] = -1;
+        if(s->match[st] < 0)
+            s->match[st] = p;
+        else {
+            for(t = s->match[st]; s->same[t] >= 0; t = s->same[t]);
+            s->same[t] = p;
+        }
+    }
+
+    /* then breadth first, filling each row and dict link from the fail
+     * state's, which are always done by then */
+    head = tail = 0;
+    for(c = 0; c < s->nclasses; c++) {
+        if((t = s->delta[c]) < 0)
+            s->delta[c] = 0;
+        else {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+
+    while(head < tail) {
+        st = queue[head++];
+
+        s->dict[st] = s->match[fail[st]] >= 0 ? fail[st] : s->dict[fail[st]];
+
+        for(c = 0; c < s->nclasses; c++) {
+            if((t = s->delta[st * s->nclasses + c]) < 0)
+                s->delta[st * s->nclasses + c] = s->delta[fail[st] * s->nclasses + c];
+            else {
+                fail[t] = s->delta[fail[st] * s->nclasses + c];
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    return JS_TRUE;
+}
+
+/* the patterns in the file's encoding. one string or an array of them */
+static JSBool file_search_init(JSContext *cx, file_searcher s, jsval v, file_encoding enc) {
+    JSObject *arr = NULL;
+    JSString *str;
+    unsigned char *pats;
+    jsuint n, i;
+    size_t len, size, used;
+    jsval ev;
+
+    memset(s, 0, sizeof(struct file_search_st));
+    s->enc = enc;
+
+    if(JSVAL_IS_OBJECT(v) && !JSVAL_IS_NULL(v) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(v))) {
+        arr = JSVAL_TO_OBJECT(v);
+        JS_GetArrayLength(cx, arr, &n);
+        ASSERT_THROW(n == 0, "no patterns to search for");
+    }
+    else
+        n = 1;
+
+    if((s->lens = (size_t *) malloc(sizeof(size_t) * n)) == NULL)
+        THROW("out of memory");
+    size = 0;
+
+    for(i = 0; i < n; i++) {
+        if(arr != NULL && !JS_GetElement(cx, arr, i, &ev))
+            return JS_FALSE;
+        if((str = JS_ValueToString(cx, arr != NULL ? ev : v)) == NULL)
+            return JS_FALSE;
+
+        len = JS_GetStringLength(str);
+        ASSERT_THROW(len == 0, "can't search for an empty pattern");
+
+        if((pats = (unsigned char *) realloc(s->pats, size + len * 3)) == NULL)
+            THROW("out of memory");
+        s->pats = pats;
+        s->lens[i] = amber_file_encode(JS_GetStringChars(str), len, JS_FALSE, &s->pats[size], enc, &used);
+        s->npats++;
+
+        ASSERT_THROW(memchr(&s->pats[size], '\n', s->lens[i]) != NULL, "patterns can't span lines");
+        size += s->lens[i];
+    }
+
+    if(s->npats > 1)
+        return file_search_automaton(cx, s);
+
+    return JS_TRUE;
+}
+
+/* the first occurrence of the one pattern at or after p */
+static const unsigned char *file_search_one(file_searcher s, const unsigned char *p, const unsigned char *end) {
+    const unsigned char *pat = s->pats;
+    size_t m = s->lens[0];
+
+    if(m == 1)
+        return memchr(p, pat[0], end - p);
+
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8(pat[0]), last = _mm_set1_epi8(pat[m - 1]);
+        unsigned int mask;
+        int bit;
+
+        /* a candidate needs both ends right, which rules out nearly
+         * everything sixteen positions at a time */
+        for(; end - p >= (ptrdiff_t) (m - 1 + 16); p += 16) {
+            mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *) p)),
+                    _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *) (p + m - 1)))));
+
+            while(mask != 0) {
+                bit = __builtin_ctz(mask);
+                if(memcmp(p + bit + 1, pat + 1, m - 2) == 0)
+                    return p + bit;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    if(p >= end)
+        return NULL;
+
+    return memmem(p, end - p, pat, m);
+}
+
+/* the start of the occurrence that ends first at or after p, and which
+ * pattern it is. the longest if several end there */
+static const unsigned char *file_search_many(file_searcher s, const unsigned char *p, const unsigned char *end, int *which) {
+    int32_t st = 0;
+
+    for(; p < end; p++) {
+        st = s->delta[st * s->nclasses + s->classes[*p]];
+        if(s->match[st] >= 0 || s->dict[st] >= 0) {
+            *which = s->match[st] >= 0 ? s->match[st] : s->match[s->dict[st]];
+            return p + 1 - s->lens[*which];
+        }
+    }
+
+    return NULL;
+}
+
+/* hand a match to the callback or keep it. 1 to go on, 0 to stop, -1 on error */
+static int file_search_found(JSContext *cx, JSObject *obj, file_searcher s, const unsigned char *buf, size_t len,
+                             off_t off, int which) {
+    JSString *str;
+    jsval args[2], ret;
+    JSBool ok, more;
+
+    s->found++;
+
+    if(s->mode != FILE_SEARCH_COUNT) {
+        args[0] = args[1] = JSVAL_VOID;
+
+        if(s->mode == FILE_SEARCH_LINES) {
+            if(len > 0 && buf[len - 1] == '\r')
+                len--;
+            if((str = file_decode(cx, (const char *) buf, len, s->enc)) == NULL)
+                return -1;
+            args[0] = STRING_TO_JSVAL(str);
+            if(!JS_NewNumberValue(cx, (jsdouble) off, &args[1]))
+                return -1;
+        }
+        else if(!JS_NewNumberValue(cx, (jsdouble) off, &args[0]))
+            return -1;
+        else
+            args[1] = INT_TO_JSVAL(which);
+
+        if(JSVAL_IS_VOID(s->callback)) {
+            if(!JS_SetElement(cx, s->results, s->found - 1, &args[0]))
+                return -1;
+        }
+
+        else {
+            JS_AddRoot(cx, &args[0]);
+            JS_AddRoot(cx, &args[1]);
+            ok = JS_CallFunctionValue(cx, obj, s->callback, 2, args, &ret);
+            JS_RemoveRoot(cx, &args[0]);
+            JS_RemoveRoot(cx, &args[1]);
+
+            if(!ok)
+                return -1;
+
+            /* the callback closed or reopened the file on us */
+            if(JS_GetPrivate(cx, obj) != s->f)
+                return 0;
+
+            /* false stops it, anything else carries on */
+            if(JSVAL_IS_BOOLEAN(ret) && JS_ValueToBoolean(cx, ret, &more) && !more)
+                return 0;
+        }
+    }
+
+    return s->limit == 0 || s->found < s->limit;
+}
+
+/* every occurrence of every pattern, overlapping and nested ones too. the
+ * automaton runs straight through, and at each byte the dict links give
+ * all the patterns ending there, longest first */
+static int file_search_offsets(JSContext *cx, JSObject *obj, file_searcher s, const unsigned char *buf, size_t len,
+                               off_t base, size_t *stop) {
+    const unsigned char *p;
+    int32_t st = 0, q, which;
+    int r;
+
+    for(p = buf; p < buf + len; p++) {
+        st = s->delta[st * s->nclasses + s->classes[*p]];
+
+        for(q = s->match[st] >= 0 ? st : s->dict[st]; q >= 0; q = s->dict[q]) {
+            for(which = s->match[q]; which >= 0; which = s->same[which]) {
+                r = file_search_found(cx, obj, s, NULL, 0, base + (p + 1 - s->lens[which] - buf), which);
+                if(r <= 0) {
+                    *stop = p + 1 - buf;
+                    return r;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* one block of whole lines. *stop is left where a stopped search got to */
+static int file_search_block(JSContext *cx, JSObject *obj, file_searcher s, const unsigned char *buf, size_t len,
+                             off_t base, size_t *stop) {
+    const unsigned char *p = buf, *end = buf + len, *hit, *line, *eol;
+    int which = 0, r;
+
+    if(s->mode == FILE_SEARCH_OFFSETS && s->npats > 1)
+        return file_search_offsets(cx, obj, s, buf, len, base, stop);
+
+    while(p < end) {
+        hit = s->npats == 1 ? file_search_one(s, p, end) : file_search_many(s, p, end, &which);
+        if(hit == NULL)
+            break;
+
+        if(s->mode == FILE_SEARCH_OFFSETS) {
+            p = hit + 1;
+            r = file_search_found(cx, obj, s, NULL, 0, base + (hit - buf), which);
+        }
+
+        else {
+            if((line = memrchr(buf, '\n', hit - buf)) == NULL)
+                line = buf;
+            else
+                line++;
+            if((eol = memchr(hit, '\n', end - hit)) == NULL)
+                eol = end;
+            p = eol < end ? eol + 1 : end;
+            r = file_search_found(cx, obj, s, line, eol - line, base + (line - buf), which);
+        }
+
+        if(r <= 0) {
+            *stop = p - buf;
+            return r;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * search(patterns [, options] [, callback]) from where the file is to its
+ * end. options are mode, one of "lines" (the default), "offsets" or
+ * "count", and limit, the most matches to take. lines gives an array of
+ * the matching lines and offsets the byte offset of every occurrence;
+ * count just counts matching lines. given a callback, lines are passed to
+ * it with their offsets, or offsets with the index of the pattern, and it
+ * can return false to stop; the number of matches is returned instead
+ */
+static JSBool file_search(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    struct file_search_st s;
+    JSObject *opts = NULL;
+    jsval v;
+    FILE *f;
+    unsigned char *buf, *nbuf;
+    size_t size, keep, n, len, stop;
+    off_t base, start;
+    int r, i, eof;
+    jsrefcount saved;
+    JSString *str;
+    int32 limit;
+    uintN cb = 1;
+
+    if((f = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(argc == 0, "nothing to search for");
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]) &&
+       JS_TypeOfValue(cx, argv[1]) != JSTYPE_FUNCTION) {
+        opts = JSVAL_TO_OBJECT(argv[1]);
+        cb = 2;
+    }
+
+    if(!file_search_init(cx, &s, argv[0], file_get_encoding(cx, obj)))
+        goto fail;
+    s.f = f;
+
+    if(argc > cb && !JSVAL_IS_VOID(argv[cb]) && !JSVAL_IS_NULL(argv[cb])) {
+        if(JS_TypeOfValue(cx, argv[cb]) != JSTYPE_FUNCTION) {
+            amber_exception_throw(cx, "callback must be a function");
+            goto fail;
+        }
+        s.callback = argv[cb];
+    }
+    else
+        s.callback = JSVAL_VOID;
+
+    if(opts != NULL) {
+        if(!JS_GetProperty(cx, opts, "mode", &v))
+            goto fail;
+        if(!JSVAL_IS_VOID(v)) {
+            if((str = JS_ValueToString(cx, v)) == NULL)
+                goto fail;
+            for(i = 0; file_search_modes[i] != NULL && strcmp(file_search_modes[i], JS_GetStringBytes(str)) != 0; i++);
+            if(file_search_modes[i] == NULL) {
+                amber_exception_throw(cx, "unknown search mode '%s'", JS_GetStringBytes(str));
+                goto fail;
+            }
+            s.mode = (file_search_mode) i;
+        }
+
+        if(!JS_GetProperty(cx, opts, "limit", &v))
+            goto fail;
+        if(!JSVAL_IS_VOID(v)) {
+            if(!JS_ValueToInt32(cx, v, &limit) || limit < 0) {
+                amber_exception_throw(cx, "limit can't be negative");
+                goto fail;
+            }
+            s.limit = limit;
+        }
+    }
+
+    /* the results go out as soon as they exist, which keeps them rooted */
+    if(s.mode == FILE_SEARCH_COUNT || !JSVAL_IS_VOID(s.callback))
+        *rval = INT_TO_JSVAL(0);
+    else {
+        if((s.results = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+            goto fail;
+        *rval = OBJECT_TO_JSVAL(s.results);
+    }
+
+    if((buf = (unsigned char *) malloc(size = FILE_SEARCH_BUFSIZE)) == NULL) {
+        amber_exception_throw(cx, "out of memory");
+        goto fail;
+    }
+
+    /* offsets are from the start of the file when we can tell where that is */
+    base = start = ftello(f);
+    if(base < 0)
+        base = 0;
+
+    keep = 0;
+    r = 1;
+    eof = 0;
+
+    while(!eof && r > 0) {
+        saved = JS_SuspendRequest(cx);
+        n = fread(&buf[keep], 1, size - keep, f);
+        JS_ResumeRequest(cx, saved);
+
+        if(ferror(f)) {
+            amber_exception_throw_code(cx, errno, "File", "read error: %s", strerror(errno));
+            free(buf);
+            goto fail;
+        }
+
+        eof = keep + n < size;
+        len = keep + n;
+
+        /* only whole lines until the end, growing for a line that won't fit */
+        if(!eof) {
+            for(len = keep + n; len > 0 && buf[len - 1] != '\n'; len--);
+            if(len == 0) {
+                keep = size;
+                if((nbuf = (unsigned char *) realloc(buf, size *= 2)) == NULL) {
+                    amber_exception_throw(cx, "out of memory");
+                    free(buf);
+                    goto fail;
+                }
+                buf = nbuf;
+                continue;
+            }
+        }
+
+        if((r = file_search_block(cx, obj, &s, buf, len, base, &stop)) < 0) {
+            free(buf);
+            goto fail;
+        }
+
+        /* stopped early, so put the file back just past what we looked at */
+        if(r == 0) {
+            if(JS_GetPrivate(cx, obj) == f && start >= 0)
+                fseeko(f, base + stop, SEEK_SET);
+            break;
+        }
+
+        keep = keep + n - len;
+        memmove(buf, &buf[len], keep);
+        base += len;
+    }
+
+    free(buf);
+    file_search_free(&s);
+
+    if(s.results == NULL && !JS_NewNumberValue(cx, (jsdouble) s.found, rval))
+        return JS_FALSE;
+
+    return JS_TRUE;
+
+fail:
+    file_search_free(&s);
+    return JS_FALSE;
+}
+
+/*
+ * moving bytes between files without bringing them into js. these work on
+ * the descriptors underneath, so stdio has to be flushed and resynced
+ * around them
+ */
+
+static int file_write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = write(fd, buf, len)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* plain read/write, for when the kernel won't do it for us. reads at *off
+ * if it's given */
+static off_t file_copy_rw(int sfd, off_t *off, int dfd, off_t len) {
+    off_t total = 0;
+    size_t want;
+    ssize_t n;
+    char *buf;
+
+    if((buf = malloc(FILE_COPY_BUFSIZE)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while(len < 0 || total < len) {
+        want = (len < 0 || len - total > FILE_COPY_BUFSIZE) ? FILE_COPY_BUFSIZE : len - total;
+
+        n = off != NULL ? pread(sfd, buf, want, *off) : read(sfd, buf, want);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(n == 0)
+            break;
+
+        if(file_write_all(dfd, buf, n) < 0) {
+            n = -1;
+            break;
+        }
+
+        if(off != NULL)
+            *off += n;
+        total += n;
+    }
+
+    free(buf);
+
+    return n < 0 ? -1 : total;
+}
+
+/* seekable source. copy_file_range keeps it all in the kernel (and lets
+ * filesystems that can share extents do so), sendfile covers the cases it
+ * refuses, like appending or a socket on the other end */
+static off_t file_copy_fds(int sfd, off_t *off, int dfd, off_t len) {
+    off_t total = 0;
+    size_t want;
+    ssize_t n;
+    int sf = 0;
+
+    while(len < 0 || total < len) {
+        want = (len < 0 || len - total > FILE_COPY_CHUNK) ? FILE_COPY_CHUNK : len - total;
+
+        if(!sf) {
+            if((n = copy_file_range(sfd, off, dfd, NULL, want, 0)) < 0 &&
+               (errno == EXDEV || errno == EINVAL || errno == EBADF || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                sf = 1;
+                continue;
+            }
+        }
+        else if((n = sendfile(dfd, sfd, off, want)) < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            if((n = file_copy_rw(sfd, off, dfd, len < 0 ? -1 : len - total)) < 0)
+                return -1;
+            return total + n;
+        }
+
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(n == 0)
+            break;
+
+        total += n;
+    }
+
+    return total;
+}
+
+/* stream source or destination. splice needs a pipe on one side, so if
+ * neither is one we go through a pipe of our own */
+static off_t file_splice_fds(int sfd, int dfd, off_t len) {
+    struct stat st;
+    off_t total = 0;
+    size_t want;
+    ssize_t n, m, left;
+    int p[2] = { -1, -1 }, err;
+
+    if(!(fstat(sfd, &st) == 0 && S_ISFIFO(st.st_mode)) && !(fstat(dfd, &st) == 0 && S_ISFIFO(st.st_mode))) {
+        if(pipe2(p, O_CLOEXEC) < 0)
+            return file_copy_rw(sfd, NULL, dfd, len);
+        fcntl(p[1], F_SETPIPE_SZ, FILE_SPLICE_CHUNK);
+    }
+
+    while(len < 0 || total < len) {
+        want = (len < 0 || len - total > FILE_SPLICE_CHUNK) ? FILE_SPLICE_CHUNK : len - total;
+
+        n = splice(sfd, NULL, p[1] < 0 ? dfd : p[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+
+            /* some files can't be spliced at all */
+            if(errno == EINVAL && total == 0) {
+                if(p[0] >= 0) {
+                    close(p[0]);
+                    close(p[1]);
+                }
+                return file_copy_rw(sfd, NULL, dfd, len);
+            }
+            break;
+        }
+        if(n == 0)
+            break;
+
+        for(left = n; p[0] >= 0 && left > 0; left -= m) {
+            if((m = splice(p[0], NULL, dfd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0) {
+                if(m < 0 && errno == EINTR) {
+                    m = 0;
+                    continue;
+                }
+                if(m == 0)
+                    errno = EPIPE;
+                n = -1;
+                break;
+            }
+        }
+        if(n < 0)
+            break;
+
+        total += n;
+    }
+
+    err = errno;
+    if(p[0] >= 0) {
+        close(p[0]);
+        close(p[1]);
+    }
+    errno = err;
+
+    return n < 0 ? -1 : total;
+}
+
+/* anything stdio has already pulled off the source has to go out first or
+ * the kernel side would skip over it. glibc is the only one that tells us
+ * how much that is */
+static off_t file_drain(FILE *src, FILE *dest, off_t len) {
+    char buf[4096];
+    size_t avail = 0, n;
+    off_t total = 0;
+
+#ifdef __GLIBC__
+    avail = src->_IO_read_end - src->_IO_read_ptr;
+#endif
+
+    if(len >= 0 && avail > len)
+        avail = len;
+
+    while(avail > 0) {
+        n = fread(buf, sizeof(char), avail > sizeof(buf) ? sizeof(buf) : avail, src);
+        if(n == 0 || fwrite(buf, sizeof(char), n, dest) != n)
+            return -1;
+        avail -= n;
+        total += n;
+    }
+
+    return total;
+}
+
+/* through stdio, for the compressed streams that have no descriptor */
+static off_t file_copy_stdio(FILE *src, FILE *dest, off_t len) {
+    char *buf;
+    size_t n;
+    off_t total = 0;
+
+    if((buf = malloc(FILE_COPY_BUFSIZE)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while(len < 0 || total < len) {
+        n = fread(buf, sizeof(char), (len < 0 || len - total > FILE_COPY_BUFSIZE) ? FILE_COPY_BUFSIZE : len - total, src);
+        if(n == 0 || fwrite(buf, sizeof(char), n, dest) != n)
+            break;
+        total += n;
+    }
+
+    free(buf);
+
+    if(ferror(src) || ferror(dest)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return total;
+}
+
+static JSBool file_transfer(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval, JSBool use_splice) {
+    FILE *src, *dest;
+    JSString *str;
+    char *name = NULL;
+    jsdouble d;
+    off_t offset = -1, len = -1, pos, total, drained;
+    int sfd, dfd, err = 0;
+    jsrefcount saved;
+
+    if((src = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(argc == 0, "no destination specified");
+
+    /* a File, or a filename to create */
+    if((dest = amber_file_stream(cx, argv[0])) == NULL) {
+        ASSERT_THROW(JSVAL_IS_OBJECT(argv[0]), "destination File is closed");
+
+        if((str = JS_ValueToString(cx, argv[0])) == NULL)
+            THROW("couldn't convert destination to string");
+        name = JS_GetStringBytes(str);
+
+        dest = fopen(name, "w");
+        ASSERT_THROW_CODE(dest == NULL, errno, "File", "couldn't open '%s' with mode 'w': %s", name, strerror(errno));
+    }
+
+    /* copyTo(dest, offset, length), pipeTo(dest, length) */
+    if(!use_splice && argc > 1 && !JSVAL_IS_VOID(argv[1]) && !JSVAL_IS_NULL(argv[1])) {
+        if(JS_ValueToNumber(cx, argv[1], &d) == JS_FALSE || d < 0)
+            goto badarg;
+        offset = (off_t) d;
+    }
+    if(argc > (use_splice ? 1 : 2) && !JSVAL_IS_VOID(argv[use_splice ? 1 : 2])) {
+        if(JS_ValueToNumber(cx, argv[use_splice ? 1 : 2], &d) == JS_FALSE || d < 0)
+            goto badarg;
+        len = (off_t) d;
+    }
+
+    sfd = fileno(src);
+    dfd = fileno(dest);
+
+    saved = JS_SuspendRequest(cx);
+
+    total = -1;
+
+    if(fflush(dest) != 0)
+        err = errno;
+
+    else if(sfd < 0 || dfd < 0) {
+        if(offset >= 0)
+            err = ESPIPE;
+        else if((total = file_copy_stdio(src, dest, len)) < 0)
+            err = errno;
+    }
+
+    else if(!use_splice && (pos = ftello(src)) >= 0 && lseek(sfd, 0, SEEK_CUR) >= 0) {
+        if(offset < 0) {
+            /* carry on from where we are and leave the file after it, same
+             * as a read. otherwise leave the position alone */
+            if((total = file_copy_fds(sfd, &pos, dfd, len)) < 0)
+                err = errno;
+            fseeko(src, pos, SEEK_SET);
+        }
+        else if((total = file_copy_fds(sfd, &offset, dfd, len)) < 0)
+            err = errno;
+    }
+
+    else if(offset >= 0)
+        err = ESPIPE;
+
+    else {
+        /* bring the descriptor up to where stdio thinks we are */
+        if((pos = ftello(src)) >= 0)
+            fseeko(src, pos, SEEK_SET);
+
+        if((drained = file_drain(src, dest, len)) < 0 || fflush(dest) != 0)
+            err = errno != 0 ? errno : EIO;
+        else if(len >= 0 && drained == len)
+            total = drained;
+        else if((total = file_splice_fds(sfd, dfd, len < 0 ? -1 : len - drained)) < 0)
+            err = errno;
+        else
+            total += drained;
+
+        if(pos >= 0 && (pos = lseek(sfd, 0, SEEK_CUR)) >= 0)
+            fseeko(src, pos, SEEK_SET);
+    }
+
+    /* and make stdio on the other side notice where the descriptor went */
+    if(dfd >= 0 && (pos = lseek(dfd, 0, SEEK_CUR)) >= 0)
+        fseeko(dest, pos, SEEK_SET);
+
+    JS_ResumeRequest(cx, saved);
+
+    if(name != NULL)
+        fclose(dest);
+
+    ASSERT_THROW(err != 0, "copy failed: %s", strerror(err));
+
+    return JS_NewNumberValue(cx, (jsdouble) total, rval);
+
+badarg:
+    if(name != NULL)
+        fclose(dest);
+    THROW("offset and length must be positive numbers");
+}
+
+static JSBool file_copyto(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return file_transfer(cx, obj, argc, argv, rval, JS_FALSE);
+}
+
+static JSBool file_pipeto(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return file_transfer(cx, obj, argc, argv, rval, JS_TRUE);
+}
+
+/* one-shot (de)compression of strings. bytes are the low half of each char,
+ * same as read() and write() */
+static JSBool file_compress(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JSString *str;
+    file_codec codec = FILE_CODEC_GZIP;
+    int32 level = -1;
+    char *in, *out = NULL;
+    size_t inlen, outlen = 0;
+
+    ASSERT_THROW(argc == 0, "nothing to compress");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert argument to string");
+    in = JS_GetStringBytes(str);
+    inlen = JS_GetStringLength(str);
+
+    if(argc > 1 && file_codec_from_value(cx, argv[1], &codec) == JS_FALSE)
+        return JS_FALSE;
+
+    if(argc > 2)
+        ASSERT_THROW(JS_ValueToInt32(cx, argv[2], &level) == JS_FALSE,
+                     "couldn't convert level to an integer");
+
+    switch(codec) {
+#ifdef FILE_GZIP
+        case FILE_CODEC_GZIP:
+        case FILE_CODEC_ZLIB: {
+            z_stream zs;
+            int ret;
+
+            memset(&zs, 0, sizeof(z_stream));
+            ASSERT_THROW(deflateInit2(&zs, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED,
+                                      codec == FILE_CODEC_GZIP ? 31 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK,
+                         "couldn't initialise compressor");
+
+            outlen = deflateBound(&zs, inlen);
+            if((out = JS_malloc(cx, outlen + 1)) == NULL) {
+                deflateEnd(&zs);
+                return JS_FALSE;
+            }
+
+            zs.next_in = (Bytef *) in;
+            zs.avail_in = inlen;
+            zs.next_out = (Bytef *) out;
+            zs.avail_out = outlen;
+
+            ret = deflate(&zs, Z_FINISH);
+            outlen = zs.total_out;
+            deflateEnd(&zs);
+
+            if(ret != Z_STREAM_END) {
+                JS_free(cx, out);
+                THROW("compression failed");
+            }
+            break;
+        }
+#endif
+
+#ifdef FILE_ZSTD
+        case FILE_CODEC_ZSTD: {
+            size_t ret;
+
+            outlen = ZSTD_compressBound(inlen);
+            if((out = JS_malloc(cx, outlen + 1)) == NULL)
+                return JS_FALSE;
+
+            ret = ZSTD_compress(out, outlen, in, inlen, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+            if(ZSTD_isError(ret)) {
+                JS_free(cx, out);
+                THROW("compression failed: %s", ZSTD_getErrorName(ret));
+            }
+            outlen = ret;
+            break;
+        }
+#endif
+
+        default:
+            *rval = STRING_TO_JSVAL(str);
+            return JS_TRUE;
+    }
+
+    out[outlen] = '\0';
+    *rval = STRING_TO_JSVAL(JS_NewString(cx, out, outlen));
+
+    return JS_TRUE;
+}
+
+static JSBool file_decompress(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JSString *str;
+    file_codec codec;
+    unsigned char *in;
+    char *out = NULL;
+    size_t inlen, outlen = 0, outsize;
+
+    ASSERT_THROW(argc == 0, "nothing to decompress");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert argument to string");
+    in = (unsigned char *) JS_GetStringBytes(str);
+    inlen = JS_GetStringLength(str);
+
+    if(argc > 1) {
+        if(file_codec_from_value(cx, argv[1], &codec) == JS_FALSE)
+            return JS_FALSE;
+    }
+
+    /* sniff it. zlib inflate handles gzip headers too */
+    else if(inlen >= 4 && in[0] == 0x28 && in[1] == 0xb5 && in[2] == 0x2f && in[3] == 0xfd)
+        codec = FILE_CODEC_ZSTD;
+    else
+        codec = FILE_CODEC_GZIP;
+
+    outsize = inlen * 4 + 1024;
+
+    switch(codec) {
+#ifdef FILE_GZIP
+        case FILE_CODEC_GZIP:
+        case FILE_CODEC_ZLIB: {
+            z_stream zs;
+            int ret;
+
+            memset(&zs, 0, sizeof(z_stream));
+            ASSERT_THROW(inflateInit2(&zs, 47) != Z_OK, "couldn't initialise decompressor");
+
+            zs.next_in = in;
+            zs.avail_in = inlen;
+
+            do {
+                if(out == NULL || zs.avail_out == 0) {
+                    if(out != NULL)
+                        outsize *= 2;
+                    if((out = JS_realloc(cx, out, outsize + 1)) == NULL) {
+                        inflateEnd(&zs);
+                        return JS_FALSE;
+                    }
+                    zs.next_out = (Bytef *) &out[zs.total_out];
+                    zs.avail_out = outsize - zs.total_out;
+                }
+
+                ret = inflate(&zs, Z_NO_FLUSH);
+            } while(ret == Z_OK || (ret == Z_BUF_ERROR && zs.avail_out == 0));
+
+            outlen = zs.total_out;
+            inflateEnd(&zs);
+
+            if(ret != Z_STREAM_END) {
+                JS_free(cx, out);
+                THROW("decompression failed: %s", ret == Z_BUF_ERROR ? "truncated input" : "corrupt input");
+            }
+            break;
+        }
+#endif
+
+#ifdef FILE_ZSTD
+        case FILE_CODEC_ZSTD: {
+            ZSTD_DCtx *dctx;
+            ZSTD_inBuffer zin = { in, inlen, 0 };
+            ZSTD_outBuffer zout = { NULL, 0, 0 };
+            size_t ret;
+
+            ASSERT_THROW((dctx = ZSTD_createDCtx()) == NULL, "couldn't initialise decompressor");
+
+            do {
+                if(zout.pos == zout.size) {
+                    if(out != NULL)
+                        outsize *= 2;
+                    if((out = JS_realloc(cx, out, outsize + 1)) == NULL) {
+                        ZSTD_freeDCtx(dctx);
+                        return JS_FALSE;
+                    }
+                    zout.dst = out;
+                    zout.size = outsize;
+                }
+
+                ret = ZSTD_decompressStream(dctx, &zout, &zin);
+            } while(!ZSTD_isError(ret) && (zin.pos < zin.size || zout.pos == zout.size));
+
+            outlen = zout.pos;
+            ZSTD_freeDCtx(dctx);
+
+            if(ZSTD_isError(ret) || ret != 0) {
+                JS_free(cx, out);
+                THROW("decompression failed: %s", ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "truncated input");
+            }
+            break;
+        }
+#endif
+
+        default:
+            *rval = STRING_TO_JSVAL(str);
+            return JS_TRUE;
+    }
+
+    out[outlen] = '\0';
+    *rval = STRING_TO_JSVAL(JS_NewString(cx, out, outlen));
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec file_methods[] = {
+    { "open",       file_open,      4, 0 },
+    { "close",      file_close,     0, 0 },
+    { "read",       file_read,      1, 0 },
+    { "write",      file_write,     1, 0 },
+    { "print",      file_print,     0, 0 },
+    { "readline",   file_readline,  0, 0 },
+    { "copyTo",     file_copyto,    3, 0 },
+    { "pipeTo",     file_pipeto,    2, 0 },
+    { "search",     file_search,    3, 0 },
+    { NULL }
+};
+
+static JSFunctionSpec file_static_methods[] = {
+    { "compress",   file_compress,      3, 0 },
+    { "decompress", file_decompress,    2, 0 },
+    { NULL }
+};
+
+enum file_tinyid {
+    FILE_EOF,
+    FILE_ENCODING
+};
+
+static JSPropertySpec file_properties[] = {
+    { "eof",        FILE_EOF,       JSPROP_ENUMERATE | JSPROP_READONLY },
+    { "encoding",   FILE_ENCODING,  JSPROP_ENUMERATE | JSPROP_PERMANENT },
+    { NULL }
+};
+
+static JSBool file_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    if(argc == 0) {
+        JS_SetPrivate(cx, obj, NULL);
+        return JS_TRUE;
+    }
+
+    return file_open(cx, obj, argc, argv, rval);
+}
+
+static JSBool file_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    FILE *f;
+    file_encoding enc;
+    int i;
+
+    if(!JSVAL_IS_INT(id))
+        return JS_TRUE;
+
+    if(JSVAL_TO_INT(id) == FILE_ENCODING) {
+        enc = file_get_encoding(cx, obj);
+        for(i = 0; file_encoding_names[i].enc != enc; i++)
+            ;
+        *vp = STRING_TO_JSVAL(JS_NewStringCopyZ(cx, file_encoding_names[i].name));
+        return JS_TRUE;
+    }
+
+    if((f = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case FILE_EOF:
+            if(feof(f))
+                *vp = BOOLEAN_TO_JSVAL(JS_TRUE);
+            else
+                *vp = BOOLEAN_TO_JSVAL(JS_FALSE);
+            break;
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool file_set_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    file_encoding enc;
+
+    if(!JSVAL_IS_INT(id) || JSVAL_TO_INT(id) != FILE_ENCODING)
+        return JS_TRUE;
+
+    if(file_encoding_from_value(cx, *vp, &enc) == JS_FALSE)
+        return JS_FALSE;
+
+    return JS_SetReservedSlot(cx, obj, 0, INT_TO_JSVAL(enc));
+}
+
+static void file_finalize(JSContext *cx, JSObject *obj) {
+    FILE *f;
+
+    if((f = JS_GetPrivate(cx, obj)) != NULL) {
+        file_release(f);
+        JS_SetPrivate(cx, obj, NULL);
+    }
+}
+
+static JSClass file_class = {
+    "File", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, file_get_property, file_set_property,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, file_finalize
+};
 
 JSBool File(JSContext *cx, JSObject *amber) {
-    JSObject *file;
+    JSObject *file, *ctor, *obj;
+    static const struct {
+        const char  *name;
+        int         fd;
+    } std[] = {
+        { "stdin",  0 },
+        { "stdout", 1 },
+        { "stderr", 2 }
+    };
+    int i;
 
     file = JS_InitClass(cx, amber, NULL, &file_class,
-                        file_constructor, 2,
+                        file_constructor, 4,
                         file_properties, file_methods,
-                        NULL, NULL);
+                        NULL, file_static_methods);
+
+    /* ready-made Files for the standard streams. they're never closed */
+    ctor = JS_GetConstructor(cx, file);
+    for(i = 0; i < 3; i++) {
+        if((obj = JS_NewObject(cx, &file_class, file, NULL)) == NULL)
+            return JS_FALSE;
+        JS_SetPrivate(cx, obj, std[i].fd == 0 ? stdin : std[i].fd == 1 ? stdout : stderr);
+        if(!JS_DefineProperty(cx, ctor, std[i].name, OBJECT_TO_JSVAL(obj), NULL, NULL,
+                              JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT))
+            return JS_FALSE;
+    }
 
     return JS_TRUE;
 }
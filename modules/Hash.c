@@ -0,0 +1,623 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <jsapi.h>
+
+#define HASH_BUFSIZE    (1024 * 1024)
+
+typedef enum hash_alg {
+    HASH_CRC32C,
+    HASH_XXH64,
+    HASH_SHA256
+} hash_alg;
+
+static const char *hash_names[] = { "crc32c", "xxh64", "sha256", NULL };
+
+typedef struct xxh64_state_st {
+    uint64_t    v[4];
+    uint64_t    total;
+    unsigned char mem[32];
+    int         memlen;
+} xxh64_state;
+
+typedef struct sha256_state_st {
+    uint32_t    h[8];
+    uint64_t    total;
+    unsigned char mem[64];
+    int         memlen;
+} sha256_state;
+
+typedef struct hash_stuff {
+    hash_alg    alg;
+    union {
+        uint32_t        crc;
+        xxh64_state     xxh;
+        sha256_state    sha;
+    } u;
+} *hash_stuff;
+
+/*
+ * crc32c. software is slice-by-8, but x86 has had an instruction for this
+ * since sse4.2 and we use it when the cpu says it's there
+ */
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t w;
+
+    crc = ~crc;
+
+    while(len >= 8) {
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xff] ^ crc32c_table[6][(w >> 8) & 0xff] ^
+              crc32c_table[5][(w >> 16) & 0xff] ^ crc32c_table[4][(w >> 24) & 0xff] ^
+              crc32c_table[3][(w >> 32) & 0xff] ^ crc32c_table[2][(w >> 40) & 0xff] ^
+              crc32c_table[1][(w >> 48) & 0xff] ^ crc32c_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+
+    while(len-- > 0)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = ~crc, w;
+
+    while(len >= 8) {
+        memcpy(&w, p, 8);
+        c = __builtin_ia32_crc32di(c, w);
+        p += 8;
+        len -= 8;
+    }
+
+    while(len-- > 0)
+        c = __builtin_ia32_crc32qi(c, *p++);
+
+    return ~c;
+}
+#endif
+
+static uint32_t (*crc32c)(uint32_t crc, const unsigned char *p, size_t len) = crc32c_sw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* every context loads the module, but the tables only need building once */
+static void crc32c_init(void) {
+    uint32_t c;
+    int i, j;
+
+    for(i = 0; i < 256; i++) {
+        c = i;
+        for(j = 0; j < 8; j++)
+            c = (c >> 1) ^ (0x82f63b78 & -(c & 1));
+        crc32c_table[0][i] = c;
+    }
+
+    for(i = 0; i < 256; i++)
+        for(j = 1; j < 8; j++)
+            crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xff] ^ (crc32c_table[j - 1][i] >> 8);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2"))
+        crc32c = crc32c_hw;
+#endif
+}
+
+/*
+ * xxhash64
+ */
+
+#define XXH_P1  (11400714785074694791ULL)
+#define XXH_P2  (14029467366897019727ULL)
+#define XXH_P3  (1609587929392839161ULL)
+#define XXH_P4  (9650029242287828579ULL)
+#define XXH_P5  (2870177450012600261ULL)
+
+#define XXH_ROTL(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t xxh64_read(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t in) {
+    acc += in * XXH_P2;
+    acc = XXH_ROTL(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_reset(xxh64_state *s) {
+    memset(s, 0, sizeof(xxh64_state));
+    s->v[0] = XXH_P1 + XXH_P2;
+    s->v[1] = XXH_P2;
+    s->v[2] = 0;
+    s->v[3] = -XXH_P1;
+}
+
+static void xxh64_update(xxh64_state *s, const unsigned char *p, size_t len) {
+    const unsigned char *end = p + len;
+    int n;
+
+    s->total += len;
+
+    if(s->memlen > 0) {
+        n = 32 - s->memlen;
+        if(len < n) {
+            memcpy(&s->mem[s->memlen], p, len);
+            s->memlen += len;
+            return;
+        }
+        memcpy(&s->mem[s->memlen], p, n);
+        p += n;
+        s->v[0] = xxh64_round(s->v[0], xxh64_read(&s->mem[0]));
+        s->v[1] = xxh64_round(s->v[1], xxh64_read(&s->mem[8]));
+        s->v[2] = xxh64_round(s->v[2], xxh64_read(&s->mem[16]));
+        s->v[3] = xxh64_round(s->v[3], xxh64_read(&s->mem[24]));
+        s->memlen = 0;
+    }
+
+    while(end - p >= 32) {
+        s->v[0] = xxh64_round(s->v[0], xxh64_read(p));
+        s->v[1] = xxh64_round(s->v[1], xxh64_read(p + 8));
+        s->v[2] = xxh64_round(s->v[2], xxh64_read(p + 16));
+        s->v[3] = xxh64_round(s->v[3], xxh64_read(p + 24));
+        p += 32;
+    }
+
+    if(p < end) {
+        memcpy(s->mem, p, end - p);
+        s->memlen = end - p;
+    }
+}
+
+static uint64_t xxh64_digest(xxh64_state *s) {
+    const unsigned char *p = s->mem, *end = s->mem + s->memlen;
+    uint64_t h;
+    uint32_t w;
+
+    if(s->total >= 32) {
+        h = XXH_ROTL(s->v[0], 1) + XXH_ROTL(s->v[1], 7) + XXH_ROTL(s->v[2], 12) + XXH_ROTL(s->v[3], 18);
+        h = xxh64_merge(h, s->v[0]);
+        h = xxh64_merge(h, s->v[1]);
+        h = xxh64_merge(h, s->v[2]);
+        h = xxh64_merge(h, s->v[3]);
+    }
+    else
+        h = s->v[2] + XXH_P5;
+
+    h += s->total;
+
+    while(end - p >= 8) {
+        h ^= xxh64_round(0, xxh64_read(p));
+        h = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+
+    if(end - p >= 4) {
+        memcpy(&w, p, 4);
+        h ^= (uint64_t) w * XXH_P1;
+        h = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+
+    while(p < end) {
+        h ^= (*p++) * XXH_P5;
+        h = XXH_ROTL(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/*
+ * sha-256
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA_ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256_state *s, const unsigned char *p) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for(i = 0; i < 16; i++)
+        w[i] = ((uint32_t) p[i * 4] << 24) | ((uint32_t) p[i * 4 + 1] << 16) | ((uint32_t) p[i * 4 + 2] << 8) | p[i * 4 + 3];
+
+    for(i = 16; i < 64; i++)
+        w[i] = (SHA_ROTR(w[i - 2], 17) ^ SHA_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+               (SHA_ROTR(w[i - 15], 7) ^ SHA_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+
+    for(i = 0; i < 64; i++) {
+        t1 = h + (SHA_ROTR(e, 6) ^ SHA_ROTR(e, 11) ^ SHA_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (SHA_ROTR(a, 2) ^ SHA_ROTR(a, 13) ^ SHA_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void sha256_reset(sha256_state *s) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(s->h, init, sizeof(init));
+    s->total = 0;
+    s->memlen = 0;
+}
+
+static void sha256_update(sha256_state *s, const unsigned char *p, size_t len) {
+    int n;
+
+    s->total += len;
+
+    if(s->memlen > 0) {
+        n = 64 - s->memlen;
+        if(len < n) {
+            memcpy(&s->mem[s->memlen], p, len);
+            s->memlen += len;
+            return;
+        }
+        memcpy(&s->mem[s->memlen], p, n);
+        sha256_block(s, s->mem);
+        p += n;
+        len -= n;
+        s->memlen = 0;
+    }
+
+    while(len >= 64) {
+        sha256_block(s, p);
+        p += 64;
+        len -= 64;
+    }
+
+    memcpy(s->mem, p, len);
+    s->memlen = len;
+}
+
+static void sha256_digest(sha256_state *s, unsigned char *out) {
+    uint64_t bits = s->total * 8;
+    int i;
+
+    s->mem[s->memlen++] = 0x80;
+    if(s->memlen > 56) {
+        memset(&s->mem[s->memlen], 0, 64 - s->memlen);
+        sha256_block(s, s->mem);
+        s->memlen = 0;
+    }
+
+    memset(&s->mem[s->memlen], 0, 56 - s->memlen);
+    for(i = 0; i < 8; i++)
+        s->mem[56 + i] = bits >> (56 - i * 8);
+    sha256_block(s, s->mem);
+
+    for(i = 0; i < 32; i++)
+        out[i] = s->h[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/*
+ * common
+ */
+
+static void hash_reset(hash_stuff hs) {
+    switch(hs->alg) {
+        case HASH_CRC32C:
+            hs->u.crc = 0;
+            break;
+
+        case HASH_XXH64:
+            xxh64_reset(&hs->u.xxh);
+            break;
+
+        case HASH_SHA256:
+            sha256_reset(&hs->u.sha);
+            break;
+    }
+}
+
+static void hash_update(hash_stuff hs, const unsigned char *p, size_t len) {
+    switch(hs->alg) {
+        case HASH_CRC32C:
+            hs->u.crc = crc32c(hs->u.crc, p, len);
+            break;
+
+        case HASH_XXH64:
+            xxh64_update(&hs->u.xxh, p, len);
+            break;
+
+        case HASH_SHA256:
+            sha256_update(&hs->u.sha, p, len);
+            break;
+    }
+}
+
+/* hex digest as a js string. the state is finished with afterwards */
+static JSString *hash_digest(JSContext *cx, hash_stuff hs) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char out[32];
+    char buf[65];
+    int len = 0, i;
+    uint64_t h;
+
+    switch(hs->alg) {
+        case HASH_CRC32C:
+            for(i = 0; i < 4; i++)
+                out[i] = hs->u.crc >> (24 - i * 8);
+            len = 4;
+            break;
+
+        case HASH_XXH64:
+            h = xxh64_digest(&hs->u.xxh);
+            for(i = 0; i < 8; i++)
+                out[i] = h >> (56 - i * 8);
+            len = 8;
+            break;
+
+        case HASH_SHA256:
+            sha256_digest(&hs->u.sha, out);
+            len = 32;
+            break;
+    }
+
+    for(i = 0; i < len; i++) {
+        buf[i * 2] = hex[out[i] >> 4];
+        buf[i * 2 + 1] = hex[out[i] & 0xf];
+    }
+    buf[len * 2] = '\0';
+
+    return JS_NewStringCopyN(cx, buf, len * 2);
+}
+
+static JSBool hash_alg_from(JSContext *cx, jsval v, hash_alg *alg) {
+    JSString *str;
+    char *name;
+    int i;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; hash_names[i] != NULL; i++)
+        if(strcmp(name, hash_names[i]) == 0) {
+            *alg = (hash_alg) i;
+            return JS_TRUE;
+        }
+
+    THROW("unknown hash algorithm '%s'", name);
+}
+
+/* feed a whole file through, outside any request so other threads can run */
+static int hash_fd(hash_stuff hs, int fd) {
+    unsigned char *buf;
+    ssize_t n;
+
+    if(posix_memalign((void **) &buf, 4096, HASH_BUFSIZE) != 0)
+        return -1;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while((n = read(fd, buf, HASH_BUFSIZE)) != 0) {
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+
+        hash_update(hs, buf, n);
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+static JSBool hash_update_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    hash_stuff hs;
+    JSString *str;
+    uintN i;
+    FILE *f;
+
+    if((hs = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    for(i = 0; i < argc; i++) {
+        /* a File gets read from where it is to the end */
+        if((f = amber_file_stream(cx, argv[i])) != NULL) {
+            unsigned char buf[65536];
+            size_t n;
+
+            while((n = fread(buf, sizeof(char), sizeof(buf), f)) > 0)
+                hash_update(hs, buf, n);
+            ASSERT_THROW(ferror(f), "read error");
+            continue;
+        }
+
+        if((str = JS_ValueToString(cx, argv[i])) == NULL)
+            THROW("couldn't convert argument to string");
+
+        hash_update(hs, (unsigned char *) JS_GetStringBytes(str), JS_GetStringLength(str));
+    }
+
+    *rval = OBJECT_TO_JSVAL(obj);
+
+    return JS_TRUE;
+}
+
+static JSBool hash_digest_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    hash_stuff hs;
+
+    if((hs = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    *rval = STRING_TO_JSVAL(hash_digest(cx, hs));
+    hash_reset(hs);
+
+    return JS_TRUE;
+}
+
+static JSBool hash_reset_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    hash_stuff hs;
+
+    if((hs = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    hash_reset(hs);
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec hash_methods[] = {
+    { "update",     hash_update_method, 1, 0 },
+    { "digest",     hash_digest_method, 0, 0 },
+    { "reset",      hash_reset_method,  0, 0 },
+    { NULL }
+};
+
+static JSBool hash_hash(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    struct hash_stuff hs;
+    JSString *str;
+
+    ASSERT_THROW(argc < 2, "need an algorithm and something to hash");
+
+    if(hash_alg_from(cx, argv[0], &hs.alg) == JS_FALSE)
+        return JS_FALSE;
+
+    if((str = JS_ValueToString(cx, argv[1])) == NULL)
+        THROW("couldn't convert argument to string");
+
+    hash_reset(&hs);
+    hash_update(&hs, (unsigned char *) JS_GetStringBytes(str), JS_GetStringLength(str));
+
+    *rval = STRING_TO_JSVAL(hash_digest(cx, &hs));
+
+    return JS_TRUE;
+}
+
+static JSBool hash_hashfile(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    struct hash_stuff hs;
+    JSString *str;
+    char *name;
+    jsrefcount saved;
+    int fd, ret, err;
+
+    ASSERT_THROW(argc < 2, "need an algorithm and a filename");
+
+    if(hash_alg_from(cx, argv[0], &hs.alg) == JS_FALSE)
+        return JS_FALSE;
+
+    if((str = JS_ValueToString(cx, argv[1])) == NULL)
+        THROW("couldn't convert argument to string");
+    name = JS_GetStringBytes(str);
+
+    fd = open(name, O_RDONLY);
+    ASSERT_THROW_CODE(fd < 0, errno, "Hash", "couldn't open '%s': %s", name, strerror(errno));
+
+    hash_reset(&hs);
+
+    saved = JS_SuspendRequest(cx);
+    ret = hash_fd(&hs, fd);
+    err = errno;
+    JS_ResumeRequest(cx, saved);
+
+    close(fd);
+
+    ASSERT_THROW(ret < 0, "couldn't read '%s': %s", name, strerror(err));
+
+    *rval = STRING_TO_JSVAL(hash_digest(cx, &hs));
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec hash_static_methods[] = {
+    { "hash",       hash_hash,      2, 0 },
+    { "hashFile",   hash_hashfile,  2, 0 },
+    { NULL }
+};
+
+static JSBool hash_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    hash_stuff hs;
+    hash_alg alg;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc == 0, "no hash algorithm specified");
+
+    if(hash_alg_from(cx, argv[0], &alg) == JS_FALSE)
+        return JS_FALSE;
+
+    hs = JS_malloc(cx, sizeof(struct hash_stuff));
+    hs->alg = alg;
+    hash_reset(hs);
+
+    JS_SetPrivate(cx, obj, hs);
+
+    return JS_TRUE;
+}
+
+static void hash_finalize(JSContext *cx, JSObject *obj) {
+    hash_stuff hs;
+
+    if((hs = JS_GetPrivate(cx, obj)) != NULL)
+        JS_free(cx, hs);
+}
+
+static JSClass hash_class = {
+    "Hash", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, hash_finalize
+};
+
+JSBool Hash(JSContext *cx, JSObject *amber) {
+    JSObject *hash;
+
+    pthread_once(&crc32c_once, crc32c_init);
+
+    hash = JS_InitClass(cx, amber, NULL, &hash_class,
+                        hash_constructor, 1,
+                        NULL, hash_methods,
+                        NULL, hash_static_methods);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,1076 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include <jsapi.h>
+
+#define JSON_MAX_DEPTH  (512)
+
+/* the File we're working on lives here so it can't be collected under us */
+#define JSON_SLOT_FILE  (0)
+
+typedef struct json_parser_st {
+    JSContext   *cx;
+    const char  *p;
+    const char  *end;
+    int         depth;
+    jschar      *chars;
+    size_t      charsize;
+    char        *error;
+} *json_parser;
+
+/* where a parsed value goes. values are stored as soon as they exist, so
+ * everything we've built hangs off something rooted */
+typedef struct json_dest_st {
+    JSObject    *obj;
+    jsint       index;
+    jschar      *key;
+    size_t      keylen;
+    jsval       *vp;
+} json_dest;
+
+typedef struct json_out_st {
+    char        *buf;
+    size_t      len;
+    size_t      size;
+    int         nomem;
+} json_out;
+
+/* JSONReader and JSONWriter, one record per line */
+typedef struct json_stream_st {
+    FILE        *f;
+    int         own;
+    char        *buf;
+    size_t      size;
+    json_out    out;
+    struct json_parser_st parser;
+} *json_stream;
+
+static JSBool json_parse_value(json_parser p, json_dest *d);
+
+static void json_skip(json_parser p) {
+    while(p->p < p->end && (*p->p == ' ' || *p->p == '\t' || *p->p == '\n' || *p->p == '\r'))
+        p->p++;
+}
+
+static JSBool json_fail(json_parser p, char *error) {
+    if(p->error == NULL)
+        p->error = error;
+    return JS_FALSE;
+}
+
+static JSBool json_store(json_parser p, json_dest *d, jsval v) {
+    if(d->obj == NULL) {
+        *d->vp = v;
+        return JS_TRUE;
+    }
+
+    if(d->key == NULL)
+        return JS_SetElement(p->cx, d->obj, d->index, &v);
+
+    return JS_DefineUCProperty(p->cx, d->obj, d->key, d->keylen, v, NULL, NULL, JSPROP_ENUMERATE);
+}
+
+/* NULL if it can't be had, with the old scratch left alone */
+static jschar *json_chars_grow(json_parser p, size_t want) {
+    size_t size = p->charsize;
+    jschar *chars;
+
+    if(p->chars == NULL || size < want) {
+        while(size < want)
+            size *= 2;
+        if((chars = (jschar *) realloc(p->chars, sizeof(jschar) * size)) == NULL)
+            return NULL;
+        p->chars = chars;
+        p->charsize = size;
+    }
+
+    return p->chars;
+}
+
+static int json_hex(const char *h) {
+    int i, c, v = 0;
+
+    for(i = 0; i < 4; i++) {
+        c = h[i];
+        if(c >= '0' && c <= '9') c -= '0';
+        else if(c >= 'a' && c <= 'f') c -= 'a' - 10;
+        else if(c >= 'A' && c <= 'F') c -= 'A' - 10;
+        else return -1;
+        v = (v << 4) | c;
+    }
+
+    return v;
+}
+
+/* decode a string body (utf-8, with escapes) into the scratch chars.
+ * returns the length decoded or -1 */
+static long json_parse_chars(json_parser p, jschar **out) {
+    const unsigned char *s;
+    jschar *c;
+    size_t n = 0;
+    unsigned int u;
+    int h;
+
+    p->p++;
+
+    for(;;) {
+        /* worst case every byte is a char */
+        if((c = json_chars_grow(p, n + (p->end - p->p) + 1)) == NULL) {
+            amber_exception_throw(p->cx, "out of memory");
+            return -1;
+        }
+        s = (const unsigned char *) p->p;
+
+        /* plain ascii run, the common case */
+        while(s < (const unsigned char *) p->end && *s >= 0x20 && *s < 0x80 && *s != '"' && *s != '\\')
+            c[n++] = *s++;
+
+        p->p = (const char *) s;
+
+        if(p->p >= p->end)
+            { json_fail(p, "unterminated string"); return -1; }
+
+        if(*s == '"') {
+            p->p++;
+            *out = c;
+            return n;
+        }
+
+        if(*s < 0x20)
+            { json_fail(p, "control character in string"); return -1; }
+
+        if(*s == '\\') {
+            if(p->end - p->p < 2)
+                { json_fail(p, "unterminated string"); return -1; }
+
+            switch(s[1]) {
+                case '"':  c[n++] = '"';  break;
+                case '\\': c[n++] = '\\'; break;
+                case '/':  c[n++] = '/';  break;
+                case 'b':  c[n++] = '\b'; break;
+                case 'f':  c[n++] = '\f'; break;
+                case 'n':  c[n++] = '\n'; break;
+                case 'r':  c[n++] = '\r'; break;
+                case 't':  c[n++] = '\t'; break;
+                case 'u':
+                    if(p->end - p->p < 6 || (h = json_hex(&p->p[2])) < 0)
+                        { json_fail(p, "bad unicode escape"); return -1; }
+                    c[n++] = h;
+                    p->p += 4;
+                    break;
+                default:
+                    { json_fail(p, "bad escape"); return -1; }
+            }
+
+            p->p += 2;
+            continue;
+        }
+
+        /* multibyte utf-8 */
+        if((*s & 0xe0) == 0xc0 && p->end - p->p >= 2 && (s[1] & 0xc0) == 0x80) {
+            u = ((s[0] & 0x1f) << 6) | (s[1] & 0x3f);
+            p->p += 2;
+        }
+        else if((*s & 0xf0) == 0xe0 && p->end - p->p >= 3 && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80) {
+            u = ((s[0] & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+            p->p += 3;
+        }
+        else if((*s & 0xf8) == 0xf0 && p->end - p->p >= 4 && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80 && (s[3] & 0xc0) == 0x80) {
+            u = ((s[0] & 0x07) << 18) | ((s[1] & 0x3f) << 12) | ((s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+            p->p += 4;
+        }
+        else
+            { json_fail(p, "invalid utf-8 in string"); return -1; }
+
+        if(u >= 0x10000) {
+            u -= 0x10000;
+            c[n++] = 0xd800 | (u >> 10);
+            c[n++] = 0xdc00 | (u & 0x3ff);
+        }
+        else
+            c[n++] = u;
+    }
+}
+
+static JSBool json_parse_string(json_parser p, json_dest *d) {
+    JSString *str;
+    jschar *c;
+    long n;
+
+    if((n = json_parse_chars(p, &c)) < 0)
+        return JS_FALSE;
+
+    if((str = JS_NewUCStringCopyN(p->cx, c, n)) == NULL)
+        return JS_FALSE;
+
+    return json_store(p, d, STRING_TO_JSVAL(str));
+}
+
+static JSBool json_parse_number(json_parser p, json_dest *d) {
+    const char *s = p->p, *digits;
+    char *end;
+    long i = 0;
+    int neg = 0, frac = 0;
+    jsdouble num;
+    jsval v;
+
+    if(s < p->end && *s == '-') {
+        neg = 1;
+        s++;
+    }
+
+    digits = s;
+    while(s < p->end && *s >= '0' && *s <= '9') {
+        if(s - digits < 9)
+            i = i * 10 + (*s - '0');
+        s++;
+    }
+
+    if(s == digits)
+        return json_fail(p, "bad number");
+
+    if(s < p->end && (*s == '.' || *s == 'e' || *s == 'E'))
+        frac = 1;
+
+    /* small integers don't need strtod or a double */
+    if(!frac && s - digits <= 9) {
+        p->p = s;
+        if(neg && i == 0)
+            return JS_NewNumberValue(p->cx, -0.0, &v) && json_store(p, d, v);
+        return json_store(p, d, INT_TO_JSVAL(neg ? -i : i));
+    }
+
+    num = strtod(p->p, &end);
+    if(end == p->p || end > p->end)
+        return json_fail(p, "bad number");
+
+    p->p = end;
+
+    return JS_NewNumberValue(p->cx, num, &v) && json_store(p, d, v);
+}
+
+static JSBool json_parse_array(json_parser p, json_dest *d) {
+    JSObject *arr;
+    json_dest e;
+
+    if((arr = JS_NewArrayObject(p->cx, 0, NULL)) == NULL ||
+       json_store(p, d, OBJECT_TO_JSVAL(arr)) == JS_FALSE)
+        return JS_FALSE;
+
+    p->p++;
+    json_skip(p);
+
+    e.obj = arr;
+    e.index = 0;
+    e.key = NULL;
+
+    if(p->p < p->end && *p->p == ']') {
+        p->p++;
+        return JS_TRUE;
+    }
+
+    for(;;) {
+        if(json_parse_value(p, &e) == JS_FALSE)
+            return JS_FALSE;
+        e.index++;
+
+        json_skip(p);
+        if(p->p >= p->end)
+            return json_fail(p, "unterminated array");
+
+        if(*p->p == ']') {
+            p->p++;
+            return JS_TRUE;
+        }
+
+        if(*p->p != ',')
+            return json_fail(p, "expected , or ] in array");
+        p->p++;
+    }
+}
+
+static JSBool json_parse_object(json_parser p, json_dest *d) {
+    JSObject *obj;
+    json_dest e;
+    jschar *key, *nkey;
+    size_t keysize = 0;
+    long n;
+    JSBool ret = JS_FALSE;
+
+    if((obj = JS_NewObject(p->cx, NULL, NULL, NULL)) == NULL ||
+       json_store(p, d, OBJECT_TO_JSVAL(obj)) == JS_FALSE)
+        return JS_FALSE;
+
+    p->p++;
+    json_skip(p);
+
+    if(p->p < p->end && *p->p == '}') {
+        p->p++;
+        return JS_TRUE;
+    }
+
+    e.obj = obj;
+    e.key = NULL;
+
+    for(;;) {
+        if(p->p >= p->end || *p->p != '"') {
+            json_fail(p, "expected string key in object");
+            break;
+        }
+
+        if((n = json_parse_chars(p, &key)) < 0)
+            break;
+
+        /* the value may need the scratch space, so the key gets its own */
+        if(keysize < n + 1) {
+            if((nkey = (jschar *) realloc(e.key, sizeof(jschar) * (n + 1))) == NULL) {
+                amber_exception_throw(p->cx, "out of memory");
+                break;
+            }
+            e.key = nkey;
+            keysize = n + 1;
+        }
+        memcpy(e.key, key, sizeof(jschar) * n);
+        e.keylen = n;
+
+        json_skip(p);
+        if(p->p >= p->end || *p->p != ':') {
+            json_fail(p, "expected : in object");
+            break;
+        }
+        p->p++;
+
+        if(json_parse_value(p, &e) == JS_FALSE)
+            break;
+
+        json_skip(p);
+        if(p->p >= p->end) {
+            json_fail(p, "unterminated object");
+            break;
+        }
+
+        if(*p->p == '}') {
+            p->p++;
+            ret = JS_TRUE;
+            break;
+        }
+
+        if(*p->p != ',') {
+            json_fail(p, "expected , or } in object");
+            break;
+        }
+        p->p++;
+        json_skip(p);
+    }
+
+    if(e.key != NULL)
+        free(e.key);
+
+    return ret;
+}
+
+static JSBool json_parse_literal(json_parser p, json_dest *d, char *word, jsval v) {
+    size_t len = strlen(word);
+
+    if(p->end - p->p < len || memcmp(p->p, word, len) != 0)
+        return json_fail(p, "unexpected character");
+
+    p->p += len;
+
+    return json_store(p, d, v);
+}
+
+static JSBool json_parse_value(json_parser p, json_dest *d) {
+    JSBool ret;
+
+    json_skip(p);
+    if(p->p >= p->end)
+        return json_fail(p, "unexpected end of input");
+
+    switch(*p->p) {
+        case '{':
+            if(++p->depth > JSON_MAX_DEPTH)
+                return json_fail(p, "nested too deeply");
+            ret = json_parse_object(p, d);
+            p->depth--;
+            return ret;
+
+        case '[':
+            if(++p->depth > JSON_MAX_DEPTH)
+                return json_fail(p, "nested too deeply");
+            ret = json_parse_array(p, d);
+            p->depth--;
+            return ret;
+
+        case '"':
+            return json_parse_string(p, d);
+
+        case 't':
+            return json_parse_literal(p, d, "true", JSVAL_TRUE);
+        case 'f':
+            return json_parse_literal(p, d, "false", JSVAL_FALSE);
+        case 'n':
+            return json_parse_literal(p, d, "null", JSVAL_NULL);
+
+        default:
+            return json_parse_number(p, d);
+    }
+}
+
+static void json_parser_init(json_parser p, JSContext *cx) {
+    p->cx = cx;
+    p->charsize = 256;
+    p->chars = (jschar *) malloc(sizeof(jschar) * p->charsize);
+}
+
+/* parse exactly one document from buf, which must be nul-terminated */
+static JSBool json_parse_buf(JSContext *cx, json_parser p, const char *buf, size_t len, json_dest *d) {
+    p->p = buf;
+    p->end = buf + len;
+    p->depth = 0;
+    p->error = NULL;
+
+    if(json_parse_value(p, d) == JS_FALSE)
+        goto fail;
+
+    json_skip(p);
+    if(p->p != p->end) {
+        json_fail(p, "trailing characters");
+        goto fail;
+    }
+
+    return JS_TRUE;
+
+fail:
+    if(p->error == NULL)
+        return JS_FALSE;
+
+    JS_ClearPendingException(cx);
+    THROW("JSON parse error at offset %ld: %s", (long) (p->p - buf), p->error);
+}
+
+/* a failure sticks, and everything after it is dropped until the caller
+ * notices nomem and throws */
+static int json_out_grow(json_out *o, size_t want) {
+    size_t size = o->size;
+    char *buf;
+
+    if(o->nomem)
+        return -1;
+
+    if(o->len + want > size) {
+        while(o->len + want > size)
+            size = size > 0 ? size * 2 : 4096;
+        if((buf = (char *) realloc(o->buf, size)) == NULL) {
+            o->nomem = 1;
+            return -1;
+        }
+        o->buf = buf;
+        o->size = size;
+    }
+
+    return 0;
+}
+
+static void json_out_put(json_out *o, const char *s, size_t len) {
+    if(json_out_grow(o, len) < 0)
+        return;
+    memcpy(&o->buf[o->len], s, len);
+    o->len += len;
+}
+
+/* encode the char at *c as utf-8, joining surrogate pairs. lone
+ * surrogates are encoded as they are */
+static char *json_put_utf8(char *b, const jschar **c, const jschar *end) {
+    unsigned int u = **c;
+
+    if(u < 0x80)
+        *b++ = u;
+
+    else if(u < 0x800) {
+        *b++ = 0xc0 | (u >> 6);
+        *b++ = 0x80 | (u & 0x3f);
+    }
+
+    else if(u >= 0xd800 && u < 0xdc00 && *c + 1 < end && (*c)[1] >= 0xdc00 && (*c)[1] < 0xe000) {
+        u = 0x10000 + ((u - 0xd800) << 10) + ((*c)[1] - 0xdc00);
+        (*c)++;
+        *b++ = 0xf0 | (u >> 18);
+        *b++ = 0x80 | ((u >> 12) & 0x3f);
+        *b++ = 0x80 | ((u >> 6) & 0x3f);
+        *b++ = 0x80 | (u & 0x3f);
+    }
+
+    else {
+        *b++ = 0xe0 | (u >> 12);
+        *b++ = 0x80 | ((u >> 6) & 0x3f);
+        *b++ = 0x80 | (u & 0x3f);
+    }
+
+    (*c)++;
+
+    return b;
+}
+
+/* quoted, escaped, utf-8 */
+static void json_out_string(json_out *o, const jschar *c, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const jschar *end = c + len;
+    unsigned int u;
+    char *b;
+
+    if(json_out_grow(o, len * 6 + 2) < 0)
+        return;
+    b = &o->buf[o->len];
+
+    *b++ = '"';
+
+    while(c < end) {
+        u = *c;
+
+        if(u >= 0x80) {
+            b = json_put_utf8(b, &c, end);
+            continue;
+        }
+
+        c++;
+
+        if(u >= 0x20 && u != '"' && u != '\\') {
+            *b++ = u;
+            continue;
+        }
+
+        *b++ = '\\';
+        switch(u) {
+            case '"':  *b++ = '"';  break;
+            case '\\': *b++ = '\\'; break;
+            case '\b': *b++ = 'b';  break;
+            case '\f': *b++ = 'f';  break;
+            case '\n': *b++ = 'n';  break;
+            case '\r': *b++ = 'r';  break;
+            case '\t': *b++ = 't';  break;
+            default:
+                *b++ = 'u'; *b++ = '0'; *b++ = '0';
+                *b++ = hex[u >> 4]; *b++ = hex[u & 0xf];
+                break;
+        }
+    }
+
+    *b++ = '"';
+
+    o->len = b - o->buf;
+}
+
+static void json_out_number(json_out *o, jsdouble d) {
+    char num[32];
+    int len;
+
+    if(!isfinite(d)) {
+        json_out_put(o, "null", 4);
+        return;
+    }
+
+    /* shortest of these that reads back the same */
+    len = snprintf(num, sizeof(num), "%.15g", d);
+    if(strtod(num, NULL) != d)
+        len = snprintf(num, sizeof(num), "%.17g", d);
+
+    json_out_put(o, num, len);
+}
+
+/* 1 if something was written, 0 if the value has no json form */
+static int json_out_value(JSContext *cx, json_out *o, jsval v, int depth) {
+    JSObject *obj;
+    JSString *str;
+    JSIdArray *ids = NULL;
+    jsuint i, len;
+    jsval id, ev;
+    int first, n, ret = -1;
+    char num[16];
+
+    if(JSVAL_IS_NULL(v)) {
+        json_out_put(o, "null", 4);
+        return 1;
+    }
+
+    if(JSVAL_IS_VOID(v))
+        return 0;
+
+    if(JSVAL_IS_BOOLEAN(v)) {
+        if(JSVAL_TO_BOOLEAN(v))
+            json_out_put(o, "true", 4);
+        else
+            json_out_put(o, "false", 5);
+        return 1;
+    }
+
+    if(JSVAL_IS_INT(v)) {
+        n = snprintf(num, sizeof(num), "%d", JSVAL_TO_INT(v));
+        json_out_put(o, num, n);
+        return 1;
+    }
+
+    if(JSVAL_IS_DOUBLE(v)) {
+        json_out_number(o, *JSVAL_TO_DOUBLE(v));
+        return 1;
+    }
+
+    if(JSVAL_IS_STRING(v)) {
+        str = JSVAL_TO_STRING(v);
+        json_out_string(o, JS_GetStringChars(str), JS_GetStringLength(str));
+        return 1;
+    }
+
+    if(JS_TypeOfValue(cx, v) == JSTYPE_FUNCTION)
+        return 0;
+
+    ASSERT_THROW(depth > JSON_MAX_DEPTH, "object is cyclic or nested too deeply");
+
+    obj = JSVAL_TO_OBJECT(v);
+
+    if(JS_IsArrayObject(cx, obj)) {
+        if(JS_GetArrayLength(cx, obj, &len) == JS_FALSE)
+            goto done;
+
+        json_out_put(o, "[", 1);
+        for(i = 0; i < len; i++) {
+            if(i > 0)
+                json_out_put(o, ",", 1);
+            if(JS_GetElement(cx, obj, i, &ev) == JS_FALSE ||
+               (n = json_out_value(cx, o, ev, depth + 1)) < 0)
+                goto done;
+            if(n == 0)
+                json_out_put(o, "null", 4);
+        }
+        json_out_put(o, "]", 1);
+
+        ret = 1;
+        goto done;
+    }
+
+    if((ids = JS_Enumerate(cx, obj)) == NULL)
+        goto done;
+
+    json_out_put(o, "{", 1);
+
+    for(i = 0, first = 1; i < ids->length; i++) {
+        if(JS_IdToValue(cx, ids->vector[i], &id) == JS_FALSE)
+            goto done;
+
+        if(JSVAL_IS_INT(id)) {
+            if(JS_GetElement(cx, obj, JSVAL_TO_INT(id), &ev) == JS_FALSE ||
+               (str = JS_ValueToString(cx, id)) == NULL)
+                goto done;
+        }
+        else {
+            str = JSVAL_TO_STRING(id);
+            if(JS_GetUCProperty(cx, obj, JS_GetStringChars(str), JS_GetStringLength(str), &ev) == JS_FALSE)
+                goto done;
+        }
+
+        /* undefined and functions are left out altogether */
+        if(JSVAL_IS_VOID(ev) || JS_TypeOfValue(cx, ev) == JSTYPE_FUNCTION)
+            continue;
+
+        if(!first)
+            json_out_put(o, ",", 1);
+        first = 0;
+
+        json_out_string(o, JS_GetStringChars(str), JS_GetStringLength(str));
+        json_out_put(o, ":", 1);
+
+        if(json_out_value(cx, o, ev, depth + 1) < 0)
+            goto done;
+    }
+
+    json_out_put(o, "}", 1);
+
+    ret = 1;
+
+done:
+    if(ids != NULL)
+        JS_DestroyIdArray(cx, ids);
+
+    return ret;
+}
+
+/* a getter can hand back something nothing else refers to, and it has to
+ * stay alive while it's written out and more getters run. anything made
+ * inside a local root scope is rooted until it's left, so one scope per
+ * call covers the whole walk */
+static int json_out_root(JSContext *cx, json_out *o, jsval v) {
+    int n;
+
+    o->nomem = 0;
+
+    if(!JS_EnterLocalRootScope(cx))
+        return -1;
+    n = json_out_value(cx, o, v, 0);
+    JS_LeaveLocalRootScope(cx);
+
+    if(n >= 0 && o->nomem) {
+        amber_exception_throw(cx, "out of memory");
+        return -1;
+    }
+
+    return n;
+}
+
+/* utf-8 copy of a js string for the parser, nul-terminated */
+static char *json_utf8(JSString *str, size_t *len) {
+    const jschar *c = JS_GetStringChars(str), *end = c + JS_GetStringLength(str);
+    char *buf, *b;
+
+    if((b = buf = (char *) malloc((end - c) * 3 + 1)) == NULL)
+        return NULL;
+
+    while(c < end) {
+        if(*c < 0x80)
+            *b++ = *c++;
+        else
+            b = json_put_utf8(b, &c, end);
+    }
+
+    *b = '\0';
+    *len = b - buf;
+
+    return buf;
+}
+
+/* and back again, for handing our output to js */
+static JSString *json_string(JSContext *cx, const char *buf, size_t len) {
+    const unsigned char *s = (const unsigned char *) buf, *end = s + len;
+    jschar *chars, *c;
+    JSString *str;
+    unsigned int u;
+
+    if((c = chars = JS_malloc(cx, sizeof(jschar) * (len + 1))) == NULL)
+        return NULL;
+
+    /* we wrote it, so it's well formed */
+    while(s < end) {
+        if(*s < 0x80)
+            *c++ = *s++;
+
+        else if((*s & 0xe0) == 0xc0) {
+            *c++ = ((s[0] & 0x1f) << 6) | (s[1] & 0x3f);
+            s += 2;
+        }
+
+        else if((*s & 0xf0) == 0xe0) {
+            *c++ = ((s[0] & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+            s += 3;
+        }
+
+        else {
+            u = (((s[0] & 0x07) << 18) | ((s[1] & 0x3f) << 12) | ((s[2] & 0x3f) << 6) | (s[3] & 0x3f)) - 0x10000;
+            *c++ = 0xd800 | (u >> 10);
+            *c++ = 0xdc00 | (u & 0x3ff);
+            s += 4;
+        }
+    }
+
+    *c = 0;
+
+    if((str = JS_NewUCString(cx, chars, c - chars)) == NULL)
+        JS_free(cx, chars);
+
+    return str;
+}
+
+static JSBool json_parse(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    struct json_parser_st p;
+    json_dest d;
+    JSString *str;
+    char *buf;
+    size_t len;
+    JSBool ret;
+
+    ASSERT_THROW(argc == 0, "nothing to parse");
+    ASSERT_THROW((str = JS_ValueToString(cx, argv[0])) == NULL, "couldn't convert argument to string");
+    argv[0] = STRING_TO_JSVAL(str);
+
+    if((buf = json_utf8(str, &len)) == NULL)
+        THROW("out of memory");
+
+    d.obj = NULL;
+    d.vp = rval;
+
+    json_parser_init(&p, cx);
+    ret = json_parse_buf(cx, &p, buf, len, &d);
+
+    free(p.chars);
+    free(buf);
+
+    return ret;
+}
+
+static JSBool json_stringify(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_out o = { NULL, 0, 0, 0 };
+    JSString *str = NULL;
+    int n;
+
+    if(argc == 0)
+        return JS_TRUE;
+
+    if((n = json_out_root(cx, &o, argv[0])) > 0 && (str = json_string(cx, o.buf, o.len)) != NULL)
+        *rval = STRING_TO_JSVAL(str);
+
+    if(o.buf != NULL)
+        free(o.buf);
+
+    return n == 0 || (n > 0 && str != NULL);
+}
+
+static JSFunctionSpec json_functions[] = {
+    { "parse",      json_parse,     1, 0 },
+    { "stringify",  json_stringify, 1, 0 },
+    { NULL }
+};
+
+/* pick up the File or filename we were handed */
+static FILE *json_open(JSContext *cx, JSObject *obj, jsval v, char *mode, int *own) {
+    FILE *f;
+
+    if((f = amber_file_stream(cx, v)) != NULL) {
+        JS_SetReservedSlot(cx, obj, JSON_SLOT_FILE, v);
+        *own = 0;
+        return f;
+    }
+
+    if(!JSVAL_IS_STRING(v) || (f = fopen(JS_GetStringBytes(JSVAL_TO_STRING(v)), mode)) == NULL)
+        return NULL;
+
+    *own = 1;
+    return f;
+}
+
+static JSBool json_stream_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, char *mode) {
+    json_stream s;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc == 0, "no file specified");
+
+    s = JS_malloc(cx, sizeof(struct json_stream_st));
+    memset(s, 0, sizeof(struct json_stream_st));
+
+    if((s->f = json_open(cx, obj, argv[0], mode, &s->own)) == NULL) {
+        JS_free(cx, s);
+        THROW("couldn't open file: %s", JSVAL_IS_STRING(argv[0]) ? strerror(errno) : "not a File or filename");
+    }
+
+    json_parser_init(&s->parser, cx);
+
+    JS_SetPrivate(cx, obj, s);
+
+    return JS_TRUE;
+}
+
+static void json_stream_free(JSContext *cx, JSObject *obj, json_stream s, int flush) {
+    if(flush && s->out.len > 0)
+        fwrite(s->out.buf, sizeof(char), s->out.len, s->f);
+
+    if(s->own)
+        fclose(s->f);
+
+    if(s->buf != NULL)
+        free(s->buf);
+    if(s->out.buf != NULL)
+        free(s->out.buf);
+    free(s->parser.chars);
+
+    JS_free(cx, s);
+    JS_SetPrivate(cx, obj, NULL);
+}
+
+static JSBool json_stream_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_stream s;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    json_stream_free(cx, obj, s, 1);
+    JS_SetReservedSlot(cx, obj, JSON_SLOT_FILE, JSVAL_VOID);
+
+    return JS_TRUE;
+}
+
+/* a File we were handed may already be gone by now, so only our own
+ * streams get flushed here */
+static void json_stream_finalize(JSContext *cx, JSObject *obj) {
+    json_stream s;
+
+    if((s = JS_GetPrivate(cx, obj)) != NULL)
+        json_stream_free(cx, obj, s, s->own);
+}
+
+/* parse the next record into d, blank lines skipped */
+static JSBool json_reader_next(JSContext *cx, json_stream s, json_dest *d, int *eof) {
+    ssize_t len;
+    char *c;
+
+    *eof = 0;
+
+    for(;;) {
+        if((len = getline(&s->buf, &s->size, s->f)) < 0) {
+            ASSERT_THROW(ferror(s->f), "read error");
+            *eof = 1;
+            return JS_TRUE;
+        }
+
+        for(c = s->buf; c < s->buf + len && (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r'); c++);
+        if(c < s->buf + len)
+            break;
+    }
+
+    return json_parse_buf(cx, &s->parser, s->buf, len, d);
+}
+
+/* undefined at eof */
+static JSBool json_reader_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_stream s;
+    json_dest d;
+    int eof;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    d.obj = NULL;
+    d.vp = rval;
+
+    return json_reader_next(cx, s, &d, &eof);
+}
+
+static JSBool json_reader_readbatch(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_stream s;
+    JSObject *batch;
+    json_dest d;
+    int32 want = 1024;
+    int eof;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    if(argc > 0)
+        ASSERT_THROW(JS_ValueToInt32(cx, argv[0], &want) == JS_FALSE || want <= 0,
+                     "batch size must be a positive integer");
+
+    if((batch = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(batch);
+
+    /* each record is parsed straight into its slot in the batch */
+    d.obj = batch;
+    d.key = NULL;
+
+    for(d.index = 0; d.index < want; d.index++) {
+        if(json_reader_next(cx, s, &d, &eof) == JS_FALSE)
+            return JS_FALSE;
+        if(eof)
+            break;
+    }
+
+    if(d.index == 0)
+        *rval = JSVAL_NULL;
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec json_reader_methods[] = {
+    { "read",       json_reader_read,       0, 0 },
+    { "readBatch",  json_reader_readbatch,  1, 0 },
+    { "close",      json_stream_close,      0, 0 },
+    { NULL }
+};
+
+static JSBool json_reader_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return json_stream_constructor(cx, obj, argc, argv, "r");
+}
+
+static JSClass json_reader_class = {
+    "JSONReader", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, json_stream_finalize
+};
+
+/* each value goes out as one line. the buffer is kept between writes */
+static JSBool json_writer_write(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_stream s;
+    uintN i;
+    int n;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    for(i = 0; i < argc; i++) {
+        s->out.len = 0;
+
+        if((n = json_out_root(cx, &s->out, argv[i])) < 0)
+            return JS_FALSE;
+        if(n == 0)
+            json_out_put(&s->out, "null", 4);
+        json_out_put(&s->out, "\n", 1);
+        ASSERT_THROW(s->out.nomem, "out of memory");
+
+        fwrite(s->out.buf, sizeof(char), s->out.len, s->f);
+        ASSERT_THROW(ferror(s->f), "write error");
+    }
+
+    s->out.len = 0;
+
+    return JS_TRUE;
+}
+
+static JSBool json_writer_flush(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    json_stream s;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(fflush(s->f) != 0, "write error");
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec json_writer_methods[] = {
+    { "write",      json_writer_write,      1, 0 },
+    { "flush",      json_writer_flush,      0, 0 },
+    { "close",      json_stream_close,      0, 0 },
+    { NULL }
+};
+
+static JSBool json_writer_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return json_stream_constructor(cx, obj, argc, argv, "w");
+}
+
+static JSClass json_writer_class = {
+    "JSONWriter", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, JS_PropertyStub, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, json_stream_finalize
+};
+
+JSBool JSON(JSContext *cx, JSObject *amber) {
+    JSObject *json, *reader, *writer;
+
+    json = JS_NewObject(cx, NULL, NULL, NULL);
+    JS_DefineProperty(cx, amber, "JSON", OBJECT_TO_JSVAL(json), NULL, NULL, JSPROP_ENUMERATE);
+    JS_DefineFunctions(cx, json, json_functions);
+
+    reader = JS_InitClass(cx, amber, NULL, &json_reader_class,
+                          json_reader_constructor, 1,
+                          NULL, json_reader_methods,
+                          NULL, NULL);
+
+    writer = JS_InitClass(cx, amber, NULL, &json_writer_class,
+                          json_writer_constructor, 1,
+                          NULL, json_writer_methods,
+                          NULL, NULL);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,718 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <jsapi.h>
+
+#define LOG_RINGSIZE    (256 * 1024)
+#define LOG_INTERVAL    (100)
+
+/*
+ * each thread that logs gets its own ring, so the only thing writers share
+ * is the level check. one producer and one consumer per ring means head and
+ * tail can just be atomic counters. the writer thread drains every ring
+ * each pass and turns records into text there, off the callers' time
+ */
+
+typedef enum log_level {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} log_level;
+
+static const char *log_level_names[] = { "debug", "info", "warn", "error", NULL };
+static const char *log_level_tags[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+typedef struct log_record {
+    uint32_t    len;
+    uint32_t    level;
+    int64_t     sec;
+    int32_t     nsec;
+    int32_t     tid;
+} log_record;
+
+typedef struct log_ring_st {
+    struct log_ring_st  *next;
+    struct log_stuff    *log;
+    unsigned char       *buf;
+    size_t              size;
+    pid_t               tid;
+    int                 idle;
+
+    /* head is only written by the owning thread, tail only by the writer.
+     * keep them off each other's cache lines */
+    uint64_t            head __attribute__((aligned(64)));
+    uint64_t            tail __attribute__((aligned(64)));
+} log_ring;
+
+typedef struct log_stuff {
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wake;
+    pthread_cond_t      space;
+    pthread_key_t       key;
+    pthread_t           writer;
+
+    log_ring            *rings;
+
+    int                 fd, own_fd;
+    int                 level;
+    int                 block;
+    int                 interval;
+    size_t              ringsize;
+
+    int                 stop;
+    int                 closed;
+    int                 busy;
+    uint64_t            flush_req, flush_done;
+
+    uint64_t            dropped, written;
+
+    char                *out;
+    size_t              outlen, outsize;
+} *log_stuff;
+
+static void log_ring_put(log_ring *r, uint64_t pos, const void *data, size_t len) {
+    size_t off = pos & (r->size - 1), first = r->size - off;
+
+    if(first >= len)
+        memcpy(&r->buf[off], data, len);
+    else {
+        memcpy(&r->buf[off], data, first);
+        memcpy(r->buf, (const char *) data + first, len - first);
+    }
+}
+
+static void log_ring_get(log_ring *r, uint64_t pos, void *data, size_t len) {
+    size_t off = pos & (r->size - 1), first = r->size - off;
+
+    if(first >= len)
+        memcpy(data, &r->buf[off], len);
+    else {
+        memcpy(data, &r->buf[off], first);
+        memcpy((char *) data + first, r->buf, len - first);
+    }
+}
+
+/* a thread that exits gives its ring back for the next one to take over.
+ * whatever it left in there still gets written, since the writer doesn't
+ * care who owns a ring. once the log is closed the ring may be gone */
+static void log_ring_release(void *arg) {
+    log_ring *r = (log_ring *) arg;
+    struct log_stuff *l = r->log;
+
+    pthread_mutex_lock(&l->mutex);
+    if(!l->closed)
+        __atomic_store_n(&r->idle, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+/* the calling thread's ring, made on first use. rings are only ever added
+ * to the front of the list, so the writer can walk it without the lock */
+static log_ring *log_ring_self(log_stuff l) {
+    log_ring *r;
+    int idle;
+
+    if((r = pthread_getspecific(l->key)) != NULL)
+        return r;
+
+    pthread_mutex_lock(&l->mutex);
+    for(r = l->rings; r != NULL; r = r->next) {
+        idle = 1;
+        if(__atomic_compare_exchange_n(&r->idle, &idle, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    pthread_mutex_unlock(&l->mutex);
+
+    if(r != NULL) {
+        r->tid = syscall(SYS_gettid);
+        pthread_setspecific(l->key, r);
+        return r;
+    }
+
+    if((r = calloc(1, sizeof(log_ring))) == NULL)
+        return NULL;
+    if((r->buf = malloc(l->ringsize)) == NULL) {
+        free(r);
+        return NULL;
+    }
+    r->log = l;
+    r->size = l->ringsize;
+    r->tid = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&l->mutex);
+    r->next = l->rings;
+    __atomic_store_n(&l->rings, r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&l->mutex);
+
+    pthread_setspecific(l->key, r);
+
+    return r;
+}
+
+static void log_out_flush(log_stuff l) {
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < l->outlen) {
+        if((n = write(l->fd, &l->out[done], l->outlen - done)) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+
+    l->outlen = 0;
+}
+
+/* turn everything that's in a ring into text. the tail moves up as each
+ * lot of output goes out, so producers get space back as soon as possible */
+static void log_ring_drain(log_stuff l, log_ring *r) {
+    static __thread int64_t last_sec = -1;
+    static __thread char stamp[32];
+    uint64_t head, tail;
+    log_record rec;
+    struct tm tm;
+    size_t want;
+    time_t t;
+    int n;
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    tail = r->tail;
+
+    while(tail < head) {
+        log_ring_get(r, tail, &rec, sizeof(log_record));
+
+        want = rec.len + 64;
+        if(l->outlen + want > l->outsize) {
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+            log_out_flush(l);
+        }
+
+        /* the date part only changes once a second */
+        if(rec.sec != last_sec) {
+            t = (time_t) rec.sec;
+            gmtime_r(&t, &tm);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+            last_sec = rec.sec;
+        }
+
+        n = sprintf(&l->out[l->outlen], "%s.%03dZ %s %d ", stamp, rec.nsec / 1000000,
+                    log_level_tags[rec.level], rec.tid);
+        l->outlen += n;
+
+        log_ring_get(r, tail + sizeof(log_record), &l->out[l->outlen], rec.len);
+        l->outlen += rec.len;
+        l->out[l->outlen++] = '\n';
+
+        tail += sizeof(log_record) + rec.len;
+
+        __atomic_add_fetch(&l->written, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void *log_writer(void *arg) {
+    log_stuff l = (log_stuff) arg;
+    struct timespec ts;
+    uint64_t req;
+    log_ring *r;
+    int stop;
+
+    pthread_mutex_lock(&l->mutex);
+
+    while(1) {
+        stop = l->stop;
+        req = l->flush_req;
+
+        pthread_mutex_unlock(&l->mutex);
+
+        for(r = __atomic_load_n(&l->rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+            log_ring_drain(l, r);
+        log_out_flush(l);
+
+        pthread_mutex_lock(&l->mutex);
+
+        l->flush_done = req;
+        pthread_cond_broadcast(&l->space);
+
+        if(stop)
+            break;
+
+        if(l->flush_req == req) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (l->interval % 1000) * 1000000L;
+            ts.tv_sec += l->interval / 1000 + ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&l->wake, &l->mutex, &ts);
+        }
+    }
+
+    pthread_mutex_unlock(&l->mutex);
+
+    return NULL;
+}
+
+/* every append and flush counts itself in busy while it's using the log, so
+ * close() can wait for them all to be out of the rings before it frees them.
+ * l itself stays around until the object is finalized, so closed and busy
+ * are always safe to look at */
+static void log_leave(log_stuff l) {
+    if(__atomic_sub_fetch(&l->busy, 1, __ATOMIC_SEQ_CST) == 0 &&
+       __atomic_load_n(&l->closed, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&l->mutex);
+        pthread_cond_broadcast(&l->space);
+        pthread_mutex_unlock(&l->mutex);
+    }
+}
+
+static int log_enter(log_stuff l) {
+    __atomic_add_fetch(&l->busy, 1, __ATOMIC_SEQ_CST);
+    if(!__atomic_load_n(&l->closed, __ATOMIC_SEQ_CST))
+        return 1;
+
+    log_leave(l);
+    return 0;
+}
+
+/* append one record to this thread's ring */
+static JSBool log_append(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, log_level level) {
+    log_stuff l;
+    log_ring *r;
+    log_record rec;
+    struct timespec ts;
+    JSString *str;
+    jsrefcount saved;
+    size_t len = 0, n, need;
+    uint64_t head, pos;
+    JSBool ok = JS_TRUE;
+    uintN i;
+
+    if((l = JS_GetPrivate(cx, obj)) == NULL || level < l->level || !log_enter(l))
+        return JS_TRUE;
+
+    if((r = log_ring_self(l)) == NULL) {
+        ok = amber_exception_throw(cx, "couldn't allocate log buffer");
+        goto done;
+    }
+
+    /* strings go back into argv so they stay rooted */
+    for(i = 0; i < argc; i++) {
+        if((str = JS_ValueToString(cx, argv[i])) == NULL) {
+            ok = JS_FALSE;
+            goto done;
+        }
+        argv[i] = STRING_TO_JSVAL(str);
+        len += JS_GetStringLength(str) + (i > 0 ? 1 : 0);
+    }
+
+    /* anything that would never fit gets cut short */
+    if(len > r->size - sizeof(log_record))
+        len = r->size - sizeof(log_record);
+    need = sizeof(log_record) + len;
+
+    head = r->head;
+    if(r->size - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) < need) {
+        if(!l->block) {
+            __atomic_add_fetch(&l->dropped, 1, __ATOMIC_RELAXED);
+            goto done;
+        }
+
+        /* the writer keeps going until close() has seen us leave, so this
+         * always gets space eventually */
+        saved = JS_SuspendRequest(cx);
+        pthread_mutex_lock(&l->mutex);
+        while(r->size - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) < need) {
+            pthread_cond_signal(&l->wake);
+            pthread_cond_wait(&l->space, &l->mutex);
+        }
+        pthread_mutex_unlock(&l->mutex);
+        JS_ResumeRequest(cx, saved);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.len = len;
+    rec.level = level;
+    rec.sec = ts.tv_sec;
+    rec.nsec = ts.tv_nsec;
+    rec.tid = r->tid;
+
+    log_ring_put(r, head, &rec, sizeof(log_record));
+    pos = head + sizeof(log_record);
+
+    for(i = 0; i < argc && pos < head + need; i++) {
+        if(i > 0) {
+            log_ring_put(r, pos, " ", 1);
+            pos++;
+        }
+
+        str = JSVAL_TO_STRING(argv[i]);
+        n = JS_GetStringLength(str);
+        if(n > head + need - pos)
+            n = head + need - pos;
+        log_ring_put(r, pos, JS_GetStringBytes(str), n);
+        pos += n;
+    }
+
+    __atomic_store_n(&r->head, head + need, __ATOMIC_RELEASE);
+
+    /* past half full, don't wait for the timer */
+    if(head + need - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) > r->size / 2)
+        pthread_cond_signal(&l->wake);
+
+done:
+    log_leave(l);
+
+    return ok;
+}
+
+static JSBool log_debug(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return log_append(cx, obj, argc, argv, LOG_DEBUG);
+}
+
+static JSBool log_info(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return log_append(cx, obj, argc, argv, LOG_INFO);
+}
+
+static JSBool log_warn(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return log_append(cx, obj, argc, argv, LOG_WARN);
+}
+
+static JSBool log_error(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return log_append(cx, obj, argc, argv, LOG_ERROR);
+}
+
+/* wait until everything logged so far has been written */
+static JSBool log_flush(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    log_stuff l;
+    jsrefcount saved;
+    uint64_t req;
+
+    if((l = JS_GetPrivate(cx, obj)) == NULL || !log_enter(l))
+        return JS_TRUE;
+
+    saved = JS_SuspendRequest(cx);
+
+    pthread_mutex_lock(&l->mutex);
+    req = ++l->flush_req;
+    pthread_cond_signal(&l->wake);
+    while(l->flush_done < req)
+        pthread_cond_wait(&l->space, &l->mutex);
+    pthread_mutex_unlock(&l->mutex);
+
+    JS_ResumeRequest(cx, saved);
+
+    log_leave(l);
+
+    return JS_TRUE;
+}
+
+/* stop taking records, let whoever is still appending or flushing finish,
+ * then write out what's left and free the rings. the writer is still
+ * running while we wait, so blocked appends and flushes get through */
+static void log_shutdown(log_stuff l) {
+    log_ring *r, *next;
+
+    pthread_mutex_lock(&l->mutex);
+    if(l->closed) {
+        pthread_mutex_unlock(&l->mutex);
+        return;
+    }
+    __atomic_store_n(&l->closed, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&l->busy, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_signal(&l->wake);
+        pthread_cond_wait(&l->space, &l->mutex);
+    }
+    l->stop = 1;
+    pthread_cond_signal(&l->wake);
+    pthread_mutex_unlock(&l->mutex);
+
+    pthread_join(l->writer, NULL);
+
+    for(r = l->rings; r != NULL; r = next) {
+        next = r->next;
+        free(r->buf);
+        free(r);
+    }
+    l->rings = NULL;
+
+    if(l->own_fd)
+        close(l->fd);
+
+    pthread_key_delete(l->key);
+
+    free(l->out);
+    l->out = NULL;
+}
+
+static void log_destroy(log_stuff l) {
+    log_shutdown(l);
+
+    pthread_cond_destroy(&l->wake);
+    pthread_cond_destroy(&l->space);
+    pthread_mutex_destroy(&l->mutex);
+
+    free(l);
+}
+
+static JSBool log_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    log_stuff l;
+    jsrefcount saved;
+
+    if((l = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    /* l stays attached, since other threads may have it in hand already;
+     * the finalizer frees it */
+    saved = JS_SuspendRequest(cx);
+    log_shutdown(l);
+    JS_ResumeRequest(cx, saved);
+
+    JS_SetReservedSlot(cx, obj, 0, JSVAL_VOID);
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec log_methods[] = {
+    { "debug",  log_debug,  0, 0 },
+    { "info",   log_info,   0, 0 },
+    { "warn",   log_warn,   0, 0 },
+    { "error",  log_error,  0, 0 },
+    { "flush",  log_flush,  0, 0 },
+    { "close",  log_close,  0, 0 },
+    { NULL }
+};
+
+enum log_tinyid {
+    LOG_LEVEL,
+    LOG_DROPPED,
+    LOG_WRITTEN
+};
+
+static JSPropertySpec log_properties[] = {
+    { "level",      LOG_LEVEL,      JSPROP_ENUMERATE | JSPROP_PERMANENT },
+    { "dropped",    LOG_DROPPED,    JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "written",    LOG_WRITTEN,    JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { NULL }
+};
+
+static JSBool log_level_from(JSContext *cx, jsval v, int *level) {
+    JSString *str;
+    char *name;
+    int i;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; log_level_names[i] != NULL; i++)
+        if(strcmp(name, log_level_names[i]) == 0) {
+            *level = i;
+            return JS_TRUE;
+        }
+
+    THROW("unknown log level '%s'", name);
+}
+
+static JSBool log_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    log_stuff l;
+
+    if((l = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case LOG_LEVEL:
+            *vp = STRING_TO_JSVAL(JS_InternString(cx, log_level_names[l->level]));
+            break;
+
+        case LOG_DROPPED:
+            return JS_NewNumberValue(cx, (jsdouble) __atomic_load_n(&l->dropped, __ATOMIC_RELAXED), vp);
+
+        case LOG_WRITTEN:
+            return JS_NewNumberValue(cx, (jsdouble) __atomic_load_n(&l->written, __ATOMIC_RELAXED), vp);
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool log_set_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    log_stuff l;
+    int level;
+
+    if((l = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case LOG_LEVEL:
+            if(!log_level_from(cx, *vp, &level))
+                return JS_FALSE;
+            l->level = level;
+            break;
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool log_get_option(JSContext *cx, JSObject *opts, const char *name, jsval *vp) {
+    *vp = JSVAL_VOID;
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    return JS_GetProperty(cx, opts, name, vp);
+}
+
+/*
+ * new Log([target], [options]). target is a File, a filename to append to,
+ * or nothing for stderr. options are level, overflow ("drop" or "block"),
+ * ringSize (bytes per thread) and interval (ms between writes)
+ */
+static JSBool log_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    log_stuff l;
+    JSObject *opts = NULL;
+    JSString *str;
+    FILE *f;
+    char *name;
+    int32 n;
+    size_t size;
+    jsval v;
+    int err;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    l = calloc(1, sizeof(struct log_stuff));
+    ASSERT_THROW(l == NULL, "out of memory");
+
+    l->fd = 2;
+    l->level = LOG_INFO;
+    l->ringsize = LOG_RINGSIZE;
+    l->interval = LOG_INTERVAL;
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if(!log_get_option(cx, opts, "level", &v) ||
+       (!JSVAL_IS_VOID(v) && !log_level_from(cx, v, &l->level)))
+        goto fail;
+
+    if(!log_get_option(cx, opts, "overflow", &v))
+        goto fail;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            goto fail;
+        name = JS_GetStringBytes(str);
+        if(strcmp(name, "block") == 0)
+            l->block = 1;
+        else if(strcmp(name, "drop") != 0) {
+            amber_exception_throw(cx, "unknown overflow behaviour '%s'", name);
+            goto fail;
+        }
+    }
+
+    if(!log_get_option(cx, opts, "ringSize", &v))
+        goto fail;
+    if(!JSVAL_IS_VOID(v)) {
+        if(!JS_ValueToInt32(cx, v, &n) || n < 1024) {
+            amber_exception_throw(cx, "ringSize must be at least 1024");
+            goto fail;
+        }
+        for(size = 1024; size < n; size *= 2)
+            ;
+        l->ringsize = size;
+    }
+
+    if(!log_get_option(cx, opts, "interval", &v))
+        goto fail;
+    if(!JSVAL_IS_VOID(v)) {
+        if(!JS_ValueToInt32(cx, v, &n) || n < 1) {
+            amber_exception_throw(cx, "interval must be a positive number of milliseconds");
+            goto fail;
+        }
+        l->interval = n;
+    }
+
+    /* keep a File alive for as long as we're writing to it */
+    if(argc > 0 && (f = amber_file_stream(cx, argv[0])) != NULL) {
+        if(fflush(f) != 0 || (l->fd = fileno(f)) < 0) {
+            amber_exception_throw(cx, "can't log to this File");
+            goto fail;
+        }
+        JS_SetReservedSlot(cx, obj, 0, argv[0]);
+    }
+    else if(argc > 0 && !JSVAL_IS_VOID(argv[0]) && !JSVAL_IS_NULL(argv[0])) {
+        if((str = JS_ValueToString(cx, argv[0])) == NULL)
+            goto fail;
+        name = JS_GetStringBytes(str);
+        if((l->fd = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666)) < 0) {
+            amber_exception_throw_code(cx, errno, "Log", "couldn't open '%s': %s", name, strerror(errno));
+            goto fail;
+        }
+        l->own_fd = 1;
+    }
+
+    l->outsize = (l->ringsize > LOG_RINGSIZE ? l->ringsize : LOG_RINGSIZE) + 128;
+    if((l->out = malloc(l->outsize)) == NULL) {
+        amber_exception_throw(cx, "out of memory");
+        goto fail;
+    }
+
+    pthread_mutex_init(&l->mutex, NULL);
+    pthread_cond_init(&l->wake, NULL);
+    pthread_cond_init(&l->space, NULL);
+    pthread_key_create(&l->key, log_ring_release);
+
+    if((err = pthread_create(&l->writer, NULL, log_writer, l)) != 0) {
+        pthread_key_delete(l->key);
+        pthread_cond_destroy(&l->wake);
+        pthread_cond_destroy(&l->space);
+        pthread_mutex_destroy(&l->mutex);
+        amber_exception_throw(cx, "couldn't start log writer: %s", strerror(err));
+        goto fail;
+    }
+
+    JS_SetPrivate(cx, obj, l);
+
+    return JS_TRUE;
+
+fail:
+    if(l->own_fd)
+        close(l->fd);
+    free(l->out);
+    free(l);
+    return JS_FALSE;
+}
+
+static void log_finalize(JSContext *cx, JSObject *obj) {
+    log_stuff l;
+
+    if((l = JS_GetPrivate(cx, obj)) != NULL)
+        log_destroy(l);
+}
+
+static JSClass log_class = {
+    "Log", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, log_get_property, log_set_property,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, log_finalize
+};
+
+JSBool Log(JSContext *cx, JSObject *amber) {
+    JSObject *log;
+
+    log = JS_InitClass(cx, amber, NULL, &log_class,
+                       log_constructor, 2,
+                       log_properties, log_methods,
+                       NULL, NULL);
+
+    return JS_TRUE;
+}
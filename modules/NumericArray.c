@@ -0,0 +1,1321 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <jsapi.h>
+
+/*
+ * contiguous float64, int64 or int32 storage. the float64 reductions and
+ * arithmetic are written with SSE2 and the int32 ones where SSE2 has the
+ * instructions; everything else is plain loops. int64 values come back to
+ * scripts as doubles, so anything past 2^53 loses precision
+ */
+
+#define NA_ALIGN        (64)
+#define NA_MIN          (16)
+
+typedef enum na_type {
+    NA_FLOAT64,
+    NA_INT64,
+    NA_INT32
+} na_type;
+
+static const struct {
+    const char  *name;
+    size_t      size;
+} na_types[] = {
+    { "float64",    8 },
+    { "int64",      8 },
+    { "int32",      4 },
+    { NULL }
+};
+
+typedef struct na_stuff {
+    na_type     type;
+    void        *data;
+    size_t      len, cap;
+} *na_stuff;
+
+#define NA_F64(a)   ((double *) (a)->data)
+#define NA_I64(a)   ((int64_t *) (a)->data)
+#define NA_I32(a)   ((int32_t *) (a)->data)
+
+static jsdouble na_get(na_stuff a, size_t i) {
+    switch(a->type) {
+        case NA_FLOAT64:
+            return NA_F64(a)[i];
+        case NA_INT64:
+            return (jsdouble) NA_I64(a)[i];
+        case NA_INT32:
+            return (jsdouble) NA_I32(a)[i];
+    }
+
+    return 0;
+}
+
+/* ints truncate towards zero and saturate, NaN becomes 0 */
+static void na_put(na_stuff a, size_t i, jsdouble d) {
+    switch(a->type) {
+        case NA_FLOAT64:
+            NA_F64(a)[i] = d;
+            break;
+
+        case NA_INT64:
+            NA_I64(a)[i] = d != d ? 0 : d >= 9223372036854775807.0 ? INT64_MAX :
+                           d <= -9223372036854775808.0 ? INT64_MIN : (int64_t) d;
+            break;
+
+        case NA_INT32:
+            NA_I32(a)[i] = d != d ? 0 : d >= 2147483647.0 ? INT32_MAX :
+                           d <= -2147483648.0 ? INT32_MIN : (int32_t) d;
+            break;
+    }
+}
+
+static JSBool na_reserve(JSContext *cx, na_stuff a, size_t want) {
+    size_t cap;
+    void *data;
+
+    size_t max = SIZE_MAX / na_types[a->type].size;
+
+    if(want <= a->cap)
+        return JS_TRUE;
+
+    ASSERT_THROW(want > max, "out of memory");
+
+    /* doubling, but never past what a size_t can count in bytes */
+    for(cap = a->cap > NA_MIN ? a->cap : NA_MIN; cap < want; cap = cap > max / 2 ? max : cap * 2)
+        ;
+
+    ASSERT_THROW(posix_memalign(&data, NA_ALIGN, cap * na_types[a->type].size) != 0, "out of memory");
+    if(a->len > 0)
+        memcpy(data, a->data, a->len * na_types[a->type].size);
+    free(a->data);
+
+    amber_memory_account((ssize_t) ((cap - a->cap) * na_types[a->type].size));
+
+    a->data = data;
+    a->cap = cap;
+
+    return JS_TRUE;
+}
+
+/* kernels */
+
+static double na_sum_f64(const double *p, size_t n) {
+    double s = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    double out[2];
+
+    for(; i + 8 <= n; i += 8) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(p + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(p + i + 2));
+        s2 = _mm_add_pd(s2, _mm_loadu_pd(p + i + 4));
+        s3 = _mm_add_pd(s3, _mm_loadu_pd(p + i + 6));
+    }
+    _mm_storeu_pd(out, _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3)));
+    s = out[0] + out[1];
+#endif
+
+    for(; i < n; i++)
+        s += p[i];
+
+    return s;
+}
+
+static double na_sum_i32(const int32_t *p, size_t n) {
+    double s = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d s0 = _mm_setzero_pd(), s1 = s0;
+    __m128i x;
+    double out[2];
+
+    /* widen to doubles as we go so the total can't overflow */
+    for(; i + 4 <= n; i += 4) {
+        x = _mm_loadu_si128((const __m128i *) (p + i));
+        s0 = _mm_add_pd(s0, _mm_cvtepi32_pd(x));
+        s1 = _mm_add_pd(s1, _mm_cvtepi32_pd(_mm_shuffle_epi32(x, 0x0e)));
+    }
+    _mm_storeu_pd(out, _mm_add_pd(s0, s1));
+    s = out[0] + out[1];
+#endif
+
+    for(; i < n; i++)
+        s += p[i];
+
+    return s;
+}
+
+static double na_sum_i64(const int64_t *p, size_t n) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+
+    for(; i + 4 <= n; i += 4) {
+        s0 += p[i];
+        s1 += p[i + 1];
+        s2 += p[i + 2];
+        s3 += p[i + 3];
+    }
+    for(; i < n; i++)
+        s0 += p[i];
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+static double na_sum(na_stuff a) {
+    switch(a->type) {
+        case NA_FLOAT64:
+            return na_sum_f64(NA_F64(a), a->len);
+        case NA_INT64:
+            return na_sum_i64(NA_I64(a), a->len);
+        case NA_INT32:
+            return na_sum_i32(NA_I32(a), a->len);
+    }
+
+    return 0;
+}
+
+/* sum of squared distances from m, for the variance */
+static double na_sumsq(na_stuff a, double m) {
+    const double *p;
+    double s = 0, d;
+    size_t i = 0, n = a->len;
+
+    if(a->type != NA_FLOAT64) {
+        for(; i < n; i++) {
+            d = na_get(a, i) - m;
+            s += d * d;
+        }
+        return s;
+    }
+
+    p = NA_F64(a);
+#ifdef __SSE2__
+    {
+        __m128d s0 = _mm_setzero_pd(), s1 = s0, vm = _mm_set1_pd(m), d0, d1;
+        double out[2];
+
+        for(; i + 4 <= n; i += 4) {
+            d0 = _mm_sub_pd(_mm_loadu_pd(p + i), vm);
+            d1 = _mm_sub_pd(_mm_loadu_pd(p + i + 2), vm);
+            s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+        }
+        _mm_storeu_pd(out, _mm_add_pd(s0, s1));
+        s = out[0] + out[1];
+    }
+#endif
+
+    for(; i < n; i++) {
+        d = p[i] - m;
+        s += d * d;
+    }
+
+    return s;
+}
+
+/* NaNs are skipped. the vector compare returns its second operand when
+ * either is NaN, and the running value never is */
+static void na_minmax_f64(const double *p, size_t n, double *min, double *max) {
+    double lo = INFINITY, hi = -INFINITY;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d vlo = _mm_set1_pd(INFINITY), vhi = _mm_set1_pd(-INFINITY), x;
+    double out[2];
+
+    for(; i + 2 <= n; i += 2) {
+        x = _mm_loadu_pd(p + i);
+        vlo = _mm_min_pd(x, vlo);
+        vhi = _mm_max_pd(x, vhi);
+    }
+    _mm_storeu_pd(out, vlo);
+    lo = out[0] < out[1] ? out[0] : out[1];
+    _mm_storeu_pd(out, vhi);
+    hi = out[0] > out[1] ? out[0] : out[1];
+#endif
+
+    for(; i < n; i++) {
+        if(p[i] < lo)
+            lo = p[i];
+        if(p[i] > hi)
+            hi = p[i];
+    }
+
+    *min = lo;
+    *max = hi;
+}
+
+static void na_minmax_i32(const int32_t *p, size_t n, double *min, double *max) {
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i vlo = _mm_set1_epi32(INT32_MAX), vhi = _mm_set1_epi32(INT32_MIN), x, m;
+    int32_t out[4];
+    int j;
+
+    /* no pminsd before SSE4.1, so compare and blend */
+    for(; i + 4 <= n; i += 4) {
+        x = _mm_loadu_si128((const __m128i *) (p + i));
+        m = _mm_cmplt_epi32(x, vlo);
+        vlo = _mm_or_si128(_mm_and_si128(m, x), _mm_andnot_si128(m, vlo));
+        m = _mm_cmpgt_epi32(x, vhi);
+        vhi = _mm_or_si128(_mm_and_si128(m, x), _mm_andnot_si128(m, vhi));
+    }
+    _mm_storeu_si128((__m128i *) out, vlo);
+    for(j = 0; j < 4; j++)
+        if(out[j] < lo)
+            lo = out[j];
+    _mm_storeu_si128((__m128i *) out, vhi);
+    for(j = 0; j < 4; j++)
+        if(out[j] > hi)
+            hi = out[j];
+#endif
+
+    for(; i < n; i++) {
+        if(p[i] < lo)
+            lo = p[i];
+        if(p[i] > hi)
+            hi = p[i];
+    }
+
+    *min = lo;
+    *max = hi;
+}
+
+static void na_minmax_i64(const int64_t *p, size_t n, double *min, double *max) {
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        if(p[i] < lo)
+            lo = p[i];
+        if(p[i] > hi)
+            hi = p[i];
+    }
+
+    *min = (double) lo;
+    *max = (double) hi;
+}
+
+static void na_minmax(na_stuff a, double *min, double *max) {
+    switch(a->type) {
+        case NA_FLOAT64:
+            na_minmax_f64(NA_F64(a), a->len, min, max);
+            break;
+        case NA_INT64:
+            na_minmax_i64(NA_I64(a), a->len, min, max);
+            break;
+        case NA_INT32:
+            na_minmax_i32(NA_I32(a), a->len, min, max);
+            break;
+    }
+}
+
+static double na_dot_f64(const double *p, const double *q, size_t n) {
+    double s = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d s0 = _mm_setzero_pd(), s1 = s0;
+    double out[2];
+
+    for(; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(p + i), _mm_loadu_pd(q + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(p + i + 2), _mm_loadu_pd(q + i + 2)));
+    }
+    _mm_storeu_pd(out, _mm_add_pd(s0, s1));
+    s = out[0] + out[1];
+#endif
+
+    for(; i < n; i++)
+        s += p[i] * q[i];
+
+    return s;
+}
+
+typedef enum na_op {
+    NA_ADD,
+    NA_SUB,
+    NA_MUL,
+    NA_DIV
+} na_op;
+
+/* p = p op (q ? q : s) */
+static void na_apply_f64(double *p, const double *q, double s, size_t n, na_op op) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d vs = _mm_set1_pd(s), x, y;
+
+    for(; i + 2 <= n; i += 2) {
+        x = _mm_loadu_pd(p + i);
+        y = q != NULL ? _mm_loadu_pd(q + i) : vs;
+        switch(op) {
+            case NA_ADD: x = _mm_add_pd(x, y); break;
+            case NA_SUB: x = _mm_sub_pd(x, y); break;
+            case NA_MUL: x = _mm_mul_pd(x, y); break;
+            case NA_DIV: x = _mm_div_pd(x, y); break;
+        }
+        _mm_storeu_pd(p + i, x);
+    }
+#endif
+
+    for(; i < n; i++) {
+        if(q != NULL)
+            s = q[i];
+        switch(op) {
+            case NA_ADD: p[i] += s; break;
+            case NA_SUB: p[i] -= s; break;
+            case NA_MUL: p[i] *= s; break;
+            case NA_DIV: p[i] /= s; break;
+        }
+    }
+}
+
+/* ints wrap on overflow, done unsigned so it's defined. the one quotient
+ * that doesn't fit, MIN / -1, saturates like na_put does. s has already
+ * been brought into range */
+#define NA_APPLY_INT(T, U, MIN, MAX, p, q, s, n, op) \
+    do { \
+        size_t i_; \
+        T y_ = (T) (s); \
+        for(i_ = 0; i_ < (n); i_++) { \
+            if((q) != NULL) \
+                y_ = (q)[i_]; \
+            switch(op) { \
+                case NA_ADD: (p)[i_] = (T) ((U) (p)[i_] + (U) y_); break; \
+                case NA_SUB: (p)[i_] = (T) ((U) (p)[i_] - (U) y_); break; \
+                case NA_MUL: (p)[i_] = (T) ((U) (p)[i_] * (U) y_); break; \
+                case NA_DIV: \
+                    if(y_ == -1) \
+                        (p)[i_] = (p)[i_] == (MIN) ? (MAX) : -(p)[i_]; \
+                    else \
+                        (p)[i_] /= y_; \
+                    break; \
+            } \
+        } \
+    } while(0)
+
+/* quickselect. leaves the k'th smallest at p[k] with nothing bigger before
+ * it and nothing smaller after */
+static void na_select(double *p, size_t n, size_t k) {
+    size_t lo = 0, hi = n - 1, i, j, mid;
+    double pivot, t;
+
+    while(hi > lo) {
+        mid = lo + (hi - lo) / 2;
+        if(p[mid] < p[lo]) { t = p[mid]; p[mid] = p[lo]; p[lo] = t; }
+        if(p[hi] < p[lo]) { t = p[hi]; p[hi] = p[lo]; p[lo] = t; }
+        if(p[hi] < p[mid]) { t = p[hi]; p[hi] = p[mid]; p[mid] = t; }
+        pivot = p[mid];
+
+        i = lo;
+        j = hi;
+        while(i <= j) {
+            while(p[i] < pivot)
+                i++;
+            while(p[j] > pivot)
+                j--;
+            if(i <= j) {
+                t = p[i]; p[i] = p[j]; p[j] = t;
+                i++;
+                if(j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            break;
+    }
+}
+
+/* the p'th percentile with linear interpolation between ranks, like
+ * numpy's default. the values are already partitioned around earlier
+ * selections, which only makes later ones cheaper */
+static double na_percentile_of(double *v, size_t n, double pct) {
+    double rank, frac, lo, hi;
+    size_t k, i;
+
+    if(n == 0)
+        return NAN;
+
+    rank = pct / 100 * (n - 1);
+    k = (size_t) rank;
+    frac = rank - k;
+
+    na_select(v, n, k);
+    lo = v[k];
+    if(frac == 0 || k + 1 >= n)
+        return lo;
+
+    for(hi = v[k + 1], i = k + 2; i < n; i++)
+        if(v[i] < hi)
+            hi = v[i];
+
+    return lo + (hi - lo) * frac;
+}
+
+/* helpers */
+
+static JSBool na_type_from(JSContext *cx, jsval v, na_type *type) {
+    JSString *str;
+    char *name;
+    int i;
+
+    *type = NA_FLOAT64;
+    if(JSVAL_IS_VOID(v))
+        return JS_TRUE;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; na_types[i].name != NULL; i++)
+        if(strcmp(name, na_types[i].name) == 0) {
+            *type = (na_type) i;
+            return JS_TRUE;
+        }
+
+    THROW("unknown numeric type '%s'", name);
+}
+
+static JSClass na_class;
+
+/* a new empty array with the given prototype, stored in *rval */
+static na_stuff na_new(JSContext *cx, JSObject *proto, na_type type, size_t len, jsval *rval) {
+    JSObject *obj;
+    na_stuff a;
+
+    if((obj = JS_NewObject(cx, &na_class, proto, NULL)) == NULL)
+        return NULL;
+    *rval = OBJECT_TO_JSVAL(obj);
+
+    if((a = calloc(1, sizeof(struct na_stuff))) == NULL) {
+        amber_exception_throw(cx, "out of memory");
+        return NULL;
+    }
+    a->type = type;
+    JS_SetPrivate(cx, obj, a);
+
+    if(!na_reserve(cx, a, len))
+        return NULL;
+
+    return a;
+}
+
+static na_stuff na_other(JSContext *cx, jsval v) {
+    if(!JSVAL_IS_OBJECT(v) || JSVAL_IS_NULL(v))
+        return NULL;
+
+    return JS_GetInstancePrivate(cx, JSVAL_TO_OBJECT(v), &na_class, NULL);
+}
+
+static JSBool na_index(JSContext *cx, na_stuff a, uintN argc, jsval *argv, size_t *i) {
+    jsdouble d;
+
+    ASSERT_THROW(argc < 1 || !JS_ValueToNumber(cx, argv[0], &d), "need an index");
+    ASSERT_THROW(d < 0 || d >= a->len || d != (size_t) d, "index out of range");
+
+    *i = (size_t) d;
+    return JS_TRUE;
+}
+
+/* methods */
+
+static JSBool na_get_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(!na_index(cx, a, argc, argv, &i))
+        return JS_FALSE;
+
+    return JS_NewNumberValue(cx, na_get(a, i), rval);
+}
+
+static JSBool na_set_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    jsdouble d;
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(!na_index(cx, a, argc, argv, &i))
+        return JS_FALSE;
+    ASSERT_THROW(argc < 2 || !JS_ValueToNumber(cx, argv[1], &d), "set needs a value");
+
+    na_put(a, i, d);
+    return JS_TRUE;
+}
+
+static JSBool na_push(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    jsdouble d;
+    uintN i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(!na_reserve(cx, a, a->len + argc))
+        return JS_FALSE;
+
+    for(i = 0; i < argc; i++) {
+        if(!JS_ValueToNumber(cx, argv[i], &d))
+            return JS_FALSE;
+        na_put(a, a->len++, d);
+    }
+
+    return JS_NewNumberValue(cx, (jsdouble) a->len, rval);
+}
+
+/* grow with zeros or cut short */
+static JSBool na_resize(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    jsdouble d;
+    size_t n;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1 || !JS_ValueToNumber(cx, argv[0], &d) || !(d >= 0 && d < 18446744073709551616.0) || d != (size_t) d,
+                 "resize needs a length");
+    n = (size_t) d;
+
+    if(!na_reserve(cx, a, n))
+        return JS_FALSE;
+    if(n > a->len)
+        memset((char *) a->data + a->len * na_types[a->type].size, 0, (n - a->len) * na_types[a->type].size);
+    a->len = n;
+
+    return JS_TRUE;
+}
+
+static JSBool na_fill(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    jsdouble d;
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1 || !JS_ValueToNumber(cx, argv[0], &d), "fill needs a value");
+
+    if(a->len > 0) {
+        na_put(a, 0, d);
+        for(i = 1; i < a->len; i++)
+            memcpy((char *) a->data + i * na_types[a->type].size, a->data, na_types[a->type].size);
+    }
+
+    *rval = OBJECT_TO_JSVAL(obj);
+    return JS_TRUE;
+}
+
+/* a slice bound as Array.prototype.slice takes it: ToInteger, counted
+ * from the end if it's negative, and clamped to the array */
+static size_t na_slice_index(jsdouble d, size_t len) {
+    if(d != d)
+        return 0;
+
+    d = trunc(d);
+    if(d < 0)
+        d += len;
+
+    return d < 0 ? 0 : d > len ? len : (size_t) d;
+}
+
+/* a copy of [start, end) */
+static JSBool na_slice(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj), b;
+    jsdouble d;
+    size_t start = 0, end;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    end = a->len;
+    if(argc > 0) {
+        if(!JS_ValueToNumber(cx, argv[0], &d))
+            return JS_FALSE;
+        start = na_slice_index(d, a->len);
+    }
+    if(argc > 1 && !JSVAL_IS_VOID(argv[1])) {
+        if(!JS_ValueToNumber(cx, argv[1], &d))
+            return JS_FALSE;
+        end = na_slice_index(d, a->len);
+    }
+    if(start > end)
+        start = end;
+
+    if((b = na_new(cx, JS_GetPrototype(cx, obj), a->type, end - start, rval)) == NULL)
+        return JS_FALSE;
+
+    b->len = end - start;
+    memcpy(b->data, (char *) a->data + start * na_types[a->type].size, b->len * na_types[a->type].size);
+
+    return JS_TRUE;
+}
+
+static JSBool na_to_array(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    JSObject *arr;
+    jsval v;
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+
+    if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    for(i = 0; i < a->len; i++)
+        if(!JS_NewNumberValue(cx, na_get(a, i), &v) || !JS_SetElement(cx, arr, i, &v))
+            return JS_FALSE;
+
+    return JS_TRUE;
+}
+
+/* raw values in native byte order, the counterpart of NumericArray.read() */
+static JSBool na_write_to(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    jsrefcount saved;
+    size_t n;
+    FILE *f;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc == 0 || (f = amber_file_stream(cx, argv[0])) == NULL, "writeTo needs an open File");
+
+    saved = JS_SuspendRequest(cx);
+    n = fwrite(a->data, na_types[a->type].size, a->len, f);
+    JS_ResumeRequest(cx, saved);
+
+    ASSERT_THROW_CODE(n != a->len, errno, "NumericArray", "write failed: %s", strerror(errno));
+
+    return JS_TRUE;
+}
+
+static JSBool na_sum_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+
+    return JS_NewNumberValue(cx, na_sum(a), rval);
+}
+
+static JSBool na_mean(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+
+    return JS_NewNumberValue(cx, a->len ? na_sum(a) / a->len : NAN, rval);
+}
+
+/* variance([ddof]). population by default, pass 1 for the sample variance */
+static JSBool na_variance(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    int32 ddof = 0;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(argc > 0 && !JS_ValueToInt32(cx, argv[0], &ddof))
+        return JS_FALSE;
+
+    if(ddof < 0 || a->len <= (size_t) ddof)
+        return JS_NewNumberValue(cx, NAN, rval);
+
+    return JS_NewNumberValue(cx, na_sumsq(a, na_sum(a) / a->len) / (a->len - ddof), rval);
+}
+
+static JSBool na_stddev(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    if(!na_variance(cx, obj, argc, argv, rval))
+        return JS_FALSE;
+
+    return JS_NewNumberValue(cx, sqrt(JSVAL_IS_INT(*rval) ? JSVAL_TO_INT(*rval) : *JSVAL_TO_DOUBLE(*rval)), rval);
+}
+
+static JSBool na_min(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    double lo, hi;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(a->len == 0)
+        return JS_NewNumberValue(cx, NAN, rval);
+
+    na_minmax(a, &lo, &hi);
+    return JS_NewNumberValue(cx, lo, rval);
+}
+
+static JSBool na_max(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    double lo, hi;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    if(a->len == 0)
+        return JS_NewNumberValue(cx, NAN, rval);
+
+    na_minmax(a, &lo, &hi);
+    return JS_NewNumberValue(cx, hi, rval);
+}
+
+static JSBool na_dot(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj), b;
+    double s = 0;
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1 || (b = na_other(cx, argv[0])) == NULL, "dot needs a NumericArray");
+    ASSERT_THROW(a->len != b->len, "arrays are different lengths");
+
+    if(a->type == NA_FLOAT64 && b->type == NA_FLOAT64)
+        s = na_dot_f64(NA_F64(a), NA_F64(b), a->len);
+    else
+        for(i = 0; i < a->len; i++)
+            s += na_get(a, i) * na_get(b, i);
+
+    return JS_NewNumberValue(cx, s, rval);
+}
+
+/* in place, with a number or another array of the same length */
+static JSBool na_arith(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval, na_op op) {
+    na_stuff a = JS_GetPrivate(cx, obj), b = NULL;
+    jsdouble s = 0;
+    size_t i;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1, "need a number or a NumericArray");
+
+    if((b = na_other(cx, argv[0])) != NULL) {
+        ASSERT_THROW(b->len != a->len, "arrays are different lengths");
+    } else if(!JS_ValueToNumber(cx, argv[0], &s))
+        return JS_FALSE;
+
+    *rval = OBJECT_TO_JSVAL(obj);
+
+    if(a->type == NA_FLOAT64 && (b == NULL || b->type == NA_FLOAT64)) {
+        na_apply_f64(NA_F64(a), b != NULL ? NA_F64(b) : NULL, s, a->len, op);
+        return JS_TRUE;
+    }
+
+    /* a float64 array only gets here when dividing by an int one */
+    if(op == NA_DIV && a->type != NA_FLOAT64) {
+        if(b == NULL) {
+            ASSERT_THROW(!(s <= -1 || s >= 1), "integer division by zero");
+        } else {
+            for(i = 0; i < b->len; i++)
+                ASSERT_THROW(na_get(b, i) == 0, "integer division by zero");
+        }
+    }
+
+    if(b != NULL && b->type != a->type) {
+        for(i = 0; i < a->len; i++) {
+            s = na_get(b, i);
+            switch(op) {
+                case NA_ADD: na_put(a, i, na_get(a, i) + s); break;
+                case NA_SUB: na_put(a, i, na_get(a, i) - s); break;
+                case NA_MUL: na_put(a, i, na_get(a, i) * s); break;
+                case NA_DIV: na_put(a, i, a->type == NA_FLOAT64 ? na_get(a, i) / s : trunc(na_get(a, i) / s)); break;
+            }
+        }
+        return JS_TRUE;
+    }
+
+    /* the scalar truncates and saturates the way a stored value would */
+    if(b == NULL) {
+        if(a->type == NA_INT64)
+            s = s != s ? 0 : s >= 9223372036854775807.0 ? INT64_MAX : s <= -9223372036854775808.0 ? INT64_MIN : trunc(s);
+        else
+            s = s != s ? 0 : s >= 2147483647.0 ? INT32_MAX : s <= -2147483648.0 ? INT32_MIN : trunc(s);
+    }
+
+    if(a->type == NA_INT64)
+        NA_APPLY_INT(int64_t, uint64_t, INT64_MIN, INT64_MAX, NA_I64(a), b != NULL ? NA_I64(b) : NULL, s, a->len, op);
+    else
+        NA_APPLY_INT(int32_t, uint32_t, INT32_MIN, INT32_MAX, NA_I32(a), b != NULL ? NA_I32(b) : NULL, s, a->len, op);
+
+    return JS_TRUE;
+}
+
+static JSBool na_add(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return na_arith(cx, obj, argc, argv, rval, NA_ADD);
+}
+
+static JSBool na_sub(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return na_arith(cx, obj, argc, argv, rval, NA_SUB);
+}
+
+static JSBool na_mul(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return na_arith(cx, obj, argc, argv, rval, NA_MUL);
+}
+
+static JSBool na_div(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    return na_arith(cx, obj, argc, argv, rval, NA_DIV);
+}
+
+/* histogram(bins, [min, max]) counts values into equal width bins. max
+ * goes in the last bin, anything outside or NaN isn't counted */
+static JSBool na_histogram(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    JSObject *arr;
+    uint32_t *counts;
+    double lo, hi, scale, x;
+    int32 bins;
+    size_t i, b;
+    jsval v;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1 || !JS_ValueToInt32(cx, argv[0], &bins) || bins < 1, "histogram needs a number of bins");
+
+    na_minmax(a, &lo, &hi);
+    if(argc > 1 && !JS_ValueToNumber(cx, argv[1], &lo))
+        return JS_FALSE;
+    if(argc > 2 && !JS_ValueToNumber(cx, argv[2], &hi))
+        return JS_FALSE;
+
+    ASSERT_THROW((counts = calloc(bins, sizeof(uint32_t))) == NULL, "out of memory");
+
+    scale = hi > lo ? bins / (hi - lo) : 0;
+    for(i = 0; i < a->len; i++) {
+        x = a->type == NA_FLOAT64 ? NA_F64(a)[i] : na_get(a, i);
+        if(!(x >= lo && x <= hi))
+            continue;
+        b = (size_t) ((x - lo) * scale);
+        counts[b < (size_t) bins ? b : (size_t) bins - 1]++;
+    }
+
+    if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL) {
+        free(counts);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    for(b = 0; b < (size_t) bins; b++)
+        if(!JS_NewNumberValue(cx, counts[b], &v) || !JS_SetElement(cx, arr, b, &v)) {
+            free(counts);
+            return JS_FALSE;
+        }
+
+    free(counts);
+    return JS_TRUE;
+}
+
+/* percentile(p) or percentile([p, ...]), p from 0 to 100. NaNs are left out */
+static JSBool na_percentile(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a = JS_GetPrivate(cx, obj);
+    JSObject *ps = NULL, *arr;
+    jsuint np = 1, i;
+    double *v, x;
+    jsdouble p;
+    size_t n, j;
+    jsval pv;
+
+    ASSERT_THROW(a == NULL, "not a NumericArray");
+    ASSERT_THROW(argc < 1, "percentile needs a percentage");
+
+    if(JSVAL_IS_OBJECT(argv[0]) && !JSVAL_IS_NULL(argv[0]) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(argv[0]))) {
+        ps = JSVAL_TO_OBJECT(argv[0]);
+        if(!JS_GetArrayLength(cx, ps, &np))
+            return JS_FALSE;
+        if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+            return JS_FALSE;
+        *rval = OBJECT_TO_JSVAL(arr);
+    }
+
+    ASSERT_THROW((v = malloc((a->len ? a->len : 1) * sizeof(double))) == NULL, "out of memory");
+    for(j = n = 0; j < a->len; j++) {
+        x = na_get(a, j);
+        if(x == x)
+            v[n++] = x;
+    }
+
+    for(i = 0; i < np; i++) {
+        if(ps != NULL) {
+            if(!JS_GetElement(cx, ps, i, &pv))
+                goto fail;
+        } else
+            pv = argv[0];
+
+        if(!JS_ValueToNumber(cx, pv, &p))
+            goto fail;
+        if(p < 0 || p > 100) {
+            amber_exception_throw(cx, "percentile must be between 0 and 100");
+            goto fail;
+        }
+
+        if(!JS_NewNumberValue(cx, na_percentile_of(v, n, p), &pv))
+            goto fail;
+
+        if(ps == NULL)
+            *rval = pv;
+        else if(!JS_SetElement(cx, arr, i, &pv))
+            goto fail;
+    }
+
+    free(v);
+    return JS_TRUE;
+
+fail:
+    free(v);
+    return JS_FALSE;
+}
+
+static JSFunctionSpec na_methods[] = {
+    { "get",        na_get_method,  1, 0 },
+    { "set",        na_set_method,  2, 0 },
+    { "push",       na_push,        1, 0 },
+    { "resize",     na_resize,      1, 0 },
+    { "fill",       na_fill,        1, 0 },
+    { "slice",      na_slice,       2, 0 },
+    { "toArray",    na_to_array,    0, 0 },
+    { "writeTo",    na_write_to,    1, 0 },
+    { "sum",        na_sum_method,  0, 0 },
+    { "mean",       na_mean,        0, 0 },
+    { "variance",   na_variance,    1, 0 },
+    { "stddev",     na_stddev,      1, 0 },
+    { "min",        na_min,         0, 0 },
+    { "max",        na_max,         0, 0 },
+    { "dot",        na_dot,         1, 0 },
+    { "add",        na_add,         1, 0 },
+    { "sub",        na_sub,         1, 0 },
+    { "mul",        na_mul,         1, 0 },
+    { "div",        na_div,         1, 0 },
+    { "histogram",  na_histogram,   3, 0 },
+    { "percentile", na_percentile,  1, 0 },
+    { NULL }
+};
+
+/* loading */
+
+typedef struct na_text {
+    int32       column;
+    char        delim;
+    int32       skip;
+    jsdouble    missing;
+} na_text;
+
+/* find the column in one line and append it */
+static int na_text_line(na_stuff a, const na_text *t, const char *line, size_t len) {
+    const char *p = line, *end = line + len, *q;
+    char field[64], *stop;
+    size_t flen;
+    int32 c;
+    double d;
+
+    if(len > 0 && line[len - 1] == '\r')
+        end--;
+
+    for(c = 0; c < t->column; c++) {
+        if((q = memchr(p, t->delim, end - p)) == NULL)
+            break;
+        p = q + 1;
+    }
+
+    d = t->missing;
+    if(c == t->column) {
+        if((q = memchr(p, t->delim, end - p)) == NULL)
+            q = end;
+        while(p < q && (*p == ' ' || *p == '\t'))
+            p++;
+        while(q > p && (q[-1] == ' ' || q[-1] == '\t'))
+            q--;
+
+        if((flen = q - p) > 0 && flen < sizeof(field)) {
+            memcpy(field, p, flen);
+            field[flen] = '\0';
+
+            /* whole numbers go through strtoll so int64 keeps every digit */
+            if(a->type != NA_FLOAT64) {
+                long long ll = strtoll(field, &stop, 10);
+                if(*stop == '\0') {
+                    if(a->type == NA_INT64)
+                        NA_I64(a)[a->len++] = ll;
+                    else
+                        na_put(a, a->len++, (double) ll);
+                    return 1;
+                }
+            }
+
+            d = strtod(field, &stop);
+            if(*stop != '\0')
+                d = t->missing;
+        }
+    }
+
+    na_put(a, a->len++, d);
+    return 1;
+}
+
+static JSBool na_text_options(JSContext *cx, JSObject *opts, na_text *t, na_type *type) {
+    JSString *str;
+    jsval v;
+
+    t->column = 0;
+    t->delim = ',';
+    t->skip = 0;
+    t->missing = NAN;
+    *type = NA_FLOAT64;
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    if(!JS_GetProperty(cx, opts, "type", &v) || !na_type_from(cx, v, type))
+        return JS_FALSE;
+
+    if(!JS_GetProperty(cx, opts, "column", &v) ||
+       (!JSVAL_IS_VOID(v) && !JS_ValueToInt32(cx, v, &t->column)))
+        return JS_FALSE;
+    ASSERT_THROW(t->column < 0, "column must be 0 or more");
+
+    if(!JS_GetProperty(cx, opts, "skip", &v) ||
+       (!JSVAL_IS_VOID(v) && !JS_ValueToInt32(cx, v, &t->skip)))
+        return JS_FALSE;
+
+    if(!JS_GetProperty(cx, opts, "missing", &v) ||
+       (!JSVAL_IS_VOID(v) && !JS_ValueToNumber(cx, v, &t->missing)))
+        return JS_FALSE;
+
+    if(!JS_GetProperty(cx, opts, "delimiter", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            return JS_FALSE;
+        ASSERT_THROW(JS_GetStringLength(str) != 1, "delimiter must be a single character");
+        t->delim = JS_GetStringBytes(str)[0];
+    }
+
+    return JS_TRUE;
+}
+
+/*
+ * NumericArray.fromText(string | File, [options]) takes one column of
+ * delimited text. options are column (from 0), delimiter (","), skip
+ * (header lines), type and missing (what empty or bad fields become, NaN
+ * by default)
+ */
+static JSBool na_from_text(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JSObject *opts = NULL;
+    jsrefcount saved;
+    JSString *str;
+    na_stuff a;
+    na_type type;
+    na_text t;
+    const char *p, *nl, *end;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int32 line_no = 0;
+    jsval proto;
+    FILE *f;
+    int ok = 1;
+
+    ASSERT_THROW(argc < 1, "fromText needs a string or a File");
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+    if(!na_text_options(cx, opts, &t, &type))
+        return JS_FALSE;
+
+    if(!JS_GetProperty(cx, obj, "prototype", &proto))
+        return JS_FALSE;
+    if((a = na_new(cx, JSVAL_TO_OBJECT(proto), type, NA_MIN, rval)) == NULL)
+        return JS_FALSE;
+
+    if((f = amber_file_stream(cx, argv[0])) != NULL) {
+        saved = JS_SuspendRequest(cx);
+        while((len = getline(&line, &size, f)) >= 0) {
+            if(line_no++ < t.skip)
+                continue;
+            if(len > 0 && line[len - 1] == '\n')
+                len--;
+            /* growing can throw, which needs the request back */
+            if(a->len == a->cap) {
+                JS_ResumeRequest(cx, saved);
+                ok = na_reserve(cx, a, a->len + 1);
+                saved = JS_SuspendRequest(cx);
+                if(!ok)
+                    break;
+            }
+            na_text_line(a, &t, line, len);
+        }
+        JS_ResumeRequest(cx, saved);
+        free(line);
+
+        return ok;
+    }
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+    argv[0] = STRING_TO_JSVAL(str);
+
+    p = JS_GetStringBytes(str);
+    end = p + strlen(p);
+
+    for(; p < end; p = nl + 1) {
+        if((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+        if(line_no++ < t.skip)
+            continue;
+        if(a->len == a->cap && !na_reserve(cx, a, a->len + 1))
+            return JS_FALSE;
+        na_text_line(a, &t, p, nl - p);
+    }
+
+    return JS_TRUE;
+}
+
+/* NumericArray.read(File, [type], [count]) takes raw native-order values,
+ * everything to the end of the file if there's no count */
+static JSBool na_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    jsrefcount saved;
+    na_stuff a;
+    na_type type = NA_FLOAT64;
+    jsdouble count = -1;
+    size_t want, n, size;
+    jsval proto;
+    FILE *f;
+
+    ASSERT_THROW(argc < 1 || (f = amber_file_stream(cx, argv[0])) == NULL, "read needs an open File");
+    if(argc > 1 && !na_type_from(cx, argv[1], &type))
+        return JS_FALSE;
+    if(argc > 2 && !JSVAL_IS_VOID(argv[2]) &&
+       (!JS_ValueToNumber(cx, argv[2], &count) || !(count >= 0 && count < 18446744073709551616.0)))
+        THROW("bad count");
+
+    if(!JS_GetProperty(cx, obj, "prototype", &proto))
+        return JS_FALSE;
+    if((a = na_new(cx, JSVAL_TO_OBJECT(proto), type, count >= 0 ? (size_t) count : 65536, rval)) == NULL)
+        return JS_FALSE;
+
+    size = na_types[type].size;
+    while(count < 0 || a->len < (size_t) count) {
+        if(a->len == a->cap && !na_reserve(cx, a, a->cap * 2))
+            return JS_FALSE;
+
+        want = a->cap - a->len;
+        if(count >= 0 && want > (size_t) count - a->len)
+            want = (size_t) count - a->len;
+
+        saved = JS_SuspendRequest(cx);
+        n = fread((char *) a->data + a->len * size, size, want, f);
+        JS_ResumeRequest(cx, saved);
+
+        a->len += n;
+        if(n < want)
+            break;
+    }
+
+    ASSERT_THROW_CODE(ferror(f), errno, "NumericArray", "read failed: %s", strerror(errno));
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec na_static_methods[] = {
+    { "fromText",   na_from_text,   2, 0 },
+    { "read",       na_read,        3, 0 },
+    { NULL }
+};
+
+enum na_tinyid {
+    NA_LENGTH,
+    NA_TYPE
+};
+
+static JSPropertySpec na_properties[] = {
+    { "length",     NA_LENGTH,  JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "type",       NA_TYPE,    JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { NULL }
+};
+
+static JSBool na_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    na_stuff a;
+
+    if((a = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case NA_LENGTH:
+            return JS_NewNumberValue(cx, (jsdouble) a->len, vp);
+
+        case NA_TYPE:
+            *vp = STRING_TO_JSVAL(JS_InternString(cx, na_types[a->type].name));
+            break;
+    }
+
+    return JS_TRUE;
+}
+
+/* new NumericArray([type], [length | array]) */
+static JSBool na_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    na_stuff a;
+    na_type type;
+    JSObject *arr = NULL;
+    jsuint len = 0, i;
+    jsdouble d;
+    jsval v;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    if(!na_type_from(cx, argc > 0 ? argv[0] : JSVAL_VOID, &type))
+        return JS_FALSE;
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(argv[1]))) {
+        arr = JSVAL_TO_OBJECT(argv[1]);
+        if(!JS_GetArrayLength(cx, arr, &len))
+            return JS_FALSE;
+    } else if(argc > 1 && !JSVAL_IS_VOID(argv[1])) {
+        ASSERT_THROW(!JS_ValueToNumber(cx, argv[1], &d) || d < 0 || d != (jsuint) d, "bad length");
+        len = (jsuint) d;
+    }
+
+    ASSERT_THROW((a = calloc(1, sizeof(struct na_stuff))) == NULL, "out of memory");
+    a->type = type;
+    JS_SetPrivate(cx, obj, a);
+
+    if(!na_reserve(cx, a, len))
+        return JS_FALSE;
+
+    if(arr == NULL) {
+        memset(a->data, 0, len * na_types[type].size);
+        a->len = len;
+        return JS_TRUE;
+    }
+
+    for(i = 0; i < len; i++) {
+        if(!JS_GetElement(cx, arr, i, &v) || !JS_ValueToNumber(cx, v, &d))
+            return JS_FALSE;
+        na_put(a, a->len++, d);
+    }
+
+    return JS_TRUE;
+}
+
+static void na_finalize(JSContext *cx, JSObject *obj) {
+    na_stuff a;
+
+    if((a = JS_GetPrivate(cx, obj)) == NULL)
+        return;
+
+    amber_memory_account(-(ssize_t) (a->cap * na_types[a->type].size));
+    free(a->data);
+    free(a);
+}
+
+static JSClass na_class = {
+    "NumericArray", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, na_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, na_finalize
+};
+
+JSBool NumericArray(JSContext *cx, JSObject *amber) {
+    JSObject *na;
+
+    na = JS_InitClass(cx, amber, NULL, &na_class,
+                      na_constructor, 2,
+                      na_properties, na_methods,
+                      NULL, na_static_methods);
+
+    return JS_TRUE;
+}
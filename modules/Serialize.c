@@ -0,0 +1,989 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <jsapi.h>
+
+/*
+ * a compact binary form for js values, for checkpoints and for handing
+ * data between processes without going through source text.
+ *
+ * a value is a tag byte followed by whatever the tag needs:
+ *
+ *   undefined null false true          nothing more
+ *   int                                zigzag varint
+ *   double date                        8 bytes, little-endian ieee
+ *   latin1                             varint length, one byte per char
+ *   utf16                              varint length, two bytes per char
+ *   array                              varint length, then each element
+ *   object                             varint count, then key, value pairs
+ *   ref                                varint index of an object seen before
+ *   key                                varint index of a key seen before
+ *
+ * every array, object and date gets the next index as it's first written,
+ * so shared and cyclic references come back as the same object. property
+ * names are written once and referred to by index after that, which is
+ * most of the win for arrays of records. names are atoms, so spotting a
+ * repeat is a pointer lookup.
+ *
+ * a record on a stream is the magic and version bytes, the varint length
+ * of the payload and the payload, so a reader can pull one in with a
+ * single read.
+ *
+ * functions have no serialized form: they come back as undefined, and
+ * properties holding them are left out, as with JSON. an undefined array
+ * element isn't defined on the way back, so holes stay holes and anything
+ * that was explicitly undefined reads the same.
+ */
+
+#define SERIAL_MAGIC        (0xa5)
+#define SERIAL_VERSION      (1)
+#define SERIAL_MAX_DEPTH    (1024)
+
+enum serial_tag {
+    SERIAL_UNDEFINED,
+    SERIAL_NULL,
+    SERIAL_FALSE,
+    SERIAL_TRUE,
+    SERIAL_INT,
+    SERIAL_DOUBLE,
+    SERIAL_DATE,
+    SERIAL_LATIN1,
+    SERIAL_UTF16,
+    SERIAL_ARRAY,
+    SERIAL_OBJECT,
+    SERIAL_REF,
+    SERIAL_KEY
+};
+
+/* pointer to index, for objects and property names already written */
+typedef struct serial_map_st {
+    void        **keys;
+    uint32_t    *values;
+    size_t      size;
+    size_t      count;
+} serial_map;
+
+typedef struct serial_out_st {
+    JSContext   *cx;
+    unsigned char *buf;
+    size_t      len;
+    size_t      size;
+    serial_map  objects;
+    serial_map  names;
+} serial_out;
+
+/* a name we've read, as it sits in the input */
+typedef struct serial_name_st {
+    const unsigned char *p;
+    size_t      len;
+    int         wide;
+} serial_name;
+
+typedef struct serial_in_st {
+    JSContext   *cx;
+    const unsigned char *p;
+    const unsigned char *end;
+    int         depth;
+    JSObject    **objects;
+    size_t      nobjects;
+    size_t      objsize;
+    serial_name *names;
+    size_t      nnames;
+    size_t      namesize;
+    jschar      *chars;
+    size_t      charsize;
+    JSClass     *date;
+} serial_in;
+
+/* where a value goes. containers are stored before they're filled, so
+ * everything we've built hangs off something rooted */
+typedef struct serial_dest_st {
+    JSObject    *obj;
+    jsint       index;
+    const jschar *key;
+    size_t      keylen;
+    jsval       *vp;
+} serial_dest;
+
+static uint32_t serial_hash(void *p) {
+    uintptr_t h = (uintptr_t) p;
+
+    h ^= h >> 17;
+    h *= 0xed5ad4bb;
+    h ^= h >> 11;
+
+    return (uint32_t) h;
+}
+
+static void serial_map_free(serial_map *m) {
+    free(m->keys);
+    free(m->values);
+}
+
+/* index of p, or -1 after giving it the next one. false if out of memory */
+static int serial_map_add(serial_map *m, void *p, long *index) {
+    void **keys;
+    uint32_t *values;
+    size_t i, j, size;
+
+    if(m->count * 2 >= m->size) {
+        size = m->size > 0 ? m->size * 2 : 256;
+        keys = (void **) calloc(size, sizeof(void *));
+        values = (uint32_t *) malloc(size * sizeof(uint32_t));
+        if(keys == NULL || values == NULL) {
+            free(keys);
+            free(values);
+            return 0;
+        }
+
+        for(i = 0; i < m->size; i++) {
+            if(m->keys[i] == NULL)
+                continue;
+            for(j = serial_hash(m->keys[i]) & (size - 1); keys[j] != NULL; j = (j + 1) & (size - 1));
+            keys[j] = m->keys[i];
+            values[j] = m->values[i];
+        }
+
+        serial_map_free(m);
+        m->keys = keys;
+        m->values = values;
+        m->size = size;
+    }
+
+    for(i = serial_hash(p) & (m->size - 1); m->keys[i] != NULL; i = (i + 1) & (m->size - 1))
+        if(m->keys[i] == p) {
+            *index = m->values[i];
+            return 1;
+        }
+
+    m->keys[i] = p;
+    m->values[i] = m->count++;
+    *index = -1;
+
+    return 1;
+}
+
+/* room for want more bytes, or NULL with the buffer left as it was */
+static unsigned char *serial_grow(serial_out *o, size_t want) {
+    unsigned char *buf;
+    size_t size;
+
+    if(o->len + want > o->size) {
+        for(size = o->size > 0 ? o->size : 4096; o->len + want > size; size *= 2)
+            ;
+        if((buf = (unsigned char *) realloc(o->buf, size)) == NULL)
+            return NULL;
+        o->buf = buf;
+        o->size = size;
+    }
+
+    return &o->buf[o->len];
+}
+
+static JSBool serial_nomem(JSContext *cx) {
+    THROW("out of memory");
+}
+
+static unsigned char *serial_put_varint(unsigned char *b, uint64_t u) {
+    while(u >= 0x80) {
+        *b++ = (u & 0x7f) | 0x80;
+        u >>= 7;
+    }
+    *b++ = u;
+
+    return b;
+}
+
+static JSBool serial_tag_varint(serial_out *o, int tag, uint64_t u) {
+    unsigned char *b;
+
+    if((b = serial_grow(o, 11)) == NULL)
+        return serial_nomem(o->cx);
+
+    *b++ = tag;
+    b = serial_put_varint(b, u);
+
+    o->len = b - o->buf;
+
+    return JS_TRUE;
+}
+
+static JSBool serial_tag_double(serial_out *o, int tag, jsdouble d) {
+    unsigned char *b;
+    uint64_t u;
+    int i;
+
+    if((b = serial_grow(o, 9)) == NULL)
+        return serial_nomem(o->cx);
+
+    memcpy(&u, &d, sizeof(u));
+
+    *b++ = tag;
+    for(i = 0; i < 8; i++, u >>= 8)
+        *b++ = u & 0xff;
+
+    o->len += 9;
+
+    return JS_TRUE;
+}
+
+/* one byte a char if they all fit, which they usually do */
+static JSBool serial_put_string(serial_out *o, JSString *str) {
+    const jschar *c = JS_GetStringChars(str);
+    size_t i, len = JS_GetStringLength(str);
+    unsigned char *tag, *b;
+    jschar any = 0;
+
+    if((tag = serial_grow(o, 11 + len * 2)) == NULL)
+        return serial_nomem(o->cx);
+
+    b = serial_put_varint(tag + 1, len);
+
+    /* narrow as we look, on the bet that it'll fit */
+    for(i = 0; i < len; i++) {
+        any |= c[i];
+        b[i] = c[i];
+    }
+
+    if(any <= 0xff) {
+        *tag = SERIAL_LATIN1;
+        o->len = b + len - o->buf;
+        return JS_TRUE;
+    }
+
+    *tag = SERIAL_UTF16;
+    for(i = 0; i < len; i++) {
+        *b++ = c[i] & 0xff;
+        *b++ = c[i] >> 8;
+    }
+
+    o->len = b - o->buf;
+
+    return JS_TRUE;
+}
+
+/* by index if we've had it before */
+static JSBool serial_put_name(serial_out *o, JSString *str) {
+    long index;
+
+    if(!serial_map_add(&o->names, str, &index))
+        return serial_nomem(o->cx);
+
+    if(index >= 0)
+        return serial_tag_varint(o, SERIAL_KEY, index);
+
+    return serial_put_string(o, str);
+}
+
+static JSBool serial_put_value(serial_out *o, jsval v, int depth);
+
+static JSBool serial_put_object(serial_out *o, JSObject *obj, int depth) {
+    JSContext *cx = o->cx;
+    JSClass *clasp;
+    JSIdArray *ids = NULL;
+    jsuint i, len;
+    jsval id, ev;
+    jsdouble d;
+    size_t count;
+    long index;
+    unsigned char *b;
+    JSBool ok = JS_FALSE;
+
+    if(!serial_map_add(&o->objects, obj, &index))
+        return serial_nomem(cx);
+    if(index >= 0)
+        return serial_tag_varint(o, SERIAL_REF, index);
+
+    ASSERT_THROW(depth > SERIAL_MAX_DEPTH, "object is nested too deeply");
+
+    clasp = JS_GetClass(cx, obj);
+
+    if(clasp != NULL && strcmp(clasp->name, "Date") == 0) {
+        if(JS_CallFunctionName(cx, obj, "getTime", 0, NULL, &ev) == JS_FALSE ||
+           JS_ValueToNumber(cx, ev, &d) == JS_FALSE)
+            return JS_FALSE;
+        return serial_tag_double(o, SERIAL_DATE, d);
+    }
+
+    if(JS_IsArrayObject(cx, obj)) {
+        if(JS_GetArrayLength(cx, obj, &len) == JS_FALSE ||
+           serial_tag_varint(o, SERIAL_ARRAY, len) == JS_FALSE)
+            goto done;
+
+        for(i = 0; i < len; i++) {
+            if(JS_GetElement(cx, obj, i, &ev) == JS_FALSE ||
+               serial_put_value(o, ev, depth + 1) == JS_FALSE)
+                goto done;
+        }
+
+        ok = JS_TRUE;
+        goto done;
+    }
+
+    if((ids = JS_Enumerate(cx, obj)) == NULL)
+        goto done;
+
+    /* the count goes in once we know how many made it */
+    if((b = serial_grow(o, 6)) == NULL) {
+        serial_nomem(cx);
+        goto done;
+    }
+    b[0] = SERIAL_OBJECT;
+    index = o->len + 1;
+    o->len += 6;
+
+    for(i = 0, count = 0; i < ids->length; i++) {
+        if(JS_IdToValue(cx, ids->vector[i], &id) == JS_FALSE)
+            goto done;
+
+        if(JSVAL_IS_INT(id)) {
+            if(JS_GetElement(cx, obj, JSVAL_TO_INT(id), &ev) == JS_FALSE)
+                goto done;
+        }
+        else if(JS_GetUCProperty(cx, obj, JS_GetStringChars(JSVAL_TO_STRING(id)),
+                                 JS_GetStringLength(JSVAL_TO_STRING(id)), &ev) == JS_FALSE)
+            goto done;
+
+        if(JS_TypeOfValue(cx, ev) == JSTYPE_FUNCTION)
+            continue;
+
+        if(JSVAL_IS_INT(id)) {
+            if(serial_tag_varint(o, SERIAL_INT, ((uint32_t) JSVAL_TO_INT(id) << 1) ^ (JSVAL_TO_INT(id) >> 31)) == JS_FALSE)
+                goto done;
+        }
+        else if(serial_put_name(o, JSVAL_TO_STRING(id)) == JS_FALSE)
+            goto done;
+
+        if(serial_put_value(o, ev, depth + 1) == JS_FALSE)
+            goto done;
+
+        count++;
+    }
+
+    /* a fixed five byte varint, so nothing has to move */
+    for(i = 0; i < 4; i++, count >>= 7)
+        o->buf[index + i] = (count & 0x7f) | 0x80;
+    o->buf[index + 4] = count & 0x0f;
+
+    ok = JS_TRUE;
+
+done:
+    if(ids != NULL)
+        JS_DestroyIdArray(cx, ids);
+
+    return ok;
+}
+
+static JSBool serial_put_value(serial_out *o, jsval v, int depth) {
+    unsigned char *b;
+    int32 i;
+
+    if(JSVAL_IS_INT(v)) {
+        i = JSVAL_TO_INT(v);
+        return serial_tag_varint(o, SERIAL_INT, ((uint32_t) i << 1) ^ (i >> 31));
+    }
+
+    if(JSVAL_IS_DOUBLE(v))
+        return serial_tag_double(o, SERIAL_DOUBLE, *JSVAL_TO_DOUBLE(v));
+
+    if(JSVAL_IS_STRING(v))
+        return serial_put_string(o, JSVAL_TO_STRING(v));
+
+    if(JSVAL_IS_OBJECT(v) && !JSVAL_IS_NULL(v) && JS_TypeOfValue(o->cx, v) != JSTYPE_FUNCTION)
+        return serial_put_object(o, JSVAL_TO_OBJECT(v), depth);
+
+    if((b = serial_grow(o, 1)) == NULL)
+        return serial_nomem(o->cx);
+
+    if(JSVAL_IS_NULL(v))
+        *b = SERIAL_NULL;
+    else if(JSVAL_IS_BOOLEAN(v))
+        *b = JSVAL_TO_BOOLEAN(v) ? SERIAL_TRUE : SERIAL_FALSE;
+    else
+        *b = SERIAL_UNDEFINED;
+
+    o->len++;
+
+    return JS_TRUE;
+}
+
+static void serial_out_init(serial_out *o, JSContext *cx) {
+    memset(o, 0, sizeof(serial_out));
+    o->cx = cx;
+}
+
+/* the maps only hold for one value, the buffer can be kept */
+static void serial_out_reset(serial_out *o) {
+    serial_map_free(&o->objects);
+    serial_map_free(&o->names);
+    memset(&o->objects, 0, sizeof(serial_map));
+    memset(&o->names, 0, sizeof(serial_map));
+    o->len = 0;
+}
+
+static void serial_out_free(serial_out *o) {
+    serial_out_reset(o);
+    free(o->buf);
+}
+
+/* reading */
+
+static JSBool serial_corrupt(serial_in *r) {
+    JSContext *cx = r->cx;
+    THROW("corrupt serialized data");
+}
+
+static int serial_get_varint(serial_in *r, uint64_t *u) {
+    int shift;
+
+    for(*u = 0, shift = 0; r->p < r->end && shift < 64; shift += 7) {
+        *u |= (uint64_t) (*r->p & 0x7f) << shift;
+        if((*r->p++ & 0x80) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int serial_get_double(serial_in *r, jsdouble *d) {
+    uint64_t u = 0;
+    int i;
+
+    if(r->end - r->p < 8)
+        return 0;
+
+    for(i = 7; i >= 0; i--)
+        u = (u << 8) | r->p[i];
+    r->p += 8;
+
+    memcpy(d, &u, sizeof(u));
+
+    return 1;
+}
+
+/* a string's chars, left where they are */
+static int serial_get_chars(serial_in *r, int tag, serial_name *n) {
+    uint64_t len;
+
+    if(!serial_get_varint(r, &len))
+        return 0;
+
+    n->wide = tag == SERIAL_UTF16;
+    n->len = len;
+    n->p = r->p;
+
+    if(len > (uint64_t) (r->end - r->p) >> n->wide)
+        return 0;
+
+    r->p += len << n->wide;
+
+    return 1;
+}
+
+static void serial_widen(jschar *c, serial_name *n) {
+    size_t i;
+
+    if(n->wide)
+        for(i = 0; i < n->len; i++)
+            c[i] = n->p[i * 2] | (n->p[i * 2 + 1] << 8);
+    else
+        for(i = 0; i < n->len; i++)
+            c[i] = n->p[i];
+}
+
+static JSString *serial_string(serial_in *r, serial_name *n) {
+    JSString *str;
+    jschar *chars;
+
+    if((chars = JS_malloc(r->cx, sizeof(jschar) * (n->len + 1))) == NULL)
+        return NULL;
+
+    serial_widen(chars, n);
+    chars[n->len] = 0;
+
+    if((str = JS_NewUCString(r->cx, chars, n->len)) == NULL)
+        JS_free(r->cx, chars);
+
+    return str;
+}
+
+/* names are widened into scratch space, they only live until they're defined */
+static jschar *serial_name_chars(serial_in *r, serial_name *n) {
+    jschar *chars;
+    size_t size;
+
+    if(r->charsize < n->len) {
+        size = n->len > 256 ? n->len : 256;
+        if((chars = (jschar *) realloc(r->chars, sizeof(jschar) * size)) == NULL) {
+            serial_nomem(r->cx);
+            return NULL;
+        }
+        r->chars = chars;
+        r->charsize = size;
+    }
+
+    serial_widen(r->chars, n);
+
+    return r->chars;
+}
+
+static JSBool serial_store(serial_in *r, serial_dest *d, jsval v) {
+    if(d->obj == NULL) {
+        *d->vp = v;
+        return JS_TRUE;
+    }
+
+    if(d->key == NULL)
+        return JS_DefineElement(r->cx, d->obj, d->index, v, NULL, NULL, JSPROP_ENUMERATE);
+
+    return JS_DefineUCProperty(r->cx, d->obj, d->key, d->keylen, v, NULL, NULL, JSPROP_ENUMERATE);
+}
+
+static JSBool serial_remember(serial_in *r, JSObject *obj) {
+    JSObject **objects;
+    size_t size;
+
+    if(r->nobjects == r->objsize) {
+        size = r->objsize > 0 ? r->objsize * 2 : 64;
+        if((objects = (JSObject **) realloc(r->objects, sizeof(JSObject *) * size)) == NULL)
+            return serial_nomem(r->cx);
+        r->objects = objects;
+        r->objsize = size;
+    }
+
+    r->objects[r->nobjects++] = obj;
+
+    return JS_TRUE;
+}
+
+/* Date.prototype is a Date, which gets us the class to construct */
+static JSObject *serial_new_date(serial_in *r, jsdouble ms) {
+    JSContext *cx = r->cx;
+    JSObject *date;
+    jsval v, arg;
+
+    if(r->date == NULL) {
+        if(JS_GetProperty(cx, JS_GetGlobalObject(cx), "Date", &v) == JS_FALSE ||
+           !JSVAL_IS_OBJECT(v) || JSVAL_IS_NULL(v) ||
+           JS_GetProperty(cx, JSVAL_TO_OBJECT(v), "prototype", &v) == JS_FALSE ||
+           !JSVAL_IS_OBJECT(v) || JSVAL_IS_NULL(v)) {
+            amber_exception_throw(cx, "no Date class to restore dates with");
+            return NULL;
+        }
+        r->date = JS_GetClass(cx, JSVAL_TO_OBJECT(v));
+    }
+
+    if((date = JS_ConstructObject(cx, r->date, NULL, NULL)) == NULL)
+        return NULL;
+
+    /* setting the time can allocate, so keep hold of the date meanwhile */
+    v = OBJECT_TO_JSVAL(date);
+    if(JS_AddNamedRoot(cx, &v, "serial date") == JS_FALSE)
+        return NULL;
+
+    if(JS_NewNumberValue(cx, ms, &arg) == JS_FALSE ||
+       JS_CallFunctionName(cx, date, "setTime", 1, &arg, &arg) == JS_FALSE)
+        date = NULL;
+
+    JS_RemoveRoot(cx, &v);
+
+    return date;
+}
+
+static JSBool serial_get_value(serial_in *r, serial_dest *d);
+
+static JSBool serial_get_array(serial_in *r, serial_dest *d) {
+    JSObject *arr;
+    serial_dest e;
+    uint64_t len;
+
+    if(!serial_get_varint(r, &len) || len > (uint64_t) (r->end - r->p) || len > 0xffffffff)
+        return serial_corrupt(r);
+
+    if((arr = JS_NewArrayObject(r->cx, 0, NULL)) == NULL ||
+       serial_store(r, d, OBJECT_TO_JSVAL(arr)) == JS_FALSE ||
+       serial_remember(r, arr) == JS_FALSE)
+        return JS_FALSE;
+
+    e.obj = arr;
+    e.key = NULL;
+
+    for(e.index = 0; (uint64_t) e.index < len; e.index++) {
+        if(r->p < r->end && *r->p == SERIAL_UNDEFINED) {
+            r->p++;
+            continue;
+        }
+        if(serial_get_value(r, &e) == JS_FALSE)
+            return JS_FALSE;
+    }
+
+    return JS_SetArrayLength(r->cx, arr, (jsuint) len);
+}
+
+static JSBool serial_get_object(serial_in *r, serial_dest *d) {
+    JSObject *obj;
+    serial_dest e;
+    serial_name *n;
+    uint64_t count, u;
+    size_t size;
+    int tag;
+
+    if(!serial_get_varint(r, &count) || count > (uint64_t) (r->end - r->p))
+        return serial_corrupt(r);
+
+    if((obj = JS_NewObject(r->cx, NULL, NULL, NULL)) == NULL ||
+       serial_store(r, d, OBJECT_TO_JSVAL(obj)) == JS_FALSE ||
+       serial_remember(r, obj) == JS_FALSE)
+        return JS_FALSE;
+
+    e.obj = obj;
+
+    while(count-- > 0) {
+        if(r->p >= r->end)
+            return serial_corrupt(r);
+
+        tag = *r->p++;
+
+        switch(tag) {
+            case SERIAL_INT:
+                if(!serial_get_varint(r, &u))
+                    return serial_corrupt(r);
+                e.key = NULL;
+                e.index = (jsint) ((u >> 1) ^ -(u & 1));
+                break;
+
+            case SERIAL_LATIN1:
+            case SERIAL_UTF16:
+                if(r->nnames == r->namesize) {
+                    size = r->namesize > 0 ? r->namesize * 2 : 64;
+                    if((n = (serial_name *) realloc(r->names, sizeof(serial_name) * size)) == NULL)
+                        return serial_nomem(r->cx);
+                    r->names = n;
+                    r->namesize = size;
+                }
+                n = &r->names[r->nnames];
+                if(!serial_get_chars(r, tag, n))
+                    return serial_corrupt(r);
+                r->nnames++;
+                if((e.key = serial_name_chars(r, n)) == NULL)
+                    return JS_FALSE;
+                e.keylen = n->len;
+                break;
+
+            case SERIAL_KEY:
+                if(!serial_get_varint(r, &u) || u >= r->nnames)
+                    return serial_corrupt(r);
+                n = &r->names[u];
+                if((e.key = serial_name_chars(r, n)) == NULL)
+                    return JS_FALSE;
+                e.keylen = n->len;
+                break;
+
+            default:
+                return serial_corrupt(r);
+        }
+
+        if(serial_get_value(r, &e) == JS_FALSE)
+            return JS_FALSE;
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool serial_get_value(serial_in *r, serial_dest *d) {
+    JSContext *cx = r->cx;
+    JSObject *obj;
+    JSString *str;
+    serial_name n;
+    uint64_t u;
+    jsdouble dbl;
+    jsval v;
+    JSBool ok;
+
+    if(r->p >= r->end)
+        return serial_corrupt(r);
+
+    switch(*r->p++) {
+        case SERIAL_UNDEFINED:
+            return serial_store(r, d, JSVAL_VOID);
+
+        case SERIAL_NULL:
+            return serial_store(r, d, JSVAL_NULL);
+
+        case SERIAL_FALSE:
+            return serial_store(r, d, JSVAL_FALSE);
+
+        case SERIAL_TRUE:
+            return serial_store(r, d, JSVAL_TRUE);
+
+        case SERIAL_INT:
+            if(!serial_get_varint(r, &u))
+                return serial_corrupt(r);
+            /* int32s are all we write, but a jsval int is narrower */
+            if(JS_NewNumberValue(cx, (jsdouble) (int32) ((u >> 1) ^ -(u & 1)), &v) == JS_FALSE)
+                return JS_FALSE;
+            return serial_store(r, d, v);
+
+        case SERIAL_DOUBLE:
+            if(!serial_get_double(r, &dbl))
+                return serial_corrupt(r);
+            if(JS_NewNumberValue(cx, dbl, &v) == JS_FALSE)
+                return JS_FALSE;
+            return serial_store(r, d, v);
+
+        case SERIAL_LATIN1:
+        case SERIAL_UTF16:
+            if(!serial_get_chars(r, r->p[-1], &n))
+                return serial_corrupt(r);
+            if((str = serial_string(r, &n)) == NULL)
+                return JS_FALSE;
+            return serial_store(r, d, STRING_TO_JSVAL(str));
+
+        case SERIAL_DATE:
+            if(!serial_get_double(r, &dbl))
+                return serial_corrupt(r);
+            if((obj = serial_new_date(r, dbl)) == NULL ||
+               serial_store(r, d, OBJECT_TO_JSVAL(obj)) == JS_FALSE)
+                return JS_FALSE;
+            return serial_remember(r, obj);
+
+        case SERIAL_REF:
+            if(!serial_get_varint(r, &u) || u >= r->nobjects)
+                return serial_corrupt(r);
+            return serial_store(r, d, OBJECT_TO_JSVAL(r->objects[u]));
+
+        case SERIAL_ARRAY:
+        case SERIAL_OBJECT:
+            ASSERT_THROW(r->depth >= SERIAL_MAX_DEPTH, "serialized data is nested too deeply");
+            r->depth++;
+            ok = r->p[-1] == SERIAL_ARRAY ? serial_get_array(r, d) : serial_get_object(r, d);
+            r->depth--;
+            return ok;
+
+        default:
+            return serial_corrupt(r);
+    }
+}
+
+static void serial_in_init(serial_in *r, JSContext *cx) {
+    memset(r, 0, sizeof(serial_in));
+    r->cx = cx;
+}
+
+/* the tables only hold for one value, the scratch space can be kept */
+static void serial_in_reset(serial_in *r, const unsigned char *buf, size_t len) {
+    r->p = buf;
+    r->end = buf + len;
+    r->depth = 0;
+    r->nobjects = 0;
+    r->nnames = 0;
+}
+
+static void serial_in_free(serial_in *r) {
+    free(r->objects);
+    free(r->names);
+    free(r->chars);
+}
+
+static JSBool serial_decode_buf(serial_in *r, const unsigned char *buf, size_t len, jsval *rval) {
+    serial_dest d;
+
+    serial_in_reset(r, buf, len);
+
+    d.obj = NULL;
+    d.vp = rval;
+
+    if(serial_get_value(r, &d) == JS_FALSE)
+        return JS_FALSE;
+
+    if(r->p != r->end)
+        return serial_corrupt(r);
+
+    return JS_TRUE;
+}
+
+/* Serialize.encode(value), a string of bytes */
+static JSBool serial_encode(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    serial_out o;
+    JSString *str;
+    jschar *chars;
+    size_t i;
+    JSBool ok;
+
+    serial_out_init(&o, cx);
+
+    /* a getter can hand back something nothing else refers to. it has to
+     * stay alive while it's written out, and while its address is in the
+     * object map. anything made inside a local root scope is rooted until
+     * it's left, so one scope covers the whole call */
+    if(!JS_EnterLocalRootScope(cx)) {
+        serial_out_free(&o);
+        return JS_FALSE;
+    }
+
+    ok = serial_put_value(&o, argc > 0 ? argv[0] : JSVAL_VOID, 0);
+    JS_LeaveLocalRootScope(cx);
+
+    if(ok == JS_TRUE) {
+        if((chars = JS_malloc(cx, sizeof(jschar) * (o.len + 1))) == NULL)
+            ok = JS_FALSE;
+        else {
+            for(i = 0; i < o.len; i++)
+                chars[i] = o.buf[i];
+            chars[o.len] = 0;
+
+            if((str = JS_NewUCString(cx, chars, o.len)) == NULL) {
+                JS_free(cx, chars);
+                ok = JS_FALSE;
+            }
+            else
+                *rval = STRING_TO_JSVAL(str);
+        }
+    }
+
+    serial_out_free(&o);
+
+    return ok;
+}
+
+/* Serialize.decode(string) */
+static JSBool serial_decode(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    serial_in r;
+    JSString *str;
+    const jschar *c;
+    unsigned char *buf;
+    size_t i, len;
+    JSBool ok;
+
+    ASSERT_THROW(argc == 0, "nothing to decode");
+    ASSERT_THROW((str = JS_ValueToString(cx, argv[0])) == NULL, "couldn't convert argument to string");
+    argv[0] = STRING_TO_JSVAL(str);
+
+    c = JS_GetStringChars(str);
+    len = JS_GetStringLength(str);
+
+    ASSERT_THROW((buf = (unsigned char *) malloc(len + 1)) == NULL, "out of memory");
+    for(i = 0; i < len; i++) {
+        if(c[i] > 0xff) {
+            free(buf);
+            THROW("corrupt serialized data");
+        }
+        buf[i] = c[i];
+    }
+
+    serial_in_init(&r, cx);
+    ok = serial_decode_buf(&r, buf, len, rval);
+    serial_in_free(&r);
+
+    free(buf);
+
+    return ok;
+}
+
+/* Serialize.write(file, value, ...), one record for each value */
+static JSBool serial_write(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    serial_out o;
+    unsigned char head[12], *h;
+    FILE *f;
+    uintN i;
+    JSBool ok = JS_TRUE;
+
+    ASSERT_THROW(argc == 0 || (f = amber_file_stream(cx, argv[0])) == NULL, "first argument must be an open File");
+
+    serial_out_init(&o, cx);
+
+    /* one local root scope for every value, as in encode */
+    if(!JS_EnterLocalRootScope(cx)) {
+        serial_out_free(&o);
+        return JS_FALSE;
+    }
+
+    for(i = 1; i < argc; i++) {
+        serial_out_reset(&o);
+
+        if((ok = serial_put_value(&o, argv[i], 0)) == JS_FALSE)
+            break;
+
+        h = head;
+        *h++ = SERIAL_MAGIC;
+        *h++ = SERIAL_VERSION;
+        h = serial_put_varint(h, o.len);
+
+        if(fwrite(head, 1, h - head, f) != (size_t) (h - head) ||
+           fwrite(o.buf, 1, o.len, f) != o.len) {
+            amber_exception_throw_code(cx, errno, "Serialize", "write error: %s", strerror(errno));
+            ok = JS_FALSE;
+            break;
+        }
+    }
+
+    JS_LeaveLocalRootScope(cx);
+    serial_out_free(&o);
+
+    return ok;
+}
+
+/* Serialize.read(file), the next value or undefined at eof */
+static JSBool serial_read(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    serial_in r;
+    unsigned char *buf;
+    uint64_t len;
+    FILE *f;
+    int c, shift;
+    JSBool ok;
+
+    ASSERT_THROW(argc == 0 || (f = amber_file_stream(cx, argv[0])) == NULL, "argument must be an open File");
+
+    if((c = getc(f)) == EOF) {
+        ASSERT_THROW_CODE(ferror(f), errno, "Serialize", "read error: %s", strerror(errno));
+        return JS_TRUE;
+    }
+
+    ASSERT_THROW(c != SERIAL_MAGIC, "not serialized data");
+    ASSERT_THROW(getc(f) != SERIAL_VERSION, "unsupported serialized data version");
+
+    for(len = 0, shift = 0; (c = getc(f)) != EOF && shift < 64; shift += 7) {
+        len |= (uint64_t) (c & 0x7f) << shift;
+        if((c & 0x80) == 0)
+            break;
+    }
+
+    ASSERT_THROW(c == EOF || (c & 0x80) || len > SIZE_MAX - 1, "corrupt serialized data");
+    ASSERT_THROW((buf = (unsigned char *) malloc(len + 1)) == NULL, "out of memory");
+
+    if(fread(buf, 1, len, f) != len) {
+        free(buf);
+        THROW("truncated serialized data");
+    }
+
+    serial_in_init(&r, cx);
+    ok = serial_decode_buf(&r, buf, len, rval);
+    serial_in_free(&r);
+
+    free(buf);
+
+    return ok;
+}
+
+static JSFunctionSpec serial_functions[] = {
+    { "encode",     serial_encode,  1, 0 },
+    { "decode",     serial_decode,  1, 0 },
+    { "write",      serial_write,   2, 0 },
+    { "read",       serial_read,    1, 0 },
+    { NULL }
+};
+
+JSBool Serialize(JSContext *cx, JSObject *amber) {
+    JSObject *serialize;
+
+    serialize = JS_NewObject(cx, NULL, NULL, NULL);
+    JS_DefineProperty(cx, amber, "Serialize", OBJECT_TO_JSVAL(serialize), NULL, NULL, JSPROP_ENUMERATE);
+    JS_DefineFunctions(cx, serialize, serial_functions);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,500 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <jsapi.h>
+
+/*
+ * a block of MAP_SHARED memory. anonymous blocks are carried across fork(),
+ * named ones are shm_open() objects any process can attach to. threads just
+ * pass the object itself around since they all share the one runtime
+ */
+
+typedef struct shared_stuff {
+    unsigned char   *mem;
+    size_t          len;
+} *shared_stuff;
+
+typedef enum shared_type {
+    SHARED_INT8,
+    SHARED_UINT8,
+    SHARED_INT16,
+    SHARED_UINT16,
+    SHARED_INT32,
+    SHARED_UINT32,
+    SHARED_INT64,
+    SHARED_FLOAT32,
+    SHARED_FLOAT64
+} shared_type;
+
+static const struct {
+    const char  *name;
+    size_t      size;
+} shared_types[] = {
+    { "int8",       1 },
+    { "uint8",      1 },
+    { "int16",      2 },
+    { "uint16",     2 },
+    { "int32",      4 },
+    { "uint32",     4 },
+    { "int64",      8 },
+    { "float32",    4 },
+    { "float64",    8 },
+    { NULL }
+};
+
+#define SHARED_IS_INT(t)    ((t) <= SHARED_INT64)
+
+/* find the type and the address it's at. atomic access has to be aligned */
+static JSBool shared_locate(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, JSBool atomic, shared_type *type, void **p) {
+    shared_stuff ss;
+    JSString *str;
+    char *name;
+    jsdouble d;
+    size_t off;
+    int i;
+
+    ASSERT_THROW((ss = JS_GetPrivate(cx, obj)) == NULL, "buffer has been released");
+    ASSERT_THROW(argc < 2, "need a type and an offset");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert type to string");
+    name = JS_GetStringBytes(str);
+
+    for(i = 0; shared_types[i].name != NULL; i++)
+        if(strcmp(name, shared_types[i].name) == 0)
+            break;
+    ASSERT_THROW(shared_types[i].name == NULL, "unknown type '%s'", name);
+    *type = (shared_type) i;
+
+    ASSERT_THROW(JS_ValueToNumber(cx, argv[1], &d) == JS_FALSE || d < 0 || d != (jsdouble) (size_t) d,
+                 "offset must be a positive integer");
+    off = (size_t) d;
+
+    ASSERT_THROW(off + shared_types[i].size > ss->len, "offset %lu out of range", (unsigned long) off);
+    ASSERT_THROW(atomic && off % shared_types[i].size != 0, "offset %lu isn't aligned for %s", (unsigned long) off, name);
+
+    *p = &ss->mem[off];
+
+    return JS_TRUE;
+}
+
+static jsdouble shared_load(void *p, shared_type type) {
+    float f;
+    double d;
+
+    /* aligned ints load atomically so a racing store is never torn */
+    switch(type) {
+        case SHARED_INT8:    return __atomic_load_n((int8_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_UINT8:   return __atomic_load_n((uint8_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_INT16:   return __atomic_load_n((int16_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_UINT16:  return __atomic_load_n((uint16_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_INT32:   return __atomic_load_n((int32_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_UINT32:  return __atomic_load_n((uint32_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_INT64:   return (jsdouble) __atomic_load_n((int64_t *) p, __ATOMIC_SEQ_CST);
+        case SHARED_FLOAT32: memcpy(&f, p, sizeof(float)); return f;
+        case SHARED_FLOAT64: memcpy(&d, p, sizeof(double)); return d;
+    }
+
+    return 0;
+}
+
+/* ints wrap like a C cast from 64 bits, same as typed arrays do */
+static int64_t shared_to_int(jsdouble d) {
+    if(d != d || d >= 9223372036854775808.0 || d < -9223372036854775808.0)
+        return 0;
+    return (int64_t) d;
+}
+
+static void shared_store(void *p, shared_type type, jsdouble v) {
+    int64_t i = SHARED_IS_INT(type) ? shared_to_int(v) : 0;
+    float f;
+
+    switch(type) {
+        case SHARED_INT8:
+        case SHARED_UINT8:   __atomic_store_n((uint8_t *) p, (uint8_t) i, __ATOMIC_SEQ_CST); break;
+        case SHARED_INT16:
+        case SHARED_UINT16:  __atomic_store_n((uint16_t *) p, (uint16_t) i, __ATOMIC_SEQ_CST); break;
+        case SHARED_INT32:
+        case SHARED_UINT32:  __atomic_store_n((uint32_t *) p, (uint32_t) i, __ATOMIC_SEQ_CST); break;
+        case SHARED_INT64:   __atomic_store_n((int64_t *) p, i, __ATOMIC_SEQ_CST); break;
+        case SHARED_FLOAT32: f = v; memcpy(p, &f, sizeof(float)); break;
+        case SHARED_FLOAT64: memcpy(p, &v, sizeof(double)); break;
+    }
+}
+
+/* returns the old value */
+static int64_t shared_add(void *p, shared_type type, int64_t delta) {
+    switch(type) {
+        case SHARED_INT8:   return __atomic_fetch_add((int8_t *) p, (int8_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_UINT8:  return __atomic_fetch_add((uint8_t *) p, (uint8_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_INT16:  return __atomic_fetch_add((int16_t *) p, (int16_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_UINT16: return __atomic_fetch_add((uint16_t *) p, (uint16_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_INT32:  return __atomic_fetch_add((int32_t *) p, (int32_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_UINT32: return __atomic_fetch_add((uint32_t *) p, (uint32_t) delta, __ATOMIC_SEQ_CST);
+        case SHARED_INT64:  return __atomic_fetch_add((int64_t *) p, delta, __ATOMIC_SEQ_CST);
+        default:            break;
+    }
+
+    return 0;
+}
+
+/* returns the value that was there, which is expect if the swap happened */
+static int64_t shared_cas(void *p, shared_type type, int64_t expect, int64_t replace) {
+#define SHARED_CAS(ctype) \
+    do { \
+        ctype e = (ctype) expect; \
+        __atomic_compare_exchange_n((ctype *) p, &e, (ctype) replace, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        return e; \
+    } while(0)
+
+    switch(type) {
+        case SHARED_INT8:   SHARED_CAS(int8_t);
+        case SHARED_UINT8:  SHARED_CAS(uint8_t);
+        case SHARED_INT16:  SHARED_CAS(int16_t);
+        case SHARED_UINT16: SHARED_CAS(uint16_t);
+        case SHARED_INT32:  SHARED_CAS(int32_t);
+        case SHARED_UINT32: SHARED_CAS(uint32_t);
+        case SHARED_INT64:  SHARED_CAS(int64_t);
+        default:            break;
+    }
+
+#undef SHARED_CAS
+
+    return 0;
+}
+
+static JSBool shared_get(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_type type;
+    void *p;
+
+    if(!shared_locate(cx, obj, argc, argv, JS_FALSE, &type, &p))
+        return JS_FALSE;
+
+    /* unaligned is allowed here, it just isn't atomic */
+    if(((uintptr_t) p) % shared_types[type].size != 0) {
+        uint64_t tmp;
+        memcpy(&tmp, p, shared_types[type].size);
+        return JS_NewNumberValue(cx, shared_load(&tmp, type), rval);
+    }
+
+    return JS_NewNumberValue(cx, shared_load(p, type), rval);
+}
+
+static JSBool shared_set(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_type type;
+    jsdouble d;
+    void *p;
+
+    if(!shared_locate(cx, obj, argc, argv, JS_FALSE, &type, &p))
+        return JS_FALSE;
+
+    ASSERT_THROW(argc < 3 || JS_ValueToNumber(cx, argv[2], &d) == JS_FALSE, "need a number to store");
+
+    if(((uintptr_t) p) % shared_types[type].size != 0) {
+        uint64_t tmp;
+        shared_store(&tmp, type, d);
+        memcpy(p, &tmp, shared_types[type].size);
+        return JS_TRUE;
+    }
+
+    shared_store(p, type, d);
+
+    return JS_TRUE;
+}
+
+static JSBool shared_add_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_type type;
+    jsdouble d = 1;
+    void *p;
+
+    if(!shared_locate(cx, obj, argc, argv, JS_TRUE, &type, &p))
+        return JS_FALSE;
+
+    ASSERT_THROW(!SHARED_IS_INT(type), "atomic add needs an integer type");
+
+    if(argc > 2)
+        ASSERT_THROW(JS_ValueToNumber(cx, argv[2], &d) == JS_FALSE, "couldn't convert delta to a number");
+
+    return JS_NewNumberValue(cx, (jsdouble) shared_add(p, type, shared_to_int(d)), rval);
+}
+
+static JSBool shared_cas_method(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_type type;
+    jsdouble e, r;
+    void *p;
+
+    if(!shared_locate(cx, obj, argc, argv, JS_TRUE, &type, &p))
+        return JS_FALSE;
+
+    ASSERT_THROW(!SHARED_IS_INT(type), "compare and swap needs an integer type");
+
+    ASSERT_THROW(argc < 4 || JS_ValueToNumber(cx, argv[2], &e) == JS_FALSE || JS_ValueToNumber(cx, argv[3], &r) == JS_FALSE,
+                 "need expected and replacement values");
+
+    return JS_NewNumberValue(cx, (jsdouble) shared_cas(p, type, shared_to_int(e), shared_to_int(r)), rval);
+}
+
+/*
+ * futex wait/notify on an int32. the futexes aren't private since the
+ * memory can be shared with other processes
+ */
+
+static JSBool shared_wait(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    jsval args[2];
+    shared_type type;
+    jsdouble d, timeout = -1;
+    struct timespec ts;
+    jsrefcount saved;
+    int32 expect;
+    void *p;
+    int ret, err;
+
+    ASSERT_THROW(argc < 2, "need an offset and an expected value");
+
+    args[0] = STRING_TO_JSVAL(JS_InternString(cx, "int32"));
+    args[1] = argv[0];
+    if(!shared_locate(cx, obj, 2, args, JS_TRUE, &type, &p))
+        return JS_FALSE;
+
+    ASSERT_THROW(JS_ValueToNumber(cx, argv[1], &d) == JS_FALSE, "couldn't convert expected value to a number");
+    expect = (int32) shared_to_int(d);
+
+    if(argc > 2 && !JSVAL_IS_VOID(argv[2]))
+        ASSERT_THROW(JS_ValueToNumber(cx, argv[2], &timeout) == JS_FALSE, "couldn't convert timeout to a number");
+
+    /* like Atomics.wait, NaN means forever. so does anything too long for
+     * a timespec */
+    if(!isfinite(timeout) || timeout / 1000 >= (jsdouble) INT_MAX)
+        timeout = -1;
+
+    if(timeout >= 0) {
+        ts.tv_sec = (time_t) (timeout / 1000);
+        ts.tv_nsec = (long) ((timeout - ts.tv_sec * 1000.0) * 1000000);
+    }
+
+    saved = JS_SuspendRequest(cx);
+    ret = syscall(SYS_futex, p, FUTEX_WAIT, expect, timeout >= 0 ? &ts : NULL, NULL, 0);
+    err = errno;
+    JS_ResumeRequest(cx, saved);
+
+    /* same answers as Atomics.wait. a signal counts as a wakeup, callers
+     * have to recheck anyway */
+    if(ret < 0 && err == EAGAIN)
+        *rval = STRING_TO_JSVAL(JS_InternString(cx, "not-equal"));
+    else if(ret < 0 && err == ETIMEDOUT)
+        *rval = STRING_TO_JSVAL(JS_InternString(cx, "timed-out"));
+    else if(ret < 0 && err != EINTR)
+        THROW("wait failed: %s", strerror(err));
+    else
+        *rval = STRING_TO_JSVAL(JS_InternString(cx, "ok"));
+
+    return JS_TRUE;
+}
+
+static JSBool shared_notify(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    jsval args[2];
+    shared_type type;
+    int32 count = INT_MAX;
+    void *p;
+    long ret;
+
+    ASSERT_THROW(argc < 1, "need an offset");
+
+    args[0] = STRING_TO_JSVAL(JS_InternString(cx, "int32"));
+    args[1] = argv[0];
+    if(!shared_locate(cx, obj, 2, args, JS_TRUE, &type, &p))
+        return JS_FALSE;
+
+    if(argc > 1 && !JSVAL_IS_VOID(argv[1]))
+        ASSERT_THROW(JS_ValueToInt32(cx, argv[1], &count) == JS_FALSE || count < 0, "count must be a positive integer");
+
+    ret = syscall(SYS_futex, p, FUTEX_WAKE, count, NULL, NULL, 0);
+    ASSERT_THROW_CODE(ret < 0, errno, "SharedBuffer", "notify failed: %s", strerror(errno));
+
+    *rval = INT_TO_JSVAL(ret);
+
+    return JS_TRUE;
+}
+
+static JSBool shared_fill(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_stuff ss;
+    int32 c = 0;
+
+    ASSERT_THROW((ss = JS_GetPrivate(cx, obj)) == NULL, "buffer has been released");
+
+    if(argc > 0)
+        ASSERT_THROW(JS_ValueToInt32(cx, argv[0], &c) == JS_FALSE, "couldn't convert fill value to an integer");
+
+    memset(ss->mem, c, ss->len);
+
+    return JS_TRUE;
+}
+
+/* unmap now rather than at gc. nothing is counted, so this is only safe
+ * once every other thread has finished with the buffer. any still using it
+ * can crash, and one blocked in wait() on it won't be woken */
+static JSBool shared_release(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_stuff ss;
+
+    if((ss = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    munmap(ss->mem, ss->len);
+    JS_free(cx, ss);
+    JS_SetPrivate(cx, obj, NULL);
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec shared_methods[] = {
+    { "get",        shared_get,         2, 0 },
+    { "set",        shared_set,         3, 0 },
+    { "add",        shared_add_method,  3, 0 },
+    { "cas",        shared_cas_method,  4, 0 },
+    { "wait",       shared_wait,        3, 0 },
+    { "notify",     shared_notify,      2, 0 },
+    { "fill",       shared_fill,        1, 0 },
+    { "release",    shared_release,     0, 0 },
+    { NULL }
+};
+
+static JSBool shared_unlink(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    JSString *str;
+    char *name;
+
+    ASSERT_THROW(argc == 0, "no name specified");
+
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert name to string");
+    name = JS_GetStringBytes(str);
+
+    ASSERT_THROW_CODE(shm_unlink(name) < 0 && errno != ENOENT, errno, "SharedBuffer", "couldn't unlink '%s': %s", name, strerror(errno));
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec shared_static_methods[] = {
+    { "unlink",     shared_unlink,      1, 0 },
+    { NULL }
+};
+
+enum shared_tinyid {
+    SHARED_LENGTH
+};
+
+static JSPropertySpec shared_properties[] = {
+    { "length",     SHARED_LENGTH,      JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { NULL }
+};
+
+static JSBool shared_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    shared_stuff ss;
+
+    if((ss = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case SHARED_LENGTH:
+            return JS_NewNumberValue(cx, (jsdouble) ss->len, vp);
+    }
+
+    return JS_TRUE;
+}
+
+/* new SharedBuffer(size) for anonymous memory, new SharedBuffer(size, name)
+ * to create or attach to a named one. attaching to a bigger one gets all of
+ * it, a smaller one is grown */
+static JSBool shared_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    shared_stuff ss;
+    JSString *str;
+    struct stat st;
+    char *name = NULL;
+    jsdouble d;
+    size_t len;
+    void *mem;
+    int fd = -1, err;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc == 0 || JS_ValueToNumber(cx, argv[0], &d) == JS_FALSE || d <= 0 || d != (jsdouble) (size_t) d,
+                 "size must be a positive integer");
+    len = (size_t) d;
+
+    if(argc > 1 && !JSVAL_IS_VOID(argv[1]) && !JSVAL_IS_NULL(argv[1])) {
+        if((str = JS_ValueToString(cx, argv[1])) == NULL)
+            THROW("couldn't convert name to string");
+        name = JS_GetStringBytes(str);
+
+        fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        ASSERT_THROW_CODE(fd < 0, errno, "SharedBuffer", "couldn't open shared memory '%s': %s", name, strerror(errno));
+
+        if(fstat(fd, &st) < 0 || (st.st_size < len && ftruncate(fd, len) < 0)) {
+            err = errno;
+            close(fd);
+            THROW("couldn't size shared memory '%s': %s", name, strerror(err));
+        }
+        if(st.st_size > len)
+            len = st.st_size;
+
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        err = errno;
+        close(fd);
+    }
+    else {
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        err = errno;
+    }
+
+    ASSERT_THROW(mem == MAP_FAILED, "couldn't map %lu bytes of shared memory: %s", (unsigned long) len, strerror(err));
+
+    if((ss = JS_malloc(cx, sizeof(struct shared_stuff))) == NULL) {
+        munmap(mem, len);
+        THROW("out of memory");
+    }
+    ss->mem = mem;
+    ss->len = len;
+
+    JS_SetPrivate(cx, obj, ss);
+
+    return JS_TRUE;
+}
+
+static void shared_finalize(JSContext *cx, JSObject *obj) {
+    shared_stuff ss;
+
+    if((ss = JS_GetPrivate(cx, obj)) != NULL) {
+        munmap(ss->mem, ss->len);
+        JS_free(cx, ss);
+    }
+}
+
+static JSClass shared_class = {
+    "SharedBuffer", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, shared_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, shared_finalize
+};
+
+JSBool SharedBuffer(JSContext *cx, JSObject *amber) {
+    JSObject *shared;
+
+    shared = JS_InitClass(cx, amber, NULL, &shared_class,
+                          shared_constructor, 2,
+                          shared_properties, shared_methods,
+                          NULL, shared_static_methods);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,952 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <jsapi.h>
+
+/*
+ * external sort of the lines of a file. the input is read in chunks that
+ * are sorted on worker threads and spilled to unlinked temporary files as
+ * runs, then the runs are merged through a heap. if the whole input fits
+ * in one chunk it's sorted in memory and never touches the disk.
+ *
+ * text keys use multikey quicksort, numeric keys an LSD radix sort on the
+ * doubles' bits. numeric sorts are stable; text sorts break ties on the
+ * whole line, the way sort(1) does
+ */
+
+#define SORT_MEMORY     (256 * 1024 * 1024)
+#define SORT_MIN_CHUNK  (1024 * 1024)
+#define SORT_THREADS    (4)
+#define SORT_FANIN      (128)
+#define SORT_IOBUF      (1024 * 1024)
+#define SORT_SMALL      (16)
+#define SORT_DEPTH      (256)
+
+typedef struct sort_opts {
+    int         numeric;
+    int         reverse;
+    int         unique;
+    int32       field;
+    char        delim;
+    size_t      memory;
+    int32       threads;
+    char        tmpdir[1024];
+} sort_opts;
+
+typedef struct sort_rec {
+    const unsigned char *key;
+    const char          *line;
+    uint32_t            klen, llen;
+    double              num;
+} sort_rec;
+
+/* one chunk being sorted on its own thread */
+typedef struct sort_job {
+    const sort_opts *opts;
+    char            *buf;
+    size_t          len;
+    FILE            *out;
+    int             fd;
+    size_t          lines;
+    int             err;
+    int             running;
+    pthread_t       t;
+} sort_job;
+
+/* the key part of a line: the whole thing, or one delimited field */
+static void sort_key(const sort_opts *o, const char *line, size_t len, const unsigned char **key, uint32_t *klen) {
+    const char *p = line, *end = line + len, *q;
+    int32 f;
+
+    if(o->field < 0) {
+        *key = (const unsigned char *) line;
+        *klen = len;
+        return;
+    }
+
+    for(f = 0; f < o->field; f++) {
+        if((q = memchr(p, o->delim, end - p)) == NULL) {
+            *key = (const unsigned char *) end;
+            *klen = 0;
+            return;
+        }
+        p = q + 1;
+    }
+
+    if((q = memchr(p, o->delim, end - p)) == NULL)
+        q = end;
+
+    *key = (const unsigned char *) p;
+    *klen = q - p;
+}
+
+/* leading number in the key, 0 if there isn't one like sort -n */
+static double sort_number(const unsigned char *key, uint32_t klen) {
+    char tmp[64], *stop;
+    double d;
+
+    if(klen >= sizeof(tmp))
+        klen = sizeof(tmp) - 1;
+    memcpy(tmp, key, klen);
+    tmp[klen] = '\0';
+
+    d = strtod(tmp, &stop);
+    return stop == tmp || d != d || d == 0 ? 0 : d;
+}
+
+static void sort_fill(const sort_opts *o, sort_rec *r, const char *line, size_t len) {
+    r->line = line;
+    r->llen = len;
+    sort_key(o, line, len, &r->key, &r->klen);
+    if(o->numeric)
+        r->num = sort_number(r->key, r->klen);
+}
+
+static int sort_bytes(const unsigned char *a, uint32_t alen, const unsigned char *b, uint32_t blen) {
+    int c;
+
+    if((c = memcmp(a, b, alen < blen ? alen : blen)) != 0)
+        return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int sort_keys_equal(const sort_opts *o, const sort_rec *a, const sort_rec *b) {
+    if(o->numeric)
+        return a->num == b->num;
+    return a->klen == b->klen && memcmp(a->key, b->key, a->klen) == 0;
+}
+
+/* full ordering, not counting reverse or where the records came from */
+static int sort_compare(const sort_opts *o, const sort_rec *a, const sort_rec *b) {
+    int c;
+
+    if(o->numeric)
+        return a->num < b->num ? -1 : a->num > b->num;
+
+    if((c = sort_bytes(a->key, a->klen, b->key, b->klen)) != 0 || o->field < 0)
+        return c;
+    return sort_bytes((const unsigned char *) a->line, a->llen, (const unsigned char *) b->line, b->llen);
+}
+
+static int sort_compare_lines(const void *a, const void *b) {
+    const sort_rec *ra = a, *rb = b;
+
+    return sort_bytes((const unsigned char *) ra->line, ra->llen, (const unsigned char *) rb->line, rb->llen);
+}
+
+/* key then line. without a field they're the same thing, so the line
+ * comparison only ever matters when there is one */
+static int sort_compare_keys(const void *a, const void *b) {
+    const sort_rec *ra = a, *rb = b;
+    int c;
+
+    if((c = sort_bytes(ra->key, ra->klen, rb->key, rb->klen)) != 0)
+        return c;
+    return sort_compare_lines(a, b);
+}
+
+/* multikey quicksort */
+
+#define SORT_CHAR(r, d)     ((d) < (r)->klen ? (int) (r)->key[d] : -1)
+
+static void sort_swap(sort_rec *a, sort_rec *b) {
+    sort_rec t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static int sort_tail(const sort_rec *a, const sort_rec *b, size_t depth) {
+    return sort_bytes(a->key + depth, a->klen - depth, b->key + depth, b->klen - depth);
+}
+
+static void sort_mkqs(const sort_opts *o, sort_rec *a, size_t n, size_t depth) {
+    size_t lt, gt, i, j;
+    int v, c, x, y, z;
+
+    /* each level down is one more character all these keys share. past a
+     * point, comparing whole keys is better than recursing any deeper */
+    if(depth > SORT_DEPTH) {
+        qsort(a, n, sizeof(sort_rec), sort_compare_keys);
+        return;
+    }
+
+    while(n > SORT_SMALL) {
+        x = SORT_CHAR(&a[0], depth);
+        y = SORT_CHAR(&a[n / 2], depth);
+        z = SORT_CHAR(&a[n - 1], depth);
+        v = x < y ? (y < z ? y : x < z ? z : x) : (x < z ? x : y < z ? z : y);
+
+        for(lt = i = 0, gt = n; i < gt; ) {
+            if((c = SORT_CHAR(&a[i], depth)) < v)
+                sort_swap(&a[lt++], &a[i++]);
+            else if(c > v)
+                sort_swap(&a[i], &a[--gt]);
+            else
+                i++;
+        }
+
+        sort_mkqs(o, a, lt, depth);
+        if(v >= 0)
+            sort_mkqs(o, a + lt, gt - lt, depth + 1);
+        else if(o->field >= 0)
+            qsort(a + lt, gt - lt, sizeof(sort_rec), sort_compare_lines);
+
+        a += gt;
+        n -= gt;
+    }
+
+    /* insertion sort for what's left, from the depth we've got to */
+    for(i = 1; i < n; i++)
+        for(j = i; j > 0; j--) {
+            c = sort_tail(&a[j - 1], &a[j], depth);
+            if(c == 0 && o->field >= 0)
+                c = sort_compare_lines(&a[j - 1], &a[j]);
+            if(c <= 0)
+                break;
+            sort_swap(&a[j - 1], &a[j]);
+        }
+}
+
+/* radix sort on the doubles' bits, flipped so they order as unsigned */
+
+typedef struct sort_radix {
+    uint64_t    k;
+    uint32_t    i;
+} sort_radix;
+
+static int sort_radix_records(const sort_opts *o, sort_rec *recs, size_t n) {
+    sort_radix *a, *b, *t;
+    sort_rec *out;
+    size_t count[256], i, pos, c;
+    uint64_t k;
+    int pass;
+
+    if(n == 0)
+        return 0;
+
+    a = malloc(n * sizeof(sort_radix));
+    b = malloc(n * sizeof(sort_radix));
+    out = malloc(n * sizeof(sort_rec));
+    if(a == NULL || b == NULL || out == NULL) {
+        free(a);
+        free(b);
+        free(out);
+        return -1;
+    }
+
+    for(i = 0; i < n; i++) {
+        memcpy(&k, &recs[i].num, sizeof(k));
+        k = k >> 63 ? ~k : k | 0x8000000000000000ULL;
+        a[i].k = o->reverse ? ~k : k;
+        a[i].i = i;
+    }
+
+    for(pass = 0; pass < 64; pass += 8) {
+        memset(count, 0, sizeof(count));
+        for(i = 0; i < n; i++)
+            count[(a[i].k >> pass) & 0xff]++;
+
+        /* every key has the same byte here */
+        if(count[(a[0].k >> pass) & 0xff] == n)
+            continue;
+
+        for(pos = i = 0; i < 256; i++) {
+            c = count[i];
+            count[i] = pos;
+            pos += c;
+        }
+        for(i = 0; i < n; i++)
+            b[count[(a[i].k >> pass) & 0xff]++] = a[i];
+
+        t = a;
+        a = b;
+        b = t;
+    }
+
+    for(i = 0; i < n; i++)
+        out[i] = recs[a[i].i];
+    memcpy(recs, out, n * sizeof(sort_rec));
+
+    free(a);
+    free(b);
+    free(out);
+    return 0;
+}
+
+/* split a chunk into records and sort them. the result's order already
+ * includes reverse */
+static sort_rec *sort_chunk(const sort_opts *o, char *buf, size_t len, size_t *count) {
+    sort_rec *recs;
+    size_t n = 0, i;
+    char *p, *end = buf + len, *nl;
+
+    for(p = buf; p < end; p = nl + 1) {
+        if((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+        n++;
+    }
+
+    if((recs = malloc((n ? n : 1) * sizeof(sort_rec))) == NULL)
+        return NULL;
+
+    for(n = 0, p = buf; p < end; p = nl + 1) {
+        if((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+        sort_fill(o, &recs[n++], p, nl - p);
+    }
+
+    if(o->numeric) {
+        if(sort_radix_records(o, recs, n) != 0) {
+            free(recs);
+            return NULL;
+        }
+    } else {
+        sort_mkqs(o, recs, n, 0);
+        if(o->reverse)
+            for(i = 0; i < n / 2; i++)
+                sort_swap(&recs[i], &recs[n - 1 - i]);
+    }
+
+    *count = n;
+    return recs;
+}
+
+static int sort_write_recs(const sort_opts *o, sort_rec *recs, size_t n, FILE *out, size_t *written) {
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        if(o->unique && i > 0 && sort_keys_equal(o, &recs[i - 1], &recs[i]))
+            continue;
+        if(fwrite(recs[i].line, 1, recs[i].llen, out) != recs[i].llen || putc('\n', out) == EOF)
+            return -1;
+        (*written)++;
+    }
+
+    return 0;
+}
+
+/* an unlinked file in tmpdir, gone as soon as it's closed */
+static FILE *sort_tmpfile(const sort_opts *o) {
+    char path[1100];
+    FILE *f;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/amber-sort-XXXXXX", o->tmpdir);
+    if((fd = mkstemp(path)) < 0)
+        return NULL;
+    unlink(path);
+
+    if((f = fdopen(fd, "w")) == NULL)
+        close(fd);
+    return f;
+}
+
+/* flush a finished run and keep only its descriptor */
+static int sort_tmpfile_done(FILE *f) {
+    int fd = -1;
+
+    if(fflush(f) == 0)
+        fd = dup(fileno(f));
+    fclose(f);
+
+    return fd;
+}
+
+static void *sort_worker(void *arg) {
+    sort_job *job = arg;
+    sort_rec *recs;
+    FILE *f;
+    size_t n;
+
+    if((recs = sort_chunk(job->opts, job->buf, job->len, &n)) == NULL) {
+        job->err = ENOMEM;
+        return NULL;
+    }
+
+    if(job->out != NULL) {
+        if(sort_write_recs(job->opts, recs, n, job->out, &job->lines) != 0)
+            job->err = errno ? errno : EIO;
+    } else if((f = sort_tmpfile(job->opts)) == NULL)
+        job->err = errno;
+    else if(sort_write_recs(job->opts, recs, n, f, &job->lines) != 0) {
+        job->err = errno ? errno : EIO;
+        fclose(f);
+    } else if((job->fd = sort_tmpfile_done(f)) < 0)
+        job->err = errno ? errno : EIO;
+
+    free(recs);
+    free(job->buf);
+    job->buf = NULL;
+
+    return NULL;
+}
+
+/* merging */
+
+typedef struct sort_src {
+    FILE        *f;
+    char        *iobuf;
+    char        *line;
+    size_t      size;
+    sort_rec    rec;
+    size_t      run;
+} sort_src;
+
+/* 1 for a line, 0 at the end of the run, -1 with errno set if the read
+ * failed or the line couldn't be grown to fit */
+static int sort_src_next(const sort_opts *o, sort_src *s) {
+    ssize_t len;
+
+    errno = 0;
+    if((len = getline(&s->line, &s->size, s->f)) < 0) {
+        if(feof(s->f) && !ferror(s->f))
+            return 0;
+        if(errno == 0)
+            errno = EIO;
+        return -1;
+    }
+    if(len > 0 && s->line[len - 1] == '\n')
+        len--;
+
+    sort_fill(o, &s->rec, s->line, len);
+    return 1;
+}
+
+/* heap order: reverse applies to the key, ties go to the earlier run so
+ * numeric sorts stay stable */
+static int sort_src_less(const sort_opts *o, const sort_src *a, const sort_src *b) {
+    int c = sort_compare(o, &a->rec, &b->rec);
+
+    if(o->reverse)
+        c = -c;
+    if(c == 0)
+        return a->run < b->run;
+    return c < 0;
+}
+
+static void sort_sift(const sort_opts *o, sort_src **heap, size_t n, size_t i) {
+    size_t l, r, m;
+    sort_src *t;
+
+    for(;;) {
+        l = 2 * i + 1;
+        r = l + 1;
+        m = i;
+        if(l < n && sort_src_less(o, heap[l], heap[m]))
+            m = l;
+        if(r < n && sort_src_less(o, heap[r], heap[m]))
+            m = r;
+        if(m == i)
+            return;
+        t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+/* merge runs into out. the runs' descriptors are closed either way */
+static int sort_merge(const sort_opts *o, int *runs, size_t nruns, FILE *out, size_t *written) {
+    sort_src *srcs, **heap;
+    char *last = NULL;
+    size_t lastsize = 0, n = 0, i, iobuf;
+    sort_rec prev;
+    int have_prev = 0, ret = 0, err = 0, got;
+
+    srcs = calloc(nruns ? nruns : 1, sizeof(sort_src));
+    heap = calloc(nruns ? nruns : 1, sizeof(sort_src *));
+    if(srcs == NULL || heap == NULL) {
+        free(srcs);
+        free(heap);
+        for(i = 0; i < nruns; i++)
+            close(runs[i]);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* split the memory budget between the readers */
+    iobuf = o->memory / (nruns ? nruns : 1);
+    if(iobuf > SORT_IOBUF)
+        iobuf = SORT_IOBUF;
+
+    for(i = 0; i < nruns; i++) {
+        srcs[i].run = i;
+        if(lseek(runs[i], 0, SEEK_SET) < 0 || (srcs[i].f = fdopen(runs[i], "r")) == NULL) {
+            err = err ? err : errno;
+            close(runs[i]);
+            ret = -1;
+            continue;
+        }
+        if((srcs[i].iobuf = malloc(iobuf)) != NULL)
+            setvbuf(srcs[i].f, srcs[i].iobuf, _IOFBF, iobuf);
+        if((got = sort_src_next(o, &srcs[i])) > 0)
+            heap[n++] = &srcs[i];
+        else if(got < 0) {
+            err = err ? err : errno;
+            ret = -1;
+        }
+    }
+
+    if(ret != 0)
+        n = 0;
+
+    for(i = n / 2; i-- > 0; )
+        sort_sift(o, heap, n, i);
+
+    while(n > 0) {
+        sort_rec *r = &heap[0]->rec;
+
+        if(!o->unique || !have_prev || !sort_keys_equal(o, &prev, r)) {
+            if(fwrite(r->line, 1, r->llen, out) != r->llen || putc('\n', out) == EOF) {
+                err = errno;
+                ret = -1;
+                break;
+            }
+            (*written)++;
+
+            /* keep a copy, the source's buffer is about to be reused */
+            if(o->unique) {
+                if(r->llen + 1 > lastsize) {
+                    lastsize = r->llen + 1;
+                    if((last = realloc(last, lastsize)) == NULL) {
+                        err = ENOMEM;
+                        ret = -1;
+                        break;
+                    }
+                }
+                memcpy(last, r->line, r->llen);
+                sort_fill(o, &prev, last, r->llen);
+                have_prev = 1;
+            }
+        }
+
+        /* a run that can't be read any further mustn't just look finished */
+        if((got = sort_src_next(o, heap[0])) < 0) {
+            err = errno;
+            ret = -1;
+            break;
+        }
+        if(got == 0)
+            heap[0] = heap[--n];
+        sort_sift(o, heap, n, 0);
+    }
+
+    for(i = 0; i < nruns; i++) {
+        if(srcs[i].f != NULL) {
+            if(ferror(srcs[i].f)) {
+                err = err ? err : EIO;
+                ret = -1;
+            }
+            fclose(srcs[i].f);
+        }
+        free(srcs[i].iobuf);
+        free(srcs[i].line);
+    }
+    free(srcs);
+    free(heap);
+    free(last);
+
+    /* callers want to know why */
+    if(ret != 0)
+        errno = err ? err : EIO;
+
+    return ret;
+}
+
+/* the actual sort, with no JS in it */
+
+/* runs are just the descriptors of their unlinked files. they only get a
+ * stdio buffer while they're being merged */
+typedef struct sort_state {
+    const sort_opts *opts;
+    int             *runs;
+    size_t          nruns, runsize;
+    int             err;
+} sort_state;
+
+static int sort_add_run(sort_state *s, int fd) {
+    int *runs;
+
+    if(s->nruns == s->runsize) {
+        s->runsize = s->runsize ? s->runsize * 2 : 16;
+        if((runs = realloc(s->runs, s->runsize * sizeof(int))) == NULL) {
+            close(fd);
+            return ENOMEM;
+        }
+        s->runs = runs;
+    }
+
+    s->runs[s->nruns++] = fd;
+
+    return 0;
+}
+
+/* jobs are finished in the order they were started, so runs stay in input
+ * order and numeric sorts stay stable */
+static void sort_finish_job(sort_state *s, sort_job *job) {
+    int err;
+
+    /* one that couldn't be started may still have been given a buffer */
+    if(!job->running) {
+        free(job->buf);
+        job->buf = NULL;
+        return;
+    }
+
+    pthread_join(job->t, NULL);
+    job->running = 0;
+
+    if(job->err != 0) {
+        if(s->err == 0)
+            s->err = job->err;
+        if(job->fd >= 0)
+            close(job->fd);
+    } else if(job->fd >= 0 && (err = sort_add_run(s, job->fd)) != 0 && s->err == 0)
+        s->err = err;
+
+    free(job->buf);
+    job->buf = NULL;
+    job->fd = -1;
+}
+
+/* merge the first runs together until the rest can be merged in one go.
+ * the result takes their place at the front to keep the order */
+static int sort_reduce_runs(sort_state *s) {
+    const sort_opts *o = s->opts;
+    size_t lines;
+    FILE *f;
+    int fd;
+
+    while(s->nruns > SORT_FANIN) {
+        if((f = sort_tmpfile(o)) == NULL)
+            return errno;
+
+        lines = 0;
+        if(sort_merge(o, s->runs, SORT_FANIN, f, &lines) != 0) {
+            fclose(f);
+            memmove(s->runs, s->runs + SORT_FANIN, (s->nruns - SORT_FANIN) * sizeof(int));
+            s->nruns -= SORT_FANIN;
+            return errno ? errno : EIO;
+        }
+
+        memmove(s->runs + 1, s->runs + SORT_FANIN, (s->nruns - SORT_FANIN) * sizeof(int));
+        s->nruns -= SORT_FANIN - 1;
+
+        if((fd = sort_tmpfile_done(f)) < 0) {
+            memmove(s->runs, s->runs + 1, (s->nruns - 1) * sizeof(int));
+            s->nruns--;
+            return errno ? errno : EIO;
+        }
+        s->runs[0] = fd;
+    }
+
+    return 0;
+}
+
+/* how much of a chunk's text fits in budget once every line has its record
+ * (and for numeric sorts, the radix keys and output copy) as well. always
+ * at least one line, however long */
+static size_t sort_chunk_cut(const sort_opts *o, const char *buf, size_t len, size_t budget) {
+    size_t per = sizeof(sort_rec), cost = 0;
+    const char *p, *end = buf + len, *nl;
+
+    if(o->numeric)
+        per += 2 * sizeof(sort_radix) + sizeof(sort_rec);
+
+    for(p = buf; p < end; p = nl + 1) {
+        if((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end - 1;
+        cost += nl + 1 - p + per;
+        if(cost > budget && p > buf)
+            break;
+    }
+
+    return p - buf;
+}
+
+static int sort_run_all(const sort_opts *o, FILE *in, FILE *out, size_t *lines, size_t *runs) {
+    sort_state s;
+    sort_job *jobs, *job;
+    size_t chunk, budget, len, have = 0, keep, cut, next = 0, i;
+    char *buf = NULL, *nl, *nb;
+    int eof = 0, direct;
+
+    memset(&s, 0, sizeof(s));
+    s.opts = o;
+    if((jobs = calloc(o->threads, sizeof(sort_job))) == NULL)
+        return ENOMEM;
+
+    /* a share for each job and one for the buffer being read into. a job's
+     * text and its records both come out of its share, so short lines make
+     * for less text in a chunk */
+    budget = o->memory / (o->threads + 1);
+    if(budget < SORT_MIN_CHUNK)
+        budget = SORT_MIN_CHUNK;
+    chunk = budget;
+
+    while(!eof && s.err == 0) {
+        if((nb = realloc(buf, chunk + 1)) == NULL) {
+            s.err = ENOMEM;
+            break;
+        }
+        buf = nb;
+
+        while(have < chunk && (len = fread(buf + have, 1, chunk - have, in)) > 0)
+            have += len;
+        if(have < chunk) {
+            if(ferror(in)) {
+                s.err = errno ? errno : EIO;
+                break;
+            }
+            eof = 1;
+        }
+
+        /* chunks are whole lines, each with its newline. a line longer
+         * than the chunk makes the chunk bigger */
+        keep = 0;
+        if(!eof) {
+            for(nl = buf + have; nl > buf && nl[-1] != '\n'; nl--)
+                ;
+            if(nl == buf) {
+                chunk *= 2;
+                continue;
+            }
+            keep = buf + have - nl;
+            have -= keep;
+        } else if(have == 0)
+            break;
+        else if(buf[have - 1] != '\n')
+            buf[have++] = '\n';
+
+        /* whatever doesn't fit goes round again with the leftovers */
+        if((cut = sort_chunk_cut(o, buf, have, budget)) < have) {
+            keep += have - cut;
+            have = cut;
+            eof = 0;
+        }
+
+        /* everything fitted first time, so skip the temporary files */
+        direct = eof && next == 0;
+
+        job = &jobs[next % o->threads];
+        sort_finish_job(&s, job);
+        if(s.err != 0)
+            break;
+
+        job->opts = o;
+        job->len = have;
+        job->out = direct ? out : NULL;
+        job->fd = -1;
+        job->lines = 0;
+        job->err = 0;
+
+        /* hand the buffer over and start the next one with what was left */
+        if((nb = malloc(chunk + 1)) == NULL) {
+            s.err = ENOMEM;
+            break;
+        }
+        memcpy(nb, buf + have, keep);
+        job->buf = buf;
+        buf = nb;
+        have = keep;
+
+        if((errno = pthread_create(&job->t, NULL, sort_worker, job)) != 0) {
+            s.err = errno;
+            break;
+        }
+        job->running = 1;
+        next++;
+    }
+
+    for(i = next > (size_t) o->threads ? next - o->threads : 0; i < next; i++)
+        sort_finish_job(&s, &jobs[i % o->threads]);
+    sort_finish_job(&s, &jobs[next % o->threads]);
+
+    if(next == 1 && jobs[0].out != NULL) {
+        *lines = jobs[0].lines;
+        *runs = 0;
+    } else {
+        *runs = s.nruns;
+
+        if(s.err == 0)
+            s.err = sort_reduce_runs(&s);
+
+        if(s.err == 0) {
+            if(sort_merge(o, s.runs, s.nruns, out, lines) != 0)
+                s.err = errno ? errno : EIO;
+            s.nruns = 0;
+        }
+    }
+
+    for(i = 0; i < s.nruns; i++)
+        close(s.runs[i]);
+    free(s.runs);
+    free(buf);
+    free(jobs);
+
+    return s.err;
+}
+
+static JSBool sort_options(JSContext *cx, JSObject *opts, sort_opts *o) {
+    JSString *str;
+    const char *tmp;
+    jsdouble d;
+    jsval v;
+
+    memset(o, 0, sizeof(sort_opts));
+    o->field = -1;
+    o->delim = ',';
+    o->memory = SORT_MEMORY;
+    o->threads = SORT_THREADS;
+    tmp = getenv("TMPDIR");
+    snprintf(o->tmpdir, sizeof(o->tmpdir), "%s", tmp != NULL && *tmp != '\0' ? tmp : "/tmp");
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    if(!JS_GetProperty(cx, opts, "numeric", &v))
+        return JS_FALSE;
+    o->numeric = JSVAL_IS_BOOLEAN(v) && JSVAL_TO_BOOLEAN(v);
+
+    if(!JS_GetProperty(cx, opts, "reverse", &v))
+        return JS_FALSE;
+    o->reverse = JSVAL_IS_BOOLEAN(v) && JSVAL_TO_BOOLEAN(v);
+
+    if(!JS_GetProperty(cx, opts, "unique", &v))
+        return JS_FALSE;
+    o->unique = JSVAL_IS_BOOLEAN(v) && JSVAL_TO_BOOLEAN(v);
+
+    if(!JS_GetProperty(cx, opts, "field", &v) ||
+       (!JSVAL_IS_VOID(v) && !JS_ValueToInt32(cx, v, &o->field)))
+        return JS_FALSE;
+
+    if(!JS_GetProperty(cx, opts, "delimiter", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            return JS_FALSE;
+        ASSERT_THROW(JS_GetStringLength(str) != 1, "delimiter must be a single character");
+        o->delim = JS_GetStringBytes(str)[0];
+    }
+
+    if(!JS_GetProperty(cx, opts, "memory", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        ASSERT_THROW(!JS_ValueToNumber(cx, v, &d) || d < SORT_MIN_CHUNK, "memory must be at least %d bytes", SORT_MIN_CHUNK);
+        o->memory = (size_t) d;
+    }
+
+    if(!JS_GetProperty(cx, opts, "threads", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        ASSERT_THROW(!JS_ValueToInt32(cx, v, &o->threads) || o->threads < 1 || o->threads > 64,
+                     "threads must be between 1 and 64");
+    }
+
+    if(!JS_GetProperty(cx, opts, "tmpdir", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            return JS_FALSE;
+        snprintf(o->tmpdir, sizeof(o->tmpdir), "%s", JS_GetStringBytes(str));
+    }
+
+    return JS_TRUE;
+}
+
+/* a File, or a path to open */
+static FILE *sort_stream(JSContext *cx, jsval v, const char *mode, int *opened) {
+    JSString *str;
+    FILE *f;
+
+    *opened = 0;
+    if((f = amber_file_stream(cx, v)) != NULL)
+        return f;
+
+    if((str = JS_ValueToString(cx, v)) == NULL)
+        return NULL;
+    if((f = fopen(JS_GetStringBytes(str), mode)) == NULL) {
+        amber_exception_throw_code(cx, errno, "Sort", "couldn't open '%s': %s", JS_GetStringBytes(str), strerror(errno));
+        return NULL;
+    }
+
+    *opened = 1;
+    return f;
+}
+
+/*
+ * Sort.file(input, output, [options]) where input and output are Files or
+ * paths. options are numeric, reverse, unique, field (from 0) and
+ * delimiter (","), memory (bytes, 256M by default), threads (4) and tmpdir.
+ * unique keeps the first line of each key in sorted order, which for text
+ * keys is the smallest whole line rather than the first one read.
+ * returns { lines, runs }
+ */
+static JSBool sort_file(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sort_opts o;
+    JSObject *res;
+    jsrefcount saved;
+    FILE *in, *out;
+    int in_opened, out_opened, err;
+    size_t lines = 0, runs = 0;
+    jsval v;
+
+    ASSERT_THROW(argc < 2, "Sort.file needs an input and an output");
+
+    if(!sort_options(cx, argc > 2 && JSVAL_IS_OBJECT(argv[2]) && !JSVAL_IS_NULL(argv[2]) ? JSVAL_TO_OBJECT(argv[2]) : NULL, &o))
+        return JS_FALSE;
+
+    if((in = sort_stream(cx, argv[0], "r", &in_opened)) == NULL)
+        return JS_FALSE;
+    if((out = sort_stream(cx, argv[1], "w", &out_opened)) == NULL) {
+        if(in_opened)
+            fclose(in);
+        return JS_FALSE;
+    }
+
+    saved = JS_SuspendRequest(cx);
+    err = sort_run_all(&o, in, out, &lines, &runs);
+    if(fflush(out) != 0 && err == 0)
+        err = errno;
+    JS_ResumeRequest(cx, saved);
+
+    if(in_opened)
+        fclose(in);
+    if(out_opened && fclose(out) != 0 && err == 0)
+        err = errno;
+
+    ASSERT_THROW(err != 0, "sort failed: %s", strerror(err));
+
+    if((res = JS_NewObject(cx, NULL, NULL, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(res);
+
+    if(!JS_NewNumberValue(cx, (jsdouble) lines, &v) || !JS_SetProperty(cx, res, "lines", &v) ||
+       !JS_NewNumberValue(cx, (jsdouble) runs, &v) || !JS_SetProperty(cx, res, "runs", &v))
+        return JS_FALSE;
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec sort_functions[] = {
+    { "file",   sort_file,  3, JSPROP_ENUMERATE },
+    { NULL }
+};
+
+JSBool Sort(JSContext *cx, JSObject *amber) {
+    JSObject *sort;
+
+    sort = JS_NewObject(cx, NULL, NULL, NULL);
+    JS_DefineProperty(cx, amber, "Sort", OBJECT_TO_JSVAL(sort), NULL, NULL, JSPROP_ENUMERATE);
+    JS_DefineFunctions(cx, sort, sort_functions);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,1230 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <jsapi.h>
+
+/*
+ * a key-value store in one mapped file:
+ *
+ *   header    one page, see store_header
+ *   index     open addressed slots of { hash, offset }, at most half full
+ *   log       records of { klen, vlen, key, value } appended one after another
+ *
+ * keys and values are strings, kept as their jschars so nothing has to be
+ * transcoded on the way in or out. a lookup is a hash, a probe or two and a
+ * memcmp against the mapping, and the data never goes near the js heap.
+ *
+ * writes only ever append. a write transaction puts its records past
+ * data_end, where nobody else looks, then commits by moving data_end over
+ * them and replaying them into the index. applied trails data_end while
+ * that happens, so a writer that finds them apart after a crash just
+ * replays the rest. an overwritten or deleted record stays where it is and
+ * counts as dead until compaction copies the live ones into a new file and
+ * renames it over the old one.
+ *
+ * there's one writer at a time, kept out by a flock on a .lock file next to
+ * the store (the store itself gets replaced, so it can't carry the lock).
+ * readers take no locks at all. index slots are published with a release
+ * store after the record they point at is complete, so a reader sees the
+ * old value or the new one. a reader that finds its file retired by a
+ * compaction opens the new one
+ */
+
+#define STORE_MAGIC         "AMBERKV"
+#define STORE_VERSION       1
+#define STORE_PAGE          4096
+#define STORE_MIN_BUCKETS   1024
+#define STORE_GROW          (1024 * 1024)
+
+/* compact on commit once there's this much dead data and it's at least
+ * half the log */
+#define STORE_COMPACT_MIN   (1024 * 1024)
+
+#define STORE_EMPTY         0
+#define STORE_DELETED       1
+
+/* vlen of a record that deletes its key */
+#define STORE_TOMBSTONE     0xffffffffu
+
+typedef struct store_header {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    retired;
+    uint64_t    buckets;
+    uint64_t    count;          /* live keys */
+    uint64_t    used;           /* slots that aren't empty, deleted ones too */
+    uint64_t    data_start;
+    uint64_t    data_end;       /* end of committed records */
+    uint64_t    applied;        /* end of records the index reflects */
+    uint64_t    dead;           /* bytes of records nothing points at */
+} store_header;
+
+typedef struct store_slot {
+    uint32_t    hash;
+    uint32_t    pad;
+    uint64_t    off;
+} store_slot;
+
+typedef struct store_record {
+    uint32_t    klen;
+    uint32_t    vlen;
+} store_record;
+
+typedef enum store_sync {
+    STORE_SYNC_NONE,
+    STORE_SYNC_ASYNC,
+    STORE_SYNC_FULL
+} store_sync;
+
+static const char *store_sync_names[] = { "none", "async", "full", NULL };
+
+/* an uncommitted write, so a transaction reads its own writes */
+typedef struct store_pending {
+    uint32_t    hash;
+    uint64_t    off;
+} store_pending;
+
+typedef struct store_stuff {
+    char            *path;
+    int             fd;
+    int             lockfd;
+    char            *map;
+    size_t          maplen;
+
+    int             readonly;
+    store_sync      sync;
+    int             txn;
+    int             iterating;
+
+    /* the writer's end of the log, past data_end inside a transaction */
+    uint64_t        log_end;
+
+    store_pending   *pend;
+    size_t          npend;
+    size_t          pcap;
+} *store_stuff;
+
+#define STORE_HDR(s)        ((store_header *) (s)->map)
+#define STORE_SLOTS(s)      ((store_slot *) ((s)->map + STORE_PAGE))
+#define STORE_REC(s, off)   ((store_record *) ((s)->map + (off)))
+#define STORE_KEY(r)        ((jschar *) ((r) + 1))
+#define STORE_VALUE(r)      (STORE_KEY(r) + (r)->klen)
+
+static size_t store_reclen(uint32_t klen, uint32_t vlen) {
+    size_t len = sizeof(store_record) + sizeof(jschar) * ((size_t) klen + (vlen == STORE_TOMBSTONE ? 0 : vlen));
+
+    return (len + 7) & ~(size_t) 7;
+}
+
+static uint32_t store_hash(const jschar *key, size_t len) {
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static int store_record_is(store_record *r, const jschar *key, size_t klen) {
+    return r->klen == klen && memcmp(STORE_KEY(r), key, klen * sizeof(jschar)) == 0;
+}
+
+/*
+ * mapping
+ */
+
+static int store_map(store_stuff s, size_t len) {
+    char *map;
+    int prot = s->readonly ? PROT_READ : PROT_READ | PROT_WRITE;
+
+    if(s->map == NULL)
+        map = mmap(NULL, len, prot, MAP_SHARED, s->fd, 0);
+    else
+        map = mremap(s->map, s->maplen, len, MREMAP_MAYMOVE);
+
+    if(map == MAP_FAILED)
+        return -1;
+
+    s->map = map;
+    s->maplen = len;
+    return 0;
+}
+
+/* a reader catches up with however long the writer has made the file */
+static int store_remap(store_stuff s) {
+    struct stat st;
+
+    if(fstat(s->fd, &st) < 0)
+        return -1;
+    if((size_t) st.st_size <= s->maplen)
+        return 0;
+
+    return store_map(s, st.st_size);
+}
+
+/* make room in the file for len more bytes of log */
+static int store_reserve(store_stuff s, size_t len) {
+    size_t size;
+
+    if(s->log_end + len <= s->maplen)
+        return 0;
+
+    size = s->maplen * 2;
+    if(size < s->log_end + len + STORE_GROW)
+        size = s->log_end + len + STORE_GROW;
+    size = (size + STORE_PAGE - 1) & ~(size_t) (STORE_PAGE - 1);
+
+    if(ftruncate(s->fd, size) < 0)
+        return -1;
+
+    return store_map(s, size);
+}
+
+static void store_msync(store_stuff s, store_sync sync) {
+    if(sync == STORE_SYNC_NONE || s->map == NULL)
+        return;
+
+    msync(s->map, s->maplen, sync == STORE_SYNC_FULL ? MS_SYNC : MS_ASYNC);
+}
+
+static int store_valid(store_stuff s) {
+    store_header *hdr = STORE_HDR(s);
+
+    return s->maplen >= STORE_PAGE &&
+           memcmp(hdr->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0 &&
+           hdr->version == STORE_VERSION &&
+           hdr->buckets >= STORE_MIN_BUCKETS && (hdr->buckets & (hdr->buckets - 1)) == 0 &&
+           hdr->data_start == ((STORE_PAGE + hdr->buckets * sizeof(store_slot) + STORE_PAGE - 1) & ~(uint64_t) (STORE_PAGE - 1)) &&
+           hdr->data_start <= hdr->applied && hdr->applied <= hdr->data_end &&
+           hdr->data_end <= s->maplen;
+}
+
+static void store_init_header(char *map, uint64_t buckets) {
+    store_header *hdr = (store_header *) map;
+
+    memcpy(hdr->magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    hdr->version = STORE_VERSION;
+    hdr->buckets = buckets;
+    hdr->data_start = (STORE_PAGE + buckets * sizeof(store_slot) + STORE_PAGE - 1) & ~(uint64_t) (STORE_PAGE - 1);
+    hdr->data_end = hdr->applied = hdr->data_start;
+}
+
+/* a record a reader can safely look at, remapping first if the writer has
+ * grown the file past what we can see. NULL if it still isn't there */
+static store_record *store_record_at(store_stuff s, uint64_t off) {
+    store_record *r;
+
+    if(off + sizeof(store_record) > s->maplen &&
+       (store_remap(s) < 0 || off + sizeof(store_record) > s->maplen))
+        return NULL;
+
+    r = STORE_REC(s, off);
+    if(off + store_reclen(r->klen, r->vlen) > s->maplen) {
+        if(store_remap(s) < 0)
+            return NULL;
+        r = STORE_REC(s, off);
+        if(off + store_reclen(r->klen, r->vlen) > s->maplen)
+            return NULL;
+    }
+
+    return r;
+}
+
+/* a committed record the writer can trust, lying wholly inside the log up
+ * to end, or NULL. the writer has all of that mapped, so this only has to
+ * guard against a torn or corrupt file */
+static store_record *store_record_in(store_stuff s, uint64_t off, uint64_t end) {
+    store_record *r;
+
+    if(off < STORE_HDR(s)->data_start || off > end || end - off < sizeof(store_record))
+        return NULL;
+
+    r = STORE_REC(s, off);
+    if(store_reclen(r->klen, r->vlen) > end - off)
+        return NULL;
+
+    return r;
+}
+
+/*
+ * the index. lookups are safe against a writer in another process; only
+ * the writer calls store_apply
+ */
+
+/* the committed record for key, or NULL. the slot is read once: a writer
+ * can move it on under us, so only the record we checked is any use */
+static store_record *store_find(store_stuff s, uint32_t hash, const jschar *key, size_t klen) {
+    store_slot *slots = STORE_SLOTS(s);
+    uint64_t mask = STORE_HDR(s)->buckets - 1, i, off;
+    store_record *r;
+
+    for(i = hash & mask; ; i = (i + 1) & mask) {
+        off = __atomic_load_n(&slots[i].off, __ATOMIC_ACQUIRE);
+        if(off == STORE_EMPTY)
+            return NULL;
+        if(off == STORE_DELETED || slots[i].hash != hash)
+            continue;
+
+        if((r = store_record_at(s, off)) == NULL)
+            return NULL;
+        slots = STORE_SLOTS(s);
+
+        if(store_record_is(r, key, klen))
+            return r;
+    }
+}
+
+/* fold one committed record, already checked, into the index */
+static void store_apply(store_stuff s, uint64_t off, store_record *r) {
+    store_header *hdr = STORE_HDR(s);
+    store_slot *slots = STORE_SLOTS(s);
+    store_record *old;
+    uint64_t mask = hdr->buckets - 1, i, cur;
+    int64_t hole = -1;
+    uint32_t hash = store_hash(STORE_KEY(r), r->klen);
+
+    for(i = hash & mask; ; i = (i + 1) & mask) {
+        cur = slots[i].off;
+        if(cur == STORE_EMPTY)
+            break;
+        if(cur == STORE_DELETED) {
+            if(hole < 0)
+                hole = i;
+            continue;
+        }
+        /* already there, from a replay that was cut short */
+        if(cur == off)
+            return;
+        /* a slot pointing outside the log can't be our key */
+        if(slots[i].hash == hash && (old = store_record_in(s, cur, hdr->data_end)) != NULL &&
+           store_record_is(old, STORE_KEY(r), r->klen)) {
+            hdr->dead += store_reclen(old->klen, old->vlen);
+            if(r->vlen == STORE_TOMBSTONE) {
+                hdr->dead += store_reclen(r->klen, r->vlen);
+                __atomic_store_n(&slots[i].off, STORE_DELETED, __ATOMIC_RELEASE);
+                hdr->count--;
+            }
+            else
+                __atomic_store_n(&slots[i].off, off, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    if(r->vlen == STORE_TOMBSTONE) {
+        hdr->dead += store_reclen(r->klen, r->vlen);
+        return;
+    }
+
+    if(hole < 0) {
+        hole = i;
+        hdr->used++;
+    }
+    slots[hole].hash = hash;
+    __atomic_store_n(&slots[hole].off, off, __ATOMIC_RELEASE);
+    hdr->count++;
+}
+
+/* bring the index up to data_end */
+static void store_replay(store_stuff s) {
+    store_header *hdr = STORE_HDR(s);
+    store_record *r;
+    uint64_t off;
+
+    /* applied moves with each record, so a crash partway through leaves at
+     * most one to be applied again */
+    for(off = hdr->applied; off < hdr->data_end; off = hdr->applied) {
+        /* a record that runs off the end is a torn or corrupt tail. nothing
+         * from there on can be trusted, so the log ends where it starts */
+        if((r = store_record_in(s, off, hdr->data_end)) == NULL) {
+            __atomic_store_n(&hdr->data_end, off, __ATOMIC_RELEASE);
+            break;
+        }
+
+        store_apply(s, off, r);
+        hdr->applied = off + store_reclen(r->klen, r->vlen);
+    }
+}
+
+/*
+ * uncommitted writes
+ */
+
+static store_pending *store_pending_find(store_stuff s, uint32_t hash, const jschar *key, size_t klen) {
+    size_t i, mask = s->pcap - 1;
+
+    if(s->npend == 0)
+        return NULL;
+
+    for(i = hash & mask; s->pend[i].off != 0; i = (i + 1) & mask)
+        if(s->pend[i].hash == hash && store_record_is(STORE_REC(s, s->pend[i].off), key, klen))
+            return &s->pend[i];
+
+    return NULL;
+}
+
+static int store_pending_add(store_stuff s, uint32_t hash, uint64_t off) {
+    store_pending *p, *old;
+    store_record *r = STORE_REC(s, off);
+    size_t i, j, mask, oldcap;
+
+    if((p = store_pending_find(s, hash, STORE_KEY(r), r->klen)) != NULL) {
+        p->off = off;
+        return 0;
+    }
+
+    if((s->npend + 1) * 2 > s->pcap) {
+        old = s->pend;
+        oldcap = s->pcap;
+        s->pcap = oldcap ? oldcap * 2 : 64;
+        if((s->pend = calloc(s->pcap, sizeof(store_pending))) == NULL) {
+            s->pend = old;
+            s->pcap = oldcap;
+            return -1;
+        }
+        mask = s->pcap - 1;
+        for(j = 0; j < oldcap; j++) {
+            if(old[j].off == 0)
+                continue;
+            for(i = old[j].hash & mask; s->pend[i].off != 0; i = (i + 1) & mask)
+                ;
+            s->pend[i] = old[j];
+        }
+        free(old);
+    }
+
+    mask = s->pcap - 1;
+    for(i = hash & mask; s->pend[i].off != 0; i = (i + 1) & mask)
+        ;
+    s->pend[i].hash = hash;
+    s->pend[i].off = off;
+    s->npend++;
+
+    return 0;
+}
+
+/* a big batch leaves a big table behind, and clearing it after every
+ * single write that follows would cost more than the writes */
+static void store_pending_clear(store_stuff s) {
+    if(s->pcap > 1024) {
+        free(s->pend);
+        s->pend = NULL;
+        s->pcap = 0;
+    }
+    else if(s->npend > 0)
+        memset(s->pend, 0, s->pcap * sizeof(store_pending));
+    s->npend = 0;
+}
+
+/*
+ * opening and closing
+ */
+
+static void store_unmap(store_stuff s) {
+    if(s->map != NULL)
+        munmap(s->map, s->maplen);
+    if(s->fd >= 0)
+        close(s->fd);
+    s->map = NULL;
+    s->maplen = 0;
+    s->fd = -1;
+}
+
+static void store_destroy(store_stuff s) {
+    if(s->txn) {
+        s->log_end = STORE_HDR(s)->data_end;
+        s->txn = 0;
+    }
+
+    store_msync(s, s->sync);
+    store_unmap(s);
+
+    if(s->lockfd >= 0)
+        close(s->lockfd);
+
+    free(s->pend);
+    free(s->path);
+    free(s);
+}
+
+/* open the file at s->path, creating it for a writer */
+static int store_open_file(JSContext *cx, store_stuff s, uint64_t buckets) {
+    struct stat st;
+
+    s->fd = open(s->path, (s->readonly ? O_RDONLY : O_RDWR | O_CREAT) | O_CLOEXEC, 0666);
+    if(s->fd < 0 || fstat(s->fd, &st) < 0) {
+        amber_exception_throw_code(cx, errno, "Store", "couldn't open '%s': %s", s->path, strerror(errno));
+        return -1;
+    }
+
+    if(st.st_size == 0 && !s->readonly) {
+        st.st_size = ((STORE_PAGE + buckets * sizeof(store_slot) + STORE_PAGE - 1) & ~(uint64_t) (STORE_PAGE - 1)) + STORE_GROW;
+        if(ftruncate(s->fd, st.st_size) < 0 || store_map(s, st.st_size) < 0) {
+            amber_exception_throw_code(cx, errno, "Store", "couldn't create '%s': %s", s->path, strerror(errno));
+            return -1;
+        }
+        store_init_header(s->map, buckets);
+    }
+    else if(st.st_size < STORE_PAGE || store_map(s, st.st_size) < 0) {
+        amber_exception_throw(cx, "'%s' isn't a store", s->path);
+        return -1;
+    }
+
+    if(!store_valid(s)) {
+        amber_exception_throw(cx, "'%s' isn't a store or is damaged", s->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* readers check on the way into every call that their file is still the
+ * current one and that they can see all of it */
+static JSBool store_current(JSContext *cx, store_stuff s) {
+    store_header *hdr;
+
+    ASSERT_THROW(s->map == NULL, "store is closed");
+
+    if(!s->readonly)
+        return JS_TRUE;
+
+    hdr = STORE_HDR(s);
+    if(__atomic_load_n(&hdr->retired, __ATOMIC_ACQUIRE)) {
+        store_unmap(s);
+        if(store_open_file(cx, s, 0) < 0) {
+            store_unmap(s);
+            return JS_FALSE;
+        }
+        hdr = STORE_HDR(s);
+    }
+
+    if(__atomic_load_n(&hdr->data_end, __ATOMIC_ACQUIRE) > s->maplen && store_remap(s) < 0)
+        THROW_CODE(errno, "Store", "couldn't map '%s': %s", s->path, strerror(errno));
+
+    return JS_TRUE;
+}
+
+/*
+ * compaction. live records are copied into a new file with an index sized
+ * for them, then anything uncommitted is carried across after them, so a
+ * transaction can compact partway through and keep going
+ */
+static JSBool store_compact_now(JSContext *cx, store_stuff s) {
+    store_header *hdr = STORE_HDR(s), *nhdr;
+    store_slot *slots = STORE_SLOTS(s), *nslots;
+    store_record *r;
+    char *tmp, *nmap;
+    uint64_t buckets, mask, i, j, off, need, tail, nlen;
+    size_t len, k;
+    int fd, failed;
+    jsrefcount saved;
+
+    for(buckets = STORE_MIN_BUCKETS; buckets < (hdr->count + s->npend) * 4; buckets *= 2)
+        ;
+
+    /* sized from what's actually live rather than from dead, which a
+     * replayed tombstone can leave overcounted */
+    for(need = 0, i = 0; i < hdr->buckets; i++) {
+        if(slots[i].off <= STORE_DELETED)
+            continue;
+        r = STORE_REC(s, slots[i].off);
+        need += store_reclen(r->klen, r->vlen);
+    }
+
+    tail = s->log_end - hdr->data_end;
+    need += ((STORE_PAGE + buckets * sizeof(store_slot) + STORE_PAGE - 1) & ~(uint64_t) (STORE_PAGE - 1)) + tail;
+    nlen = (need + STORE_GROW + STORE_PAGE - 1) & ~(uint64_t) (STORE_PAGE - 1);
+
+    len = strlen(s->path);
+    ASSERT_THROW((tmp = malloc(len + 9)) == NULL, "out of memory");
+    sprintf(tmp, "%s.compact", s->path);
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0 || ftruncate(fd, nlen) < 0 ||
+       (nmap = mmap(NULL, nlen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        amber_exception_throw_code(cx, errno, "Store", "couldn't compact '%s': %s", s->path, strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return JS_FALSE;
+    }
+
+    store_init_header(nmap, buckets);
+    nhdr = (store_header *) nmap;
+    nslots = (store_slot *) (nmap + STORE_PAGE);
+    mask = buckets - 1;
+    off = nhdr->data_start;
+
+    for(i = 0; i < hdr->buckets; i++) {
+        if(slots[i].off <= STORE_DELETED)
+            continue;
+
+        r = STORE_REC(s, slots[i].off);
+        k = store_reclen(r->klen, r->vlen);
+        memcpy(nmap + off, r, k);
+
+        for(j = slots[i].hash & mask; nslots[j].off != STORE_EMPTY; j = (j + 1) & mask)
+            ;
+        nslots[j].hash = slots[i].hash;
+        nslots[j].off = off;
+        nhdr->count++;
+        nhdr->used++;
+        off += k;
+    }
+
+    nhdr->data_end = nhdr->applied = off;
+    memcpy(nmap + off, s->map + hdr->data_end, tail);
+
+    /* the new file has to be on disk before it replaces the old one */
+    saved = JS_SuspendRequest(cx);
+    failed = msync(nmap, nlen, MS_SYNC) < 0 || fsync(fd) < 0 || rename(tmp, s->path) < 0;
+    JS_ResumeRequest(cx, saved);
+
+    if(failed) {
+        amber_exception_throw_code(cx, errno, "Store", "couldn't compact '%s': %s", s->path, strerror(errno));
+        munmap(nmap, nlen);
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return JS_FALSE;
+    }
+    free(tmp);
+
+    for(k = 0; k < s->pcap; k++)
+        if(s->pend[k].off != 0)
+            s->pend[k].off = s->pend[k].off - hdr->data_end + off;
+
+    __atomic_store_n(&hdr->retired, 1, __ATOMIC_RELEASE);
+    store_unmap(s);
+
+    s->fd = fd;
+    s->map = nmap;
+    s->maplen = nlen;
+    s->log_end = off + tail;
+
+    return JS_TRUE;
+}
+
+/*
+ * writing
+ */
+
+static JSBool store_commit_now(JSContext *cx, store_stuff s) {
+    store_header *hdr = STORE_HDR(s);
+    jsrefcount saved;
+
+    s->txn = 0;
+
+    if(s->log_end == hdr->data_end)
+        return JS_TRUE;
+
+    if((hdr->used + s->npend) * 2 > hdr->buckets) {
+        if(!store_compact_now(cx, s)) {
+            s->log_end = STORE_HDR(s)->data_end;
+            store_pending_clear(s);
+            return JS_FALSE;
+        }
+        hdr = STORE_HDR(s);
+    }
+
+    /* full durability writes the records before the header that owns them */
+    if(s->sync == STORE_SYNC_FULL) {
+        saved = JS_SuspendRequest(cx);
+        store_msync(s, STORE_SYNC_FULL);
+        JS_ResumeRequest(cx, saved);
+    }
+
+    __atomic_store_n(&hdr->data_end, s->log_end, __ATOMIC_RELEASE);
+    store_replay(s);
+    store_pending_clear(s);
+
+    if(hdr->dead >= STORE_COMPACT_MIN && hdr->dead * 2 >= hdr->data_end - hdr->data_start)
+        return store_compact_now(cx, s);
+
+    if(s->sync != STORE_SYNC_NONE) {
+        saved = JS_SuspendRequest(cx);
+        store_msync(s, s->sync);
+        JS_ResumeRequest(cx, saved);
+    }
+
+    return JS_TRUE;
+}
+
+/* append a record for key, with value or a tombstone when value is NULL */
+static JSBool store_append(JSContext *cx, store_stuff s, JSString *key, JSString *value) {
+    const jschar *kc = JS_GetStringChars(key);
+    size_t klen = JS_GetStringLength(key), vlen = value ? JS_GetStringLength(value) : 0, len;
+    store_record *r;
+    uint64_t off;
+
+    ASSERT_THROW(s->readonly, "store is read-only");
+    ASSERT_THROW(s->iterating, "can't change a store from inside forEach");
+    ASSERT_THROW(klen >= STORE_TOMBSTONE || vlen >= STORE_TOMBSTONE, "key or value too long");
+
+    len = store_reclen(klen, value ? vlen : STORE_TOMBSTONE);
+    if(store_reserve(s, len) < 0)
+        THROW_CODE(errno, "Store", "couldn't grow '%s': %s", s->path, strerror(errno));
+
+    off = s->log_end;
+    r = STORE_REC(s, off);
+    r->klen = klen;
+    r->vlen = value ? vlen : STORE_TOMBSTONE;
+    memcpy(STORE_KEY(r), kc, klen * sizeof(jschar));
+    if(value)
+        memcpy(STORE_VALUE(r), JS_GetStringChars(value), vlen * sizeof(jschar));
+    s->log_end += len;
+
+    if(store_pending_add(s, store_hash(kc, klen), off) < 0) {
+        s->log_end = off;
+        THROW("out of memory");
+    }
+
+    return s->txn ? JS_TRUE : store_commit_now(cx, s);
+}
+
+/* the record key currently maps to, or NULL */
+static store_record *store_lookup(store_stuff s, JSString *key) {
+    const jschar *kc = JS_GetStringChars(key);
+    size_t klen = JS_GetStringLength(key);
+    uint32_t hash = store_hash(kc, klen);
+    store_pending *p;
+    store_record *r;
+
+    if((p = store_pending_find(s, hash, kc, klen)) != NULL)
+        r = STORE_REC(s, p->off);
+    else if((r = store_find(s, hash, kc, klen)) == NULL)
+        return NULL;
+
+    return r->vlen == STORE_TOMBSTONE ? NULL : r;
+}
+
+/*
+ * js
+ */
+
+static JSBool store_get(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    store_record *r;
+    JSString *key, *str;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(argc < 1, "get() needs a key");
+
+    if(!store_current(cx, s) || (key = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+
+    if((r = store_lookup(s, key)) == NULL) {
+        *rval = JSVAL_VOID;
+        return JS_TRUE;
+    }
+
+    if((str = JS_NewUCStringCopyN(cx, STORE_VALUE(r), r->vlen)) == NULL)
+        return JS_FALSE;
+
+    *rval = STRING_TO_JSVAL(str);
+
+    return JS_TRUE;
+}
+
+static JSBool store_has(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    JSString *key;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(argc < 1, "has() needs a key");
+
+    if(!store_current(cx, s) || (key = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+
+    *rval = BOOLEAN_TO_JSVAL(store_lookup(s, key) != NULL);
+
+    return JS_TRUE;
+}
+
+static JSBool store_set(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    JSString *key, *value;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(argc < 2, "set() needs a key and a value");
+
+    if((key = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+    argv[0] = STRING_TO_JSVAL(key);
+    if((value = JS_ValueToString(cx, argv[1])) == NULL)
+        return JS_FALSE;
+    argv[1] = STRING_TO_JSVAL(value);
+
+    return store_append(cx, s, key, value);
+}
+
+static JSBool store_delete(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    JSString *key;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(argc < 1, "delete() needs a key");
+    ASSERT_THROW(s->readonly, "store is read-only");
+
+    if(!store_current(cx, s) || (key = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+    argv[0] = STRING_TO_JSVAL(key);
+
+    if(store_lookup(s, key) == NULL) {
+        *rval = JSVAL_FALSE;
+        return JS_TRUE;
+    }
+
+    *rval = JSVAL_TRUE;
+    return store_append(cx, s, key, NULL);
+}
+
+static JSBool store_begin(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(s->readonly, "store is read-only");
+    ASSERT_THROW(s->txn, "already in a transaction");
+
+    s->txn = 1;
+
+    return JS_TRUE;
+}
+
+static JSBool store_commit(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(!s->txn, "not in a transaction");
+    ASSERT_THROW(s->iterating, "can't commit from inside forEach");
+
+    return store_commit_now(cx, s);
+}
+
+static JSBool store_rollback(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(!s->txn, "not in a transaction");
+
+    s->log_end = STORE_HDR(s)->data_end;
+    store_pending_clear(s);
+    s->txn = 0;
+
+    return JS_TRUE;
+}
+
+/* transaction(fn) runs fn(store) in a transaction, commits if it returns and
+ * rolls back if it throws. returns whatever fn did */
+static JSBool store_transaction(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    jsval arg;
+
+    ASSERT_THROW(argc < 1 || JS_TypeOfValue(cx, argv[0]) != JSTYPE_FUNCTION,
+                 "transaction() needs a function");
+
+    if(!store_begin(cx, obj, argc, argv, rval))
+        return JS_FALSE;
+
+    arg = OBJECT_TO_JSVAL(obj);
+    if(!JS_CallFunctionValue(cx, obj, argv[0], 1, &arg, rval)) {
+        /* the function may have closed the store on its way out */
+        if((s = JS_GetPrivate(cx, obj)) != NULL && s->txn) {
+            s->log_end = STORE_HDR(s)->data_end;
+            store_pending_clear(s);
+            s->txn = 0;
+        }
+        return JS_FALSE;
+    }
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL || !s->txn)
+        return JS_TRUE;
+
+    return store_commit_now(cx, s);
+}
+
+/* forEach(fn) calls fn(key, value) for every committed key, in no order */
+static JSBool store_foreach(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    store_record *r;
+    store_slot *slots;
+    JSString *str;
+    jsval args[2], ignored;
+    uint64_t i, off;
+    JSBool ok = JS_TRUE;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(argc < 1 || JS_TypeOfValue(cx, argv[0]) != JSTYPE_FUNCTION,
+                 "forEach() needs a function");
+
+    if(!store_current(cx, s))
+        return JS_FALSE;
+
+    /* the callback can't write, but a reader can still move its mapping,
+     * so everything is looked up again each time round */
+    s->iterating++;
+    args[0] = args[1] = JSVAL_NULL;
+    if(!JS_AddNamedRoot(cx, &args[0], "Store forEach key") ||
+       !JS_AddNamedRoot(cx, &args[1], "Store forEach value")) {
+        s->iterating--;
+        return JS_FALSE;
+    }
+
+    for(i = 0; ok && (s = JS_GetPrivate(cx, obj)) != NULL && s->map != NULL && i < STORE_HDR(s)->buckets; i++) {
+        slots = STORE_SLOTS(s);
+        if((off = __atomic_load_n(&slots[i].off, __ATOMIC_ACQUIRE)) <= STORE_DELETED)
+            continue;
+        if((r = store_record_at(s, off)) == NULL)
+            continue;
+
+        if((str = JS_NewUCStringCopyN(cx, STORE_KEY(r), r->klen)) == NULL) {
+            ok = JS_FALSE;
+            break;
+        }
+        args[0] = STRING_TO_JSVAL(str);
+        r = STORE_REC(s, off);
+        if((str = JS_NewUCStringCopyN(cx, STORE_VALUE(r), r->vlen)) == NULL) {
+            ok = JS_FALSE;
+            break;
+        }
+        args[1] = STRING_TO_JSVAL(str);
+
+        ok = JS_CallFunctionValue(cx, obj, argv[0], 2, args, &ignored);
+    }
+
+    JS_RemoveRoot(cx, &args[0]);
+    JS_RemoveRoot(cx, &args[1]);
+    if((s = JS_GetPrivate(cx, obj)) != NULL)
+        s->iterating--;
+
+    return ok;
+}
+
+/* keys() is every committed key, in no order */
+static JSBool store_keys(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    store_record *r;
+    store_slot *slots;
+    JSObject *arr;
+    JSString *str;
+    jsval v;
+    uint64_t i, off;
+    jsint n = 0;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+
+    if(!store_current(cx, s))
+        return JS_FALSE;
+
+    if((arr = JS_NewArrayObject(cx, 0, NULL)) == NULL)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    slots = STORE_SLOTS(s);
+    for(i = 0; i < STORE_HDR(s)->buckets; i++) {
+        if((off = __atomic_load_n(&slots[i].off, __ATOMIC_ACQUIRE)) <= STORE_DELETED)
+            continue;
+        if((r = store_record_at(s, off)) == NULL)
+            continue;
+        slots = STORE_SLOTS(s);
+
+        if((str = JS_NewUCStringCopyN(cx, STORE_KEY(r), r->klen)) == NULL)
+            return JS_FALSE;
+        v = STRING_TO_JSVAL(str);
+        if(!JS_SetElement(cx, arr, n++, &v))
+            return JS_FALSE;
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool store_compact(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+    ASSERT_THROW(s->readonly, "store is read-only");
+    ASSERT_THROW(s->iterating, "can't compact from inside forEach");
+
+    return store_compact_now(cx, s);
+}
+
+/* sync() forces everything committed out to disk, whatever the sync mode */
+static JSBool store_flush(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    jsrefcount saved;
+
+    ASSERT_THROW((s = JS_GetPrivate(cx, obj)) == NULL, "store is closed");
+
+    if(!s->readonly) {
+        saved = JS_SuspendRequest(cx);
+        store_msync(s, STORE_SYNC_FULL);
+        JS_ResumeRequest(cx, saved);
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool store_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(s->iterating, "can't close a store from inside forEach");
+
+    store_destroy(s);
+    JS_SetPrivate(cx, obj, NULL);
+
+    return JS_TRUE;
+}
+
+static JSFunctionSpec store_methods[] = {
+    { "get",            store_get,          1, 0 },
+    { "has",            store_has,          1, 0 },
+    { "set",            store_set,          2, 0 },
+    { "delete",         store_delete,       1, 0 },
+    { "begin",          store_begin,        0, 0 },
+    { "commit",         store_commit,       0, 0 },
+    { "rollback",       store_rollback,     0, 0 },
+    { "transaction",    store_transaction,  1, 0 },
+    { "forEach",        store_foreach,      1, 0 },
+    { "keys",           store_keys,         0, 0 },
+    { "compact",        store_compact,      0, 0 },
+    { "sync",           store_flush,        0, 0 },
+    { "close",          store_close,        0, 0 },
+    { NULL }
+};
+
+enum store_tinyid {
+    STORE_SIZE,
+    STORE_PATH,
+    STORE_READONLY,
+    STORE_FILESIZE,
+    STORE_DEADBYTES,
+    STORE_INTRANSACTION
+};
+
+static JSPropertySpec store_properties[] = {
+    { "size",           STORE_SIZE,             JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "path",           STORE_PATH,             JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "readonly",       STORE_READONLY,         JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "fileSize",       STORE_FILESIZE,         JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "deadBytes",      STORE_DEADBYTES,        JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "inTransaction",  STORE_INTRANSACTION,    JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { NULL }
+};
+
+/* size and the byte counts are for what's committed */
+static JSBool store_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    store_stuff s;
+    store_header *hdr;
+
+    if((s = JS_GetPrivate(cx, obj)) == NULL || !JSVAL_IS_INT(id))
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case STORE_PATH:
+            *vp = STRING_TO_JSVAL(JS_NewStringCopyZ(cx, s->path));
+            return JS_TRUE;
+
+        case STORE_READONLY:
+            *vp = BOOLEAN_TO_JSVAL(s->readonly);
+            return JS_TRUE;
+
+        case STORE_INTRANSACTION:
+            *vp = BOOLEAN_TO_JSVAL(s->txn);
+            return JS_TRUE;
+    }
+
+    if(!store_current(cx, s))
+        return JS_FALSE;
+    hdr = STORE_HDR(s);
+
+    switch(JSVAL_TO_INT(id)) {
+        case STORE_SIZE:
+            return JS_NewNumberValue(cx, (jsdouble) hdr->count, vp);
+
+        case STORE_FILESIZE:
+            return JS_NewNumberValue(cx, (jsdouble) hdr->data_end, vp);
+
+        case STORE_DEADBYTES:
+            return JS_NewNumberValue(cx, (jsdouble) hdr->dead, vp);
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool store_get_option(JSContext *cx, JSObject *opts, const char *name, jsval *vp) {
+    *vp = JSVAL_VOID;
+
+    if(opts == NULL)
+        return JS_TRUE;
+
+    return JS_GetProperty(cx, opts, name, vp);
+}
+
+/*
+ * new Store(path, [options]). options are readonly, sync ("none", "async"
+ * or "full", for what a commit waits for), wait (block for the writer lock
+ * rather than throwing) and buckets (starting index size for a new store)
+ */
+static JSBool store_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    store_stuff s;
+    JSObject *opts = NULL;
+    JSString *str;
+    char *name, *lockpath;
+    JSBool b, wait = JS_FALSE;
+    uint64_t buckets = STORE_MIN_BUCKETS;
+    jsdouble d;
+    jsval v;
+    int i, err;
+    jsrefcount saved;
+
+    JS_SetPrivate(cx, obj, NULL);
+
+    ASSERT_THROW(argc < 1, "Store needs a path");
+    if((str = JS_ValueToString(cx, argv[0])) == NULL)
+        return JS_FALSE;
+
+    s = calloc(1, sizeof(struct store_stuff));
+    ASSERT_THROW(s == NULL, "out of memory");
+
+    s->fd = s->lockfd = -1;
+    if((s->path = strdup(JS_GetStringBytes(str))) == NULL) {
+        amber_exception_throw(cx, "out of memory");
+        goto fail;
+    }
+
+    if(argc > 1 && JSVAL_IS_OBJECT(argv[1]) && !JSVAL_IS_NULL(argv[1]))
+        opts = JSVAL_TO_OBJECT(argv[1]);
+
+    if(!store_get_option(cx, opts, "readonly", &v) || !JS_ValueToBoolean(cx, v, &b))
+        goto fail;
+    s->readonly = b;
+
+    if(!store_get_option(cx, opts, "wait", &v) || !JS_ValueToBoolean(cx, v, &wait))
+        goto fail;
+
+    if(!store_get_option(cx, opts, "sync", &v))
+        goto fail;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            goto fail;
+        name = JS_GetStringBytes(str);
+        for(i = 0; store_sync_names[i] != NULL; i++)
+            if(strcmp(name, store_sync_names[i]) == 0)
+                break;
+        if(store_sync_names[i] == NULL) {
+            amber_exception_throw(cx, "unknown sync mode '%s'", name);
+            goto fail;
+        }
+        s->sync = (store_sync) i;
+    }
+
+    if(!store_get_option(cx, opts, "buckets", &v))
+        goto fail;
+    if(!JSVAL_IS_VOID(v)) {
+        if(!JS_ValueToNumber(cx, v, &d) || !(d >= 1 && d <= (jsdouble) (1LL << 40))) {
+            amber_exception_throw(cx, "buckets must be a positive number");
+            goto fail;
+        }
+        while(buckets < d)
+            buckets *= 2;
+    }
+
+    /* the writer lock comes first, so nobody compacts the file out from
+     * under us between opening it and checking it */
+    if(!s->readonly) {
+        if((lockpath = malloc(strlen(s->path) + 6)) == NULL) {
+            amber_exception_throw(cx, "out of memory");
+            goto fail;
+        }
+        sprintf(lockpath, "%s.lock", s->path);
+        s->lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        free(lockpath);
+        if(s->lockfd < 0) {
+            amber_exception_throw_code(cx, errno, "Store", "couldn't open lock for '%s': %s", s->path, strerror(errno));
+            goto fail;
+        }
+
+        if(wait) {
+            saved = JS_SuspendRequest(cx);
+            while((err = flock(s->lockfd, LOCK_EX)) < 0 && errno == EINTR)
+                ;
+            JS_ResumeRequest(cx, saved);
+        }
+        else
+            err = flock(s->lockfd, LOCK_EX | LOCK_NB);
+
+        if(err < 0) {
+            if(errno == EWOULDBLOCK)
+                amber_exception_throw_code(cx, errno, "Store", "'%s' is already open for writing", s->path);
+            else
+                amber_exception_throw_code(cx, errno, "Store", "couldn't lock '%s': %s", s->path, strerror(errno));
+            goto fail;
+        }
+    }
+
+    if(store_open_file(cx, s, buckets) < 0)
+        goto fail;
+
+    /* finish whatever a writer that died mid-commit left behind */
+    if(!s->readonly) {
+        if(STORE_HDR(s)->applied < STORE_HDR(s)->data_end) {
+            store_replay(s);
+            store_msync(s, s->sync);
+        }
+        s->log_end = STORE_HDR(s)->data_end;
+    }
+
+    JS_SetPrivate(cx, obj, s);
+
+    return JS_TRUE;
+
+fail:
+    store_unmap(s);
+    if(s->lockfd >= 0)
+        close(s->lockfd);
+    free(s->path);
+    free(s);
+    return JS_FALSE;
+}
+
+static void store_finalize(JSContext *cx, JSObject *obj) {
+    store_stuff s;
+
+    if((s = JS_GetPrivate(cx, obj)) != NULL)
+        store_destroy(s);
+}
+
+static JSClass store_class = {
+    "Store", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub, JS_PropertyStub, store_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, store_finalize
+};
+
+JSBool Store(JSContext *cx, JSObject *amber) {
+    JSObject *store;
+
+    store = JS_InitClass(cx, amber, NULL, &store_class,
+                         store_constructor, 2,
+                         store_properties, store_methods,
+                         NULL, NULL);
+
+    return JS_TRUE;
+}
@@ -0,0 +1,449 @@
+#include "amber/amber.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jsapi.h>
+
+#define SB_MINSIZE      (256)
+
+/*
+ * the buffer is jschars, so appending a string is a straight copy and
+ * toString() can give the buffer to the engine as it is. once that's
+ * happened the string lives in reserved slot 0 and the builder has no
+ * buffer of its own until the next append copies it back out
+ */
+
+typedef struct sb_stuff {
+    jschar      *buf;
+    size_t      len, size;
+} *sb_stuff;
+
+static JSBool sb_grow(JSContext *cx, JSObject *obj, sb_stuff sb, size_t want) {
+    JSString *str;
+    jschar *buf;
+    size_t size;
+    jsval v;
+
+    if(sb->buf != NULL && sb->len + want < sb->size)
+        return JS_TRUE;
+
+    size = sb->size < SB_MINSIZE ? SB_MINSIZE : sb->size;
+    while(sb->len + want >= size)
+        size *= 2;
+
+    if((buf = JS_realloc(cx, sb->buf, sizeof(jschar) * size)) == NULL)
+        return JS_FALSE;
+
+    /* handed off, take a copy back */
+    if(sb->buf == NULL && sb->len > 0) {
+        JS_GetReservedSlot(cx, obj, 0, &v);
+        str = JSVAL_TO_STRING(v);
+        memcpy(buf, JS_GetStringChars(str), sizeof(jschar) * sb->len);
+        JS_SetReservedSlot(cx, obj, 0, JSVAL_VOID);
+    }
+
+    sb->buf = buf;
+    sb->size = size;
+
+    return JS_TRUE;
+}
+
+static JSBool sb_put_chars(JSContext *cx, JSObject *obj, sb_stuff sb, const jschar *c, size_t len) {
+    if(!sb_grow(cx, obj, sb, len))
+        return JS_FALSE;
+
+    memcpy(&sb->buf[sb->len], c, sizeof(jschar) * len);
+    sb->len += len;
+
+    return JS_TRUE;
+}
+
+static JSBool sb_put_bytes(JSContext *cx, JSObject *obj, sb_stuff sb, const char *c, size_t len) {
+    size_t i;
+
+    if(!sb_grow(cx, obj, sb, len))
+        return JS_FALSE;
+
+    for(i = 0; i < len; i++)
+        sb->buf[sb->len++] = (unsigned char) c[i];
+
+    return JS_TRUE;
+}
+
+static JSBool sb_put_fill(JSContext *cx, JSObject *obj, sb_stuff sb, jschar c, size_t n) {
+    if(!sb_grow(cx, obj, sb, n))
+        return JS_FALSE;
+
+    while(n-- > 0)
+        sb->buf[sb->len++] = c;
+
+    return JS_TRUE;
+}
+
+static JSBool sb_put_value(JSContext *cx, JSObject *obj, sb_stuff sb, jsval v) {
+    JSString *str;
+    char num[16];
+    int n;
+
+    /* ints are common enough in reports to skip making a string for */
+    if(JSVAL_IS_INT(v)) {
+        n = snprintf(num, sizeof(num), "%d", JSVAL_TO_INT(v));
+        return sb_put_bytes(cx, obj, sb, num, n);
+    }
+
+    if(JSVAL_IS_STRING(v))
+        str = JSVAL_TO_STRING(v);
+    else if((str = JS_ValueToString(cx, v)) == NULL)
+        return JS_FALSE;
+
+    return sb_put_chars(cx, obj, sb, JS_GetStringChars(str), JS_GetStringLength(str));
+}
+
+static JSBool sb_append(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+    uintN i;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    for(i = 0; i < argc; i++)
+        if(!sb_put_value(cx, obj, sb, argv[i]))
+            return JS_FALSE;
+
+    *rval = OBJECT_TO_JSVAL(obj);
+
+    return JS_TRUE;
+}
+
+static JSBool sb_append_line(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    if(!sb_append(cx, obj, argc, argv, rval))
+        return JS_FALSE;
+
+    return sb_put_bytes(cx, obj, sb, "\n", 1);
+}
+
+/*
+ * printf-alike. flags, width and precision work as usual on d i u x X o c
+ * e E f g G and s. numbers go through snprintf, strings are copied as
+ * jschars. arguments that run out are treated as undefined
+ */
+static JSBool sb_append_format(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+    JSString *fstr, *str;
+    const jschar *f, *end, *start;
+    char spec[32], num[1024];
+    int nspec, width, prec, left, n;
+    jsdouble d;
+    int32 i;
+    uintN arg = 1;
+    size_t slen;
+    jsval v;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(argc == 0, "no format specified");
+
+    if((fstr = JS_ValueToString(cx, argv[0])) == NULL)
+        THROW("couldn't convert format to string");
+    argv[0] = STRING_TO_JSVAL(fstr);
+
+    f = JS_GetStringChars(fstr);
+    end = f + JS_GetStringLength(fstr);
+
+    while(f < end) {
+        for(start = f; f < end && *f != '%'; f++)
+            ;
+        if(f > start && !sb_put_chars(cx, obj, sb, start, f - start))
+            return JS_FALSE;
+        if(f == end)
+            break;
+
+        start = f++;
+
+        if(f < end && *f == '%') {
+            f++;
+            if(!sb_put_bytes(cx, obj, sb, "%", 1))
+                return JS_FALSE;
+            continue;
+        }
+
+        /* pull the spec apart, keeping a narrow copy for snprintf */
+        nspec = 0;
+        spec[nspec++] = '%';
+        left = 0;
+        while(f < end && (*f == '-' || *f == '+' || *f == ' ' || *f == '#' || *f == '0')) {
+            if(*f == '-')
+                left = 1;
+            if(nspec < 8)
+                spec[nspec++] = *f;
+            f++;
+        }
+        /* stop counting once it's too big, it's only getting rejected */
+        for(width = 0; f < end && *f >= '0' && *f <= '9'; f++)
+            if(width <= 256)
+                width = width * 10 + (*f - '0');
+        prec = -1;
+        if(f < end && *f == '.')
+            for(f++, prec = 0; f < end && *f >= '0' && *f <= '9'; f++)
+                if(prec <= 256)
+                    prec = prec * 10 + (*f - '0');
+
+        ASSERT_THROW(f == end, "incomplete format specification");
+        ASSERT_THROW(width > 256 || prec > 256, "format width or precision too large");
+
+        if(width > 0)
+            nspec += snprintf(&spec[nspec], sizeof(spec) - nspec, "%d", width);
+        if(prec >= 0)
+            nspec += snprintf(&spec[nspec], sizeof(spec) - nspec, ".%d", prec);
+
+        v = arg < argc ? argv[arg] : JSVAL_VOID;
+        arg++;
+
+        switch(*f) {
+            case 'd': case 'i': case 'c':
+                if(!JS_ValueToInt32(cx, v, &i))
+                    return JS_FALSE;
+                spec[nspec++] = *f;
+                spec[nspec] = '\0';
+                n = snprintf(num, sizeof(num), spec, i);
+                break;
+
+            case 'u': case 'x': case 'X': case 'o':
+                if(!JS_ValueToInt32(cx, v, &i))
+                    return JS_FALSE;
+                spec[nspec++] = *f;
+                spec[nspec] = '\0';
+                n = snprintf(num, sizeof(num), spec, (unsigned int) i);
+                break;
+
+            case 'e': case 'E': case 'f': case 'g': case 'G':
+                if(!JS_ValueToNumber(cx, v, &d))
+                    return JS_FALSE;
+                spec[nspec++] = *f;
+                spec[nspec] = '\0';
+                n = snprintf(num, sizeof(num), spec, d);
+                break;
+
+            case 's':
+                if((str = JS_ValueToString(cx, v)) == NULL)
+                    return JS_FALSE;
+                slen = JS_GetStringLength(str);
+                if(prec >= 0 && slen > prec)
+                    slen = prec;
+
+                if(!left && width > slen && !sb_put_fill(cx, obj, sb, ' ', width - slen))
+                    return JS_FALSE;
+                if(!sb_put_chars(cx, obj, sb, JS_GetStringChars(str), slen))
+                    return JS_FALSE;
+                if(left && width > slen && !sb_put_fill(cx, obj, sb, ' ', width - slen))
+                    return JS_FALSE;
+
+                f++;
+                continue;
+
+            default:
+                THROW("unknown format conversion '%c'", (char) *f);
+        }
+
+        f++;
+
+        if(n >= sizeof(num))
+            n = sizeof(num) - 1;
+        if(!sb_put_bytes(cx, obj, sb, num, n))
+            return JS_FALSE;
+    }
+
+    *rval = OBJECT_TO_JSVAL(obj);
+
+    return JS_TRUE;
+}
+
+static JSBool sb_reserve(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+    int32 want;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(argc == 0 || JS_ValueToInt32(cx, argv[0], &want) == JS_FALSE || want < 0,
+                 "reserve needs a positive size");
+
+    if(want > sb->len)
+        return sb_grow(cx, obj, sb, want - sb->len);
+
+    return JS_TRUE;
+}
+
+static JSBool sb_clear(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    sb->len = 0;
+    JS_SetReservedSlot(cx, obj, 0, JSVAL_VOID);
+
+    return JS_TRUE;
+}
+
+static JSBool sb_to_string(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+    JSString *str;
+    jschar *buf;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL || sb->len == 0) {
+        *rval = JS_GetEmptyStringValue(cx);
+        return JS_TRUE;
+    }
+
+    /* already handed off and nothing added since */
+    if(sb->buf == NULL) {
+        JS_GetReservedSlot(cx, obj, 0, rval);
+        return JS_TRUE;
+    }
+
+    /* the engine wants the exact size and a terminator */
+    if((buf = JS_realloc(cx, sb->buf, sizeof(jschar) * (sb->len + 1))) == NULL)
+        return JS_FALSE;
+    buf[sb->len] = 0;
+
+    if((str = JS_NewUCString(cx, buf, sb->len)) == NULL) {
+        sb->buf = buf;
+        sb->size = sb->len + 1;
+        return JS_FALSE;
+    }
+
+    sb->buf = NULL;
+    sb->size = 0;
+
+    *rval = STRING_TO_JSVAL(str);
+    JS_SetReservedSlot(cx, obj, 0, *rval);
+
+    return JS_TRUE;
+}
+
+/* write out to a File and empty the builder. the chars are encoded the way
+ * the File says straight from the buffer, which is kept for reuse */
+static JSBool sb_write_to(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+    JSString *str;
+    FILE *f;
+    size_t len;
+    jsval v;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    ASSERT_THROW(argc == 0 || (f = amber_file_stream(cx, argv[0])) == NULL, "writeTo needs an open File");
+
+    if((len = sb->len) > 0) {
+        /* handed off, so the chars are in the string */
+        if(sb->buf == NULL) {
+            JS_GetReservedSlot(cx, obj, 0, &v);
+            str = JSVAL_TO_STRING(v);
+            if(!amber_file_write(cx, f, JS_GetStringChars(str), len, amber_file_get_encoding(cx, argv[0])))
+                return JS_FALSE;
+            JS_SetReservedSlot(cx, obj, 0, JSVAL_VOID);
+        }
+
+        else if(!amber_file_write(cx, f, sb->buf, len, amber_file_get_encoding(cx, argv[0])))
+            return JS_FALSE;
+    }
+
+    sb->len = 0;
+
+    return JS_NewNumberValue(cx, (jsdouble) len, rval);
+}
+
+static JSFunctionSpec sb_methods[] = {
+    { "append",         sb_append,          1, 0 },
+    { "appendLine",     sb_append_line,     1, 0 },
+    { "appendFormat",   sb_append_format,   1, 0 },
+    { "reserve",        sb_reserve,         1, 0 },
+    { "clear",          sb_clear,           0, 0 },
+    { "toString",       sb_to_string,       0, 0 },
+    { "writeTo",        sb_write_to,        1, 0 },
+    { NULL }
+};
+
+enum sb_tinyid {
+    SB_LENGTH,
+    SB_CAPACITY
+};
+
+static JSPropertySpec sb_properties[] = {
+    { "length",     SB_LENGTH,      JSPROP_ENUMERATE | JSPROP_READONLY },
+    { "capacity",   SB_CAPACITY,    JSPROP_ENUMERATE | JSPROP_READONLY },
+    { NULL }
+};
+
+static JSBool sb_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
+    sb_stuff sb;
+
+    if((sb = JS_GetPrivate(cx, obj)) == NULL)
+        return JS_TRUE;
+
+    switch(JSVAL_TO_INT(id)) {
+        case SB_LENGTH:
+            return JS_NewNumberValue(cx, (jsdouble) sb->len, vp);
+
+        case SB_CAPACITY:
+            return JS_NewNumberValue(cx, (jsdouble) (sb->buf != NULL ? sb->size : sb->len), vp);
+    }
+
+    return JS_TRUE;
+}
+
+static JSBool sb_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
+    sb_stuff sb;
+
+    sb = JS_malloc(cx, sizeof(struct sb_stuff));
+    ASSERT_THROW(sb == NULL, "out of memory");
+    memset(sb, 0, sizeof(struct sb_stuff));
+
+    JS_SetPrivate(cx, obj, sb);
+
+    /* a number is a size to start with, anything else is initial content */
+    if(argc > 0) {
+        if(JSVAL_IS_NUMBER(argv[0]))
+            return sb_reserve(cx, obj, argc, argv, rval);
+        return sb_put_value(cx, obj, sb, argv[0]);
+    }
+
+    return JS_TRUE;
+}
+
+static void sb_finalize(JSContext *cx, JSObject *obj) {
+    sb_stuff sb;
+
+    if((sb = JS_GetPrivate(cx, obj)) != NULL) {
+        if(sb->buf != NULL)
+            JS_free(cx, sb->buf);
+        JS_free(cx, sb);
+    }
+}
+
+static JSClass sb_class = {
+    "StringBuilder", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub, JS_PropertyStub, sb_get_property, JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, sb_finalize
+};
+
+JSBool StringBuilder(JSContext *cx, JSObject *amber) {
+    JSObject *sb;
+
+    sb = JS_InitClass(cx, amber, NULL, &sb_class,
+                      sb_constructor, 1,
+                      sb_properties, sb_methods,
+                      NULL, NULL);
+
+    return JS_TRUE;
+}
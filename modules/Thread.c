@@ -1,6 +1,16 @@
 #include "amber/amber.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #define JS_THREADSAFE 1
 #include <jsapi.h>
@@ -19,16 +29,41 @@ typedef struct thread_stuff {
     JSObject            *amber;
     JSFunction          *fun;
     jsval               arg;
+    jsval               result;
+    jsdouble            max_cpu, max_wall, max_heap;
+    char                name[16];
+    int                 priority, has_priority, priority_err;
+    clockid_t           clock;
+    int                 has_clock;
+    int                 joined, detached;
+    /* under the mutex: the thread is done with everything but ts, and the
+     * Thread was collected first so ts is the thread's to free */
+    int                 finished, orphaned;
+    struct rusage       usage;
 } *thread_stuff;
 
+/* returns whatever the thread's function returned */
 static JSBool thread_join(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     thread_stuff ts;
+    jsrefcount saved;
     void *ret;
 
     if((ts = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
 
-    pthread_join(ts->t, &ret);
+    ASSERT_THROW(ts->detached && !ts->joined, "thread has been detached");
+
+    if(!ts->joined) {
+        saved = JS_SuspendRequest(cx);
+        pthread_join(ts->t, &ret);
+        JS_ResumeRequest(cx, saved);
+        ts->joined = 1;
+    }
+
+    if(ts->priority_err != 0)
+        THROW_CODE(ts->priority_err, "Thread", "couldn't set thread priority to %d: %s", ts->priority, strerror(ts->priority_err));
+
+    *rval = ts->result;
 
     return JS_TRUE;
 }
@@ -39,7 +74,12 @@ static JSBool thread_detach(JSContext *cx, JSObject *obj, uintN argc, jsval *arg
     if((ts = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
 
-    pthread_detach(ts->t);
+    pthread_mutex_lock(&ts->mutex);
+    if(!ts->joined && !ts->detached) {
+        pthread_detach(ts->t);
+        ts->detached = 1;
+    }
+    pthread_mutex_unlock(&ts->mutex);
 
     return JS_TRUE;
 }
@@ -65,42 +105,196 @@ static JSFunctionSpec thread_static_methods[] = {
 };
 
 enum thread_tinyid {
-    THREAD_STATE
+    THREAD_STATE,
+    THREAD_NAME,
+    THREAD_RESULT,
+    THREAD_CPU_TIME,
+    THREAD_VOLUNTARY_SWITCHES,
+    THREAD_INVOLUNTARY_SWITCHES
 };
 
 static JSPropertySpec thread_properties[] = {
-    { "state",  THREAD_STATE,   JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "state",              THREAD_STATE,                   JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "name",               THREAD_NAME,                    JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "result",             THREAD_RESULT,                  JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "cpuTime",            THREAD_CPU_TIME,                JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "voluntarySwitches",  THREAD_VOLUNTARY_SWITCHES,      JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
+    { "involuntarySwitches", THREAD_INVOLUNTARY_SWITCHES,   JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT },
     { NULL }
 };
 
 static void *thread_start(void *arg) {
     thread_stuff ts = (thread_stuff) arg;
     JSContext *cx;
-    jsval argv[1], rval;
+    amber_watchdog wd;
+    amber_memory mem;
+    jsval argv[1];
     uintN argc;
+    int orphaned;
 
     cx = JS_NewContext(ts->rt, 8192);
     JS_SetContextPrivate(cx, ts);
 
+    /* natives look here for the global, AmberError included */
+    JS_SetGlobalObject(cx, ts->amber);
+
     if(ts->arg != JSVAL_VOID) {
         argv[0] = ts->arg;
         argc = 1;
     } else
         argc = 0;
 
-    ts->state = THREAD_RUN;
-    JS_CallFunction(cx, ts->amber, ts->fun, argc, argv, &rval);
-    ts->state = THREAD_DONE;
+    wd = amber_watchdog_start(cx, ts->max_cpu, ts->max_wall);
+    mem = amber_memory_start(cx, (size_t) ts->max_heap);
+
+    /* nice values are per thread on linux. if we can't have the one we
+     * were asked for, the function doesn't run and join() says why */
+    if(ts->has_priority && setpriority(PRIO_PROCESS, syscall(SYS_gettid), ts->priority) < 0)
+        ts->priority_err = errno;
+
+    /* our own clock, so cpuTime never has to go through a pthread_t that
+     * might be gone by the time it's asked */
+    ts->has_clock = pthread_getcpuclockid(pthread_self(), &ts->clock) == 0;
+
+    __atomic_store_n(&ts->state, THREAD_RUN, __ATOMIC_RELEASE);
+    if(ts->priority_err == 0)
+        JS_CallFunction(cx, ts->amber, ts->fun, argc, argv, &ts->result);
+    getrusage(RUSAGE_THREAD, &ts->usage);
+    __atomic_store_n(&ts->state, THREAD_DONE, __ATOMIC_RELEASE);
+
+    amber_memory_stop(mem);
+    amber_watchdog_stop(wd);
+
+    pthread_mutex_lock(&ts->mutex);
+    ts->finished = 1;
+    orphaned = ts->orphaned;
+    pthread_mutex_unlock(&ts->mutex);
+
+    /* nobody's left to free it */
+    if(orphaned) {
+        pthread_mutex_destroy(&ts->mutex);
+        amber_memory_account(-(ssize_t) sizeof(struct thread_stuff));
+        JS_free(cx, ts);
+    }
 
     JS_DestroyContext(cx);
 
     return NULL;
 }
 
+static JSBool thread_option_number(JSContext *cx, JSObject *opts, const char *name, jsdouble *d) {
+    jsval v;
+
+    if(!JS_GetProperty(cx, opts, name, &v))
+        return JS_FALSE;
+
+    if(JSVAL_IS_VOID(v))
+        return JS_TRUE;
+
+    return JS_ValueToNumber(cx, v, d);
+}
+
+/* cpus given either as an array of numbers or a single number */
+static JSBool thread_option_affinity(JSContext *cx, JSObject *opts, cpu_set_t *set, int *given) {
+    JSObject *arr;
+    jsuint len, i;
+    int32 cpu;
+    jsval v;
+
+    CPU_ZERO(set);
+    *given = 0;
+
+    if(!JS_GetProperty(cx, opts, "affinity", &v))
+        return JS_FALSE;
+
+    if(JSVAL_IS_VOID(v))
+        return JS_TRUE;
+
+    if(JSVAL_IS_OBJECT(v) && !JSVAL_IS_NULL(v) && JS_IsArrayObject(cx, JSVAL_TO_OBJECT(v))) {
+        arr = JSVAL_TO_OBJECT(v);
+        if(!JS_GetArrayLength(cx, arr, &len))
+            return JS_FALSE;
+
+        for(i = 0; i < len; i++) {
+            if(!JS_GetElement(cx, arr, i, &v) || !JS_ValueToInt32(cx, v, &cpu))
+                return JS_FALSE;
+            ASSERT_THROW(cpu < 0 || cpu >= CPU_SETSIZE, "no such cpu %d", cpu);
+            CPU_SET(cpu, set);
+        }
+    } else {
+        if(!JS_ValueToInt32(cx, v, &cpu))
+            return JS_FALSE;
+        ASSERT_THROW(cpu < 0 || cpu >= CPU_SETSIZE, "no such cpu %d", cpu);
+        CPU_SET(cpu, set);
+    }
+
+    ASSERT_THROW(CPU_COUNT(set) == 0, "affinity needs at least one cpu");
+    *given = 1;
+
+    return JS_TRUE;
+}
+
+/*
+ * new Thread(fun, arg, options). options are maxCpu and maxWall (seconds),
+ * maxHeap (bytes, measured across the whole process since threads share a
+ * heap), stackSize (bytes), affinity (cpu or array of cpus), name (shows
+ * up in top -H and perf, 15 characters at most) and priority (a nice value)
+ */
+static JSBool thread_options(JSContext *cx, JSObject *opts, thread_stuff ts, pthread_attr_t *attr) {
+    jsdouble d;
+    cpu_set_t set;
+    JSString *str;
+    int given;
+    jsval v;
+
+    if(!thread_option_number(cx, opts, "maxCpu", &ts->max_cpu) ||
+       !thread_option_number(cx, opts, "maxWall", &ts->max_wall) ||
+       !thread_option_number(cx, opts, "maxHeap", &ts->max_heap))
+        return JS_FALSE;
+    ASSERT_THROW(ts->max_heap < 0, "maxHeap can't be negative");
+
+    d = 0;
+    if(!thread_option_number(cx, opts, "stackSize", &d))
+        return JS_FALSE;
+    if(d != 0) {
+        ASSERT_THROW(d < PTHREAD_STACK_MIN || d > (jsdouble) (size_t) -1,
+                     "stackSize must be at least %d", PTHREAD_STACK_MIN);
+        ASSERT_THROW(pthread_attr_setstacksize(attr, (size_t) d) != 0, "bad stackSize");
+    }
+
+    if(!thread_option_affinity(cx, opts, &set, &given))
+        return JS_FALSE;
+    if(given)
+        ASSERT_THROW(pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set) != 0, "bad affinity");
+
+    if(!JS_GetProperty(cx, opts, "name", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        if((str = JS_ValueToString(cx, v)) == NULL)
+            return JS_FALSE;
+        strncpy(ts->name, JS_GetStringBytes(str), sizeof(ts->name) - 1);
+    }
+
+    d = 0;
+    if(!JS_GetProperty(cx, opts, "priority", &v))
+        return JS_FALSE;
+    if(!JSVAL_IS_VOID(v)) {
+        if(!JS_ValueToNumber(cx, v, &d))
+            return JS_FALSE;
+        ASSERT_THROW(d < -20 || d > 19, "priority must be between -20 and 19");
+        ts->priority = (int) d;
+        ts->has_priority = 1;
+    }
+
+    return JS_TRUE;
+}
+
 static JSBool thread_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval) {
     JSFunction *fun;
     jsval arg;
     thread_stuff ts;
+    pthread_attr_t attr;
+    int err;
 
     if(argc == 0) {
         *rval = JSVAL_VOID;
@@ -116,6 +310,29 @@ static JSBool thread_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval
         arg = JSVAL_VOID;
 
     ts = JS_malloc(cx, sizeof(struct thread_stuff));
+    ASSERT_THROW(ts == NULL, "out of memory");
+    memset(ts, 0, sizeof(struct thread_stuff));
+    amber_memory_account(sizeof(struct thread_stuff));
+
+    pthread_attr_init(&attr);
+
+    if(argc > 2 && JSVAL_IS_OBJECT(argv[2]) && !JSVAL_IS_NULL(argv[2])) {
+        if(!thread_options(cx, JSVAL_TO_OBJECT(argv[2]), ts, &attr)) {
+            pthread_attr_destroy(&attr);
+            amber_memory_account(-(ssize_t) sizeof(struct thread_stuff));
+            JS_free(cx, ts);
+            return JS_FALSE;
+        }
+    }
+
+    /* the result has to survive until join, whichever context made it */
+    ts->result = JSVAL_VOID;
+    if(!JS_AddNamedRoot(cx, &ts->result, "Thread result")) {
+        pthread_attr_destroy(&attr);
+        amber_memory_account(-(ssize_t) sizeof(struct thread_stuff));
+        JS_free(cx, ts);
+        return JS_FALSE;
+    }
 
     pthread_mutex_init(&ts->mutex, NULL);
 
@@ -127,9 +344,21 @@ static JSBool thread_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval
     ts->fun = fun;
     ts->arg = arg;
 
-    JS_SetPrivate(cx, obj, ts);
+    err = pthread_create(&ts->t, &attr, thread_start, ts);
+    pthread_attr_destroy(&attr);
+
+    if(err != 0) {
+        JS_RemoveRoot(cx, &ts->result);
+        pthread_mutex_destroy(&ts->mutex);
+        amber_memory_account(-(ssize_t) sizeof(struct thread_stuff));
+        JS_free(cx, ts);
+        THROW("couldn't create thread: %s", strerror(err));
+    }
 
-    pthread_create(&ts->t, NULL, thread_start, ts);
+    if(ts->name[0] != '\0')
+        pthread_setname_np(ts->t, ts->name);
+
+    JS_SetPrivate(cx, obj, ts);
 
     return JS_TRUE;
 }
@@ -137,6 +366,8 @@ static JSBool thread_constructor(JSContext *cx, JSObject *obj, uintN argc, jsval
 static JSBool thread_get_property(JSContext *cx, JSObject *obj, jsval id, jsval *vp) {
     thread_stuff ts;
     JSString *str;
+    struct timespec now;
+    jsdouble secs;
 
     if((ts = JS_GetPrivate(cx, obj)) == NULL)
         return JS_TRUE;
@@ -159,15 +390,77 @@ static JSBool thread_get_property(JSContext *cx, JSObject *obj, jsval id, jsval
 
             *vp = STRING_TO_JSVAL(str);
             break;
+
+        case THREAD_NAME:
+            if(ts->name[0] != '\0')
+                *vp = STRING_TO_JSVAL(JS_NewStringCopyZ(cx, ts->name));
+            break;
+
+        case THREAD_RESULT:
+            *vp = ts->result;
+            break;
+
+        /* cpu time is live while running, the rest only once it's done.
+         * the thread marks itself done before it goes away, so a reading
+         * taken while it still says running came from a live thread */
+        case THREAD_CPU_TIME:
+            secs = 0;
+            if(__atomic_load_n(&ts->state, __ATOMIC_ACQUIRE) == THREAD_RUN && ts->has_clock &&
+               clock_gettime(ts->clock, &now) == 0 &&
+               __atomic_load_n(&ts->state, __ATOMIC_ACQUIRE) == THREAD_RUN)
+                secs = now.tv_sec + now.tv_nsec / 1e9;
+            else if(__atomic_load_n(&ts->state, __ATOMIC_ACQUIRE) == THREAD_DONE)
+                secs = ts->usage.ru_utime.tv_sec + ts->usage.ru_stime.tv_sec +
+                       (ts->usage.ru_utime.tv_usec + ts->usage.ru_stime.tv_usec) / 1e6;
+            return JS_NewNumberValue(cx, secs, vp);
+
+        case THREAD_VOLUNTARY_SWITCHES:
+            return JS_NewNumberValue(cx, (jsdouble) ts->usage.ru_nvcsw, vp);
+
+        case THREAD_INVOLUNTARY_SWITCHES:
+            return JS_NewNumberValue(cx, (jsdouble) ts->usage.ru_nivcsw, vp);
     }
 
     return JS_TRUE;
 }
 
+/* a thread that's still going is detached and left to free its own stuff
+ * when it's done. one that's finished only needs reaping */
+static void thread_finalize(JSContext *cx, JSObject *obj) {
+    thread_stuff ts;
+    int running, detached;
+
+    if((ts = JS_GetPrivate(cx, obj)) == NULL)
+        return;
+
+    JS_RemoveRoot(cx, &ts->result);
+
+    if(!ts->joined) {
+        /* once orphaned is set the thread can free ts at any moment, so
+         * everything we need is read before letting go */
+        pthread_mutex_lock(&ts->mutex);
+        running = ts->orphaned = !ts->finished;
+        detached = ts->detached;
+        if(running && !detached)
+            pthread_detach(ts->t);
+        pthread_mutex_unlock(&ts->mutex);
+
+        if(running)
+            return;
+
+        if(!detached)
+            pthread_join(ts->t, NULL);
+    }
+
+    pthread_mutex_destroy(&ts->mutex);
+    amber_memory_account(-(ssize_t) sizeof(struct thread_stuff));
+    JS_free(cx, ts);
+}
+
 static JSClass thread_class = {
     "Thread", JSCLASS_HAS_PRIVATE,
     JS_PropertyStub, JS_PropertyStub, thread_get_property, JS_PropertyStub,
-    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, JS_FinalizeStub
+    JS_EnumerateStub, JS_ResolveStub, JS_ConvertStub, thread_finalize
 };
 
 JSBool Thread(JSContext *cx, JSObject *amber) {